@@ -0,0 +1,137 @@
+#!/usr/bin/env dnsjit
+local clock = require("dnsjit.lib.clock")
+local log = require("dnsjit.core.log")
+local getopt = require("dnsjit.lib.getopt").new({
+    { "v", "verbose", 0, "Enable and increase verbosity for each time given", "?+" },
+    { "z", "zone", "example.com.", "Zone to match names against", "?" },
+})
+local pcap, runs = unpack(getopt:parse())
+if getopt:val("help") then
+    getopt:usage()
+    return
+end
+local v = getopt:val("v")
+if v > 0 then
+    log.enable("warning")
+end
+if v > 1 then
+    log.enable("notice")
+end
+if v > 2 then
+    log.enable("info")
+end
+if v > 3 then
+    log.enable("debug")
+end
+
+if pcap == nil then
+    print("usage: "..arg[1].." <pcap> [runs]")
+    return
+end
+runs = tonumber(runs) or 10
+
+local object = require("dnsjit.core.objects")
+local bit = require("bit")
+local ffi = require("ffi")
+local name = require("dnsjit.core.object.dns.name")
+
+-- Load all DNS payloads to memory first so only name handling is measured.
+local input = require("dnsjit.input.fpcap").new()
+local layer = require("dnsjit.filter.layer").new()
+input:open(pcap)
+layer:producer(input)
+local producer, ctx = layer:produce()
+local payloads = {}
+while true do
+    local obj = producer(ctx)
+    if obj == nil then break end
+    if obj:type() == "payload" then
+        local pl = obj:cast()
+        if pl.len > 12 then
+            local buf = ffi.new("uint8_t[?]", pl.len)
+            ffi.copy(buf, pl.payload, pl.len)
+            table.insert(payloads, { buf, tonumber(pl.len) })
+        end
+    end
+end
+
+local pl = ffi.new("core_object_payload_t")
+pl.obj_type = object.PAYLOAD
+local dns = require("dnsjit.core.object.dns").new(ffi.cast("core_object_t*", pl))
+
+local function run(label, fn)
+    local start_sec, start_nsec = clock:monotonic()
+    local names = 0
+    for r = 1, runs do
+        for _, payload in ipairs(payloads) do
+            pl.payload = payload[1]
+            pl.len = payload[2]
+            names = names + fn()
+        end
+    end
+    local end_sec, end_nsec = clock:monotonic()
+    local runtime = (end_sec - start_sec) + ((end_nsec - start_nsec) / 1000000000)
+    print(label, names, runtime, names / runtime, matched)
+end
+
+print("== kernels", name.impl())
+print("== path", "names", "runtime", "names/sec", "in zone")
+
+-- Current Lua path: parse each record, render the name with label.tostring()
+-- and lowercase, group and suffix match with Lua strings.
+local label = require("dnsjit.core.object.dns.label")
+local Q = require("dnsjit.core.object.dns.q")
+local RR = require("dnsjit.core.object.dns.rr")
+local labels = label.new(127)
+local q, rr = Q.new(), RR.new()
+local zone = string.lower(getopt:val("zone"))
+local groups = {}
+local matched = 0
+run("lua", function()
+    local names = 0
+    if dns:parse_header() ~= 0 then
+        return 0
+    end
+    for n = 1, dns.qdcount do
+        if dns:parse_q(q, labels, 127) ~= 0 then
+            return names
+        end
+        local dn = string.lower(label.tostring(dns, labels, q.labels) or ".")
+        groups[dn] = (groups[dn] or 0) + 1
+        matched = matched + (dn:sub(-#zone) == zone and 1 or 0)
+        names = names + 1
+    end
+    for n = 1, dns.ancount + dns.nscount + dns.arcount do
+        if dns:parse_rr(rr, labels, 127) ~= 0 then
+            return names
+        end
+        local dn = string.lower(label.tostring(dns, labels, rr.labels) or ".")
+        groups[dn] = (groups[dn] or 0) + 1
+        matched = matched + (dn:sub(-#zone) == zone and 1 or 0)
+        names = names + 1
+    end
+    return names
+end)
+
+-- C path: decode the whole message and hash and suffix match the names
+-- directly in the arena.
+local msg = require("dnsjit.core.object.dns.msg").new()
+local wzone = name.wire(zone)
+local hgroups = {}
+matched = 0
+run("c", function()
+    if dns:decode(msg) ~= 0 then
+        return 0
+    end
+    local rrs = tonumber(msg.rrs)
+    for n = 0, rrs - 1 do
+        local nm = msg.name[msg.rr[n].name]
+        local ptr = msg.arena + nm.offset
+        local h = tonumber(bit.band(name.hash(ptr, nm.length), 0xffffffff))
+        hgroups[h] = (hgroups[h] or 0) + 1
+        if name.is_subdomain(ptr, nm.length, wzone) then
+            matched = matched + 1
+        end
+    end
+    return rrs
+end)
@@ -0,0 +1,536 @@
+#!/usr/bin/env dnsjit
+local clock = require("dnsjit.lib.clock")
+local log = require("dnsjit.core.log")
+local getopt = require("dnsjit.lib.getopt").new({
+    { "v", "verbose", 0, "Enable and increase verbosity for each time given", "?+" },
+    { "o", "output", "-", "Write the JSON results to this file, - for stdout", "?" },
+    { "r", "runs", 5, "Number of measured runs of each benchmark (after one warm-up run)", "?" },
+    { "n", "sizes", "10000,100000,1000000", "Number of packets of the generated captures for read benchmarks", "?" },
+    { "p", "packets", 100000, "Number of packets for the other benchmarks", "?" },
+    { "b", "bench", "read,layer,dns,copy,channel,dnssim", "Benchmarks to run", "?" },
+    { "d", "dir", "/tmp", "Directory for the generated captures", "?" },
+    { "P", "port", 0, "UDP port of the local responder for the dnssim benchmark, 0 for any", "?" },
+})
+getopt:parse()
+if getopt:val("help") then
+    getopt:usage()
+    return
+end
+local v = getopt:val("v")
+if v > 0 then
+    log.enable("warning")
+end
+if v > 1 then
+    log.enable("notice")
+end
+if v > 2 then
+    log.enable("info")
+end
+if v > 3 then
+    log.enable("debug")
+end
+
+-- Benchmark suite, results are written as JSON for regression tracking:
+--   { "suite": "dnsjit", "version": 1, "runs": N, ..., "results": [
+--     { "bench": "read", "name": "mmpcap", "params": { "packets": 10000 },
+--       "unit": "packets/s", "median": ..., "min": ..., "max": ...,
+--       "samples": [ ... ] }, ... ] }
+-- Captures are generated deterministically so results are comparable
+-- between runs and machines, each benchmark does one warm-up run that is
+-- not recorded and reports the median of the measured runs.
+-- Progress is written to stderr.
+
+local ffi = require("ffi")
+local bit = require("bit")
+local object = require("dnsjit.core.objects")
+
+local runs = tonumber(getopt:val("r"))
+local packets = tonumber(getopt:val("p"))
+local dir = getopt:val("d")
+local port = tonumber(getopt:val("P"))
+local sizes = {}
+for n in string.gmatch(getopt:val("n"), "%d+") do
+    table.insert(sizes, tonumber(n))
+end
+local enabled = {}
+for b in string.gmatch(getopt:val("b"), "[^,]+") do
+    enabled[b] = true
+end
+
+local function progress(...)
+    io.stderr:write(table.concat({...}, " "), "\n")
+end
+
+local function now()
+    local sec, nsec = clock.monotonic()
+    return sec + nsec / 1000000000
+end
+
+--
+-- Capture generation
+--
+
+local function u16(n)
+    return string.char(bit.band(bit.rshift(n, 8), 0xff), bit.band(n, 0xff))
+end
+
+local function u32(n)
+    return u16(bit.band(bit.rshift(n, 16), 0xffff)) .. u16(bit.band(n, 0xffff))
+end
+
+local function qname(i)
+    return string.char(7) .. string.format("www%04d", i % 10000) .. string.char(7) .. "example" .. string.char(3) .. "com" .. string.char(0)
+end
+
+-- A query for www<i>.example.com A, or a response to it with two answers.
+local function dns(i, response)
+    local id = bit.band(i, 0xffff)
+    if not response then
+        return u16(id) .. u16(0x0100) .. u16(1) .. u16(0) .. u16(0) .. u16(0) .. qname(i) .. u16(1) .. u16(1)
+    end
+    local answer = u16(0xc00c) .. u16(1) .. u16(1) .. u32(300) .. u16(4)
+    return u16(id) .. u16(0x8180) .. u16(1) .. u16(2) .. u16(0) .. u16(0) .. qname(i) .. u16(1) .. u16(1)
+        .. answer .. u32(0xc0000201) .. answer .. u32(0xc0000202)
+end
+
+local function ether(ethertype, vlan)
+    local hdr = "\2\0\0\0\0\2" .. "\2\0\0\0\0\1"
+    if vlan then
+        return hdr .. u16(0x8100) .. u16(vlan) .. u16(ethertype)
+    end
+    return hdr .. u16(ethertype)
+end
+
+local function ipv4(i, proto, payload, response)
+    local client = u32(0x0a000000 + i % 65536)
+    local server = u32(0xc0000201)
+    local src, dst = client, server
+    if response then
+        src, dst = server, client
+    end
+    return "\69\0" .. u16(20 + #payload) .. u16(bit.band(i, 0xffff)) .. u16(0x4000)
+        .. string.char(64, proto) .. u16(0) .. src .. dst .. payload
+end
+
+local function ipv6(i, nh, payload, response)
+    local client = "\253\0\0\0\0\0\0\0\0\0\0\0" .. u32(i % 65536)
+    local server = "\32\1\13\184\0\0\0\0\0\0\0\0\0\0\0\1"
+    local src, dst = client, server
+    if response then
+        src, dst = server, client
+    end
+    return u32(0x60000000) .. u16(#payload) .. string.char(nh, 64) .. src .. dst .. payload
+end
+
+local function udp(i, payload, response)
+    local sport, dport = 1024 + i % 60000, 53
+    if response then
+        sport, dport = dport, sport
+    end
+    return u16(sport) .. u16(dport) .. u16(8 + #payload) .. u16(0) .. payload
+end
+
+local function tcp(i, payload, response)
+    local sport, dport = 1024 + i % 60000, 53
+    if response then
+        sport, dport = dport, sport
+    end
+    return u16(sport) .. u16(dport) .. u32(i) .. u32(0) .. u16(0x5018) .. u16(65535) .. u16(0) .. u16(0)
+        .. u16(#payload) .. payload
+end
+
+local templates = {
+    ipv4 = function(i, r) return ether(0x0800) .. ipv4(i, 17, udp(i, dns(i, r), r), r) end,
+    ipv6 = function(i, r) return ether(0x86dd) .. ipv6(i, 17, udp(i, dns(i, r), r), r) end,
+    vlan = function(i, r) return ether(0x0800, 100) .. ipv4(i, 17, udp(i, dns(i, r), r), r) end,
+    tcp = function(i, r) return ether(0x0800) .. ipv4(i, 6, tcp(i, dns(i, r), r), r) end,
+}
+local mixes = {
+    ipv4 = { "ipv4" },
+    ipv6 = { "ipv6" },
+    vlan = { "vlan" },
+    tcp = { "tcp" },
+    mix = { "ipv4", "ipv6", "vlan", "tcp" },
+}
+
+ffi.cdef[[
+typedef struct benchmark_pcap_hdr {
+    uint32_t magic;
+    uint16_t major, minor;
+    int32_t thiszone;
+    uint32_t sigfigs, snaplen, network;
+} benchmark_pcap_hdr_t;
+typedef struct benchmark_pcap_rec {
+    uint32_t ts_sec, ts_usec, incl_len, orig_len;
+} benchmark_pcap_rec_t;
+]]
+
+-- Generate (once) a capture of n packets of the mix, alternating queries
+-- and responses unless queries_only, 10000 packets per second.
+local generated = {}
+local function capture(mix, n, queries_only)
+    local file = string.format("%s/dnsjit-bench-%s-%d%s.pcap", dir, mix, n, queries_only and "-q" or "")
+    if generated[file] then
+        return file
+    end
+    progress("generating", file)
+    local f = assert(io.open(file, "wb"))
+    local hdr = ffi.new("benchmark_pcap_hdr_t", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1)
+    f:write(ffi.string(hdr, ffi.sizeof(hdr)))
+    local rec = ffi.new("benchmark_pcap_rec_t")
+    local types = mixes[mix]
+    local buf = {}
+    for i = 0, n - 1 do
+        local response = not queries_only and i % 2 == 1
+        local q = queries_only and i or math.floor(i / 2)
+        local pkt = templates[types[q % #types + 1]](q, response)
+        rec.ts_sec = 1500000000 + math.floor(i / 10000)
+        rec.ts_usec = (i % 10000) * 100
+        rec.incl_len = #pkt
+        rec.orig_len = #pkt
+        table.insert(buf, ffi.string(rec, ffi.sizeof(rec)))
+        table.insert(buf, pkt)
+        if #buf >= 2048 then
+            f:write(table.concat(buf))
+            buf = {}
+        end
+    end
+    f:write(table.concat(buf))
+    f:close()
+    generated[file] = true
+    return file
+end
+
+--
+-- Runner
+--
+
+local results = {}
+
+-- Run fn (which returns the number of items processed, and optionally
+-- the elapsed seconds if it measures itself) runs + 1 times and record the
+-- rates of all but the first run.
+local function bench(group, name, params, unit, fn)
+    if not enabled[group] then
+        return
+    end
+    local samples = {}
+    for run = 0, runs do
+        collectgarbage()
+        local start = now()
+        local items, elapsed = fn()
+        elapsed = elapsed or (now() - start)
+        if run > 0 then
+            table.insert(samples, items / elapsed)
+        end
+    end
+    local sorted = { unpack(samples) }
+    table.sort(sorted)
+    local median = sorted[math.floor((#sorted + 1) / 2)]
+    if #sorted % 2 == 0 then
+        median = (sorted[#sorted / 2] + sorted[#sorted / 2 + 1]) / 2
+    end
+    table.insert(results, {
+        bench = group,
+        name = name,
+        params = params,
+        unit = unit,
+        median = median,
+        min = sorted[1],
+        max = sorted[#sorted],
+        samples = samples,
+    })
+    local p = {}
+    for k, val in pairs(params) do
+        table.insert(p, k .. "=" .. tostring(val))
+    end
+    table.sort(p)
+    progress(string.format("%-8s %-24s %-32s %14.0f %s", group, name, table.concat(p, " "), median, unit))
+end
+
+--
+-- Benchmarks
+--
+
+-- Reading captures of several sizes with each input module.
+if enabled.read then
+    for _, n in ipairs(sizes) do
+        local file = capture("mix", n)
+        bench("read", "fpcap", { packets = n }, "packets/s", function()
+            local input = require("dnsjit.input.fpcap").new()
+            input:open(file)
+            local prod, pctx = input:produce()
+            while prod(pctx) ~= nil do end
+            return input:packets()
+        end)
+        bench("read", "mmpcap", { packets = n }, "packets/s", function()
+            local input = require("dnsjit.input.mmpcap").new()
+            input:open(file)
+            local prod, pctx = input:produce()
+            while prod(pctx) ~= nil do end
+            return input:packets()
+        end)
+        bench("read", "pcap", { packets = n }, "packets/s", function()
+            local input = require("dnsjit.input.pcap").new()
+            local null = require("dnsjit.output.null").new()
+            input:open_offline(file)
+            input:receiver(null)
+            input:dispatch()
+            return input:packets()
+        end)
+    end
+end
+
+-- Parsing the layers of different traffic mixes.
+if enabled.layer then
+    for _, mix in ipairs({ "ipv4", "ipv6", "vlan", "tcp", "mix" }) do
+        local file = capture(mix, packets)
+        bench("layer", mix, { packets = packets }, "packets/s", function()
+            local input = require("dnsjit.input.mmpcap").new()
+            local layer = require("dnsjit.filter.layer").new()
+            input:open(file)
+            layer:producer(input)
+            local prod, pctx = layer:produce()
+            local n = 0
+            while prod(pctx) ~= nil do
+                n = n + 1
+            end
+            return n
+        end)
+    end
+end
+
+-- Load the DNS payloads of a capture into memory.
+local function payloads(file)
+    local input = require("dnsjit.input.mmpcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open(file)
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+    local list = {}
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        if obj:type() == "payload" then
+            local pl = obj:cast()
+            local buf = ffi.new("uint8_t[?]", pl.len)
+            ffi.copy(buf, pl.payload, pl.len)
+            table.insert(list, { buf, tonumber(pl.len), obj:prev():type() == "tcp" })
+        end
+    end
+    return list
+end
+
+-- DNS header and full message parsing of in-memory payloads.
+if enabled.dns then
+    local list = payloads(capture("mix", packets))
+    local pl = ffi.new("core_object_payload_t")
+    pl.obj_type = object.PAYLOAD
+    local msg = require("dnsjit.core.object.dns.msg").new()
+
+    bench("dns", "parse_header", { packets = #list }, "messages/s", function()
+        local dns = require("dnsjit.core.object.dns").new(ffi.cast("core_object_t*", pl))
+        local n = 0
+        for _, p in ipairs(list) do
+            pl.payload, pl.len = p[1], p[2]
+            dns.includes_dnslen = p[3] and 1 or 0
+            if dns:parse_header() == 0 then
+                n = n + 1
+            end
+        end
+        return n
+    end)
+    bench("dns", "decode", { packets = #list }, "messages/s", function()
+        local dns = require("dnsjit.core.object.dns").new(ffi.cast("core_object_t*", pl))
+        local n = 0
+        for _, p in ipairs(list) do
+            pl.payload, pl.len = p[1], p[2]
+            dns.includes_dnslen = p[3] and 1 or 0
+            if dns:decode(msg) == 0 then
+                n = n + 1
+            end
+        end
+        return n
+    end)
+end
+
+-- Copying (and freeing) the full object chain of parsed packets.
+if enabled.copy then
+    local input = require("dnsjit.input.mmpcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open(capture("mix", packets))
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+    local chains = {}
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        table.insert(chains, obj:copy())
+    end
+
+    bench("copy", "core_object_copy", { packets = #chains }, "chains/s", function()
+        for _, obj in ipairs(chains) do
+            obj:copy():free()
+        end
+        return #chains
+    end)
+
+    for _, obj in ipairs(chains) do
+        obj:free()
+    end
+end
+
+-- Passing objects through channels to consumer threads.
+if enabled.channel then
+    local function consumer(thr)
+        local c = thr:pop()
+        while c:get() ~= nil do end
+    end
+
+    for _, capacity in ipairs({ 64, 2048, 65536 }) do
+        for _, threads in ipairs({ 1, 2, 4 }) do
+            bench("channel", "put_get", { capacity = capacity, threads = threads, objects = packets }, "objects/s", function()
+                local zero = require("dnsjit.input.zero").new()
+                local prod, pctx = zero:produce()
+                local channels, workers = {}, {}
+                for t = 1, threads do
+                    channels[t] = require("dnsjit.core.channel").new(capacity)
+                    workers[t] = require("dnsjit.core.thread").new()
+                    workers[t]:start(consumer)
+                    workers[t]:push(channels[t])
+                end
+                local start = now()
+                local per = math.floor(packets / threads)
+                for n = 1, per do
+                    for t = 1, threads do
+                        channels[t]:put(prod(pctx))
+                    end
+                end
+                for t = 1, threads do
+                    channels[t]:close()
+                    workers[t]:stop()
+                end
+                return per * threads, now() - start
+            end)
+        end
+    end
+end
+
+-- dnssim sending queries to a local responder (see dnsjit.lib.responder).
+if enabled.dnssim then
+    local resp = require("dnsjit.lib.responder").new()
+    resp:threads(2)
+    assert(resp:udp("127.0.0.1", port) == 0, "responder udp failed")
+    assert(resp:start() == 0, "responder start failed")
+    local udp_port = resp:ports()
+
+    local file = capture("ipv4", packets, true)
+    local clients = 1000
+    local latency
+    bench("dnssim", "udp", { queries = packets, clients = clients }, "answers/s", function()
+        local input = require("dnsjit.input.mmpcap").new()
+        local layer = require("dnsjit.filter.layer").new()
+        local split = require("dnsjit.filter.ipsplit").new()
+        local copy = require("dnsjit.filter.copy").new()
+        local sim = require("dnsjit.output.dnssim").new(clients)
+        sim:udp_only()
+        sim:target("127.0.0.1", udp_port)
+        sim:free_after_use(true)
+        copy:obj_type(object.IP)
+        copy:obj_type(object.IP6)
+        copy:obj_type(object.PAYLOAD)
+        copy:receiver(sim)
+        split:overwrite_dst()
+        split:receiver(copy)
+        input:open(file)
+        layer:producer(input)
+        local prod, pctx = layer:produce()
+        local recv, rctx = split:receive()
+
+        local start = now()
+        local n = 0
+        while true do
+            local obj = prod(pctx)
+            if obj == nil then break end
+            recv(rctx, obj)
+            n = n + 1
+            if n % 64 == 0 then
+                sim:run_nowait()
+            end
+        end
+        while sim:run_nowait() > 0 do end
+        local elapsed = now() - start
+        latency = { p50 = sim:latency_percentile(50), p90 = sim:latency_percentile(90), p99 = sim:latency_percentile(99) }
+        return sim:answers(), elapsed
+    end)
+    results[#results].latency_ms = latency
+
+    resp:stop()
+end
+
+--
+-- JSON output
+--
+
+local escapes = {
+    ['"'] = '\\"', ["\\"] = "\\\\", ["\b"] = "\\b", ["\f"] = "\\f",
+    ["\n"] = "\\n", ["\r"] = "\\r", ["\t"] = "\\t",
+}
+
+-- JSON string, other control characters are written as \u00XX and the
+-- rest is passed as is (UTF-8)
+local function quote(s)
+    return '"' .. (s:gsub('[%c"\\]', function(c)
+        return escapes[c] or string.format("\\u%04x", c:byte())
+    end)) .. '"'
+end
+
+local function json(val)
+    local t = type(val)
+    if t == "table" then
+        if #val > 0 or next(val) == nil then
+            local items = {}
+            for _, v in ipairs(val) do
+                table.insert(items, json(v))
+            end
+            return "[" .. table.concat(items, ",") .. "]"
+        end
+        local keys = {}
+        for k in pairs(val) do
+            table.insert(keys, k)
+        end
+        table.sort(keys)
+        local items = {}
+        for _, k in ipairs(keys) do
+            table.insert(items, quote(tostring(k)) .. ":" .. json(val[k]))
+        end
+        return "{" .. table.concat(items, ",") .. "}"
+    elseif t == "string" then
+        return quote(val)
+    elseif t == "number" then
+        if val ~= val or val == math.huge or val == -math.huge then
+            return "null"
+        end
+        return string.format("%.17g", val)
+    elseif t == "boolean" then
+        return tostring(val)
+    end
+    return "null"
+end
+
+local out = json({
+    suite = "dnsjit",
+    version = 1,
+    timestamp = os.time(),
+    runs = runs,
+    jit = { version = jit.version, os = jit.os, arch = jit.arch },
+    results = results,
+}) .. "\n"
+
+if getopt:val("o") == "-" then
+    io.stdout:write(out)
+else
+    local f = assert(io.open(getopt:val("o"), "w"))
+    f:write(out)
+    f:close()
+end
@@ -0,0 +1,41 @@
+#!/usr/bin/env dnsjit
+local getopt = require("dnsjit.lib.getopt").new({
+    { "z", "zstd", false, "Compress record batches with zstd", "?" },
+    { "r", "rtt", false, "Match responses to queries and add the RTT", "?" },
+})
+local pcap_in, arrow_out = unpack(getopt:parse())
+if getopt:val("help") or pcap_in == nil or arrow_out == nil then
+    getopt:usage()
+    return
+end
+
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+local output = require("dnsjit.output.columnar").new()
+
+if getopt:val("z") then
+    output:compression("zstd")
+end
+if getopt:val("r") then
+    output:qrmatch(require("dnsjit.filter.qrmatch").new())
+end
+
+input:open_offline(pcap_in)
+layer:producer(input)
+local producer, ctx = layer:produce()
+
+if output:open(arrow_out) ~= 0 then
+    return
+end
+local receiver, rctx = output:receive()
+
+while true do
+    local obj = producer(ctx)
+    if obj == nil then break end
+    if obj:type() == "payload" then
+        receiver(rctx, obj)
+    end
+end
+
+output:close()
+print(output:rows(), "DNS messages written in", output:batches(), "record batches")
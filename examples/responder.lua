@@ -0,0 +1,88 @@
+#!/usr/bin/env dnsjit
+local log = require("dnsjit.core.log")
+local getopt = require("dnsjit.lib.getopt").new({
+    { "v", "verbose", 0, "Enable and increase verbosity for each time given", "?+" },
+    { "H", "host", "127.0.0.1", "Address to listen on", "?" },
+    { "u", "udp", 53535, "UDP port, 0 for any or -1 to disable", "?" },
+    { "t", "tcp", 53535, "TCP port, 0 for any or -1 to disable", "?" },
+    { "T", "tls", -1, "TLS port, 0 for any or -1 to disable", "?" },
+    { "s", "https2", -1, "DNS-over-HTTPS (HTTP/2) port, 0 for any or -1 to disable", "?" },
+    { "c", "cert", "", "TLS and HTTPS certificate (and key) PEM file, default self-signed", "?" },
+    { "k", "key", "", "TLS and HTTPS key PEM file if not in the certificate file", "?" },
+    { "n", "threads", 1, "Number of threads", "?" },
+    { "r", "rcode", 0, "Rcode of the answers", "?" },
+    { "d", "drop", 0, "Probability (0.0 to 1.0) of dropping a query", "?" },
+    { "l", "latency", "fixed:0:0", "Latency of answers as <fixed|uniform|exponential>:<seconds>:<jitter seconds>", "?" },
+    { "D", "duration", 0, "Stop after this many seconds, 0 to run until interrupted", "?" },
+})
+getopt:parse()
+if getopt:val("help") then
+    getopt:usage()
+    return
+end
+local v = getopt:val("v")
+if v > 0 then
+    log.enable("warning")
+end
+if v > 1 then
+    log.enable("notice")
+end
+if v > 2 then
+    log.enable("info")
+end
+if v > 3 then
+    log.enable("debug")
+end
+
+-- Local DNS responder for load testing the output modules, prints the
+-- statistics every second.
+
+local ffi = require("ffi")
+ffi.cdef[[
+int responder_poll(void*, unsigned long, int) asm("poll");
+]]
+
+local host = getopt:val("H")
+local resp = require("dnsjit.lib.responder").new()
+resp:threads(tonumber(getopt:val("n")))
+resp:rcode(tonumber(getopt:val("r")))
+resp:drop(tonumber(getopt:val("d")))
+local dist, seconds, jitter = string.match(getopt:val("l"), "^(%a+):?([%d.]*):?([%d.]*)$")
+resp:latency(dist, tonumber(seconds), tonumber(jitter))
+
+if tonumber(getopt:val("u")) > -1 and resp:udp(host, getopt:val("u")) ~= 0 then
+    return 1
+end
+if tonumber(getopt:val("t")) > -1 and resp:tcp(host, getopt:val("t")) ~= 0 then
+    return 1
+end
+local cert, key = getopt:val("c"), getopt:val("k")
+if tonumber(getopt:val("T")) > -1 then
+    if resp:tls(host, getopt:val("T"), cert ~= "" and cert or nil, key ~= "" and key or nil) ~= 0 then
+        return 1
+    end
+end
+if tonumber(getopt:val("s")) > -1 then
+    if resp:https2(host, getopt:val("s"), cert ~= "" and cert or nil, key ~= "" and key or nil) ~= 0 then
+        return 1
+    end
+end
+if resp:start() ~= 0 then
+    return 1
+end
+
+local udp, tcp, tls, https2 = resp:ports()
+print(string.format("listening on %s udp %d tcp %d tls %d https2 %d", host, udp, tcp, tls, https2))
+
+local duration = tonumber(getopt:val("D"))
+local seconds, last = 0, resp:stats()
+while duration == 0 or seconds < duration do
+    ffi.C.responder_poll(nil, 0, 1000)
+    seconds = seconds + 1
+    local stats = resp:stats()
+    print(string.format("queries %d/s answers %d/s dropped %d malformed %d connections %d errors %d",
+        stats.queries - last.queries, stats.answers - last.answers,
+        stats.dropped, stats.malformed, stats.connections, stats.errors))
+    last = stats
+end
+resp:stop()
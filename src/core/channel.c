@@ -22,6 +22,7 @@
 
 #include "core/channel.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 
 #include <sched.h>
 
@@ -32,6 +33,8 @@ static core_channel_t _defaults = {
     0, 0
 };
 
+static size_t _m_put = 0, _m_get = 0, _m_full = 0;
+
 core_log_t* core_channel_log()
 {
     return &_log;
@@ -59,6 +62,10 @@ void core_channel_init(core_channel_t* self, size_t capacity)
 
     lfatal_oom(self->ring_buf = malloc(sizeof(ck_ring_buffer_t) * capacity));
     ck_ring_init(&self->ring, capacity);
+
+    core_metrics_counter(&_m_put, "dnsjit_channel_put_total", 0, "Objects put into channels");
+    core_metrics_counter(&_m_get, "dnsjit_channel_get_total", 0, "Objects taken out of channels");
+    core_metrics_counter(&_m_full, "dnsjit_channel_full_total", 0, "Puts that had to wait for a full channel");
 }
 
 void core_channel_destroy(core_channel_t* self)
@@ -72,9 +79,13 @@ void core_channel_put(core_channel_t* self, const void* obj)
     mlassert_self();
     lassert(self->ring_buf, "ring_buf is nil");
 
-    while (!ck_ring_enqueue_spsc(&self->ring, self->ring_buf, (void*)obj)) {
-        sched_yield();
+    if (!ck_ring_enqueue_spsc(&self->ring, self->ring_buf, (void*)obj)) {
+        core_metrics_inc(_m_full);
+        while (!ck_ring_enqueue_spsc(&self->ring, self->ring_buf, (void*)obj)) {
+            sched_yield();
+        }
     }
+    core_metrics_inc(_m_put);
 }
 
 int core_channel_try_put(core_channel_t* self, const void* obj)
@@ -85,6 +96,7 @@ int core_channel_try_put(core_channel_t* self, const void* obj)
     if (!ck_ring_enqueue_spsc(&self->ring, self->ring_buf, (void*)obj)) {
         return -1;
     }
+    core_metrics_inc(_m_put);
 
     return 0;
 }
@@ -102,6 +114,7 @@ void* core_channel_get(core_channel_t* self)
             return 0;
         }
     }
+    core_metrics_inc(_m_get);
 
     return obj;
 }
@@ -115,6 +128,7 @@ void* core_channel_try_get(core_channel_t* self)
     if (!ck_ring_dequeue_spsc(&self->ring, self->ring_buf, &obj)) {
         return 0;
     }
+    core_metrics_inc(_m_get);
 
     return obj;
 }
@@ -164,6 +178,7 @@ void core_channel_run(core_channel_t* self)
                 return;
             }
         }
+        core_metrics_inc(_m_get);
         self->recv(self->ctx, obj);
     }
 }
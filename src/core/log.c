@@ -25,13 +25,302 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <ck_pr.h>
 
 static core_log_t _log = LOG_T_INIT("core");
 
+/*
+ * Asynchronous output: every thread that logs gets a single-producer ring
+ * of formatted lines which is drained to stdout by a writer thread, the
+ * producer never takes a lock and a full ring drops the line instead of
+ * blocking.
+ * Rings are kept on a list that is only appended to, a ring is reused by a
+ * new thread once the thread that owned it has exited.
+ */
+
+#define _LOG_LINE_SIZE 1024
+#define _LOG_RING_SLOTS 256
+#define _LOG_SITES 64
+#define _LOG_IDLE_NS 1000000
+
+typedef struct _ring _ring_t;
+struct _ring {
+    _ring_t* next;
+    int      owned;
+
+    unsigned int head, tail;
+    unsigned int dropped, dropped_reported;
+
+    struct {
+        size_t len;
+        char   buf[_LOG_LINE_SIZE];
+    } slot[_LOG_RING_SLOTS];
+};
+
+static int               _async   = 0;
+static int               _running = 0;
+static pthread_t         _writer;
+static _ring_t*          _rings       = 0;
+static pthread_mutex_t   _rings_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t   _drain_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t   _writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t     _ring_key;
+static pthread_once_t    _ring_once = PTHREAD_ONCE_INIT;
+static __thread _ring_t* _ring      = 0;
+
+/*
+ * Rate limiting: at most burst messages per call site (file, line and
+ * format) within interval, the number of messages suppressed is reported
+ * with the next message from the same site after the interval has passed.
+ * Sites are tracked per thread in a small direct mapped table, a collision
+ * just restarts the accounting for the site.
+ */
+
+typedef struct _site {
+    const char* file;
+    const char* msg;
+    size_t      line;
+    uint64_t    start, count, suppressed;
+} _site_t;
+
+static unsigned int     _burst    = 0;
+static uint64_t         _interval = 0;
+static __thread _site_t _sites[_LOG_SITES];
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int _ratelimit(const char* file, size_t line, const char* msg, uint64_t* suppressed)
+{
+    unsigned int burst = ck_pr_load_uint(&_burst);
+    _site_t*     s;
+    uint64_t     now;
+
+    *suppressed = 0;
+    if (!burst) {
+        return 0;
+    }
+
+    s   = &_sites[(((uintptr_t)file >> 3) ^ ((uintptr_t)msg >> 3) ^ line) % _LOG_SITES];
+    now = _now();
+    if (s->file != file || s->msg != msg || s->line != line) {
+        s->file       = file;
+        s->msg        = msg;
+        s->line       = line;
+        s->start      = now;
+        s->count      = 0;
+        s->suppressed = 0;
+    } else if (now - s->start >= ck_pr_load_64(&_interval)) {
+        *suppressed   = s->suppressed;
+        s->start      = now;
+        s->count      = 0;
+        s->suppressed = 0;
+    }
+    if (s->count < burst) {
+        s->count++;
+        return 0;
+    }
+    s->suppressed++;
+    return 1;
+}
+
+static void _ring_release(void* ptr)
+{
+    _ring_t* ring = (_ring_t*)ptr;
+
+    pthread_mutex_lock(&_rings_lock);
+    ring->owned = 0;
+    pthread_mutex_unlock(&_rings_lock);
+}
+
+static void _ring_key_create(void)
+{
+    pthread_key_create(&_ring_key, _ring_release);
+}
+
+static _ring_t* _ring_get(void)
+{
+    _ring_t* ring;
+
+    if (_ring) {
+        return _ring;
+    }
+
+    pthread_once(&_ring_once, _ring_key_create);
+    pthread_mutex_lock(&_rings_lock);
+    for (ring = _rings; ring; ring = ring->next) {
+        if (!ring->owned) {
+            break;
+        }
+    }
+    if (!ring) {
+        if (!(ring = calloc(1, sizeof(_ring_t)))) {
+            pthread_mutex_unlock(&_rings_lock);
+            return 0;
+        }
+        ring->next = _rings;
+        ck_pr_fence_store();
+        ck_pr_store_ptr(&_rings, ring);
+    }
+    ring->owned = 1;
+    pthread_mutex_unlock(&_rings_lock);
+
+    pthread_setspecific(_ring_key, ring);
+    _ring = ring;
+    return ring;
+}
+
+static int _push(const char* buf, size_t len)
+{
+    _ring_t*     ring = _ring_get();
+    unsigned int tail;
+
+    if (!ring) {
+        return 0;
+    }
+
+    tail = ring->tail;
+    if (tail - ck_pr_load_uint(&ring->head) >= _LOG_RING_SLOTS) {
+        ck_pr_inc_uint(&ring->dropped);
+        return 1;
+    }
+    memcpy(ring->slot[tail % _LOG_RING_SLOTS].buf, buf, len);
+    ring->slot[tail % _LOG_RING_SLOTS].len = len;
+    ck_pr_fence_store();
+    ck_pr_store_uint(&ring->tail, tail + 1);
+    return 1;
+}
+
+/* Must be called with _drain_lock held, returns the number of lines written. */
+static size_t _drain(void)
+{
+    _ring_t*     ring;
+    unsigned int head, tail, dropped;
+    size_t       n = 0;
+
+    for (ring = ck_pr_load_ptr(&_rings); ring; ring = ring->next) {
+        head = ring->head;
+        tail = ck_pr_load_uint(&ring->tail);
+        ck_pr_fence_load();
+        for (; head != tail; head++, n++) {
+            fwrite(ring->slot[head % _LOG_RING_SLOTS].buf, 1, ring->slot[head % _LOG_RING_SLOTS].len, stdout);
+        }
+        ck_pr_fence_memory();
+        ck_pr_store_uint(&ring->head, head);
+
+        dropped = ck_pr_load_uint(&ring->dropped);
+        if (dropped != ring->dropped_reported) {
+            fprintf(stdout, "%s warning: dropped %u log messages, ring full\n", _log.name, dropped - ring->dropped_reported);
+            ring->dropped_reported = dropped;
+            n++;
+        }
+    }
+    if (n) {
+        fflush(stdout);
+    }
+    return n;
+}
+
+static void* _writer_run(void* arg)
+{
+    struct timespec idle = { 0, _LOG_IDLE_NS };
+    size_t          n;
+
+    (void)arg;
+    while (ck_pr_load_int(&_running)) {
+        pthread_mutex_lock(&_drain_lock);
+        n = _drain();
+        pthread_mutex_unlock(&_drain_lock);
+        if (!n) {
+            nanosleep(&idle, 0);
+        }
+    }
+    return 0;
+}
+
+static void _writer_stop(void)
+{
+    pthread_mutex_lock(&_writer_lock);
+    ck_pr_store_int(&_async, 0);
+    if (ck_pr_load_int(&_running)) {
+        ck_pr_store_int(&_running, 0);
+        pthread_join(_writer, 0);
+    }
+    pthread_mutex_lock(&_drain_lock);
+    _drain();
+    pthread_mutex_unlock(&_drain_lock);
+    pthread_mutex_unlock(&_writer_lock);
+}
+
+static int _display_file_line(const core_log_t* l)
+{
+    if (!l) {
+        return _log.settings.display_file_line == 3;
+    }
+    if (l->settings.display_file_line) {
+        return l->settings.display_file_line == 3;
+    }
+    if (l->module && l->module->display_file_line) {
+        return l->module->display_file_line == 3;
+    }
+    return _log.settings.display_file_line == 3;
+}
+
+static void _emit(const core_log_t* l, const char* file, size_t line, const char* level, const char* buf)
+{
+    char out[_LOG_LINE_SIZE];
+    int  n;
+
+    if (_display_file_line(l)) {
+        if (l && l->is_obj) {
+            n = snprintf(out, sizeof(out), "%s[%lu] %s[%p] %s: %s\n", file, line, l->name, l, level, buf);
+        } else {
+            n = snprintf(out, sizeof(out), "%s[%lu] %s %s: %s\n", file, line, l ? l->name : _log.name, level, buf);
+        }
+    } else {
+        if (l && l->is_obj) {
+            n = snprintf(out, sizeof(out), "%s[%p] %s: %s\n", l->name, l, level, buf);
+        } else {
+            n = snprintf(out, sizeof(out), "%s %s: %s\n", l ? l->name : _log.name, level, buf);
+        }
+    }
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(out)) {
+        n          = sizeof(out) - 1;
+        out[n - 1] = '\n';
+    }
+
+    if (ck_pr_load_int(&_async) && _push(out, n)) {
+        return;
+    }
+    fwrite(out, 1, n, stdout);
+}
+
+static void _suppressed(const core_log_t* l, const char* file, size_t line, const char* level, uint64_t suppressed)
+{
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "%lu similar messages suppressed", (unsigned long)suppressed);
+    _emit(l, file, line, level, buf);
+}
+
 void core_log_debug(const core_log_t* l, const char* file, size_t line, const char* msg, ...)
 {
-    char    buf[512];
-    va_list ap;
+    char     buf[512];
+    va_list  ap;
+    uint64_t suppressed;
     if (!l) {
         if (_log.settings.debug != 3) {
             return;
@@ -49,55 +338,24 @@ void core_log_debug(const core_log_t* l, const char* file, size_t line, const ch
             return;
         }
     }
+    if (_ratelimit(file, line, msg, &suppressed)) {
+        return;
+    }
     va_start(ap, msg);
     vsnprintf(buf, sizeof(buf), msg, ap);
     va_end(ap);
     buf[sizeof(buf) - 1] = 0;
-    for (;;) {
-        if (!l) {
-            if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        } else {
-            if (l->settings.display_file_line) {
-                if (l->settings.display_file_line != 3) {
-                    break;
-                }
-            } else if (l->module && l->module->display_file_line) {
-                if (l->module->display_file_line != 3) {
-                    break;
-                }
-            } else if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        }
-        if (l) {
-            if (l->is_obj) {
-                printf("%s[%lu] %s[%p] debug: %s\n", file, line, l->name, l, buf);
-                return;
-            }
-            printf("%s[%lu] %s debug: %s\n", file, line, l->name, buf);
-            return;
-        }
-        printf("%s[%lu] %s debug: %s\n", file, line, _log.name, buf);
-        return;
+    if (suppressed) {
+        _suppressed(l, file, line, "debug", suppressed);
     }
-
-    if (l) {
-        if (l->is_obj) {
-            printf("%s[%p] debug: %s\n", l->name, l, buf);
-            return;
-        }
-        printf("%s debug: %s\n", l->name, buf);
-        return;
-    }
-    printf("%s debug: %s\n", _log.name, buf);
+    _emit(l, file, line, "debug", buf);
 }
 
 void core_log_info(const core_log_t* l, const char* file, size_t line, const char* msg, ...)
 {
-    char    buf[512];
-    va_list ap;
+    char     buf[512];
+    va_list  ap;
+    uint64_t suppressed;
     if (!l) {
         if (_log.settings.info != 3) {
             return;
@@ -115,55 +373,24 @@ void core_log_info(const core_log_t* l, const char* file, size_t line, const cha
             return;
         }
     }
+    if (_ratelimit(file, line, msg, &suppressed)) {
+        return;
+    }
     va_start(ap, msg);
     vsnprintf(buf, sizeof(buf), msg, ap);
     va_end(ap);
     buf[sizeof(buf) - 1] = 0;
-    for (;;) {
-        if (!l) {
-            if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        } else {
-            if (l->settings.display_file_line) {
-                if (l->settings.display_file_line != 3) {
-                    break;
-                }
-            } else if (l->module && l->module->display_file_line) {
-                if (l->module->display_file_line != 3) {
-                    break;
-                }
-            } else if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        }
-        if (l) {
-            if (l->is_obj) {
-                printf("%s[%lu] %s[%p] info: %s\n", file, line, l->name, l, buf);
-                return;
-            }
-            printf("%s[%lu] %s info: %s\n", file, line, l->name, buf);
-            return;
-        }
-        printf("%s[%lu] %s info: %s\n", file, line, _log.name, buf);
-        return;
-    }
-
-    if (l) {
-        if (l->is_obj) {
-            printf("%s[%p] info: %s\n", l->name, l, buf);
-            return;
-        }
-        printf("%s info: %s\n", l->name, buf);
-        return;
+    if (suppressed) {
+        _suppressed(l, file, line, "info", suppressed);
     }
-    printf("%s info: %s\n", _log.name, buf);
+    _emit(l, file, line, "info", buf);
 }
 
 void core_log_notice(const core_log_t* l, const char* file, size_t line, const char* msg, ...)
 {
-    char    buf[512];
-    va_list ap;
+    char     buf[512];
+    va_list  ap;
+    uint64_t suppressed;
     if (!l) {
         if (_log.settings.notice != 3) {
             return;
@@ -181,55 +408,24 @@ void core_log_notice(const core_log_t* l, const char* file, size_t line, const c
             return;
         }
     }
+    if (_ratelimit(file, line, msg, &suppressed)) {
+        return;
+    }
     va_start(ap, msg);
     vsnprintf(buf, sizeof(buf), msg, ap);
     va_end(ap);
     buf[sizeof(buf) - 1] = 0;
-    for (;;) {
-        if (!l) {
-            if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        } else {
-            if (l->settings.display_file_line) {
-                if (l->settings.display_file_line != 3) {
-                    break;
-                }
-            } else if (l->module && l->module->display_file_line) {
-                if (l->module->display_file_line != 3) {
-                    break;
-                }
-            } else if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        }
-        if (l) {
-            if (l->is_obj) {
-                printf("%s[%lu] %s[%p] notice: %s\n", file, line, l->name, l, buf);
-                return;
-            }
-            printf("%s[%lu] %s notice: %s\n", file, line, l->name, buf);
-            return;
-        }
-        printf("%s[%lu] %s notice: %s\n", file, line, _log.name, buf);
-        return;
+    if (suppressed) {
+        _suppressed(l, file, line, "notice", suppressed);
     }
-
-    if (l) {
-        if (l->is_obj) {
-            printf("%s[%p] notice: %s\n", l->name, l, buf);
-            return;
-        }
-        printf("%s notice: %s\n", l->name, buf);
-        return;
-    }
-    printf("%s notice: %s\n", _log.name, buf);
+    _emit(l, file, line, "notice", buf);
 }
 
 void core_log_warning(const core_log_t* l, const char* file, size_t line, const char* msg, ...)
 {
-    char    buf[512];
-    va_list ap;
+    char     buf[512];
+    va_list  ap;
+    uint64_t suppressed;
     if (!l) {
         if (_log.settings.warning != 3) {
             return;
@@ -247,98 +443,28 @@ void core_log_warning(const core_log_t* l, const char* file, size_t line, const
             return;
         }
     }
+    if (_ratelimit(file, line, msg, &suppressed)) {
+        return;
+    }
     va_start(ap, msg);
     vsnprintf(buf, sizeof(buf), msg, ap);
     va_end(ap);
     buf[sizeof(buf) - 1] = 0;
-    for (;;) {
-        if (!l) {
-            if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        } else {
-            if (l->settings.display_file_line) {
-                if (l->settings.display_file_line != 3) {
-                    break;
-                }
-            } else if (l->module && l->module->display_file_line) {
-                if (l->module->display_file_line != 3) {
-                    break;
-                }
-            } else if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        }
-        if (l) {
-            if (l->is_obj) {
-                printf("%s[%lu] %s[%p] warning: %s\n", file, line, l->name, l, buf);
-                return;
-            }
-            printf("%s[%lu] %s warning: %s\n", file, line, l->name, buf);
-            return;
-        }
-        printf("%s[%lu] %s warning: %s\n", file, line, _log.name, buf);
-        return;
+    if (suppressed) {
+        _suppressed(l, file, line, "warning", suppressed);
     }
-
-    if (l) {
-        if (l->is_obj) {
-            printf("%s[%p] warning: %s\n", l->name, l, buf);
-            return;
-        }
-        printf("%s warning: %s\n", l->name, buf);
-        return;
-    }
-    printf("%s warning: %s\n", _log.name, buf);
+    _emit(l, file, line, "warning", buf);
 }
 
 void core_log_critical(const core_log_t* l, const char* file, size_t line, const char* msg, ...)
 {
-    char    buf[512];
-    va_list ap;
+    char     buf[512];
+    va_list  ap;
     va_start(ap, msg);
     vsnprintf(buf, sizeof(buf), msg, ap);
     va_end(ap);
     buf[sizeof(buf) - 1] = 0;
-    for (;;) {
-        if (!l) {
-            if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        } else {
-            if (l->settings.display_file_line) {
-                if (l->settings.display_file_line != 3) {
-                    break;
-                }
-            } else if (l->module && l->module->display_file_line) {
-                if (l->module->display_file_line != 3) {
-                    break;
-                }
-            } else if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        }
-        if (l) {
-            if (l->is_obj) {
-                printf("%s[%lu] %s[%p] critical: %s\n", file, line, l->name, l, buf);
-                return;
-            }
-            printf("%s[%lu] %s critical: %s\n", file, line, l->name, buf);
-            return;
-        }
-        printf("%s[%lu] %s critical: %s\n", file, line, _log.name, buf);
-        return;
-    }
-
-    if (l) {
-        if (l->is_obj) {
-            printf("%s[%p] critical: %s\n", l->name, l, buf);
-            return;
-        }
-        printf("%s critical: %s\n", l->name, buf);
-        return;
-    }
-    printf("%s critical: %s\n", _log.name, buf);
+    _emit(l, file, line, "critical", buf);
 }
 
 void core_log_fatal(const core_log_t* l, const char* file, size_t line, const char* msg, ...)
@@ -349,46 +475,73 @@ void core_log_fatal(const core_log_t* l, const char* file, size_t line, const ch
     vsnprintf(buf, sizeof(buf), msg, ap);
     va_end(ap);
     buf[sizeof(buf) - 1] = 0;
-    for (;;) {
-        if (!l) {
-            if (_log.settings.display_file_line != 3) {
-                break;
-            }
-        } else {
-            if (l->settings.display_file_line) {
-                if (l->settings.display_file_line != 3) {
-                    break;
-                }
-            } else if (l->module && l->module->display_file_line) {
-                if (l->module->display_file_line != 3) {
-                    break;
-                }
-            } else if (_log.settings.display_file_line != 3) {
-                break;
+    if (ck_pr_load_int(&_async)) {
+        /* drain what the other threads have queued so the fatal message
+         * comes last, it is written directly as the writer is stopped by
+         * exit() */
+        pthread_mutex_lock(&_drain_lock);
+        _drain();
+        ck_pr_store_int(&_async, 0);
+        pthread_mutex_unlock(&_drain_lock);
+    }
+    _emit(l, file, line, "fatal", buf);
+    exit(1);
+}
+
+void core_log_async(int enable)
+{
+    pthread_mutex_lock(&_writer_lock);
+    if (enable) {
+        if (!ck_pr_load_int(&_running)) {
+            static int registered = 0;
+            int        err;
+
+            if (!registered) {
+                atexit(_writer_stop);
+                registered = 1;
             }
-        }
-        if (l) {
-            if (l->is_obj) {
-                printf("%s[%lu] %s[%p] fatal: %s\n", file, line, l->name, l, buf);
-                exit(1);
+            fflush(stdout);
+            ck_pr_store_int(&_running, 1);
+            if ((err = pthread_create(&_writer, 0, _writer_run, 0))) {
+                ck_pr_store_int(&_running, 0);
+                pthread_mutex_unlock(&_writer_lock);
+                mlcritical("pthread_create() error: %s", core_log_errstr(err));
+                return;
             }
-            printf("%s[%lu] %s fatal: %s\n", file, line, l->name, buf);
-            exit(1);
         }
-        printf("%s[%lu] %s fatal: %s\n", file, line, _log.name, buf);
-        exit(1);
+        ck_pr_store_int(&_async, 1);
+        pthread_mutex_unlock(&_writer_lock);
+        return;
     }
+    pthread_mutex_unlock(&_writer_lock);
+    _writer_stop();
+}
 
-    if (l) {
-        if (l->is_obj) {
-            printf("%s[%p] fatal: %s\n", l->name, l, buf);
-            exit(1);
-        }
-        printf("%s fatal: %s\n", l->name, buf);
-        exit(1);
+void core_log_ratelimit(unsigned int burst, uint64_t interval)
+{
+    ck_pr_store_64(&_interval, interval);
+    ck_pr_store_uint(&_burst, burst);
+}
+
+void core_log_flush()
+{
+    if (ck_pr_load_int(&_async)) {
+        pthread_mutex_lock(&_drain_lock);
+        _drain();
+        pthread_mutex_unlock(&_drain_lock);
     }
-    printf("%s fatal: %s\n", _log.name, buf);
-    exit(1);
+    fflush(stdout);
+}
+
+uint64_t core_log_dropped()
+{
+    _ring_t* ring;
+    uint64_t dropped = 0;
+
+    for (ring = ck_pr_load_ptr(&_rings); ring; ring = ring->next) {
+        dropped += ck_pr_load_uint(&ring->dropped);
+    }
+    return dropped;
 }
 
 core_log_t* core_log_log()
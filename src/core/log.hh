@@ -41,3 +41,8 @@ void core_log_critical(const core_log_t* l, const char* file, size_t line, const
 void core_log_fatal(const core_log_t* l, const char* file, size_t line, const char* msg, ...);
 
 core_log_t* core_log_log();
+
+void core_log_async(int enable);
+void core_log_ratelimit(unsigned int burst, uint64_t interval);
+void core_log_flush();
+uint64_t core_log_dropped();
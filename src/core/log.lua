@@ -195,6 +195,27 @@
 -- .BR glwarning(msg...) ,
 -- .BR glcritical(msg...) ,
 -- .BR glfatal(msg...) .
+-- .SS Asynchronous output and rate limiting
+-- By default messages are written to stdout by the thread generating them.
+-- With
+-- .B async()
+-- enabled each thread instead queues its formatted messages in its own
+-- lock-free ring which is written out by a background thread, so that
+-- logging from the hot path of one thread does not stall the others on the
+-- stdout lock.
+-- If a ring is full the message is dropped and a warning with the number of
+-- dropped messages is written when the ring is drained.
+-- Queued messages are written before a fatal message and at exit.
+-- .LP
+-- With
+-- .B ratelimit()
+-- each call site (file, line and format) may only generate a burst of
+-- messages per interval, the rest are suppressed before being formatted and
+-- their number is reported with the next message from the call site after
+-- the interval has passed.
+-- Critical and fatal messages are never suppressed.
+--   log.async(true)
+--   log.ratelimit(10, 1.0)
 module(...,package.seeall)
 
 require("dnsjit.core.log_h")
@@ -315,6 +336,37 @@ function Log:display_file_line(bool)
     end
 end
 
+-- Enable or disable asynchronous output of messages, this is global for
+-- all Log objects.
+function Log.async(bool)
+    if bool == true then
+        C.core_log_async(1)
+    else
+        C.core_log_async(0)
+    end
+end
+
+-- Allow at most
+-- .I burst
+-- debug, info, notice and warning messages per call site within
+-- .I interval
+-- seconds (default 1.0), a burst of 0 disables rate limiting which is the
+-- default.
+-- This is global for all Log objects.
+function Log.ratelimit(burst, interval)
+    C.core_log_ratelimit(burst, (interval or 1.0) * 1000000000)
+end
+
+-- Write out all queued messages and flush stdout.
+function Log.flush()
+    C.core_log_flush()
+end
+
+-- Return the number of messages dropped because a ring was full.
+function Log.dropped()
+    return tonumber(C.core_log_dropped())
+end
+
 -- Generate a debug message.
 function Log.debug(self, ...)
     local format
@@ -0,0 +1,753 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "core/metrics.h"
+#include "core/assert.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <ck_pr.h>
+
+static core_log_t _log = LOG_T_INIT("core.metrics");
+
+/*
+ * Each thread updating metrics gets its own slab of 64-bit slots, aligned
+ * on a cache line and only ever written by that thread, so updating a
+ * metric is a plain add without locks, atomics or cache line contention.
+ * Snapshots sum the slot over all slabs, slabs are kept on a list that is
+ * only appended to and a slab is reused (with its values) by a new thread
+ * once the thread that owned it has exited.
+ * A metric uses one slot, a histogram uses one per bucket, one for values
+ * above the last bucket and one for the sum of all values.
+ * Slot 0 is never assigned so updates to a metric that failed to register
+ * are harmless.
+ */
+
+#define METRICS_SLOTS 4096
+#define METRICS_MAX 512
+#define METRICS_POLL_MS 100
+
+typedef struct _metric {
+    core_metrics_type_t type;
+    char*               name;
+    char*               labels;
+    char*               help;
+    size_t              slot;
+    uint64_t*           bounds;
+    size_t              buckets;
+    double              unit;
+} _metric_t;
+
+static _metric_t       _metric[METRICS_MAX];
+static _metric_t*      _slot_metric[METRICS_SLOTS];
+static size_t          _metrics = 0;
+static size_t          _slots   = 1;
+static pthread_mutex_t _lock    = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct _slab _slab_t;
+struct _slab {
+    uint64_t value[METRICS_SLOTS];
+    _slab_t* next;
+    int      owned;
+};
+
+static _slab_t*        _slabs      = 0;
+static pthread_mutex_t _slabs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t   _slab_key;
+static pthread_once_t  _slab_once = PTHREAD_ONCE_INIT;
+static __thread uint64_t* _value  = 0;
+
+core_log_t* core_metrics_log()
+{
+    return &_log;
+}
+
+/*
+ * Registry
+ */
+
+static size_t _register(size_t* slot, core_metrics_type_t type, const char* name, const char* labels, const char* help, const uint64_t* bounds, size_t buckets, double unit)
+{
+    _metric_t* m;
+    size_t     i, need;
+
+    mlassert(name, "name is nil");
+    if (!labels) {
+        labels = "";
+    }
+    if (!help) {
+        help = "";
+    }
+
+    pthread_mutex_lock(&_lock);
+    if (slot && *slot) {
+        pthread_mutex_unlock(&_lock);
+        return *slot;
+    }
+    for (i = 0; i < _metrics; i++) {
+        m = &_metric[i];
+        if (!strcmp(m->name, name) && !strcmp(m->labels, labels)) {
+            if (m->type != type) {
+                pthread_mutex_unlock(&_lock);
+                mlfatal("metric %s{%s} already registered with another type", name, labels);
+            }
+            if (slot) {
+                *slot = m->slot;
+            }
+            pthread_mutex_unlock(&_lock);
+            return m->slot;
+        }
+    }
+
+    need = type == CORE_METRICS_HISTOGRAM ? buckets + 2 : 1;
+    if (_metrics == METRICS_MAX || _slots + need > METRICS_SLOTS) {
+        pthread_mutex_unlock(&_lock);
+        mlcritical("too many metrics, %s{%s} not registered", name, labels);
+        return 0;
+    }
+
+    m = &_metric[_metrics];
+    mlfatal_oom(m->name = strdup(name));
+    mlfatal_oom(m->labels = strdup(labels));
+    mlfatal_oom(m->help = strdup(help));
+    m->type    = type;
+    m->slot    = _slots;
+    m->bounds  = 0;
+    m->buckets = 0;
+    m->unit    = unit;
+    if (type == CORE_METRICS_HISTOGRAM) {
+        mlfatal_oom(m->bounds = malloc(sizeof(uint64_t) * (buckets ? buckets : 1)));
+        memcpy(m->bounds, bounds, sizeof(uint64_t) * buckets);
+        m->buckets = buckets;
+    }
+    _slot_metric[m->slot] = m;
+    _slots += need;
+    _metrics++;
+    if (slot) {
+        *slot = m->slot;
+    }
+    pthread_mutex_unlock(&_lock);
+
+    mldebug("registered %s{%s} slot %lu", name, labels, m->slot);
+    return m->slot;
+}
+
+size_t core_metrics_counter(size_t* slot, const char* name, const char* labels, const char* help)
+{
+    return _register(slot, CORE_METRICS_COUNTER, name, labels, help, 0, 0, 1.0);
+}
+
+size_t core_metrics_gauge(size_t* slot, const char* name, const char* labels, const char* help)
+{
+    return _register(slot, CORE_METRICS_GAUGE, name, labels, help, 0, 0, 1.0);
+}
+
+size_t core_metrics_histogram(size_t* slot, const char* name, const char* labels, const char* help, const uint64_t* bounds, size_t buckets, double unit)
+{
+    size_t i;
+
+    mlassert(bounds || !buckets, "bounds is nil");
+    for (i = 1; i < buckets; i++) {
+        if (bounds[i] <= bounds[i - 1]) {
+            mlfatal("histogram %s bounds must be increasing", name);
+        }
+    }
+    if (unit <= 0) {
+        unit = 1.0;
+    }
+    return _register(slot, CORE_METRICS_HISTOGRAM, name, labels, help, bounds, buckets, unit);
+}
+
+size_t core_metrics_find(const char* name, const char* labels)
+{
+    size_t i, slot = 0;
+
+    mlassert(name, "name is nil");
+    if (!labels) {
+        labels = "";
+    }
+
+    pthread_mutex_lock(&_lock);
+    for (i = 0; i < _metrics; i++) {
+        if (!strcmp(_metric[i].name, name) && !strcmp(_metric[i].labels, labels)) {
+            slot = _metric[i].slot;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return slot;
+}
+
+/*
+ * Per thread slabs
+ */
+
+static void _slab_release(void* ptr)
+{
+    _slab_t* slab = (_slab_t*)ptr;
+
+    pthread_mutex_lock(&_slabs_lock);
+    slab->owned = 0;
+    pthread_mutex_unlock(&_slabs_lock);
+}
+
+static void _slab_key_create(void)
+{
+    pthread_key_create(&_slab_key, _slab_release);
+}
+
+static uint64_t* _slab_get(void)
+{
+    _slab_t* slab;
+
+    pthread_once(&_slab_once, _slab_key_create);
+    pthread_mutex_lock(&_slabs_lock);
+    for (slab = _slabs; slab; slab = slab->next) {
+        if (!slab->owned) {
+            break;
+        }
+    }
+    if (!slab) {
+        void* ptr = 0;
+
+        if (posix_memalign(&ptr, 64, sizeof(_slab_t))) {
+            ptr = 0;
+        }
+        mlfatal_oom(slab = ptr);
+        memset(slab, 0, sizeof(_slab_t));
+        slab->next = _slabs;
+        ck_pr_fence_store();
+        ck_pr_store_ptr(&_slabs, slab);
+    }
+    slab->owned = 1;
+    pthread_mutex_unlock(&_slabs_lock);
+
+    pthread_setspecific(_slab_key, slab);
+    _value = slab->value;
+    return _value;
+}
+
+void core_metrics_inc(size_t slot)
+{
+    uint64_t* value = _value ? _value : _slab_get();
+
+    ck_pr_store_64(&value[slot], value[slot] + 1);
+}
+
+void core_metrics_add(size_t slot, uint64_t n)
+{
+    uint64_t* value = _value ? _value : _slab_get();
+
+    ck_pr_store_64(&value[slot], value[slot] + n);
+}
+
+void core_metrics_dec(size_t slot)
+{
+    uint64_t* value = _value ? _value : _slab_get();
+
+    ck_pr_store_64(&value[slot], value[slot] - 1);
+}
+
+void core_metrics_observe(size_t slot, uint64_t n)
+{
+    uint64_t*  value = _value ? _value : _slab_get();
+    _metric_t* m     = _slot_metric[slot];
+    size_t     i;
+
+    if (!m) {
+        return;
+    }
+    for (i = 0; i < m->buckets && n > m->bounds[i]; i++)
+        ;
+    ck_pr_store_64(&value[slot + i], value[slot + i] + 1);
+    ck_pr_store_64(&value[slot + m->buckets + 1], value[slot + m->buckets + 1] + n);
+}
+
+/*
+ * Snapshots
+ */
+
+core_metrics_snapshot_t* core_metrics_snapshot_new()
+{
+    core_metrics_snapshot_t* self;
+
+    mlfatal_oom(self = calloc(1, sizeof(core_metrics_snapshot_t)));
+    mlfatal_oom(self->value = calloc(METRICS_SLOTS, sizeof(uint64_t)));
+
+    return self;
+}
+
+void core_metrics_snapshot_free(core_metrics_snapshot_t* self)
+{
+    if (self) {
+        free(self->value);
+        free(self);
+    }
+}
+
+void core_metrics_snapshot_take(core_metrics_snapshot_t* self)
+{
+    _slab_t* slab;
+    size_t   i;
+
+    mlassert_self();
+
+    pthread_mutex_lock(&_lock);
+    self->slots = _slots;
+    pthread_mutex_unlock(&_lock);
+
+    memset(self->value, 0, sizeof(uint64_t) * METRICS_SLOTS);
+    for (slab = ck_pr_load_ptr(&_slabs); slab; slab = slab->next) {
+        for (i = 1; i < self->slots; i++) {
+            self->value[i] += ck_pr_load_64(&slab->value[i]);
+        }
+    }
+}
+
+void core_metrics_snapshot_merge(core_metrics_snapshot_t* self, const core_metrics_snapshot_t* other)
+{
+    size_t i;
+
+    mlassert_self();
+    mlassert(other, "other is nil");
+
+    for (i = 1; i < other->slots; i++) {
+        self->value[i] += other->value[i];
+    }
+    if (other->slots > self->slots) {
+        self->slots = other->slots;
+    }
+}
+
+int64_t core_metrics_snapshot_value(const core_metrics_snapshot_t* self, size_t slot)
+{
+    _metric_t* m;
+    uint64_t   count = 0;
+    size_t     i;
+
+    mlassert_self();
+
+    if (!slot || slot >= self->slots || slot >= METRICS_SLOTS) {
+        return 0;
+    }
+    m = _slot_metric[slot];
+    if (m && m->type == CORE_METRICS_HISTOGRAM) {
+        for (i = 0; i <= m->buckets; i++) {
+            count += self->value[slot + i];
+        }
+        return (int64_t)count;
+    }
+    return (int64_t)self->value[slot];
+}
+
+/*
+ * Prometheus text format
+ */
+
+typedef struct _text {
+    char*  buf;
+    size_t len, size;
+} _text_t;
+
+static void _printf(_text_t* text, const char* fmt, ...)
+{
+    va_list ap;
+    int     n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(text->buf + text->len, text->size - text->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return;
+        }
+        if (text->len + n < text->size) {
+            text->len += n;
+            return;
+        }
+        text->size = (text->size + n) * 2;
+        mlfatal_oom(text->buf = realloc(text->buf, text->size));
+    }
+}
+
+static int _cmp(const void* a, const void* b)
+{
+    const _metric_t* ma = *(const _metric_t**)a;
+    const _metric_t* mb = *(const _metric_t**)b;
+    int              c  = strcmp(ma->name, mb->name);
+
+    if (c) {
+        return c;
+    }
+    return ma < mb ? -1 : ma > mb;
+}
+
+static void _text(_text_t* text, const core_metrics_snapshot_t* snapshot)
+{
+    static const char* type[] = { "counter", "gauge", "histogram" };
+    _metric_t*         sorted[METRICS_MAX];
+    const char*        last = 0;
+    size_t             i, j, n;
+    uint64_t           count;
+
+    pthread_mutex_lock(&_lock);
+    for (i = 0, n = 0; i < _metrics; i++) {
+        if (_metric[i].slot < snapshot->slots) {
+            sorted[n++] = &_metric[i];
+        }
+    }
+    qsort(sorted, n, sizeof(_metric_t*), _cmp);
+
+    for (i = 0; i < n; i++) {
+        _metric_t*      m = sorted[i];
+        const uint64_t* v = &snapshot->value[m->slot];
+        const char*     sep = *m->labels ? "," : "";
+
+        if (!last || strcmp(last, m->name)) {
+            if (*m->help) {
+                _printf(text, "# HELP %s %s\n", m->name, m->help);
+            }
+            _printf(text, "# TYPE %s %s\n", m->name, type[m->type]);
+            last = m->name;
+        }
+
+        switch (m->type) {
+        case CORE_METRICS_COUNTER:
+            _printf(text, *m->labels ? "%s{%s} %lu\n" : "%s%s %lu\n", m->name, m->labels, (unsigned long)v[0]);
+            break;
+        case CORE_METRICS_GAUGE:
+            _printf(text, *m->labels ? "%s{%s} %ld\n" : "%s%s %ld\n", m->name, m->labels, (long)(int64_t)v[0]);
+            break;
+        case CORE_METRICS_HISTOGRAM:
+            for (j = 0, count = 0; j < m->buckets; j++) {
+                count += v[j];
+                if (m->unit == 1.0) {
+                    _printf(text, "%s_bucket{%s%sle=\"%lu\"} %lu\n", m->name, m->labels, sep, (unsigned long)m->bounds[j], (unsigned long)count);
+                } else {
+                    _printf(text, "%s_bucket{%s%sle=\"%g\"} %lu\n", m->name, m->labels, sep, m->bounds[j] * m->unit, (unsigned long)count);
+                }
+            }
+            count += v[m->buckets];
+            _printf(text, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", m->name, m->labels, sep, (unsigned long)count);
+            if (m->unit == 1.0) {
+                _printf(text, *m->labels ? "%s_sum{%s} %lu\n" : "%s_sum%s %lu\n", m->name, m->labels, (unsigned long)v[m->buckets + 1]);
+            } else {
+                _printf(text, *m->labels ? "%s_sum{%s} %.9g\n" : "%s_sum%s %.9g\n", m->name, m->labels, v[m->buckets + 1] * m->unit);
+            }
+            _printf(text, *m->labels ? "%s_count{%s} %lu\n" : "%s_count%s %lu\n", m->name, m->labels, (unsigned long)count);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+/* Render the snapshot, or a new snapshot if nil, into an allocated buffer. */
+static char* _render(const core_metrics_snapshot_t* snapshot, size_t* len)
+{
+    core_metrics_snapshot_t* taken = 0;
+    _text_t                  text  = { 0, 0, 4096 };
+
+    if (!snapshot) {
+        taken = core_metrics_snapshot_new();
+        core_metrics_snapshot_take(taken);
+        snapshot = taken;
+    }
+    mlfatal_oom(text.buf = malloc(text.size));
+    _text(&text, snapshot);
+    core_metrics_snapshot_free(taken);
+
+    *len = text.len;
+    return text.buf;
+}
+
+size_t core_metrics_text(const core_metrics_snapshot_t* snapshot, char* buf, size_t size)
+{
+    size_t len;
+    char*  out = _render(snapshot, &len);
+
+    if (buf && size) {
+        size_t n = len < size ? len : size - 1;
+
+        memcpy(buf, out, n);
+        buf[n] = 0;
+    }
+    free(out);
+
+    return len;
+}
+
+/*
+ * Exporters
+ */
+
+static pthread_mutex_t _export_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  _export_cond = PTHREAD_COND_INITIALIZER;
+static int             _export_registered = 0;
+static int             _file_running      = 0;
+static pthread_t       _file_thread;
+static char*           _file_path = 0;
+static uint64_t        _file_interval;
+static int             _socket_running = 0;
+static pthread_t       _socket_thread;
+static char*           _socket_path = 0;
+static int             _socket_fd   = -1;
+
+static int _write_file(const char* path)
+{
+    char   tmp[4096];
+    char*  out;
+    size_t len;
+    FILE*  fp;
+    int    ret = 0;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        mlcritical("path too long: %s", path);
+        return -1;
+    }
+    out = _render(0, &len);
+    if (!(fp = fopen(tmp, "w"))) {
+        mlcritical("fopen(%s) error: %s", tmp, core_log_errstr(errno));
+        free(out);
+        return -1;
+    }
+    if (fwrite(out, 1, len, fp) != len) {
+        mlcritical("fwrite(%s) error: %s", tmp, core_log_errstr(errno));
+        ret = -1;
+    }
+    if (fclose(fp)) {
+        mlcritical("fclose(%s) error: %s", tmp, core_log_errstr(errno));
+        ret = -1;
+    }
+    free(out);
+    if (!ret && rename(tmp, path)) {
+        mlcritical("rename(%s, %s) error: %s", tmp, path, core_log_errstr(errno));
+        ret = -1;
+    }
+    return ret;
+}
+
+static void* _file_run(void* arg)
+{
+    struct timespec ts;
+
+    (void)arg;
+    pthread_mutex_lock(&_export_lock);
+    while (_file_running) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += _file_interval / 1000;
+        ts.tv_nsec += (_file_interval % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&_export_cond, &_export_lock, &ts);
+        if (!_file_running) {
+            break;
+        }
+        pthread_mutex_unlock(&_export_lock);
+        _write_file(_file_path);
+        pthread_mutex_lock(&_export_lock);
+    }
+    pthread_mutex_unlock(&_export_lock);
+    return 0;
+}
+
+static void _serve(int fd)
+{
+    static const char* header = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\n\r\n";
+    struct pollfd      pfd    = { fd, POLLIN, 0 };
+    char               req[1024], hdr[128];
+    ssize_t            n = 0, w;
+    size_t             len, off;
+    char*              out;
+
+    /* answer HTTP requests, for example from curl --unix-socket, but also
+     * just write the text if the client does not send anything */
+    if (poll(&pfd, 1, METRICS_POLL_MS) > 0) {
+        n = read(fd, req, sizeof(req));
+    }
+    out = _render(0, &len);
+    if (n >= 4 && !memcmp(req, "GET ", 4)) {
+        int hlen = snprintf(hdr, sizeof(hdr), header, (unsigned long)len);
+        if (write(fd, hdr, hlen) != hlen) {
+            free(out);
+            return;
+        }
+    }
+    for (off = 0; off < len; off += w) {
+        if ((w = write(fd, out + off, len - off)) < 1) {
+            break;
+        }
+    }
+    free(out);
+}
+
+static void* _socket_run(void* arg)
+{
+    struct pollfd pfd = { _socket_fd, POLLIN, 0 };
+    int           fd;
+
+    (void)arg;
+    while (ck_pr_load_int(&_socket_running)) {
+        if (poll(&pfd, 1, METRICS_POLL_MS) < 1) {
+            continue;
+        }
+        if ((fd = accept(_socket_fd, 0, 0)) < 0) {
+            continue;
+        }
+        _serve(fd);
+        close(fd);
+    }
+    return 0;
+}
+
+static void _export_atexit(void)
+{
+    core_metrics_export_stop();
+}
+
+static void _export_register(void)
+{
+    if (!_export_registered) {
+        atexit(_export_atexit);
+        _export_registered = 1;
+    }
+}
+
+int core_metrics_export_file(const char* path, uint64_t interval_ms)
+{
+    int err;
+
+    mlassert(path, "path is nil");
+
+    if (!interval_ms) {
+        return _write_file(path);
+    }
+
+    pthread_mutex_lock(&_export_lock);
+    if (_file_running) {
+        pthread_mutex_unlock(&_export_lock);
+        mlcritical("file exporter already running");
+        return -1;
+    }
+    _export_register();
+    free(_file_path);
+    mlfatal_oom(_file_path = strdup(path));
+    _file_interval = interval_ms;
+    _file_running  = 1;
+    if ((err = pthread_create(&_file_thread, 0, _file_run, 0))) {
+        _file_running = 0;
+        pthread_mutex_unlock(&_export_lock);
+        mlcritical("pthread_create() error: %s", core_log_errstr(err));
+        return -1;
+    }
+    pthread_mutex_unlock(&_export_lock);
+
+    return 0;
+}
+
+int core_metrics_export_socket(const char* path)
+{
+    struct sockaddr_un addr;
+    int                err;
+
+    mlassert(path, "path is nil");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        mlcritical("socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    pthread_mutex_lock(&_export_lock);
+    if (_socket_fd > -1) {
+        pthread_mutex_unlock(&_export_lock);
+        mlcritical("socket exporter already running");
+        return -1;
+    }
+    if ((_socket_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        pthread_mutex_unlock(&_export_lock);
+        mlcritical("socket() error: %s", core_log_errstr(errno));
+        return -1;
+    }
+    unlink(path);
+    if (bind(_socket_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        mlcritical("bind(%s) error: %s", path, core_log_errstr(errno));
+        goto fail;
+    }
+    if (listen(_socket_fd, 16)) {
+        mlcritical("listen(%s) error: %s", path, core_log_errstr(errno));
+        goto fail;
+    }
+    _export_register();
+    free(_socket_path);
+    mlfatal_oom(_socket_path = strdup(path));
+    ck_pr_store_int(&_socket_running, 1);
+    if ((err = pthread_create(&_socket_thread, 0, _socket_run, 0))) {
+        ck_pr_store_int(&_socket_running, 0);
+        mlcritical("pthread_create() error: %s", core_log_errstr(err));
+        goto fail;
+    }
+    pthread_mutex_unlock(&_export_lock);
+
+    return 0;
+
+fail:
+    close(_socket_fd);
+    _socket_fd = -1;
+    pthread_mutex_unlock(&_export_lock);
+    return -1;
+}
+
+void core_metrics_export_stop()
+{
+    pthread_mutex_lock(&_export_lock);
+    if (_file_running) {
+        _file_running = 0;
+        pthread_cond_signal(&_export_cond);
+        pthread_mutex_unlock(&_export_lock);
+        pthread_join(_file_thread, 0);
+        pthread_mutex_lock(&_export_lock);
+        /* final values */
+        _write_file(_file_path);
+    }
+    if (_socket_fd > -1) {
+        ck_pr_store_int(&_socket_running, 0);
+        pthread_mutex_unlock(&_export_lock);
+        pthread_join(_socket_thread, 0);
+        pthread_mutex_lock(&_export_lock);
+        close(_socket_fd);
+        _socket_fd = -1;
+        unlink(_socket_path);
+    }
+    pthread_mutex_unlock(&_export_lock);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+
+typedef enum core_metrics_type {
+    CORE_METRICS_COUNTER   = 0,
+    CORE_METRICS_GAUGE     = 1,
+    CORE_METRICS_HISTOGRAM = 2
+} core_metrics_type_t;
+
+typedef struct core_metrics_snapshot {
+    /* Values of all slots summed over all threads, slot 0 is unused. */
+    size_t    slots;
+    uint64_t* value;
+} core_metrics_snapshot_t;
+
+core_log_t* core_metrics_log();
+
+size_t core_metrics_counter(size_t* slot, const char* name, const char* labels, const char* help);
+size_t core_metrics_gauge(size_t* slot, const char* name, const char* labels, const char* help);
+size_t core_metrics_histogram(size_t* slot, const char* name, const char* labels, const char* help, const uint64_t* bounds, size_t buckets, double unit);
+size_t core_metrics_find(const char* name, const char* labels);
+
+void core_metrics_inc(size_t slot);
+void core_metrics_add(size_t slot, uint64_t n);
+void core_metrics_dec(size_t slot);
+void core_metrics_observe(size_t slot, uint64_t value);
+
+core_metrics_snapshot_t* core_metrics_snapshot_new();
+void core_metrics_snapshot_free(core_metrics_snapshot_t* self);
+void core_metrics_snapshot_take(core_metrics_snapshot_t* self);
+void core_metrics_snapshot_merge(core_metrics_snapshot_t* self, const core_metrics_snapshot_t* other);
+int64_t core_metrics_snapshot_value(const core_metrics_snapshot_t* self, size_t slot);
+size_t core_metrics_text(const core_metrics_snapshot_t* snapshot, char* buf, size_t size);
+
+int core_metrics_export_file(const char* path, uint64_t interval_ms);
+int core_metrics_export_socket(const char* path);
+void core_metrics_export_stop();
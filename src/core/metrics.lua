@@ -0,0 +1,217 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.core.metrics
+-- Metrics registry with Prometheus text export
+--   local metrics = require("dnsjit.core.metrics")
+--   metrics.export_file("/var/lib/node_exporter/dnsjit.prom", 10)
+--   ...
+--   print(metrics.text())
+-- .SS Custom metrics from Lua
+--   local sent = metrics.counter("myscript_sent_total", nil, "Queries sent")
+--   metrics.inc(sent)
+--   local lat = metrics.histogram("myscript_latency_seconds", nil,
+--       "Latency", { 1000000, 10000000, 100000000 }, 1e-9)
+--   metrics.observe(lat, 2500000)
+--
+-- Registry of counters, gauges and histograms shared by all threads.
+-- Modules register their metrics by name and optional labels (in the
+-- Prometheus form
+-- .IR key="value",... )
+-- and update them in their hot paths, each thread updates its own copy of
+-- the values (in memory not shared with other threads) without locking so
+-- updating a metric costs about as much as updating a field in the module.
+-- Snapshots sum the values of all threads and can be rendered in the
+-- Prometheus text exposition format, written periodically to a file (for
+-- example for the node_exporter textfile collector) or served on a Unix
+-- socket (plain text, or HTTP if the client sends a GET request).
+-- .LP
+-- The following metrics are registered by the modules when used:
+-- .TP
+-- dnsjit_channel_put_total, dnsjit_channel_get_total
+-- Objects put into and taken out of channels.
+-- .TP
+-- dnsjit_channel_full_total
+-- Times a put had to wait because the channel was full.
+-- .TP
+-- dnsjit_input_packets_total{module}
+-- Packets read by input.fpcap, input.mmpcap and input.pcap, or generated by
+-- input.dnsgen.
+-- .TP
+-- dnsjit_layer_packets_total, dnsjit_layer_errors_total
+-- Packets parsed by filter.layer and those it failed to parse.
+-- .TP
+-- dnsjit_ipsplit_packets_total, dnsjit_ipsplit_discarded_total
+-- Packets passed through and discarded by filter.ipsplit.
+-- .TP
+-- dnsjit_dnssim_requests_total, dnsjit_dnssim_answers_total, dnsjit_dnssim_discarded_total, dnsjit_dnssim_ongoing
+-- Requests, answers, discarded packets and ongoing requests of output.dnssim.
+-- .TP
+-- dnsjit_dnssim_latency_seconds
+-- Histogram of the request latency of output.dnssim.
+-- .TP
+-- dnsjit_output_packets_total{module}, dnsjit_output_received_total{module}, dnsjit_output_errors_total{module}
+-- Packets sent, received and errors of output.udpcli, output.tcpcli,
+-- output.tlscli and output.dnscli.
+module(...,package.seeall)
+
+require("dnsjit.core.metrics_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Metrics = {}
+local Snapshot = {}
+
+-- Register (or find an already registered) counter and return its slot,
+-- .I labels
+-- and
+-- .I help
+-- are optional.
+function Metrics.counter(name, labels, help)
+    return tonumber(C.core_metrics_counter(nil, name, labels, help))
+end
+
+-- Register (or find an already registered) gauge and return its slot.
+function Metrics.gauge(name, labels, help)
+    return tonumber(C.core_metrics_gauge(nil, name, labels, help))
+end
+
+-- Register (or find an already registered) histogram and return its slot,
+-- .I bounds
+-- is a table of increasing upper bounds of the buckets and
+-- .I unit
+-- (default 1) is what a recorded value is multiplied by on export, for
+-- example 1e-9 to record nanoseconds and export seconds.
+function Metrics.histogram(name, labels, help, bounds, unit)
+    local b = ffi.new("uint64_t[?]", #bounds)
+    for i, v in ipairs(bounds) do
+        b[i - 1] = v
+    end
+    return tonumber(C.core_metrics_histogram(nil, name, labels, help, b, #bounds, unit or 1))
+end
+
+-- Return the slot of a registered metric or nil if not registered.
+function Metrics.find(name, labels)
+    local slot = C.core_metrics_find(name, labels)
+    if slot == 0 then
+        return
+    end
+    return tonumber(slot)
+end
+
+-- Increase a counter or gauge by one, or by
+-- .I n
+-- if given.
+function Metrics.inc(slot, n)
+    if n then
+        C.core_metrics_add(slot, n)
+    else
+        C.core_metrics_inc(slot)
+    end
+end
+
+-- Decrease a gauge by one.
+function Metrics.dec(slot)
+    C.core_metrics_dec(slot)
+end
+
+-- Record a value in a histogram.
+function Metrics.observe(slot, value)
+    C.core_metrics_observe(slot, value)
+end
+
+-- Return a new snapshot of all values.
+function Metrics.snapshot()
+    local self = setmetatable({
+        obj = C.core_metrics_snapshot_new(),
+    }, { __index = Snapshot })
+    ffi.gc(self.obj, C.core_metrics_snapshot_free)
+    C.core_metrics_snapshot_take(self.obj)
+    return self
+end
+
+-- Return the current value of the metric with the given name and labels,
+-- or nil if not registered.
+-- For histograms the count of recorded values is returned.
+function Metrics.value(name, labels)
+    return Metrics.snapshot():value(name, labels)
+end
+
+-- Return the current values in the Prometheus text format.
+function Metrics.text()
+    return Metrics.snapshot():text()
+end
+
+-- Write the values in the Prometheus text format to
+-- .I path
+-- every
+-- .I interval
+-- seconds, and once more at exit or when stopped.
+-- The file is written to
+-- .I path.tmp
+-- and then renamed.
+-- Without an interval the file is written once.
+-- Returns 0 on success.
+function Metrics.export_file(path, interval)
+    return C.core_metrics_export_file(path, (interval or 0) * 1000)
+end
+
+-- Serve the values in the Prometheus text format on a Unix socket at
+-- .IR path ,
+-- an existing file at the path is removed.
+-- Returns 0 on success.
+function Metrics.export_socket(path)
+    return C.core_metrics_export_socket(path)
+end
+
+-- Stop the exporters, the socket is removed.
+function Metrics.stop()
+    C.core_metrics_export_stop()
+end
+
+-- Update the snapshot with the current values.
+function Snapshot:take()
+    C.core_metrics_snapshot_take(self.obj)
+end
+
+-- Add the values of another snapshot to this one.
+function Snapshot:merge(other)
+    C.core_metrics_snapshot_merge(self.obj, other.obj)
+end
+
+-- Return the value of the metric with the given name and labels in the
+-- snapshot, or nil if not registered.
+-- For histograms the count of recorded values is returned.
+function Snapshot:value(name, labels)
+    local slot = C.core_metrics_find(name, labels)
+    if slot == 0 then
+        return
+    end
+    return tonumber(C.core_metrics_snapshot_value(self.obj, slot))
+end
+
+-- Return the values in the Prometheus text format.
+function Snapshot:text()
+    local len = C.core_metrics_text(self.obj, nil, 0)
+    local buf = ffi.new("char[?]", len + 1)
+    C.core_metrics_text(self.obj, buf, len + 1)
+    return ffi.string(buf, len)
+end
+
+-- dnsjit.core.log (3)
+return Metrics
@@ -22,6 +22,7 @@
 
 #include "core/object/dns.h"
 #include "core/object/payload.h"
+#include "core/object/pcap.h"
 #include "core/assert.h"
 
 #include <stdlib.h>
@@ -469,3 +470,329 @@ int core_object_dns_parse_rr(core_object_dns_t* self, core_object_dns_rr_t* rr,
     // TODO: error here on malformed/truncated? could be quite spammy
     return _ERR_MALFORMED;
 }
+
+core_object_dns_msg_t* core_object_dns_msg_new(size_t max_rrs, size_t max_names, size_t arena_size)
+{
+    core_object_dns_msg_t* self;
+
+    mlfatal_oom(self = calloc(1, sizeof(core_object_dns_msg_t)));
+    mlfatal_oom(self->rr = malloc(max_rrs * sizeof(core_object_dns_msg_rr_t)));
+    self->max_rrs = max_rrs;
+    mlfatal_oom(self->name = malloc(max_names * sizeof(core_object_dns_name_t)));
+    self->max_names = max_names;
+    mlfatal_oom(self->arena = malloc(arena_size));
+    self->arena_size = arena_size;
+
+    return self;
+}
+
+void core_object_dns_msg_free(core_object_dns_msg_t* self)
+{
+    mlassert_self();
+    free(self->rr);
+    free(self->name);
+    free(self->arena);
+    free(self);
+}
+
+/*
+ * Maximum number of compression pointers followed for one name, pointers
+ * must also point backwards so a loop can't be formed.
+ */
+#define _MAX_POINTERS 128
+
+static int _decode_name(core_object_dns_t* self, core_object_dns_msg_t* msg, const uint8_t* base, size_t* index)
+{
+    const uint8_t*          end    = self->payload + self->len;
+    const uint8_t*          at     = self->at;
+    const uint8_t*          resume = 0;
+    size_t                  pointers = 0, ptr;
+    core_object_dns_name_t* name;
+    uint8_t                 length;
+
+    if (msg->names == msg->max_names) {
+        mlwarning("need more names, aborting DNS decoding");
+        return _ERR_NEEDLABELS;
+    }
+    name         = &msg->name[msg->names];
+    name->offset = msg->arena_used;
+    name->length = 0;
+    name->labels = 0;
+
+    for (;;) {
+        if (at >= end) {
+            return _ERR_MALFORMED;
+        }
+        length = *at;
+
+        if ((length & 0xc0) == 0xc0) {
+            if (at + 1 >= end || ++pointers > _MAX_POINTERS) {
+                return _ERR_MALFORMED;
+            }
+            ptr = ((length & 0x3f) << 8) | at[1];
+            if (base + ptr >= at) {
+                return _ERR_MALFORMED;
+            }
+            if (!resume) {
+                resume = at + 2;
+            }
+            at = base + ptr;
+            continue;
+        } else if (length & 0xc0) {
+            /* Extended label types are not supported. */
+            return _ERR_MALFORMED;
+        }
+
+        if (at + 1 + length > end || name->length + 1 + length > 255) {
+            return _ERR_MALFORMED;
+        }
+        if (msg->arena_used + 1 + length > msg->arena_size) {
+            mlwarning("need more arena space, aborting DNS decoding");
+            return _ERR_NEEDLABELS;
+        }
+        memcpy(&msg->arena[msg->arena_used], at, 1 + length);
+        msg->arena_used += 1 + length;
+        name->length += 1 + length;
+        at += 1 + length;
+
+        if (!length) {
+            break;
+        }
+        name->labels++;
+    }
+
+    if (!resume) {
+        resume = at;
+    }
+    self->left -= resume - self->at;
+    self->at = resume;
+    *index   = msg->names++;
+
+    return 0;
+}
+
+static int _decode_rr(core_object_dns_t* self, core_object_dns_msg_t* msg, const uint8_t* base, core_object_dns_section_t section)
+{
+    core_object_dns_msg_rr_t* rr;
+    size_t                    rdata_names, rdata_end;
+    int                       ret;
+
+    if (msg->rrs == msg->max_rrs) {
+        mlwarning("need more rrs, aborting DNS decoding");
+        return _ERR_NEEDLABELS;
+    }
+    rr = &msg->rr[msg->rrs];
+    memset(rr, 0, sizeof(core_object_dns_msg_rr_t));
+    rr->section = section;
+    rr->offset  = self->at - self->payload;
+
+    if ((ret = _decode_name(self, msg, base, &rr->name))) {
+        return ret;
+    }
+
+    for (;;) {
+        need16(rr->type, self->at, self->left);
+        need16(rr->class, self->at, self->left);
+
+        if (section == CORE_OBJECT_DNS_SECTION_QUESTION) {
+            rr->length = self->at - self->payload - rr->offset;
+            msg->rrs++;
+            return 0;
+        }
+
+        need32(rr->ttl, self->at, self->left);
+        need16(rr->rdlength, self->at, self->left);
+        if (rr->rdlength > self->left) {
+            break;
+        }
+        rr->rdata_offset = self->at - self->payload;
+        rr->rdata_name   = msg->names;
+        rdata_end        = rr->rdata_offset + rr->rdlength;
+
+        switch (rr->type) {
+        case CORE_OBJECT_DNS_TYPE_MX:
+        case CORE_OBJECT_DNS_TYPE_AFSDB:
+        case CORE_OBJECT_DNS_TYPE_RT:
+        case CORE_OBJECT_DNS_TYPE_KX:
+        case CORE_OBJECT_DNS_TYPE_LP:
+        case CORE_OBJECT_DNS_TYPE_PX:
+            advancexb(2, self->at, self->left);
+            break;
+
+        case CORE_OBJECT_DNS_TYPE_SIG:
+        case CORE_OBJECT_DNS_TYPE_RRSIG:
+            advancexb(18, self->at, self->left);
+            break;
+
+        case CORE_OBJECT_DNS_TYPE_SRV:
+            advancexb(6, self->at, self->left);
+            break;
+
+        case CORE_OBJECT_DNS_TYPE_NAPTR: {
+            uint8_t naptr_length;
+
+            advancexb(4, self->at, self->left);
+            need8(naptr_length, self->at, self->left);
+            advancexb(naptr_length, self->at, self->left);
+            need8(naptr_length, self->at, self->left);
+            advancexb(naptr_length, self->at, self->left);
+            need8(naptr_length, self->at, self->left);
+            advancexb(naptr_length, self->at, self->left);
+        } break;
+
+        case CORE_OBJECT_DNS_TYPE_HIP: {
+            uint8_t  hit_length;
+            uint16_t pk_length;
+
+            need8(hit_length, self->at, self->left);
+            advancexb(1, self->at, self->left);
+            need16(pk_length, self->at, self->left);
+            advancexb(hit_length, self->at, self->left);
+            advancexb(pk_length, self->at, self->left);
+        } break;
+        }
+        if (self->at - self->payload > rdata_end) {
+            break;
+        }
+
+        /* HIP has any number of rendezvous servers until the end of rdata,
+         * names missing from empty rdata (dynamic updates) are allowed. */
+        rdata_names = rr->type == CORE_OBJECT_DNS_TYPE_HIP ? SIZE_MAX : _rdata_labels(rr->type);
+        while (rdata_names && self->at - self->payload < rdata_end) {
+            size_t index;
+
+            if ((ret = _decode_name(self, msg, base, &index))) {
+                return ret;
+            }
+            rr->rdata_names++;
+            rdata_names--;
+        }
+        if (self->at - self->payload > rdata_end) {
+            break;
+        }
+
+        /* Skip the rest of the rdata. */
+        self->left -= self->payload + rdata_end - self->at;
+        self->at   = self->payload + rdata_end;
+        rr->length = rdata_end - rr->offset;
+        msg->rrs++;
+        return 0;
+    }
+
+    // TODO: error here on malformed/truncated? could be quite spammy
+    return _ERR_MALFORMED;
+}
+
+int core_object_dns_decode(core_object_dns_t* self, core_object_dns_msg_t* msg)
+{
+    const uint8_t* base;
+    size_t         n;
+    int            ret;
+    mlassert_self();
+    mlassert(msg, "msg is nil");
+
+    msg->rrs        = 0;
+    msg->names      = 0;
+    msg->arena_used = 0;
+
+    if ((ret = core_object_dns_parse_header(self))) {
+        return ret;
+    }
+    /* Compression pointers are relative to the start of the DNS message. */
+    base = self->at - 12;
+
+    for (n = 0; n < self->qdcount; n++) {
+        if ((ret = _decode_rr(self, msg, base, CORE_OBJECT_DNS_SECTION_QUESTION))) {
+            return ret;
+        }
+    }
+    for (n = 0; n < self->ancount; n++) {
+        if ((ret = _decode_rr(self, msg, base, CORE_OBJECT_DNS_SECTION_ANSWER))) {
+            return ret;
+        }
+    }
+    for (n = 0; n < self->nscount; n++) {
+        if ((ret = _decode_rr(self, msg, base, CORE_OBJECT_DNS_SECTION_AUTHORITY))) {
+            return ret;
+        }
+    }
+    for (n = 0; n < self->arcount; n++) {
+        if ((ret = _decode_rr(self, msg, base, CORE_OBJECT_DNS_SECTION_ADDITIONAL))) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+size_t core_object_dns_msg_name_tostr(const core_object_dns_msg_t* self, size_t name, char* buf, size_t size)
+{
+    const uint8_t* label;
+    const uint8_t* end;
+    size_t         len = 0;
+    mlassert_self();
+    mlassert(name < self->names, "name out of range");
+    mlassert(buf, "buf is nil");
+    mlassert(size, "size is zero");
+
+    label = &self->arena[self->name[name].offset];
+    end   = label + self->name[name].length;
+
+    if (*label == 0 && len + 1 < size) {
+        buf[len++] = '.';
+    }
+    for (; label < end && *label; label += 1 + *label) {
+        if (len + *label + 1 >= size) {
+            break;
+        }
+        memcpy(&buf[len], label + 1, *label);
+        len += *label;
+        buf[len++] = '.';
+    }
+    buf[len] = 0;
+
+    return len;
+}
+
+/*
+ * Find the layers of a DNS packet in the object chain, returns 0 if there
+ * is a non-empty payload over UDP or TCP over IP or IP6, -1 otherwise.
+ */
+int core_object_dns_layers(core_object_dns_layers_t* layers, const core_object_t* obj)
+{
+    mlassert(layers, "layers is nil");
+
+    layers->payload = 0;
+    layers->proto   = 0;
+    layers->ip      = 0;
+    layers->pcap    = 0;
+
+    for (; obj; obj = obj->obj_prev) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_PAYLOAD:
+            if (!layers->payload)
+                layers->payload = (const core_object_payload_t*)obj;
+            break;
+        case CORE_OBJECT_UDP:
+        case CORE_OBJECT_TCP:
+            if (!layers->proto)
+                layers->proto = obj;
+            break;
+        case CORE_OBJECT_IP:
+        case CORE_OBJECT_IP6:
+            if (!layers->ip)
+                layers->ip = obj;
+            break;
+        case CORE_OBJECT_PCAP:
+            if (!layers->pcap)
+                layers->pcap = (const core_object_pcap_t*)obj;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!layers->payload || !layers->proto || !layers->ip || !layers->payload->len)
+        return -1;
+    return 0;
+}
@@ -20,6 +20,8 @@
 
 #include "core/log.h"
 #include "core/object.h"
+#include "core/object/payload.h"
+#include "core/object/pcap.h"
 
 #ifndef __dnsjit_core_object_dns_h
 #define __dnsjit_core_object_dns_h
@@ -181,4 +183,18 @@
 #define CORE_OBJECT_DNS_EDNS0_OPT_CHAIN 13
 #define CORE_OBJECT_DNS_EDNS0_OPT_DEVICEID 26946
 
+/*
+ * The objects of a DNS packet, the first of each kind found walking the
+ * object chain backwards: the payload, the UDP or TCP object, the IP or IP6
+ * object and the PCAP object (if any).
+ */
+typedef struct core_object_dns_layers {
+    const core_object_payload_t* payload;
+    const core_object_t*         proto;
+    const core_object_t*         ip;
+    const core_object_pcap_t*    pcap;
+} core_object_dns_layers_t;
+
+int core_object_dns_layers(core_object_dns_layers_t* layers, const core_object_t* obj);
+
 #endif
@@ -107,6 +107,58 @@ typedef struct core_object_dns {
     uint16_t arcount;
 } core_object_dns_t;
 
+typedef enum core_object_dns_section {
+    CORE_OBJECT_DNS_SECTION_QUESTION   = 0,
+    CORE_OBJECT_DNS_SECTION_ANSWER     = 1,
+    CORE_OBJECT_DNS_SECTION_AUTHORITY  = 2,
+    CORE_OBJECT_DNS_SECTION_ADDITIONAL = 3
+} core_object_dns_section_t;
+
+typedef struct core_object_dns_name {
+    /* Offset and length of the uncompressed wire-format name in the arena,
+     * the length includes the root label. */
+    size_t offset;
+    size_t length;
+
+    /* Number of labels, excluding the root label. */
+    size_t labels;
+} core_object_dns_name_t;
+
+typedef struct core_object_dns_msg_rr {
+    core_object_dns_section_t section;
+
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t rdlength;
+
+    /* Offset and length of the whole record and the offset of the rdata
+     * within the payload, rdata_offset is 0 for questions. */
+    size_t offset;
+    size_t length;
+    size_t rdata_offset;
+
+    /* Index of the owner name and of the first of rdata_names names within
+     * the rdata in the names of the message. */
+    size_t name;
+    size_t rdata_name;
+    size_t rdata_names;
+} core_object_dns_msg_rr_t;
+
+typedef struct core_object_dns_msg {
+    core_object_dns_msg_rr_t* rr;
+    size_t                    rrs;
+    size_t                    max_rrs;
+
+    core_object_dns_name_t* name;
+    size_t                  names;
+    size_t                  max_names;
+
+    uint8_t* arena;
+    size_t   arena_used;
+    size_t   arena_size;
+} core_object_dns_msg_t;
+
 core_log_t* core_object_dns_log();
 
 core_object_dns_t* core_object_dns_new();
@@ -117,3 +169,8 @@ void core_object_dns_reset(core_object_dns_t* self, const core_object_t* obj);
 int core_object_dns_parse_header(core_object_dns_t* self);
 int core_object_dns_parse_q(core_object_dns_t* self, core_object_dns_q_t* q, core_object_dns_label_t* label, size_t labels);
 int core_object_dns_parse_rr(core_object_dns_t* self, core_object_dns_rr_t* rr, core_object_dns_label_t* label, size_t labels);
+
+core_object_dns_msg_t* core_object_dns_msg_new(size_t max_rrs, size_t max_names, size_t arena_size);
+void core_object_dns_msg_free(core_object_dns_msg_t* self);
+int core_object_dns_decode(core_object_dns_t* self, core_object_dns_msg_t* msg);
+size_t core_object_dns_msg_name_tostr(const core_object_dns_msg_t* self, size_t name, char* buf, size_t size);
@@ -39,6 +39,14 @@
 --       ...
 --     end
 --   end
+-- .SS Decode a whole DNS message in one pass
+--   local dns = require("dnsjit.core.object.dns").new(payload)
+--   local msg = require("dnsjit.core.object.dns.msg").new()
+--   if dns:decode(msg) == 0 then
+--     for n = 0, tonumber(msg.rrs) - 1 do
+--       print(msg.rr[n].type, msg:name(msg.rr[n].name))
+--     end
+--   end
 --
 -- The object that describes a DNS message.
 -- .SS Attributes
@@ -555,6 +563,20 @@ function Dns:parse_rr(rr, labels, num_labels)
     return C.core_object_dns_parse_rr(self, rr, labels, num_labels)
 end
 
+-- Parse the header and decode all questions and resource records of the
+-- underlaying object into the given
+-- .I msg
+-- (see dnsjit.core.object.dns.msg), resolving all compression pointers.
+-- This is done in C in one pass without allocations and is much faster than
+-- .IR parse ().
+-- Returns 0 on success or negative integer on error which can be for
+-- malformed or truncated DNS (-2) or if more space in
+-- .I msg
+-- is needed (-3).
+function Dns:decode(msg)
+    return C.core_object_dns_decode(self, msg)
+end
+
 -- Begin parsing the underlaying object using
 -- .IR parse_header "(), "
 -- .IR parse_q ()
@@ -792,6 +814,8 @@ core_object_dns_t = ffi.metatype(t_name, { __index = Dns })
 -- dnsjit.core.object (3),
 -- dnsjit.core.object.payload (3),
 -- dnsjit.core.object.dns.label (3),
+-- dnsjit.core.object.dns.msg (3),
+-- dnsjit.core.object.dns.name (3),
 -- dnsjit.core.object.dns.q (3),
 -- dnsjit.core.object.dns.rr (3)
 return Dns
@@ -0,0 +1,118 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.core.object.dns.msg
+-- Container of a fully decoded DNS message
+--   local dns = require("dnsjit.core.object.dns").new(payload)
+--   local msg = require("dnsjit.core.object.dns.msg").new()
+--   if dns:decode(msg) == 0 then
+--     for n = 0, tonumber(msg.rrs) - 1 do
+--       local rr = msg.rr[n]
+--       print(rr.section, rr.type, msg:name(rr.name))
+--     end
+--   end
+--
+-- The object that holds the result of decoding a whole DNS message with
+-- .IR dnsjit.core.object.dns:decode() .
+-- All questions and resource records are decoded in one pass and all
+-- domain names, including the ones within rdata, have their compression
+-- pointers resolved into a flat arena of uncompressed wire-format names.
+-- The storage is preallocated and reused for each decoded message.
+-- .SS Attributes
+-- .TP
+-- rr, rrs
+-- Array of
+-- .I rrs
+-- decoded questions and resource records (core_object_dns_msg_rr_t) in the
+-- order they appear in the message.
+-- Each has a
+-- .I section
+-- (0 question, 1 answer, 2 authority, 3 additional),
+-- .IR type ", " class ", " ttl " and " rdlength ,
+-- the
+-- .IR offset " and " length
+-- of the record and the
+-- .I rdata_offset
+-- within the payload,
+-- the index of the owner
+-- .I name
+-- and
+-- .I rdata_names
+-- names found within the rdata starting at index
+-- .IR rdata_name .
+-- .TP
+-- name, names
+-- Array of
+-- .I names
+-- decoded names (core_object_dns_name_t) with the
+-- .IR offset " and " length
+-- (including the root label) of the name in the arena and the number of
+-- .IR labels .
+-- .TP
+-- arena, arena_used
+-- The uncompressed wire-format names.
+module(...,package.seeall)
+
+require("dnsjit.core.object.dns_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local t_name = "core_object_dns_msg_t"
+local core_object_dns_msg_t
+local Msg = {
+    SECTION = {
+        QUESTION = 0,
+        ANSWER = 1,
+        AUTHORITY = 2,
+        ADDITIONAL = 3,
+    },
+}
+
+-- Create a new decoded message container with room for
+-- .I max_rrs
+-- questions and resource records (default 256),
+-- .I max_names
+-- names (default 512) and an arena of
+-- .I arena_size
+-- bytes for the names (default 32768).
+function Msg.new(max_rrs, max_names, arena_size)
+    local self = C.core_object_dns_msg_new(max_rrs or 256, max_names or 512, arena_size or 32768)
+    ffi.gc(self, C.core_object_dns_msg_free)
+    return self
+end
+
+local _buf = ffi.new("char[?]", 1024)
+
+-- Return the name at the given index (starting from 0) as a string in
+-- presentation format.
+function Msg:name(index)
+    local len = C.core_object_dns_msg_name_tostr(self, index, _buf, 1024)
+    return ffi.string(_buf, len)
+end
+
+-- Return the name at the given index (starting from 0) as a string in
+-- uncompressed wire format.
+function Msg:wire_name(index)
+    local name = self.name[index]
+    return ffi.string(self.arena + name.offset, name.length)
+end
+
+core_object_dns_msg_t = ffi.metatype(t_name, { __index = Msg })
+
+-- dnsjit.core.object.dns (3)
+return Msg
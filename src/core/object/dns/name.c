@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "core/object/dns/name.h"
+
+#include <string.h>
+
+/*
+ * The vector kernels are selected at compile time, see --enable-cpuext.
+ * Label length bytes are at most 63 and never in the range of upper case
+ * letters so the whole wire-format name can be lowercased byte by byte.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define _IMPL "avx2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define _IMPL "sse2"
+#else
+#define _IMPL "scalar"
+#endif
+
+const char* core_object_dns_name_impl()
+{
+    return _IMPL;
+}
+
+static inline uint8_t _lower(uint8_t c)
+{
+    return (uint8_t)(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+#ifdef __SSE2__
+static inline __m128i _lower16(__m128i x)
+{
+    /* Move 'A'..'Z' to the lowest signed values to check with one compare. */
+    __m128i t = _mm_add_epi8(x, _mm_set1_epi8((char)(0x80 - 'A')));
+    __m128i m = _mm_cmplt_epi8(t, _mm_set1_epi8((char)(0x80 + 26)));
+    return _mm_or_si128(x, _mm_and_si128(m, _mm_set1_epi8(0x20)));
+}
+#endif
+
+#ifdef __AVX2__
+static inline __m256i _lower32(__m256i x)
+{
+    __m256i t = _mm256_add_epi8(x, _mm256_set1_epi8((char)(0x80 - 'A')));
+    __m256i m = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 26)), t);
+    return _mm256_or_si256(x, _mm256_and_si256(m, _mm256_set1_epi8(0x20)));
+}
+#endif
+
+void core_object_dns_name_lower(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __AVX2__
+    for (; i + 32 <= len; i += 32) {
+        _mm256_storeu_si256((__m256i*)(dst + i), _lower32(_mm256_loadu_si256((const __m256i*)(src + i))));
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        _mm_storeu_si128((__m128i*)(dst + i), _lower16(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] = _lower(src[i]);
+    }
+}
+
+int core_object_dns_name_cmp(const uint8_t* a, size_t alen, const uint8_t* b, size_t blen)
+{
+    size_t   n = alen < blen ? alen : blen;
+    size_t   i = 0;
+    uint32_t mask;
+
+#ifdef __AVX2__
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _lower32(_mm256_loadu_si256((const __m256i*)(a + i)));
+        __m256i y = _lower32(_mm256_loadu_si256((const __m256i*)(b + i)));
+        if ((mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)))) {
+            i += __builtin_ctz(mask);
+            return (int)_lower(a[i]) - (int)_lower(b[i]);
+        }
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _lower16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m128i y = _lower16(_mm_loadu_si128((const __m128i*)(b + i)));
+        if ((mask = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff)) {
+            i += __builtin_ctz(mask);
+            return (int)_lower(a[i]) - (int)_lower(b[i]);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (_lower(a[i]) != _lower(b[i])) {
+            return (int)_lower(a[i]) - (int)_lower(b[i]);
+        }
+    }
+    (void)mask;
+
+    return alen < blen ? -1 : alen > blen;
+}
+
+int core_object_dns_name_equal(const uint8_t* a, size_t alen, const uint8_t* b, size_t blen)
+{
+    return alen == blen && !core_object_dns_name_cmp(a, alen, b, blen);
+}
+
+size_t core_object_dns_name_copy_lower(uint8_t* dst, const uint8_t* at, size_t left)
+{
+    size_t  len = 0;
+    uint8_t label;
+
+    while (len < left) {
+        label = at[len];
+        if ((label & 0xc0) || len + 1 + label > 255 || len + 1 + label > left)
+            return 0;
+        len += 1 + label;
+        if (!label) {
+            core_object_dns_name_lower(dst, at, len);
+            return len;
+        }
+    }
+    return 0;
+}
+
+size_t core_object_dns_name_labels(const uint8_t* name, size_t len)
+{
+    size_t off = 0, labels = 0;
+
+    while (off < len && name[off]) {
+        off += 1 + name[off];
+        labels++;
+    }
+    return labels;
+}
+
+/*
+ * Return the offset of the name made of the last given number of labels
+ * (i.e. the zone cut at that depth), or -1 if the name has fewer labels.
+ */
+ssize_t core_object_dns_name_suffix(const uint8_t* name, size_t len, size_t labels)
+{
+    size_t total = core_object_dns_name_labels(name, len), off = 0;
+
+    if (labels > total) {
+        return -1;
+    }
+    for (; total > labels; total--) {
+        off += 1 + name[off];
+    }
+    return off;
+}
+
+int core_object_dns_name_is_subdomain(const uint8_t* name, size_t len, const uint8_t* zone, size_t zlen)
+{
+    size_t off = 0;
+
+    /* Skip labels until the rest is as long as the zone, it must end on a
+     * label boundary. */
+    while (len - off > zlen) {
+        if (!name[off]) {
+            return 0;
+        }
+        off += 1 + name[off];
+        if (off >= len) {
+            return 0;
+        }
+    }
+    return len - off == zlen && !core_object_dns_name_cmp(name + off, zlen, zone, zlen);
+}
+
+/*
+ * Lowercase 8 ASCII bytes at once.
+ */
+static inline uint64_t _lower64(uint64_t w)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t       h    = w & (0x7f * ones);
+    uint64_t       ge_a = h + (0x80 - 'A') * ones;
+    uint64_t       gt_z = h + (0x7f - 'Z') * ones;
+
+    return w | (((ge_a ^ gt_z) & ~w & (0x80 * ones)) >> 2);
+}
+
+static inline uint64_t _mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Case-insensitive 64-bit hash, works on 8 bytes at a time and gives the
+ * same result regardless of the vector kernels used.
+ */
+uint64_t core_object_dns_name_hash(const uint8_t* name, size_t len, uint64_t seed)
+{
+    uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL), w;
+    size_t   i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, name + i, 8);
+        h = (h ^ _lower64(w)) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    if (i < len) {
+        w = 0;
+        memcpy(&w, name + i, len - i);
+        h = (h ^ _lower64(w)) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    return _mix(h);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __dnsjit_core_object_dns_name_h
+#define __dnsjit_core_object_dns_name_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "core/object/dns/name.hh"
+
+/*
+ * Copy the uncompressed name at the start of at (e.g. the QNAME of a
+ * question) lowercased to dst, which must hold 255 bytes. Returns the
+ * length of the name or 0 if it is compressed, longer than 255 bytes or
+ * runs past left bytes.
+ */
+size_t core_object_dns_name_copy_lower(uint8_t* dst, const uint8_t* at, size_t left);
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Functions working on uncompressed wire-format domain names (length
+ * prefixed labels ending with the root label, see
+ * core_object_dns_msg_t), all comparisons are ASCII case-insensitive.
+ */
+
+const char* core_object_dns_name_impl();
+
+void core_object_dns_name_lower(uint8_t* dst, const uint8_t* src, size_t len);
+int core_object_dns_name_cmp(const uint8_t* a, size_t alen, const uint8_t* b, size_t blen);
+int core_object_dns_name_equal(const uint8_t* a, size_t alen, const uint8_t* b, size_t blen);
+size_t core_object_dns_name_labels(const uint8_t* name, size_t len);
+ssize_t core_object_dns_name_suffix(const uint8_t* name, size_t len, size_t labels);
+int core_object_dns_name_is_subdomain(const uint8_t* name, size_t len, const uint8_t* zone, size_t zlen);
+uint64_t core_object_dns_name_hash(const uint8_t* name, size_t len, uint64_t seed);
@@ -0,0 +1,113 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.core.object.dns.name
+-- Fast functions for wire-format domain names
+--   local name = require("dnsjit.core.object.dns.name")
+--   local zone = name.wire("example.com.")
+--   if dns:decode(msg) == 0 then
+--     local n = msg.name[msg.rr[0].name]
+--     local ptr = msg.arena + n.offset
+--     if name.is_subdomain(ptr, n.length, zone) then
+--       print(name.hash(ptr, n.length))
+--     end
+--   end
+--
+-- Case-insensitive lowercasing, comparison, suffix (zone cut) matching and
+-- 64-bit hashing of uncompressed wire-format domain names, as found in the
+-- arena of dnsjit.core.object.dns.msg.
+-- The C functions use SSE2 or AVX2 when enabled at compile time (see
+-- .IR --enable-cpuext )
+-- with a scalar fallback and can be used directly by C modules.
+-- .P
+-- Arguments are in the same order as for the C functions, each name is
+-- followed by its length which may be nil if the name is a Lua string.
+-- The hash is the same regardless of the vector kernels used.
+module(...,package.seeall)
+
+require("dnsjit.core.object.dns.name_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Name = {}
+
+-- Return the name of the kernels in use: avx2, sse2 or scalar.
+function Name.impl()
+    return ffi.string(C.core_object_dns_name_impl())
+end
+
+-- Convert a domain name in presentation format (without escapes) to wire
+-- format, the root is assumed if the trailing dot is missing.
+function Name.wire(str)
+    local parts = {}
+    for label in string.gmatch(str, "[^.]+") do
+        table.insert(parts, string.char(#label) .. label)
+    end
+    table.insert(parts, "\0")
+    return table.concat(parts)
+end
+
+-- Return the name lowercased, as a Lua string.
+function Name.lower(name, len)
+    len = len or #name
+    local buf = ffi.new("uint8_t[?]", len)
+    C.core_object_dns_name_lower(buf, name, len)
+    return ffi.string(buf, len)
+end
+
+-- Compare two names, returns 0 if equal or a negative or positive integer
+-- for ordering (by lowercased bytes, not the canonical DNS order).
+function Name.cmp(a, alen, b, blen)
+    return C.core_object_dns_name_cmp(a, alen or #a, b, blen or #b)
+end
+
+-- Return true if the names are equal.
+function Name.equal(a, alen, b, blen)
+    return C.core_object_dns_name_equal(a, alen or #a, b, blen or #b) == 1
+end
+
+-- Return the number of labels of the name, excluding the root.
+function Name.labels(name, len)
+    return tonumber(C.core_object_dns_name_labels(name, len or #name))
+end
+
+-- Return the offset of the last
+-- .I labels
+-- labels of the name (its zone cut at that depth) or nil if the name has
+-- fewer labels.
+function Name.suffix(name, len, labels)
+    local off = C.core_object_dns_name_suffix(name, len or #name, labels)
+    if off < 0 then
+        return
+    end
+    return tonumber(off)
+end
+
+-- Return true if the name is equal to or below the zone, the zone must be a
+-- Lua string in wire format.
+function Name.is_subdomain(name, len, zone)
+    return C.core_object_dns_name_is_subdomain(name, len or #name, zone, #zone) == 1
+end
+
+-- Return the 64-bit hash (uint64_t) of the name, with optional seed.
+function Name.hash(name, len, seed)
+    return C.core_object_dns_name_hash(name, len or #name, seed or 0)
+end
+
+-- dnsjit.core.object.dns.msg (3)
+return Name
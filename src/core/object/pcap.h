@@ -32,7 +32,7 @@
         ,                                        \
             0, 0,                                \
             { 0, 0 }, 0, 0, 0,                   \
-            0                                    \
+            0, 0                                 \
     }
 
 #endif
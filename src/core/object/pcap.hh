@@ -32,6 +32,10 @@ typedef struct core_object_pcap {
     const unsigned char* bytes;
 
     uint8_t is_swapped;
+
+    /* Index of the input the packet came from when merged by input.merge
+     * with tagging enabled, otherwise 0. */
+    uint32_t source;
 } core_object_pcap_t;
 
 core_object_pcap_t* core_object_pcap_copy(const core_object_pcap_t* self);
@@ -47,6 +47,11 @@
 -- Indicate if the byte order of the PCAP is different then the host.
 -- This is used in, for example, the Layer filter to correctly parse null
 -- objects since they are stored in the capturers host byte order.
+-- .TP
+-- source
+-- Index of the input the packet was read from, set by
+-- .I dnsjit.input.merge
+-- when tagging is enabled.
 module(...,package.seeall)
 
 require("dnsjit.core.object.pcap_h")
@@ -93,6 +98,7 @@ core_object_pcap_t = ffi.metatype(t_name, { __index = Pcap })
 -- dnsjit.input.pcap (3),
 -- dnsjit.input.fpcap (3),
 -- dnsjit.input.mmpcap (3),
+-- dnsjit.input.merge (3),
 -- dnsjit.filter.layer (3),
 -- dnsjit.output.pcap (3)
 return Pcap
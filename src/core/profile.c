@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "core/profile.h"
+#include "core/assert.h"
+#include "lib/histogram.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static core_log_t           _log      = LOG_T_INIT("core.profile");
+static core_profile_stage_t _defaults = {
+    LOG_T_INIT_OBJ("core.profile"),
+    0, 0, 0, 0,
+    0
+};
+
+/*
+ * Timing is done with the TSC where available (cycles) and with the
+ * monotonic clock (nanoseconds) elsewhere.
+ * Only every Nth packet is timed, the decision is made by the outermost
+ * stage of the thread so that a timed packet is timed through all the
+ * nested stages it passes and the time of a stage can be split into the
+ * time spent in the nested stages and in the stage itself (self).
+ */
+
+#define PROFILE_NAME 64
+#define PROFILE_CALIBRATE_NS 10000000
+
+struct core_profile_record {
+    core_profile_record_t*       next;
+    char                         name[PROFILE_NAME];
+    const core_profile_record_t* parent;
+
+    uint64_t         packets;
+    uint64_t         sampled;
+    uint64_t         cycles;
+    uint64_t         self_cycles;
+    lib_histogram_t* histogram;
+};
+
+static uint64_t               _sample  = 0;
+static double                 _cpns    = 1.0;
+static uint64_t               _started = 0;
+static core_profile_record_t* _records = 0;
+static core_profile_record_t** _last   = &_records;
+static pthread_mutex_t        _lock    = PTHREAD_MUTEX_INITIALIZER;
+static char*                  _report_path = 0;
+static char*                  _folded_path = 0;
+static int                    _at_exit     = 0;
+
+static __thread size_t                 _depth    = 0;
+static __thread int                    _sampling = 0;
+static __thread uint64_t               _tick     = 0;
+static __thread uint64_t               _nested   = 0;
+static __thread core_profile_record_t* _current  = 0;
+
+static inline uint64_t _cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static uint64_t _ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+core_log_t* core_profile_log()
+{
+    return &_log;
+}
+
+void core_profile_enable(uint64_t sample)
+{
+    if (sample && !_started) {
+#if defined(__x86_64__) || defined(__i386__)
+        struct timespec ts = { 0, PROFILE_CALIBRATE_NS };
+        uint64_t        ns, c;
+
+        ns = _ns();
+        c  = _cycles();
+        nanosleep(&ts, 0);
+        c  = _cycles() - c;
+        ns = _ns() - ns;
+        if (ns) {
+            _cpns = (double)c / ns;
+        }
+#endif
+        _started = _cycles();
+        mldebug("sampling 1/%lu, %.3f cycles/ns", (unsigned long)sample, _cpns);
+    }
+    _sample = sample;
+}
+
+uint64_t core_profile_sample()
+{
+    return _sample;
+}
+
+double core_profile_cycles_per_ns()
+{
+    return _cpns;
+}
+
+void core_profile_stage_init(core_profile_stage_t* self, const char* name)
+{
+    core_profile_record_t* rec;
+
+    mlassert_self();
+    mlassert(name, "name is nil");
+
+    *self = _defaults;
+
+    lfatal_oom(rec = calloc(1, sizeof(core_profile_record_t)));
+    strncpy(rec->name, name, sizeof(rec->name) - 1);
+    lfatal_oom(rec->histogram = lib_histogram_new(10, 100000000000ULL, 2));
+    self->record = rec;
+
+    pthread_mutex_lock(&_lock);
+    *_last = rec;
+    _last  = &rec->next;
+    pthread_mutex_unlock(&_lock);
+
+    ldebug("init() %s", name);
+}
+
+void core_profile_stage_destroy(core_profile_stage_t* self)
+{
+    mlassert_self();
+
+    /* the record is kept for the report */
+    self->record = 0;
+}
+
+uint64_t core_profile_stage_packets(const core_profile_stage_t* self)
+{
+    mlassert_self();
+    return self->record->packets;
+}
+
+uint64_t core_profile_stage_sampled(const core_profile_stage_t* self)
+{
+    mlassert_self();
+    return self->record->sampled;
+}
+
+uint64_t core_profile_stage_cycles(const core_profile_stage_t* self)
+{
+    mlassert_self();
+    return self->record->cycles;
+}
+
+uint64_t core_profile_stage_self_cycles(const core_profile_stage_t* self)
+{
+    mlassert_self();
+    return self->record->self_cycles;
+}
+
+uint64_t core_profile_stage_percentile(const core_profile_stage_t* self, double percentile)
+{
+    mlassert_self();
+    return lib_histogram_percentile(self->record->histogram, percentile);
+}
+
+/*
+ * Timing of a hop, the call is made through the macro so that the
+ * receiver and producer share the bookkeeping.
+ */
+
+static inline int _enter(void)
+{
+    if (!_depth++) {
+        _sampling = !(++_tick % _sample);
+    }
+    return _sampling;
+}
+
+static inline void _timed(core_profile_record_t* rec, core_profile_record_t* parent, uint64_t nested, uint64_t elapsed)
+{
+    rec->sampled++;
+    rec->cycles += elapsed;
+    rec->self_cycles += elapsed - _nested;
+    lib_histogram_record(rec->histogram, elapsed);
+    if (!rec->parent) {
+        rec->parent = parent;
+    }
+
+    _current = parent;
+    _nested  = nested + elapsed;
+}
+
+static void _receive(core_profile_stage_t* self, const core_object_t* obj)
+{
+    core_profile_record_t *rec = self->record, *parent;
+    uint64_t               nested, start;
+
+    rec->packets++;
+    if (!_sample) {
+        self->recv(self->recv_ctx, obj);
+        return;
+    }
+    if (!_enter()) {
+        self->recv(self->recv_ctx, obj);
+        _depth--;
+        return;
+    }
+
+    parent   = _current;
+    nested   = _nested;
+    _current = rec;
+    _nested  = 0;
+    start    = _cycles();
+    self->recv(self->recv_ctx, obj);
+    _timed(rec, parent, nested, _cycles() - start);
+    _depth--;
+}
+
+core_receiver_t core_profile_stage_receiver()
+{
+    return (core_receiver_t)_receive;
+}
+
+static const core_object_t* _produce(core_profile_stage_t* self)
+{
+    core_profile_record_t *rec = self->record, *parent;
+    const core_object_t*   obj;
+    uint64_t               nested, start, elapsed;
+
+    if (!_sample) {
+        if ((obj = self->prod(self->prod_ctx))) {
+            rec->packets++;
+        }
+        return obj;
+    }
+    if (!_enter()) {
+        if ((obj = self->prod(self->prod_ctx))) {
+            rec->packets++;
+        }
+        _depth--;
+        return obj;
+    }
+
+    parent   = _current;
+    nested   = _nested;
+    _current = rec;
+    _nested  = 0;
+    start    = _cycles();
+    obj      = self->prod(self->prod_ctx);
+    elapsed  = _cycles() - start;
+    if (obj) {
+        rec->packets++;
+        _timed(rec, parent, nested, elapsed);
+    } else {
+        /* not a packet, the time is left to the caller */
+        _current = parent;
+        _nested  = nested;
+    }
+    _depth--;
+
+    return obj;
+}
+
+core_producer_t core_profile_stage_producer()
+{
+    return (core_producer_t)_produce;
+}
+
+/*
+ * Reports
+ */
+
+static size_t _path(const core_profile_record_t* rec, char* buf, size_t size)
+{
+    size_t len = 0, n;
+
+    if (rec->parent) {
+        len = _path(rec->parent, buf, size);
+        if (len + 1 < size) {
+            buf[len++] = ';';
+        }
+    }
+    n = strlen(rec->name);
+    if (len + n >= size) {
+        n = size - len - 1;
+    }
+    memcpy(buf + len, rec->name, n);
+    len += n;
+    buf[len] = 0;
+
+    return len;
+}
+
+static FILE* _open(const char* path)
+{
+    FILE* fp;
+
+    if (!path || !*path || !strcmp(path, "-")) {
+        return stdout;
+    }
+    if (!(fp = fopen(path, "w"))) {
+        mlcritical("fopen(%s) error: %s", path, core_log_errstr(errno));
+    }
+    return fp;
+}
+
+static int _close(FILE* fp, const char* path)
+{
+    if (fp == stdout) {
+        fflush(fp);
+        return 0;
+    }
+    if (fclose(fp)) {
+        mlcritical("fclose(%s) error: %s", path, core_log_errstr(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int core_profile_report(const char* path)
+{
+    const core_profile_record_t* rec;
+    FILE*                        fp;
+    char                         name[256];
+    uint64_t                     elapsed;
+
+    if (!(fp = _open(path))) {
+        return -1;
+    }
+
+    elapsed = _started ? _cycles() - _started : 0;
+    fprintf(fp, "profile: 1/%lu packets timed, %.3f cycles/ns, %.3f s elapsed\n",
+        (unsigned long)_sample, _cpns, elapsed / _cpns / 1e9);
+    fprintf(fp, "%-32s %12s %10s %10s %10s %10s %10s %7s %7s\n",
+        "stage", "packets", "sampled", "mean", "p50", "p99", "self", "total%", "self%");
+
+    pthread_mutex_lock(&_lock);
+    for (rec = _records; rec; rec = rec->next) {
+        /* sampled cycles are scaled up to an estimate for all packets */
+        double scale = rec->sampled ? (double)rec->packets / rec->sampled : 0;
+
+        _path(rec, name, sizeof(name));
+        fprintf(fp, "%-32s %12lu %10lu %10.0f %10lu %10lu %10.0f %7.2f %7.2f\n",
+            name,
+            (unsigned long)rec->packets,
+            (unsigned long)rec->sampled,
+            rec->sampled ? (double)rec->cycles / rec->sampled : 0,
+            (unsigned long)lib_histogram_percentile(rec->histogram, 50),
+            (unsigned long)lib_histogram_percentile(rec->histogram, 99),
+            rec->sampled ? (double)rec->self_cycles / rec->sampled : 0,
+            elapsed ? 100.0 * rec->cycles * scale / elapsed : 0,
+            elapsed ? 100.0 * rec->self_cycles * scale / elapsed : 0);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return _close(fp, path);
+}
+
+int core_profile_folded(const char* path)
+{
+    const core_profile_record_t* rec;
+    FILE*                        fp;
+    char                         name[256];
+
+    if (!(fp = _open(path))) {
+        return -1;
+    }
+
+    /* one line per stage in the folded stack format of FlameGraph,
+     * weighted with the estimated self cycles for all packets */
+    pthread_mutex_lock(&_lock);
+    for (rec = _records; rec; rec = rec->next) {
+        if (!rec->sampled) {
+            continue;
+        }
+        _path(rec, name, sizeof(name));
+        fprintf(fp, "%s %.0f\n", name, (double)rec->self_cycles * rec->packets / rec->sampled);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return _close(fp, path);
+}
+
+static void _report_at_exit(void)
+{
+    if (_report_path) {
+        core_profile_report(_report_path);
+    }
+    if (_folded_path) {
+        core_profile_folded(_folded_path);
+    }
+}
+
+void core_profile_at_exit(const char* report, const char* folded)
+{
+    free(_report_path);
+    free(_folded_path);
+    _report_path = 0;
+    _folded_path = 0;
+    if (report) {
+        mlfatal_oom(_report_path = strdup(report));
+    }
+    if (folded) {
+        mlfatal_oom(_folded_path = strdup(folded));
+    }
+    if (!_at_exit) {
+        atexit(_report_at_exit);
+        _at_exit = 1;
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.core.producer_h")
+
+typedef struct core_profile_record core_profile_record_t;
+
+typedef struct core_profile_stage {
+    core_log_t _log;
+
+    core_receiver_t recv;
+    void*           recv_ctx;
+    core_producer_t prod;
+    void*           prod_ctx;
+
+    /* The statistics are kept in a record owned by the profiler so that
+     * they outlive the stage and can be reported at exit. */
+    core_profile_record_t* record;
+} core_profile_stage_t;
+
+core_log_t* core_profile_log();
+
+void core_profile_enable(uint64_t sample);
+uint64_t core_profile_sample();
+double core_profile_cycles_per_ns();
+
+void core_profile_stage_init(core_profile_stage_t* self, const char* name);
+void core_profile_stage_destroy(core_profile_stage_t* self);
+uint64_t core_profile_stage_packets(const core_profile_stage_t* self);
+uint64_t core_profile_stage_sampled(const core_profile_stage_t* self);
+uint64_t core_profile_stage_cycles(const core_profile_stage_t* self);
+uint64_t core_profile_stage_self_cycles(const core_profile_stage_t* self);
+uint64_t core_profile_stage_percentile(const core_profile_stage_t* self, double percentile);
+
+core_receiver_t core_profile_stage_receiver();
+core_producer_t core_profile_stage_producer();
+
+int core_profile_report(const char* path);
+int core_profile_folded(const char* path);
+void core_profile_at_exit(const char* report, const char* folded);
@@ -0,0 +1,173 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.core.profile
+-- Per-stage profiling of a processing pipeline
+--   local profile = require("dnsjit.core.profile")
+--   profile.enable(100)
+--   profile.at_exit()
+--   local input = require("dnsjit.input.mmpcap").new()
+--   local layer = require("dnsjit.filter.layer").new()
+--   local s_input = profile.stage("mmpcap")
+--   local s_layer = profile.stage("layer")
+--   s_input:producer(input)
+--   layer:producer(s_input)
+--   s_layer:producer(layer)
+--   local producer, ctx = s_layer:produce()
+--   ...
+--
+-- Profiling stages are pass-through receivers and producers placed between
+-- the modules of a pipeline, each measures the time spent in the module it
+-- passes objects to (as a receiver) or gets objects from (as a producer),
+-- including the stages nested within it.
+-- Time is measured in CPU cycles using the TSC on x86, or nanoseconds on
+-- other platforms, and only for 1 in N packets to keep the overhead low.
+-- The decision to time a packet is made by the outermost stage so a timed
+-- packet is timed in all stages it passes, which lets the time of a stage
+-- be split in time spent in nested stages and in the module itself (self).
+-- Time spent outside all stages, for example in Lua code between calls to
+-- a producer, shows up as the part of the elapsed time not covered by the
+-- outermost stages.
+-- .LP
+-- The report lists, for each stage by its path of nested stages, the number
+-- of packets, the number timed, the mean, median and 99th percentile cycles
+-- per timed packet including nested stages, the mean self cycles and the
+-- share of the elapsed time estimated for all packets.
+-- The folded report has one line per stage with its path and estimated self
+-- cycles, as used by
+-- .IR flamegraph.pl .
+-- .LP
+-- A stage must only be used by one thread, use one stage per thread (with
+-- the same name) to profile the same module in multiple threads.
+-- When profiling is not enabled stages only count packets.
+module(...,package.seeall)
+
+require("dnsjit.core.profile_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local t_name = "core_profile_stage_t"
+local core_profile_stage_t = ffi.typeof(t_name)
+local Profile = {}
+local Stage = {}
+
+-- Enable profiling, timing 1 in
+-- .I sample
+-- packets (default 100), 0 disables.
+function Profile.enable(sample)
+    C.core_profile_enable(sample or 100)
+end
+
+-- Return the number of CPU cycles per nanosecond as measured when enabled.
+function Profile.cycles_per_ns()
+    return C.core_profile_cycles_per_ns()
+end
+
+-- Create a new stage with the given
+-- .IR name .
+function Profile.stage(name)
+    local self = {
+        _receiver = nil,
+        _producer = nil,
+        obj = core_profile_stage_t(),
+    }
+    C.core_profile_stage_init(self.obj, name)
+    ffi.gc(self.obj, C.core_profile_stage_destroy)
+    return setmetatable(self, { __index = Stage })
+end
+
+-- Write the report to
+-- .I path
+-- or to stdout if not given, returns 0 on success.
+function Profile.report(path)
+    return C.core_profile_report(path)
+end
+
+-- Write the folded report to
+-- .I path
+-- or to stdout if not given, returns 0 on success.
+function Profile.folded(path)
+    return C.core_profile_folded(path)
+end
+
+-- Write the report to
+-- .I report
+-- (default stdout, "-") and optionally the folded report to
+-- .I folded
+-- at exit.
+function Profile.at_exit(report, folded)
+    C.core_profile_at_exit(report or "-", folded)
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Stage:log()
+    if self == nil then
+        return C.core_profile_log()
+    end
+    return self.obj._log
+end
+
+-- Return the C functions and context for receiving objects.
+function Stage:receive()
+    return C.core_profile_stage_receiver(), self.obj
+end
+
+-- Set the receiver to pass objects to.
+function Stage:receiver(o)
+    self.obj.recv, self.obj.recv_ctx = o:receive()
+    self._receiver = o
+end
+
+-- Return the C functions and context for producing objects.
+function Stage:produce()
+    return C.core_profile_stage_producer(), self.obj
+end
+
+-- Set the producer to get objects from.
+function Stage:producer(o)
+    self.obj.prod, self.obj.prod_ctx = o:produce()
+    self._producer = o
+end
+
+-- Return the number of packets passed through the stage.
+function Stage:packets()
+    return tonumber(C.core_profile_stage_packets(self.obj))
+end
+
+-- Return the number of packets timed.
+function Stage:sampled()
+    return tonumber(C.core_profile_stage_sampled(self.obj))
+end
+
+-- Return the total cycles of the timed packets, including nested stages.
+function Stage:cycles()
+    return tonumber(C.core_profile_stage_cycles(self.obj))
+end
+
+-- Return the total cycles of the timed packets, excluding nested stages.
+function Stage:self_cycles()
+    return tonumber(C.core_profile_stage_self_cycles(self.obj))
+end
+
+-- Return the cycles per timed packet at the given percentile (0 to 100).
+function Stage:percentile(percentile)
+    return tonumber(C.core_profile_stage_percentile(self.obj, percentile))
+end
+
+-- dnsjit.core.metrics (3)
+return Profile
@@ -24,8 +24,11 @@
 module(...,package.seeall)
 
 -- dnsjit.filter.copy (3),
+-- dnsjit.filter.hll (3),
 -- dnsjit.filter.ipsplit (3),
 -- dnsjit.filter.layer (3),
+-- dnsjit.filter.qrmatch (3),
 -- dnsjit.filter.split (3),
--- dnsjit.filter.timing (3)
+-- dnsjit.filter.timing (3),
+-- dnsjit.filter.topk (3)
 return
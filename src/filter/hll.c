@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "filter/hll.h"
+#include "core/assert.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _SETS 3
+
+typedef struct _filter_hll {
+    filter_hll_t pub;
+
+    /* HyperLogLog registers of all fields, for the current interval, the
+     * last completed interval and in total. */
+    uint8_t* set[_SETS];
+    size_t   m;
+    int      started;
+} _filter_hll_t;
+
+/*
+ * Saved state: header followed by the total registers of all fields.
+ */
+#define _STATE_MAGIC "DJHLLREG"
+#define _STATE_VERSION 1
+
+typedef struct _state_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t precision;
+    uint32_t fields;
+    uint32_t _pad;
+} _state_header_t;
+
+#define _self ((_filter_hll_t*)self)
+
+static core_log_t   _log      = LOG_T_INIT("filter.hll");
+static filter_hll_t _defaults = {
+    LOG_T_INIT_OBJ("filter.hll"),
+    0, 0,
+    0,
+    (1 << FILTER_HLL_FIELDS) - 1,
+    24, 48,
+    0, 0, 0, 0,
+    0, 0
+};
+
+core_log_t* filter_hll_log()
+{
+    return &_log;
+}
+
+filter_hll_t* filter_hll_new(size_t precision)
+{
+    filter_hll_t* self;
+    int           i;
+
+    mlassert(precision >= 4 && precision <= 18, "precision must be between 4 and 18");
+
+    mlfatal_oom(self = malloc(sizeof(_filter_hll_t)));
+    *self           = _defaults;
+    self->precision = precision;
+    _self->m        = (size_t)1 << precision;
+    _self->started  = 0;
+
+    for (i = 0; i < _SETS; i++) {
+        lfatal_oom(_self->set[i] = calloc(FILTER_HLL_FIELDS, _self->m));
+    }
+
+    return self;
+}
+
+void filter_hll_free(filter_hll_t* self)
+{
+    int i;
+    mlassert_self();
+
+    for (i = 0; i < _SETS; i++)
+        free(_self->set[i]);
+    free(self);
+}
+
+void filter_hll_reset(filter_hll_t* self)
+{
+    int i;
+    mlassert_self();
+
+    for (i = 0; i < _SETS; i++)
+        memset(_self->set[i], 0, FILTER_HLL_FIELDS * _self->m);
+    _self->started      = 0;
+    self->current_start = 0;
+    self->last_start    = 0;
+    self->intervals     = 0;
+    self->queries       = 0;
+    self->discarded     = 0;
+}
+
+void filter_hll_rollover(filter_hll_t* self)
+{
+    uint8_t* last;
+    mlassert_self();
+
+    last                           = _self->set[FILTER_HLL_LAST];
+    _self->set[FILTER_HLL_LAST]    = _self->set[FILTER_HLL_CURRENT];
+    _self->set[FILTER_HLL_CURRENT] = last;
+    memset(last, 0, FILTER_HLL_FIELDS * _self->m);
+
+    self->last_start = self->current_start;
+    self->intervals++;
+}
+
+static inline uint64_t _fmix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Hash the first prefix bits of an address, the length is mixed in so
+ * that IPv4 and IPv6 addresses never share a hash by construction.
+ */
+static uint64_t _addr_hash(const uint8_t* addr, size_t len, size_t prefix)
+{
+    uint8_t  buf[16] = { 0 };
+    uint64_t a, b;
+
+    if (prefix > len * 8)
+        prefix = len * 8;
+    memcpy(buf, addr, prefix / 8);
+    if (prefix % 8)
+        buf[prefix / 8] = addr[prefix / 8] & (0xff << (8 - prefix % 8));
+
+    memcpy(&a, buf, 8);
+    memcpy(&b, buf + 8, 8);
+    return _fmix(a ^ _fmix(b ^ ((uint64_t)len << 56 | prefix)));
+}
+
+static inline void _add(filter_hll_t* self, filter_hll_field_t field, uint64_t hash)
+{
+    size_t   p   = self->precision;
+    size_t   idx = field * _self->m + (hash >> (64 - p));
+    uint8_t  rho = __builtin_clzll(hash << p | (uint64_t)1 << (p - 1)) + 1;
+    uint8_t* reg;
+
+    reg = &_self->set[FILTER_HLL_CURRENT][idx];
+    if (*reg < rho)
+        *reg = rho;
+    reg = &_self->set[FILTER_HLL_TOTAL][idx];
+    if (*reg < rho)
+        *reg = rho;
+}
+
+double filter_hll_estimate(filter_hll_t* self, filter_hll_set_t set, filter_hll_field_t field)
+{
+    const uint8_t* reg;
+    double         m, sum = 0, alpha, est;
+    size_t         i, zeros = 0;
+    mlassert_self();
+    lassert(set < _SETS, "invalid set");
+    lassert(field < FILTER_HLL_FIELDS, "invalid field");
+
+    reg = _self->set[set] + field * _self->m;
+    m   = _self->m;
+    for (i = 0; i < _self->m; i++) {
+        sum += ldexp(1.0, -reg[i]);
+        if (!reg[i])
+            zeros++;
+    }
+
+    switch (_self->m) {
+    case 16:
+        alpha = 0.673;
+        break;
+    case 32:
+        alpha = 0.697;
+        break;
+    case 64:
+        alpha = 0.709;
+        break;
+    default:
+        alpha = 0.7213 / (1 + 1.079 / m);
+    }
+
+    /* Use linear counting for small cardinalities, with a 64 bit hash no
+     * large range correction is needed. */
+    est = alpha * m * m / sum;
+    if (est <= 2.5 * m && zeros)
+        est = m * log(m / zeros);
+
+    return est;
+}
+
+static inline void _max(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (dst[i] < src[i])
+            dst[i] = src[i];
+    }
+}
+
+int filter_hll_merge(filter_hll_t* self, filter_hll_t* other)
+{
+    int i;
+    mlassert_self();
+    lassert(other, "other is nil");
+
+    if (other->precision != self->precision) {
+        lcritical("unable to merge, precision must be the same");
+        return -1;
+    }
+
+    for (i = 0; i < _SETS; i++)
+        _max(_self->set[i], ((_filter_hll_t*)other)->set[i], FILTER_HLL_FIELDS * _self->m);
+    self->queries += other->queries;
+    self->discarded += other->discarded;
+
+    return 0;
+}
+
+int filter_hll_save(filter_hll_t* self, const char* file)
+{
+    _state_header_t header;
+    FILE*           fp;
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (!(fp = fopen(file, "wb"))) {
+        lcritical("fopen(%s) error: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, _STATE_MAGIC, sizeof(header.magic));
+    header.version   = _STATE_VERSION;
+    header.precision = self->precision;
+    header.fields    = FILTER_HLL_FIELDS;
+    if (fwrite(&header, sizeof(header), 1, fp) != 1
+        || fwrite(_self->set[FILTER_HLL_TOTAL], _self->m, FILTER_HLL_FIELDS, fp) != FILTER_HLL_FIELDS) {
+        lcritical("fwrite(%s) error: %s", file, core_log_errstr(errno));
+        fclose(fp);
+        return -1;
+    }
+
+    if (fclose(fp)) {
+        lcritical("fclose(%s) error: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int filter_hll_load(filter_hll_t* self, const char* file)
+{
+    _state_header_t header;
+    uint8_t*        reg;
+    FILE*           fp;
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (!(fp = fopen(file, "rb"))) {
+        lcritical("fopen(%s) error: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, _STATE_MAGIC, sizeof(header.magic))
+        || header.version != _STATE_VERSION
+        || header.precision != self->precision
+        || header.fields != FILTER_HLL_FIELDS) {
+        lcritical("invalid or incompatible state file %s", file);
+        fclose(fp);
+        return -1;
+    }
+
+    lfatal_oom(reg = malloc(FILTER_HLL_FIELDS * _self->m));
+    if (fread(reg, _self->m, FILTER_HLL_FIELDS, fp) != FILTER_HLL_FIELDS) {
+        lcritical("truncated state file %s", file);
+        free(reg);
+        fclose(fp);
+        return -1;
+    }
+    _max(_self->set[FILTER_HLL_TOTAL], reg, FILTER_HLL_FIELDS * _self->m);
+
+    free(reg);
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Roll over to a new interval if the PCAP timestamp is past the current,
+ * intervals are aligned to the epoch and empty intervals are skipped.
+ */
+static int _interval(filter_hll_t* self, const core_object_pcap_t* pcap)
+{
+    uint64_t ns, start;
+
+    if (!self->interval_ms || !pcap)
+        return 0;
+
+    ns    = (uint64_t)pcap->ts.sec * 1000000000 + pcap->ts.nsec;
+    start = ns - ns % (self->interval_ms * 1000000);
+    if (!_self->started) {
+        _self->started      = 1;
+        self->current_start = start;
+        return 0;
+    }
+    if (start <= self->current_start)
+        return 0;
+
+    filter_hll_rollover(self);
+    self->current_start = start;
+    return 1;
+}
+
+int filter_hll_process(filter_hll_t* self, const core_object_t* obj)
+{
+    core_object_dns_layers_t layers;
+    const uint8_t*           src;
+    uint8_t                  qname[255];
+    size_t                   len, addr_len;
+    uint64_t                 hash;
+    int                      ret, found;
+    mlassert_self();
+
+    found = core_object_dns_layers(&layers, obj);
+    ret   = _interval(self, layers.pcap);
+
+    if (found) {
+        self->discarded++;
+        ldebug("packet discarded (missing payload, udp/tcp or ip/ip6 object)");
+        return ret;
+    }
+
+    core_object_dns_t dns = CORE_OBJECT_DNS_INIT(layers.payload);
+    dns.includes_dnslen   = layers.proto->obj_type == CORE_OBJECT_TCP;
+    if (core_object_dns_parse_header(&dns)) {
+        self->discarded++;
+        ldebug("packet discarded (malformed DNS header)");
+        return ret;
+    }
+    if (dns.qr)
+        return ret;
+    self->queries++;
+
+    if (layers.ip->obj_type == CORE_OBJECT_IP) {
+        src      = ((const core_object_ip_t*)layers.ip)->src;
+        addr_len = 4;
+    } else {
+        src      = ((const core_object_ip6_t*)layers.ip)->src;
+        addr_len = 16;
+    }
+    if (self->fields & (1 << FILTER_HLL_CLIENT))
+        _add(self, FILTER_HLL_CLIENT, _addr_hash(src, addr_len, addr_len * 8));
+    if (self->fields & (1 << FILTER_HLL_PREFIX))
+        _add(self, FILTER_HLL_PREFIX, _addr_hash(src, addr_len, addr_len == 4 ? self->ip4_prefix : self->ip6_prefix));
+
+    if (!(self->fields & (1 << FILTER_HLL_QNAME | 1 << FILTER_HLL_QNAME_QTYPE))
+        || !dns.qdcount || !(len = core_object_dns_name_copy_lower(qname, dns.at, dns.left)))
+        return ret;
+
+    hash = core_object_dns_name_hash(qname, len, 0);
+    if (self->fields & (1 << FILTER_HLL_QNAME))
+        _add(self, FILTER_HLL_QNAME, hash);
+    if ((self->fields & (1 << FILTER_HLL_QNAME_QTYPE)) && dns.left >= len + 2)
+        _add(self, FILTER_HLL_QNAME_QTYPE, _fmix(hash ^ ((uint64_t)dns.at[len] << 8 | dns.at[len + 1])));
+
+    return ret;
+}
+
+static void _receive(filter_hll_t* self, const core_object_t* obj)
+{
+    mlassert_self();
+
+    filter_hll_process(self, obj);
+    if (self->recv)
+        self->recv(self->recv_ctx, obj);
+}
+
+core_receiver_t filter_hll_receiver(filter_hll_t* self)
+{
+    return (core_receiver_t)_receive;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef enum filter_hll_field {
+    FILTER_HLL_CLIENT,
+    FILTER_HLL_PREFIX,
+    FILTER_HLL_QNAME,
+    FILTER_HLL_QNAME_QTYPE,
+    FILTER_HLL_FIELDS
+} filter_hll_field_t;
+
+typedef enum filter_hll_set {
+    FILTER_HLL_CURRENT,
+    FILTER_HLL_LAST,
+    FILTER_HLL_TOTAL
+} filter_hll_set_t;
+
+typedef struct filter_hll {
+    core_log_t _log;
+
+    /* Receiver to pass all objects on to. */
+    core_receiver_t recv;
+    void*           recv_ctx;
+
+    size_t precision;
+
+    /* Bitmask of (1 << filter_hll_field_t) to count. */
+    uint32_t fields;
+
+    /* Prefix lengths of client addresses counted for FILTER_HLL_PREFIX. */
+    uint8_t ip4_prefix;
+    uint8_t ip6_prefix;
+
+    /* Length of an interval, 0 disables rollover. The start of the current
+     * and the last completed interval is in ns since the epoch. */
+    uint64_t interval_ms;
+    uint64_t current_start;
+    uint64_t last_start;
+    uint64_t intervals;
+
+    uint64_t queries;
+    uint64_t discarded;
+} filter_hll_t;
+
+core_log_t* filter_hll_log();
+
+filter_hll_t* filter_hll_new(size_t precision);
+void filter_hll_free(filter_hll_t* self);
+void filter_hll_reset(filter_hll_t* self);
+int filter_hll_process(filter_hll_t* self, const core_object_t* obj);
+void filter_hll_rollover(filter_hll_t* self);
+double filter_hll_estimate(filter_hll_t* self, filter_hll_set_t set, filter_hll_field_t field);
+int filter_hll_merge(filter_hll_t* self, filter_hll_t* other);
+int filter_hll_save(filter_hll_t* self, const char* file);
+int filter_hll_load(filter_hll_t* self, const char* file);
+
+core_receiver_t filter_hll_receiver(filter_hll_t* self);
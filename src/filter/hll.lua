@@ -0,0 +1,246 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.filter.hll
+-- Estimate the number of unique clients and names in fixed memory
+--   local hll = require("dnsjit.filter.hll").new()
+--   hll:interval(60)
+--   layer:producer(input)
+--   local prod, pctx = layer:produce()
+--   while true do
+--       local obj = prod(pctx)
+--       if obj == nil then break end
+--       if hll:process(obj) then
+--           print(hll:last_start(), hll:estimate("client", "last"))
+--       end
+--   end
+--   print("total", hll:estimate("client", "total"))
+--
+-- Filter that estimates the number of distinct keys of queries using
+-- HyperLogLog sketches, each field takes
+-- .I 2^precision
+-- bytes of memory and has a standard error of about
+-- .IR 1.04/sqrt(2^precision) ,
+-- 0.81% for the default precision of 14.
+-- The object chain must contain a payload, UDP or TCP and IPv4 or IPv6
+-- object (see dnsjit.filter.layer), anything else is discarded.
+-- .P
+-- The fields counted are:
+-- .TP
+-- client
+-- The source address of the query.
+-- .TP
+-- prefix
+-- The source address of the query truncated to a prefix, /24 for IPv4 and
+-- /48 for IPv6 by default.
+-- .TP
+-- qname
+-- The QNAME, case-insensitive and only if not compressed.
+-- .TP
+-- qname_qtype
+-- The QNAME and QTYPE.
+-- .LP
+-- Each field is estimated for the current interval, the last completed
+-- interval and in total.
+-- Intervals are based on the PCAP timestamps and aligned to the epoch,
+-- intervals without any packets are skipped.
+-- Without an interval set, or without PCAP objects,
+-- .I rollover()
+-- can be called to complete an interval.
+-- .P
+-- Sketches of the same precision can be merged, for example when counting
+-- in multiple threads (see
+-- .IR share() )
+-- or across runs by saving and loading the total counts.
+-- .P
+-- When used as a receiver all objects are passed on to the set receiver
+-- after being counted.
+module(...,package.seeall)
+
+require("dnsjit.filter.hll_h")
+local ffi = require("ffi")
+local C = ffi.C
+local bit = require("bit")
+
+local Hll = {}
+
+local _fields = {
+    client = C.FILTER_HLL_CLIENT,
+    prefix = C.FILTER_HLL_PREFIX,
+    qname = C.FILTER_HLL_QNAME,
+    qname_qtype = C.FILTER_HLL_QNAME_QTYPE,
+}
+
+local _sets = {
+    current = C.FILTER_HLL_CURRENT,
+    last = C.FILTER_HLL_LAST,
+    total = C.FILTER_HLL_TOTAL,
+}
+
+local function _field(field)
+    local f = _fields[field]
+    if f == nil then
+        error("invalid field "..tostring(field))
+    end
+    return f
+end
+
+-- Create a new Hll filter with sketches of
+-- .I 2^precision
+-- registers, precision is between 4 and 18 (default 14).
+function Hll.new(precision)
+    local self = {
+        obj = C.filter_hll_new(precision or 14),
+    }
+    ffi.gc(self.obj, C.filter_hll_free)
+    return setmetatable(self, { __index = Hll })
+end
+
+-- Wrap a shared filter_hll_t object, for example one received by a thread.
+-- The object is not freed by the wrapper.
+function Hll.wrap(obj)
+    return setmetatable({ obj = obj }, { __index = Hll })
+end
+
+-- Return information to use when sharing this object between threads.
+function Hll:share()
+    return ffi.cast("void*", self.obj), "filter_hll_t*", "dnsjit.filter.hll_h"
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Hll:log()
+    if self == nil then
+        return C.filter_hll_log()
+    end
+    return self.obj._log
+end
+
+-- Return the C functions and context for receiving objects.
+function Hll:receive()
+    local recv = C.filter_hll_receiver(self.obj)
+    return recv, self.obj
+end
+
+-- Set the receiver to pass objects to.
+function Hll:receiver(o)
+    self.obj.recv, self.obj.recv_ctx = o:receive()
+end
+
+-- Set the fields to count, by name, all fields are counted by default.
+function Hll:fields(...)
+    local mask = 0
+    for _, field in pairs({...}) do
+        mask = bit.bor(mask, bit.lshift(1, _field(field)))
+    end
+    self.obj.fields = mask
+end
+
+-- Set the prefix length of IPv4 (default 24) and IPv6 (default 48) client
+-- addresses counted in the prefix field.
+function Hll:prefix(ip4, ip6)
+    if ip4 ~= nil then
+        self.obj.ip4_prefix = ip4
+    end
+    if ip6 ~= nil then
+        self.obj.ip6_prefix = ip6
+    end
+end
+
+-- Set the length of an interval in seconds, 0 (default) disables rollover.
+function Hll:interval(seconds)
+    self.obj.interval_ms = math.floor(seconds * 1000)
+end
+
+-- Count an object, return true if it started a new interval and the last
+-- one can be read.
+function Hll:process(obj)
+    return C.filter_hll_process(self.obj, obj) == 1
+end
+
+-- Complete the current interval.
+function Hll:rollover()
+    C.filter_hll_rollover(self.obj)
+end
+
+-- Return the estimated number of distinct keys of a field in the
+-- .I set
+-- "current", "last" or "total" (default).
+function Hll:estimate(field, set)
+    local s = _sets[set or "total"]
+    if s == nil then
+        error("invalid set "..tostring(set))
+    end
+    return math.floor(C.filter_hll_estimate(self.obj, s, _field(field)) + 0.5)
+end
+
+-- Return the start of the current interval in seconds since the epoch.
+function Hll:current_start()
+    return tonumber(self.obj.current_start) / 1e9
+end
+
+-- Return the start of the last completed interval in seconds since the
+-- epoch.
+function Hll:last_start()
+    return tonumber(self.obj.last_start) / 1e9
+end
+
+-- Return the number of completed intervals.
+function Hll:intervals()
+    return tonumber(self.obj.intervals)
+end
+
+-- Clear all sketches and counters.
+function Hll:reset()
+    C.filter_hll_reset(self.obj)
+end
+
+-- Merge the sketches of another Hll filter (or shared filter_hll_t object)
+-- of the same precision into this one, return 0 on success.
+function Hll:merge(other)
+    if type(other) == "table" then
+        other = other.obj
+    end
+    return C.filter_hll_merge(self.obj, other)
+end
+
+-- Save the total sketches to a file, return 0 on success.
+function Hll:save(file)
+    return C.filter_hll_save(self.obj, file)
+end
+
+-- Merge total sketches saved by
+-- .I save()
+-- into this one, return 0 on success.
+function Hll:load(file)
+    return C.filter_hll_load(self.obj, file)
+end
+
+-- Return the number of queries counted.
+function Hll:queries()
+    return tonumber(self.obj.queries)
+end
+
+-- Return the number of objects discarded.
+function Hll:discarded()
+    return tonumber(self.obj.discarded)
+end
+
+-- dnsjit.filter.layer (3),
+-- dnsjit.filter.topk (3),
+-- dnsjit.core.thread (3)
+return Hll
@@ -22,6 +22,7 @@
 
 #include "filter/ipsplit.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 
 typedef struct _filter_ipsplit {
     filter_ipsplit_t pub;
@@ -48,6 +49,8 @@ static filter_ipsplit_t _defaults = {
     NULL
 };
 
+static size_t _m_pkts = 0, _m_discarded = 0;
+
 core_log_t* filter_ipsplit_log()
 {
     return &_log;
@@ -62,6 +65,9 @@ filter_ipsplit_t* filter_ipsplit_new()
     _self->trie         = trie_create(NULL);
     _self->weight_total = 0;
 
+    core_metrics_counter(&_m_pkts, "dnsjit_ipsplit_packets_total", 0, "Packets passed on by filter.ipsplit");
+    core_metrics_counter(&_m_discarded, "dnsjit_ipsplit_discarded_total", 0, "Packets discarded by filter.ipsplit");
+
     return self;
 }
 
@@ -223,26 +229,47 @@ static void _receive(filter_ipsplit_t* self, const core_object_t* obj)
     }
     if (pkt == NULL) {
         self->discarded++;
+        core_metrics_inc(_m_discarded);
         lwarning("packet discarded (missing ip/ip6 object)");
         return;
     }
 
+    /* Copies of a capture overlaid by input.merge have the index of the
+     * copy in the pcap object, the same address in different copies is
+     * considered to be different clients. */
+    uint32_t             source = 0;
+    const core_object_t* o;
+    for (o = pkt; o != NULL; o = o->obj_prev) {
+        if (o->obj_type == CORE_OBJECT_PCAP) {
+            source = ((const core_object_pcap_t*)o)->source;
+            break;
+        }
+    }
+
     /* Lookup IPv4/IPv6 address in trie (prefix-tree). Inserts new node if not found. */
-    trie_val_t* node = 0;
+    uint8_t key[16 + sizeof(source)];
+    size_t  key_len = 0;
     switch (pkt->obj_type) {
     case CORE_OBJECT_IP: {
         core_object_ip_t* ip = (core_object_ip_t*)pkt;
-        node                 = trie_get_ins(_self->trie, (char*)ip->src, sizeof(ip->src));
+        memcpy(key, ip->src, sizeof(ip->src));
+        key_len = sizeof(ip->src);
         break;
     }
     case CORE_OBJECT_IP6: {
         core_object_ip6_t* ip6 = (core_object_ip6_t*)pkt;
-        node                   = trie_get_ins(_self->trie, (char*)ip6->src, sizeof(ip6->src));
+        memcpy(key, ip6->src, sizeof(ip6->src));
+        key_len = sizeof(ip6->src);
         break;
     }
     default:
         lfatal("unsupported object type");
     }
+    if (source) {
+        memcpy(key + key_len, &source, sizeof(source));
+        key_len += sizeof(source);
+    }
+    trie_val_t* node = trie_get_ins(_self->trie, (char*)key, key_len);
     lassert(node, "trie failure");
 
     _client_t* client;
@@ -254,6 +281,7 @@ static void _receive(filter_ipsplit_t* self, const core_object_t* obj)
 
     client = (_client_t*)*node;
     _overwrite(self, pkt, client);
+    core_metrics_inc(_m_pkts);
     client->recv->recv(client->recv->ctx, obj);
 }
 
@@ -21,6 +21,7 @@
 #include "core/log.h"
 #include "core/object/ip.h"
 #include "core/object/ip6.h"
+#include "core/object/pcap.h"
 #include "core/receiver.h"
 
 #ifndef __dnsjit_filter_ipsplit_h
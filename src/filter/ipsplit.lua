@@ -33,6 +33,10 @@
 -- All objects from this client will be passed to the assigned receiver.
 -- The filter can also write a receiver-specific client ID (starting from 1)
 -- to the source or destination IP in the packet.
+-- Packets tagged with a source index by
+-- .I dnsjit.input.merge
+-- are considered to be from a different client for each source, so
+-- overlaid copies of a capture do not share clients.
 module(...,package.seeall)
 
 require("dnsjit.filter.ipsplit_h")
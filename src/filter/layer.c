@@ -22,6 +22,7 @@
 
 #include "filter/layer.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 
 #include <string.h>
 #include <pcap/pcap.h>
@@ -85,6 +86,8 @@ static filter_layer_t _defaults = {
     CORE_OBJECT_PAYLOAD_INIT(0)
 };
 
+static size_t _m_pkts = 0, _m_errs = 0;
+
 core_log_t* filter_layer_log()
 {
     return &_log;
@@ -95,6 +98,9 @@ void filter_layer_init(filter_layer_t* self)
     mlassert_self();
 
     *self = _defaults;
+
+    core_metrics_counter(&_m_pkts, "dnsjit_layer_packets_total", 0, "Packets parsed by filter.layer");
+    core_metrics_counter(&_m_errs, "dnsjit_layer_errors_total", 0, "Packets filter.layer failed to parse");
 }
 
 void filter_layer_destroy(filter_layer_t* self)
@@ -654,9 +660,12 @@ static void _receive(filter_layer_t* self, const core_object_t* obj)
         lfatal("obj is not CORE_OBJECT_PCAP");
     }
 
-    if (!_link(self, (core_object_pcap_t*)obj)) {
-        self->recv(self->ctx, self->produced);
+    if (_link(self, (core_object_pcap_t*)obj)) {
+        core_metrics_inc(_m_errs);
+        return;
     }
+    core_metrics_inc(_m_pkts);
+    self->recv(self->ctx, self->produced);
 }
 
 core_receiver_t filter_layer_receiver()
@@ -670,9 +679,14 @@ static const core_object_t* _produce(filter_layer_t* self)
     mlassert_self();
 
     obj = self->prod(self->prod_ctx);
-    if (!obj || obj->obj_type != CORE_OBJECT_PCAP || _link(self, (core_object_pcap_t*)obj)) {
+    if (!obj || obj->obj_type != CORE_OBJECT_PCAP) {
+        return 0;
+    }
+    if (_link(self, (core_object_pcap_t*)obj)) {
+        core_metrics_inc(_m_errs);
         return 0;
     }
+    core_metrics_inc(_m_pkts);
 
     return self->produced;
 }
@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "filter/qrmatch.h"
+#include "core/assert.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _NONE UINT32_MAX
+
+/*
+ * Key of a query/response pair, the layout is fixed (no padding) so it can
+ * be hashed, compared and saved as bytes.
+ */
+typedef struct _key {
+    uint8_t  client[16];
+    uint8_t  server[16];
+    uint16_t client_port;
+    uint16_t server_port;
+    uint16_t id;
+    uint8_t  is_ip6;
+    uint8_t  _pad;
+    uint32_t qname_hash;
+} _key_t;
+
+/*
+ * In-flight query, kept in a fixed pool and linked in the order of arrival
+ * which is also the order in which they time out.
+ */
+typedef struct _entry {
+    _key_t          key;
+    uint32_t        hash;
+    uint32_t        prev, next;
+    core_timespec_t qts;
+} _entry_t;
+
+typedef struct _filter_qrmatch {
+    filter_qrmatch_t pub;
+
+    /* Open addressing hash table (linear probing) of pool index + 1,
+     * 0 is an empty slot. */
+    uint32_t* slots;
+    size_t    mask;
+
+    _entry_t* pool;
+    uint32_t  free;
+    uint32_t  oldest, newest;
+} _filter_qrmatch_t;
+
+/*
+ * Saved state: header followed by the in-flight queries from the oldest,
+ * in host byte order.
+ */
+#define _STATE_MAGIC "DJQRMTCH"
+#define _STATE_VERSION 1
+
+typedef struct _state_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t records;
+} _state_header_t;
+
+typedef struct _state_record {
+    _key_t  key;
+    int64_t sec;
+    int64_t nsec;
+} _state_record_t;
+
+#define _self ((_filter_qrmatch_t*)self)
+
+static core_log_t       _log      = LOG_T_INIT("filter.qrmatch");
+static filter_qrmatch_t _defaults = {
+    LOG_T_INIT_OBJ("filter.qrmatch"),
+    0, 0,
+    5000,
+    0, 0,
+    0, 0, 0, 0, 0, 0, 0,
+};
+
+core_log_t* filter_qrmatch_log()
+{
+    return &_log;
+}
+
+filter_qrmatch_t* filter_qrmatch_new(size_t max_inflight)
+{
+    filter_qrmatch_t* self;
+    size_t            i, slots = 1;
+
+    mlassert(max_inflight > 0 && max_inflight < _NONE / 2, "invalid max_inflight");
+
+    mlfatal_oom(self = malloc(sizeof(_filter_qrmatch_t)));
+    *self              = _defaults;
+    self->max_inflight = max_inflight;
+
+    /* Keep the load factor of the table at most 0.5. */
+    while (slots < max_inflight * 2)
+        slots <<= 1;
+    lfatal_oom(_self->slots = calloc(slots, sizeof(uint32_t)));
+    _self->mask = slots - 1;
+
+    lfatal_oom(_self->pool = malloc(max_inflight * sizeof(_entry_t)));
+    for (i = 0; i < max_inflight; i++)
+        _self->pool[i].next = i + 1 < max_inflight ? i + 1 : _NONE;
+    _self->free   = 0;
+    _self->oldest = _self->newest = _NONE;
+
+    return self;
+}
+
+void filter_qrmatch_free(filter_qrmatch_t* self)
+{
+    mlassert_self();
+
+    free(_self->slots);
+    free(_self->pool);
+    free(self);
+}
+
+static inline uint32_t _hash(const _key_t* key)
+{
+    const uint8_t* p    = (const uint8_t*)key;
+    uint32_t       hash = 2166136261u;
+    size_t         i;
+
+    for (i = 0; i < sizeof(_key_t); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+/*
+ * Hash the QNAME (case-insensitive) so that responses are matched to the
+ * query they answer even if the message ID and ports collide.
+ */
+static uint32_t _qname_hash(const uint8_t* at, size_t left)
+{
+    uint32_t hash = 2166136261u;
+    uint8_t  len, c;
+
+    while (left) {
+        len = *at++;
+        left--;
+        hash = (hash ^ len) * 16777619u;
+        /* End of name, compression pointer or extended label type. */
+        if (!len || (len & 0xc0) || len > left)
+            break;
+        for (; len; len--, left--) {
+            c = *at++;
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            hash = (hash ^ c) * 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+/*
+ * Return the slot holding the given pool index.
+ */
+static size_t _slot_of(filter_qrmatch_t* self, uint32_t idx)
+{
+    size_t i = _self->pool[idx].hash & _self->mask;
+
+    while (_self->slots[i] != idx + 1) {
+        mlassert(_self->slots[i], "entry not in table");
+        i = (i + 1) & _self->mask;
+    }
+    return i;
+}
+
+static void _remove(filter_qrmatch_t* self, size_t slot)
+{
+    uint32_t  idx = _self->slots[slot] - 1;
+    _entry_t* e   = &_self->pool[idx];
+    size_t    i = slot, j = slot, k;
+
+    /* Backward shift deletion, keeps probe sequences intact without
+     * tombstones. */
+    for (;;) {
+        j = (j + 1) & _self->mask;
+        if (!_self->slots[j])
+            break;
+        k = _self->pool[_self->slots[j] - 1].hash & _self->mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            _self->slots[i] = _self->slots[j];
+            i               = j;
+        }
+    }
+    _self->slots[i] = 0;
+
+    if (e->prev != _NONE)
+        _self->pool[e->prev].next = e->next;
+    else
+        _self->oldest = e->next;
+    if (e->next != _NONE)
+        _self->pool[e->next].prev = e->prev;
+    else
+        _self->newest = e->prev;
+
+    e->next     = _self->free;
+    _self->free = idx;
+    self->inflight--;
+}
+
+static void _insert(filter_qrmatch_t* self, const _key_t* key, const core_timespec_t* qts)
+{
+    uint32_t  idx;
+    _entry_t* e;
+    size_t    i;
+
+    if (_self->free == _NONE) {
+        _remove(self, _slot_of(self, _self->oldest));
+        self->evicted++;
+    }
+
+    idx         = _self->free;
+    e           = &_self->pool[idx];
+    _self->free = e->next;
+
+    e->key  = *key;
+    e->hash = _hash(key);
+    e->qts  = *qts;
+    e->prev = _self->newest;
+    e->next = _NONE;
+    if (_self->newest != _NONE)
+        _self->pool[_self->newest].next = idx;
+    else
+        _self->oldest = idx;
+    _self->newest = idx;
+
+    i = e->hash & _self->mask;
+    while (_self->slots[i])
+        i = (i + 1) & _self->mask;
+    _self->slots[i] = idx + 1;
+    self->inflight++;
+}
+
+/*
+ * Return the slot of the oldest query with the given key, or -1.
+ */
+static ssize_t _lookup(filter_qrmatch_t* self, const _key_t* key)
+{
+    uint32_t hash = _hash(key);
+    size_t   i    = hash & _self->mask;
+    _entry_t* e;
+
+    while (_self->slots[i]) {
+        e = &_self->pool[_self->slots[i] - 1];
+        if (e->hash == hash && !memcmp(&e->key, key, sizeof(_key_t)))
+            return i;
+        i = (i + 1) & _self->mask;
+    }
+    return -1;
+}
+
+static inline uint64_t _elapsed_ns(const core_timespec_t* from, const core_timespec_t* to)
+{
+    int64_t ns = (to->sec - from->sec) * 1000000000 + (to->nsec - from->nsec);
+    return ns > 0 ? ns : 0;
+}
+
+static void _expire(filter_qrmatch_t* self, const core_timespec_t* now)
+{
+    uint64_t timeout_ns = self->timeout_ms * 1000000;
+
+    while (_self->oldest != _NONE && _elapsed_ns(&_self->pool[_self->oldest].qts, now) > timeout_ns) {
+        _remove(self, _slot_of(self, _self->oldest));
+        self->timeouts++;
+    }
+}
+
+const filter_qrmatch_match_t* filter_qrmatch_process(filter_qrmatch_t* self, const core_object_t* obj)
+{
+    core_object_dns_layers_t  layers;
+    const core_object_t *     proto, *ip;
+    const core_object_pcap_t* pcap;
+    const uint8_t *           src, *dst;
+    uint16_t                  sport, dport;
+    _key_t                    key;
+    ssize_t                   slot;
+    mlassert_self();
+
+    if (core_object_dns_layers(&layers, obj) || !layers.pcap) {
+        self->discarded++;
+        ldebug("packet discarded (missing payload, udp/tcp, ip/ip6 or pcap object)");
+        return NULL;
+    }
+    proto = layers.proto;
+    ip    = layers.ip;
+    pcap  = layers.pcap;
+
+    core_object_dns_t dns = CORE_OBJECT_DNS_INIT(layers.payload);
+    dns.includes_dnslen   = proto->obj_type == CORE_OBJECT_TCP;
+    if (core_object_dns_parse_header(&dns)) {
+        self->discarded++;
+        ldebug("packet discarded (malformed DNS header)");
+        return NULL;
+    }
+
+    if (proto->obj_type == CORE_OBJECT_UDP) {
+        sport = ((const core_object_udp_t*)proto)->sport;
+        dport = ((const core_object_udp_t*)proto)->dport;
+    } else {
+        sport = ((const core_object_tcp_t*)proto)->sport;
+        dport = ((const core_object_tcp_t*)proto)->dport;
+    }
+
+    memset(&key, 0, sizeof(key));
+    if (ip->obj_type == CORE_OBJECT_IP) {
+        src = ((const core_object_ip_t*)ip)->src;
+        dst = ((const core_object_ip_t*)ip)->dst;
+        memcpy(dns.qr ? key.server : key.client, src, 4);
+        memcpy(dns.qr ? key.client : key.server, dst, 4);
+    } else {
+        src = ((const core_object_ip6_t*)ip)->src;
+        dst = ((const core_object_ip6_t*)ip)->dst;
+        memcpy(dns.qr ? key.server : key.client, src, 16);
+        memcpy(dns.qr ? key.client : key.server, dst, 16);
+        key.is_ip6 = 1;
+    }
+    key.client_port = dns.qr ? dport : sport;
+    key.server_port = dns.qr ? sport : dport;
+    key.id          = dns.id;
+    key.qname_hash  = dns.qdcount ? _qname_hash(dns.at, dns.left) : 0;
+
+    _expire(self, &pcap->ts);
+
+    if (!dns.qr) {
+        self->queries++;
+        _insert(self, &key, &pcap->ts);
+        return NULL;
+    }
+
+    self->responses++;
+    if ((slot = _lookup(self, &key)) < 0) {
+        self->unmatched++;
+        return NULL;
+    }
+
+    _entry_t* e = &_self->pool[_self->slots[slot] - 1];
+
+    self->match.qts    = e->qts;
+    self->match.rts    = pcap->ts;
+    self->match.rtt_ns = _elapsed_ns(&e->qts, &pcap->ts);
+    self->match.is_ip6 = key.is_ip6;
+    memcpy(self->match.client, key.client, sizeof(key.client));
+    memcpy(self->match.server, key.server, sizeof(key.server));
+    self->match.client_port = key.client_port;
+    self->match.server_port = key.server_port;
+    self->match.id          = key.id;
+    self->match.rcode       = dns.rcode;
+    self->match.qname_hash  = key.qname_hash;
+    self->match.response    = (const core_object_t*)layers.payload;
+
+    _remove(self, slot);
+    self->matched++;
+
+    return &self->match;
+}
+
+int filter_qrmatch_save(filter_qrmatch_t* self, const char* file)
+{
+    _state_header_t header;
+    _state_record_t record;
+    FILE*           fp;
+    uint32_t        idx;
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (!(fp = fopen(file, "wb"))) {
+        lcritical("fopen(%s) error: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, _STATE_MAGIC, sizeof(header.magic));
+    header.version     = _STATE_VERSION;
+    header.record_size = sizeof(_state_record_t);
+    header.records     = self->inflight;
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        goto error;
+
+    memset(&record, 0, sizeof(record));
+    for (idx = _self->oldest; idx != _NONE; idx = _self->pool[idx].next) {
+        record.key  = _self->pool[idx].key;
+        record.sec  = _self->pool[idx].qts.sec;
+        record.nsec = _self->pool[idx].qts.nsec;
+        if (fwrite(&record, sizeof(record), 1, fp) != 1)
+            goto error;
+    }
+
+    if (fclose(fp)) {
+        lcritical("fclose(%s) error: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+    linfo("saved %zu in-flight queries to %s", self->inflight, file);
+    return 0;
+
+error:
+    lcritical("fwrite(%s) error: %s", file, core_log_errstr(errno));
+    fclose(fp);
+    return -1;
+}
+
+int filter_qrmatch_load(filter_qrmatch_t* self, const char* file)
+{
+    _state_header_t header;
+    _state_record_t record;
+    core_timespec_t qts;
+    FILE*           fp;
+    uint64_t        n;
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    if (!(fp = fopen(file, "rb"))) {
+        lcritical("fopen(%s) error: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, _STATE_MAGIC, sizeof(header.magic))
+        || header.version != _STATE_VERSION
+        || header.record_size != sizeof(_state_record_t)) {
+        lcritical("invalid or incompatible state file %s", file);
+        fclose(fp);
+        return -1;
+    }
+
+    for (n = 0; n < header.records; n++) {
+        if (fread(&record, sizeof(record), 1, fp) != 1) {
+            lcritical("truncated state file %s", file);
+            fclose(fp);
+            return -1;
+        }
+        qts.sec  = record.sec;
+        qts.nsec = record.nsec;
+        _insert(self, &record.key, &qts);
+    }
+
+    fclose(fp);
+    linfo("loaded %" PRIu64 " in-flight queries from %s", header.records, file);
+    return 0;
+}
+
+static void _receive(filter_qrmatch_t* self, const core_object_t* obj)
+{
+    mlassert_self();
+
+    if (filter_qrmatch_process(self, obj) && self->recv)
+        self->recv(self->recv_ctx, obj);
+}
+
+core_receiver_t filter_qrmatch_receiver(filter_qrmatch_t* self)
+{
+    return (core_receiver_t)_receive;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.core.timespec_h")
+
+typedef struct filter_qrmatch_match {
+    /* Time of the query and the response from the PCAP and the round-trip
+     * time between them in ns. */
+    core_timespec_t qts;
+    core_timespec_t rts;
+    uint64_t        rtt_ns;
+
+    /* Addresses (IPv4 uses the first 4 bytes) and ports of the client
+     * (query source) and server (query destination). */
+    uint8_t  is_ip6;
+    uint8_t  client[16];
+    uint8_t  server[16];
+    uint16_t client_port;
+    uint16_t server_port;
+
+    uint16_t id;
+    uint8_t  rcode;
+    uint32_t qname_hash;
+
+    /* The response object chain, only valid during the call. */
+    const core_object_t* response;
+} filter_qrmatch_match_t;
+
+typedef struct filter_qrmatch {
+    core_log_t _log;
+
+    /* Receiver of matched responses, the match is available in match. */
+    core_receiver_t recv;
+    void*           recv_ctx;
+
+    /* Queries older than this (relative to the latest packet) are expired. */
+    uint64_t timeout_ms;
+
+    size_t max_inflight;
+    size_t inflight;
+
+    uint64_t queries;
+    uint64_t responses;
+    uint64_t matched;
+    uint64_t unmatched; /* responses without a query */
+    uint64_t timeouts;  /* queries expired without a response */
+    uint64_t evicted;   /* queries evicted because the table was full */
+    uint64_t discarded;
+
+    filter_qrmatch_match_t match;
+} filter_qrmatch_t;
+
+core_log_t* filter_qrmatch_log();
+
+filter_qrmatch_t* filter_qrmatch_new(size_t max_inflight);
+void filter_qrmatch_free(filter_qrmatch_t* self);
+const filter_qrmatch_match_t* filter_qrmatch_process(filter_qrmatch_t* self, const core_object_t* obj);
+int filter_qrmatch_save(filter_qrmatch_t* self, const char* file);
+int filter_qrmatch_load(filter_qrmatch_t* self, const char* file);
+
+core_receiver_t filter_qrmatch_receiver(filter_qrmatch_t* self);
@@ -0,0 +1,162 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.filter.qrmatch
+-- Match DNS queries with their responses
+--   local qrmatch = require("dnsjit.filter.qrmatch").new()
+--   qrmatch:timeout(5)
+--   layer:producer(input)
+--   local prod, pctx = layer:produce()
+--   while true do
+--       local obj = prod(pctx)
+--       if obj == nil then break end
+--       local match = qrmatch:process(obj)
+--       if match ~= nil then
+--           print(match.id, tonumber(match.rtt_ns))
+--       end
+--   end
+--
+-- Filter that pairs DNS responses with the queries they answer and calculates
+-- the round-trip time from the PCAP timestamps.
+-- The object chain must contain a payload, UDP or TCP, IPv4 or IPv6 and a PCAP
+-- object (see dnsjit.filter.layer), anything else is discarded.
+-- Queries and responses are matched on the client and server address and
+-- port, the message ID and a case-insensitive hash of the QNAME.
+-- .P
+-- In-flight queries are kept in an open addressing hash table of a fixed
+-- size, queries that don't get a response within the timeout are expired
+-- in the order they arrived and the oldest query is evicted when the table
+-- is full.
+-- The in-flight queries can be saved to a compact binary file and loaded
+-- again to continue matching over multiple PCAP files.
+-- .P
+-- When used as a receiver, matched responses are passed on to the set
+-- receiver while the match is available in
+-- .I self.obj.match
+-- for the duration of the call.
+module(...,package.seeall)
+
+require("dnsjit.filter.qrmatch_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local QRMatch = {}
+
+-- Create a new QRMatch filter that keeps up to
+-- .I max_inflight
+-- queries waiting for a response (default 1048576).
+function QRMatch.new(max_inflight)
+    local self = {
+        obj = C.filter_qrmatch_new(max_inflight or 1048576),
+    }
+    ffi.gc(self.obj, C.filter_qrmatch_free)
+    return setmetatable(self, { __index = QRMatch })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function QRMatch:log()
+    if self == nil then
+        return C.filter_qrmatch_log()
+    end
+    return self.obj._log
+end
+
+-- Set the timeout in seconds after which queries without a response are
+-- expired (default 5s).
+-- The time is taken from the PCAP timestamps.
+function QRMatch:timeout(seconds)
+    self.obj.timeout_ms = math.floor(seconds * 1000)
+end
+
+-- Return the C functions and context for receiving objects.
+function QRMatch:receive()
+    local recv = C.filter_qrmatch_receiver(self.obj)
+    return recv, self.obj
+end
+
+-- Set the receiver to pass matched responses to.
+function QRMatch:receiver(o)
+    self.obj.recv, self.obj.recv_ctx = o:receive()
+end
+
+-- Process an object, return the match (filter_qrmatch_match_t) if the
+-- object is a response to an in-flight query or nil otherwise.
+-- The match is overwritten by the next call.
+function QRMatch:process(obj)
+    local match = C.filter_qrmatch_process(self.obj, obj)
+    if match == nil then
+        return
+    end
+    return match
+end
+
+-- Save the in-flight queries to a file, return 0 on success.
+function QRMatch:save(file)
+    return C.filter_qrmatch_save(self.obj, file)
+end
+
+-- Load in-flight queries from a file created by
+-- .IR save() ,
+-- return 0 on success.
+function QRMatch:load(file)
+    return C.filter_qrmatch_load(self.obj, file)
+end
+
+-- Return the number of queries waiting for a response.
+function QRMatch:inflight()
+    return tonumber(self.obj.inflight)
+end
+
+-- Return the number of queries processed.
+function QRMatch:queries()
+    return tonumber(self.obj.queries)
+end
+
+-- Return the number of responses processed.
+function QRMatch:responses()
+    return tonumber(self.obj.responses)
+end
+
+-- Return the number of responses matched to a query.
+function QRMatch:matched()
+    return tonumber(self.obj.matched)
+end
+
+-- Return the number of responses without a matching query.
+function QRMatch:unmatched()
+    return tonumber(self.obj.unmatched)
+end
+
+-- Return the number of queries that expired without a response.
+function QRMatch:timeouts()
+    return tonumber(self.obj.timeouts)
+end
+
+-- Return the number of queries evicted because the table was full.
+function QRMatch:evicted()
+    return tonumber(self.obj.evicted)
+end
+
+-- Number of input packets discarded due to various reasons.
+-- To investigate causes, run with increased logging level.
+function QRMatch:discarded()
+    return tonumber(self.obj.discarded)
+end
+
+-- dnsjit.filter.layer (3)
+return QRMatch
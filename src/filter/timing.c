@@ -25,6 +25,7 @@
 #include "core/timespec.h"
 #include "core/object/pcap.h"
 
+#include <math.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -40,6 +41,21 @@ typedef struct _filter_timing {
     void (*timing_callback)(filter_timing_t*, const core_object_pcap_t*);
     struct timespec mod_ts;
     size_t          counter;
+
+    /* Schedule of the pacing engine in ns of CLOCK_MONOTONIC, when the
+     * last packet was due, the time of the last release and until when
+     * packets are released at once. */
+    int64_t  offset;
+    uint64_t start;
+    uint64_t target;
+    uint64_t due;
+    uint64_t now;
+    uint64_t release_until;
+
+    /* Fraction of a ns carried between gaps of the rate modes and the
+     * state of the random number generator for the poisson mode. */
+    double   carry;
+    uint64_t rng;
 } _filter_timing_t;
 
 static core_log_t      _log      = LOG_T_INIT("filter.timing");
@@ -47,6 +63,9 @@ static filter_timing_t _defaults = {
     LOG_T_INIT_OBJ("filter.timing"),
     0, 0,
     TIMING_MODE_KEEP, 0, 0, 0, 0, 0.0, 0,
+    0.0, 0.0, 0.0, 0, 0, 1,
+    0, 50000,
+    0, 0, 0,
     0, 0
 };
 
@@ -57,30 +76,144 @@ core_log_t* filter_timing_log()
     return &_log;
 }
 
-static void _keep(filter_timing_t* self, const core_object_pcap_t* pkt)
-{
 #if HAVE_CLOCK_NANOSLEEP
-    struct timespec to = {
-        _self->diff.tv_sec + pkt->ts.sec,
-        _self->diff.tv_nsec + pkt->ts.nsec
-    };
-    int ret = EINTR;
+static inline uint64_t _now(filter_timing_t* self)
+{
+    struct timespec ts;
 
-    if (to.tv_nsec >= N1e9) {
-        to.tv_sec += 1;
-        to.tv_nsec -= N1e9;
-    } else if (to.tv_nsec < 0) {
-        to.tv_sec -= 1;
-        to.tv_nsec += N1e9;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        lfatal("clock_gettime()");
     }
+    return (uint64_t)ts.tv_sec * N1e9 + ts.tv_nsec;
+}
 
-    while (ret) {
-        ldebug("keep mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
-        ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
-        if (ret && ret != EINTR) {
-            lfatal("clock_nanosleep(%ld.%09ld) %d", to.tv_sec, to.tv_nsec, ret);
+/*
+ * Wait until the target time, sleeping for the most part of long waits and
+ * polling the clock for the rest. Packets that are due before the end of
+ * the current quantum are released without reading the clock, which keeps
+ * high packet rates from turning into a syscall per packet.
+ */
+static void _pace(filter_timing_t* self, uint64_t target)
+{
+    struct timespec to;
+    uint64_t        now;
+    int             ret;
+
+    _self->due = target;
+    if (target <= _self->release_until) {
+        lib_histogram_record(self->lateness, _self->now > target ? _self->now - target : 0);
+        return;
+    }
+
+    now = _now(self);
+    if (target > now + self->spin) {
+        to.tv_sec  = (target - self->spin) / N1e9;
+        to.tv_nsec = (target - self->spin) % N1e9;
+        ret        = EINTR;
+        while (ret) {
+            ldebug("sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
+            ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
+            if (ret && ret != EINTR) {
+                lfatal("clock_nanosleep(%ld.%09ld) %d", to.tv_sec, to.tv_nsec, ret);
+            }
         }
+        self->sleeps++;
+        now = _now(self);
     }
+    while (now < target) {
+        now = _now(self);
+    }
+
+    _self->now           = now;
+    _self->release_until = now + self->quantum;
+    lib_histogram_record(self->lateness, now - target);
+}
+
+/*
+ * Advance the schedule by the given gap, the next packet is due relative to
+ * when the last packet was due and not when it was released so any lag is
+ * caught up with.
+ */
+static inline void _advance(filter_timing_t* self, const struct timespec* gap)
+{
+    if (gap->tv_sec > -1 && gap->tv_nsec > -1) {
+        _self->target += (uint64_t)gap->tv_sec * N1e9 + gap->tv_nsec;
+    }
+    _pace(self, _self->target);
+}
+
+static double _rate_at(filter_timing_t* self, uint64_t elapsed)
+{
+    double rate = self->rate;
+
+    if (self->rate_step != 0.0 && self->rate_interval) {
+        if (self->rate_linear) {
+            rate += self->rate_step * ((double)elapsed / self->rate_interval);
+        } else {
+            rate += self->rate_step * (double)(elapsed / self->rate_interval);
+        }
+        if (self->rate_max > 0.0 && rate > self->rate_max) {
+            rate = self->rate_max;
+        }
+    }
+
+    return rate;
+}
+
+/*
+ * The gaps are added to the schedule, not slept, so the rate is kept
+ * against the clock regardless of how long each packet took to process.
+ */
+static inline void _schedule(filter_timing_t* self, double gap)
+{
+    uint64_t whole;
+
+    _self->carry += gap;
+    whole = (uint64_t)_self->carry;
+    _self->carry -= whole;
+    _self->target += whole;
+    _pace(self, _self->target);
+}
+
+static void _rate(filter_timing_t* self, const core_object_pcap_t* pkt)
+{
+    double rate = _rate_at(self, _self->target - _self->start);
+
+    if (rate > 0.0) {
+        _schedule(self, N1e9 / rate);
+    }
+}
+
+/*
+ * xorshift64*, the arrivals are portable and the same for a given seed.
+ */
+static inline double _uniform(filter_timing_t* self)
+{
+    _self->rng ^= _self->rng >> 12;
+    _self->rng ^= _self->rng << 25;
+    _self->rng ^= _self->rng >> 27;
+
+    /* (0, 1] */
+    return (double)(((_self->rng * 0x2545f4914f6cdd1dULL) >> 11) + 1) / 9007199254740992.0;
+}
+
+static void _poisson(filter_timing_t* self, const core_object_pcap_t* pkt)
+{
+    double rate = _rate_at(self, _self->target - _self->start);
+
+    if (rate > 0.0) {
+        _schedule(self, -log(_uniform(self)) * N1e9 / rate);
+    }
+}
+#endif
+
+static void _keep(filter_timing_t* self, const core_object_pcap_t* pkt)
+{
+#if HAVE_CLOCK_NANOSLEEP
+    int64_t to = pkt->ts.sec * N1e9 + pkt->ts.nsec + _self->offset;
+
+    /* Due relative to the start of the capture, so there is no drift. */
+    _pace(self, to > 0 ? (uint64_t)to : 0);
 #elif HAVE_NANOSLEEP
     struct timespec diff = {
         pkt->ts.sec - _self->last_pkthdr_ts.sec,
@@ -118,7 +251,6 @@ static void _increase(filter_timing_t* self, const core_object_pcap_t* pkt)
         pkt->ts.sec - _self->last_pkthdr_ts.sec,
         pkt->ts.nsec - _self->last_pkthdr_ts.nsec
     };
-    int ret = EINTR;
 
     if (diff.tv_nsec >= N1e9) {
         diff.tv_sec += 1;
@@ -135,29 +267,12 @@ static void _increase(filter_timing_t* self, const core_object_pcap_t* pkt)
         diff.tv_nsec -= N1e9;
     }
 
-    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
 #if HAVE_CLOCK_NANOSLEEP
-        struct timespec to = {
-            _self->last_ts.tv_sec + diff.tv_sec,
-            _self->last_ts.tv_nsec + diff.tv_nsec
-        };
-
-        if (to.tv_nsec >= N1e9) {
-            to.tv_sec += 1;
-            to.tv_nsec -= N1e9;
-        } else if (to.tv_nsec < 0) {
-            to.tv_sec -= 1;
-            to.tv_nsec += N1e9;
-        }
-
-        while (ret) {
-            ldebug("increase mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
-            ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
-            if (ret && ret != EINTR) {
-                lfatal("clock_nanosleep(%ld.%09ld) %d", to.tv_sec, to.tv_nsec, ret);
-            }
-        }
+    _advance(self, &diff);
 #elif HAVE_NANOSLEEP
+    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
+        int ret = EINTR;
+
         while (ret) {
             ldebug("increase mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -167,16 +282,10 @@ static void _increase(filter_timing_t* self, const core_object_pcap_t* pkt)
                 }
             }
         }
-#endif
     }
+#endif
 
     _self->last_pkthdr_ts = pkt->ts;
-
-#if HAVE_CLOCK_NANOSLEEP
-    if (clock_gettime(CLOCK_MONOTONIC, &_self->last_ts)) {
-        lfatal("clock_gettime()");
-    }
-#endif
 }
 
 static void _reduce(filter_timing_t* self, const core_object_pcap_t* pkt)
@@ -185,7 +294,6 @@ static void _reduce(filter_timing_t* self, const core_object_pcap_t* pkt)
         pkt->ts.sec - _self->last_pkthdr_ts.sec,
         pkt->ts.nsec - _self->last_pkthdr_ts.nsec
     };
-    int ret = EINTR;
 
     if (diff.tv_nsec >= N1e9) {
         diff.tv_sec += 1;
@@ -202,29 +310,12 @@ static void _reduce(filter_timing_t* self, const core_object_pcap_t* pkt)
         diff.tv_nsec += N1e9;
     }
 
-    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
 #if HAVE_CLOCK_NANOSLEEP
-        struct timespec to = {
-            _self->last_ts.tv_sec + diff.tv_sec,
-            _self->last_ts.tv_nsec + diff.tv_nsec
-        };
-
-        if (to.tv_nsec >= N1e9) {
-            to.tv_sec += 1;
-            to.tv_nsec -= N1e9;
-        } else if (to.tv_nsec < 0) {
-            to.tv_sec -= 1;
-            to.tv_nsec += N1e9;
-        }
-
-        while (ret) {
-            ldebug("reduce mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
-            ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
-            if (ret && ret != EINTR) {
-                lfatal("clock_nanosleep(%ld.%09ld) %d", to.tv_sec, to.tv_nsec, ret);
-            }
-        }
+    _advance(self, &diff);
 #elif HAVE_NANOSLEEP
+    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
+        int ret = EINTR;
+
         while (ret) {
             ldebug("reduce mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -234,16 +325,10 @@ static void _reduce(filter_timing_t* self, const core_object_pcap_t* pkt)
                 }
             }
         }
-#endif
     }
+#endif
 
     _self->last_pkthdr_ts = pkt->ts;
-
-#if HAVE_CLOCK_NANOSLEEP
-    if (clock_gettime(CLOCK_MONOTONIC, &_self->last_ts)) {
-        lfatal("clock_gettime()");
-    }
-#endif
 }
 
 static void _multiply(filter_timing_t* self, const core_object_pcap_t* pkt)
@@ -252,7 +337,6 @@ static void _multiply(filter_timing_t* self, const core_object_pcap_t* pkt)
         pkt->ts.sec - _self->last_pkthdr_ts.sec,
         pkt->ts.nsec - _self->last_pkthdr_ts.nsec
     };
-    int ret = EINTR;
 
     if (diff.tv_nsec >= N1e9) {
         diff.tv_sec += 1;
@@ -269,29 +353,12 @@ static void _multiply(filter_timing_t* self, const core_object_pcap_t* pkt)
         diff.tv_nsec %= N1e9;
     }
 
-    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
 #if HAVE_CLOCK_NANOSLEEP
-        struct timespec to = {
-            _self->last_ts.tv_sec + diff.tv_sec,
-            _self->last_ts.tv_nsec + diff.tv_nsec
-        };
-
-        if (to.tv_nsec >= N1e9) {
-            to.tv_sec += 1;
-            to.tv_nsec -= N1e9;
-        } else if (to.tv_nsec < 0) {
-            to.tv_sec -= 1;
-            to.tv_nsec += N1e9;
-        }
-
-        while (ret) {
-            ldebug("multiply mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
-            ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
-            if (ret && ret != EINTR) {
-                lfatal("clock_nanosleep(%ld.%09ld) %d", to.tv_sec, to.tv_nsec, ret);
-            }
-        }
+    _advance(self, &diff);
 #elif HAVE_NANOSLEEP
+    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
+        int ret = EINTR;
+
         while (ret) {
             ldebug("multiply mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -301,16 +368,10 @@ static void _multiply(filter_timing_t* self, const core_object_pcap_t* pkt)
                 }
             }
         }
-#endif
     }
+#endif
 
     _self->last_pkthdr_ts = pkt->ts;
-
-#if HAVE_CLOCK_NANOSLEEP
-    if (clock_gettime(CLOCK_MONOTONIC, &_self->last_ts)) {
-        lfatal("clock_gettime()");
-    }
-#endif
 }
 
 static void _fixed(filter_timing_t* self, const core_object_pcap_t* pkt)
@@ -319,31 +380,13 @@ static void _fixed(filter_timing_t* self, const core_object_pcap_t* pkt)
         _self->mod_ts.tv_sec,
         _self->mod_ts.tv_nsec
     };
-    int ret = EINTR;
 
-    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
 #if HAVE_CLOCK_NANOSLEEP
-        struct timespec to = {
-            _self->last_ts.tv_sec + diff.tv_sec,
-            _self->last_ts.tv_nsec + diff.tv_nsec
-        };
-
-        if (to.tv_nsec >= N1e9) {
-            to.tv_sec += 1;
-            to.tv_nsec -= N1e9;
-        } else if (to.tv_nsec < 0) {
-            to.tv_sec -= 1;
-            to.tv_nsec += N1e9;
-        }
-
-        while (ret) {
-            ldebug("fixed mode, sleep to %ld.%09ld", to.tv_sec, to.tv_nsec);
-            ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &to, 0);
-            if (ret && ret != EINTR) {
-                lfatal("clock_nanosleep(%ld.%09ld) %d", to.tv_sec, to.tv_nsec, ret);
-            }
-        }
+    _advance(self, &diff);
 #elif HAVE_NANOSLEEP
+    if (diff.tv_sec > -1 && diff.tv_nsec > -1) {
+        int ret = EINTR;
+
         while (ret) {
             ldebug("fixed mode, sleep for %ld.%09ld", diff.tv_sec, diff.tv_nsec);
             if ((ret = nanosleep(&diff, &diff))) {
@@ -353,16 +396,10 @@ static void _fixed(filter_timing_t* self, const core_object_pcap_t* pkt)
                 }
             }
         }
-#endif
     }
+#endif
 
     _self->last_pkthdr_ts = pkt->ts;
-
-#if HAVE_CLOCK_NANOSLEEP
-    if (clock_gettime(CLOCK_MONOTONIC, &_self->last_ts)) {
-        lfatal("clock_gettime()");
-    }
-#endif
 }
 
 #if HAVE_CLOCK_NANOSLEEP
@@ -440,6 +477,13 @@ static void _init(filter_timing_t* self, const core_object_pcap_t* pkt)
     ldebug("init with clock_nanosleep() now is %ld.%09ld, diff of first pkt %ld.%09ld",
         _self->last_ts.tv_sec, _self->last_ts.tv_nsec,
         _self->diff.tv_sec, _self->diff.tv_nsec);
+
+    _self->target        = (uint64_t)_self->last_ts.tv_sec * N1e9 + _self->last_ts.tv_nsec;
+    _self->offset        = (int64_t)_self->target - (pkt->ts.sec * N1e9 + pkt->ts.nsec);
+    _self->start         = _self->target;
+    _self->due           = _self->target;
+    _self->now           = _self->target;
+    _self->release_until = _self->target + self->quantum;
 #elif HAVE_NANOSLEEP
     ldebug("init with nanosleep()");
 #else
@@ -484,6 +528,25 @@ static void _init(filter_timing_t* self, const core_object_pcap_t* pkt)
         _self->mod_ts.tv_nsec  = pkt->ts.nsec;
 #else
         lfatal("realtime mode requires clock_nanosleep()");
+#endif
+        break;
+    case TIMING_MODE_RATE:
+#if HAVE_CLOCK_NANOSLEEP
+        ldebug("init mode rate %f pps", self->rate);
+        _self->timing_callback = _rate;
+        _self->carry           = 0.0;
+#else
+        lfatal("rate mode requires clock_nanosleep()");
+#endif
+        break;
+    case TIMING_MODE_POISSON:
+#if HAVE_CLOCK_NANOSLEEP
+        ldebug("init mode poisson %f pps", self->rate);
+        _self->timing_callback = _poisson;
+        _self->carry           = 0.0;
+        _self->rng             = self->seed ? self->seed : 1;
+#else
+        lfatal("poisson mode requires clock_nanosleep()");
 #endif
         break;
     default:
@@ -494,9 +557,10 @@ static void _init(filter_timing_t* self, const core_object_pcap_t* pkt)
 filter_timing_t* filter_timing_new()
 {
     filter_timing_t* self;
-    mlfatal_oom(self = malloc(sizeof(_filter_timing_t)));
+    mlfatal_oom(self = calloc(1, sizeof(_filter_timing_t)));
     *self                  = _defaults;
     _self->timing_callback = _init;
+    lfatal_oom(self->lateness = lib_histogram_new(1000, 60 * (uint64_t)N1e9, 2));
 
     return self;
 }
@@ -504,9 +568,47 @@ filter_timing_t* filter_timing_new()
 void filter_timing_free(filter_timing_t* self)
 {
     mlassert_self();
+    lib_histogram_free(self->lateness);
     free(self);
 }
 
+double filter_timing_target_rate(filter_timing_t* self)
+{
+    mlassert_self();
+
+#if HAVE_CLOCK_NANOSLEEP
+    if (self->mode == TIMING_MODE_RATE || self->mode == TIMING_MODE_POISSON) {
+        return _rate_at(self, _self->start ? _now(self) - _self->start : 0);
+    }
+#endif
+    return 0.0;
+}
+
+int64_t filter_timing_scheduled(filter_timing_t* self)
+{
+    mlassert_self();
+
+#if HAVE_CLOCK_NANOSLEEP
+    return (int64_t)(_self->due - _self->start);
+#else
+    return 0;
+#endif
+}
+
+double filter_timing_achieved_rate(filter_timing_t* self)
+{
+    mlassert_self();
+
+#if HAVE_CLOCK_NANOSLEEP
+    uint64_t elapsed;
+
+    if (_self->start && (elapsed = _now(self) - _self->start)) {
+        return (double)self->released * N1e9 / elapsed;
+    }
+#endif
+    return 0.0;
+}
+
 static void _receive(filter_timing_t* self, const core_object_t* obj)
 {
     mlassert_self();
@@ -517,6 +619,7 @@ static void _receive(filter_timing_t* self, const core_object_t* obj)
     }
 
     _self->timing_callback(self, (core_object_pcap_t*)obj);
+    self->released++;
     self->recv(self->ctx, obj);
 }
 
@@ -542,6 +645,7 @@ static const core_object_t* _produce(filter_timing_t* self)
     }
 
     _self->timing_callback(self, (core_object_pcap_t*)obj);
+    self->released++;
     return obj;
 }
 
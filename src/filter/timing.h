@@ -21,6 +21,7 @@
 #include "core/log.h"
 #include "core/receiver.h"
 #include "core/producer.h"
+#include "lib/histogram.h"
 
 #ifndef __dnsjit_filter_timing_h
 #define __dnsjit_filter_timing_h
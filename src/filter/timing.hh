@@ -22,6 +22,7 @@
 //lua:require("dnsjit.core.receiver_h")
 //lua:require("dnsjit.core.producer_h")
 //lua:require("dnsjit.core.timespec_h")
+//lua:require("dnsjit.lib.histogram_h")
 
 typedef struct filter_timing {
     core_log_t      _log;
@@ -33,12 +34,34 @@ typedef struct filter_timing {
         TIMING_MODE_REDUCE   = 2,
         TIMING_MODE_MULTIPLY = 3,
         TIMING_MODE_FIXED    = 4,
-        TIMING_MODE_REALTIME = 5
+        TIMING_MODE_REALTIME = 5,
+        TIMING_MODE_RATE     = 6,
+        TIMING_MODE_POISSON  = 7
     } mode;
     size_t   inc, red, fixed, rt_batch;
     float    mul;
     uint64_t rt_drift;
 
+    /* Packets per second for the rate and poisson modes, increased by
+     * rate_step every rate_interval ns (continuously if rate_linear is set)
+     * up to rate_max if not 0. The poisson mode draws the gaps between
+     * packets from an exponential distribution using the seed. */
+    double   rate, rate_step, rate_max;
+    uint64_t rate_interval;
+    int      rate_linear;
+    uint64_t seed;
+
+    /* Packets due within quantum ns of the last clock reading are released
+     * together without waiting, waits shorter than spin ns are done by
+     * polling the clock instead of sleeping. */
+    uint64_t quantum, spin;
+
+    /* Lateness in ns of each packet released against its scheduled time,
+     * early packets are recorded as 0. */
+    lib_histogram_t* lateness;
+    uint64_t         sleeps;
+    uint64_t         released;
+
     core_producer_t prod;
     void*           prod_ctx;
 } filter_timing_t;
@@ -47,6 +70,9 @@ core_log_t* filter_timing_log();
 
 filter_timing_t* filter_timing_new();
 void filter_timing_free(filter_timing_t* self);
+double filter_timing_target_rate(filter_timing_t* self);
+double filter_timing_achieved_rate(filter_timing_t* self);
+int64_t filter_timing_scheduled(filter_timing_t* self);
 
 core_receiver_t filter_timing_receiver(filter_timing_t* self);
 core_producer_t filter_timing_producer(filter_timing_t* self);
@@ -24,11 +24,24 @@
 --
 -- Filter to manipulate processing so it simulates the actual timing when
 -- packets arrived or to delay processing.
+-- .P
+-- Each packet is given a time it is due on a schedule that follows the
+-- capture, or the modified timing between packets, so any lag is caught up
+-- with instead of accumulating.
+-- Long waits sleep until shortly before the packet is due and poll the
+-- clock for the rest of the wait, see
+-- .IR spin() ,
+-- and packets due within a
+-- .I quantum
+-- of each other can be released together.
+-- How late packets were released is recorded in a histogram, see
+-- .IR lateness() .
 module(...,package.seeall)
 
 require("dnsjit.filter.timing_h")
 local ffi = require("ffi")
 local C = ffi.C
+local Histogram = require("dnsjit.lib.histogram")
 
 local Timing = {}
 
@@ -71,6 +84,11 @@ end
 
 -- Set the timing mode to multiply the timing between packets by the given
 -- factor (float/double).
+-- This also changes the timing between the queries of each client.
+-- To increase the rate while keeping the timing of each client, see
+-- .I overlay()
+-- in
+-- .IR dnsjit.input.merge .
 function Timing:multiply(factor)
     self.obj.mode = "TIMING_MODE_MULTIPLY"
     self.obj.mul = factor
@@ -98,6 +116,117 @@ function Timing:realtime(drift, batch_size)
     self.obj.rt_drift = math.floor(drift * 1000000000)
 end
 
+-- Set the timing mode to release packets at a fixed rate of
+-- .I pps
+-- packets per second, regardless of the timing in the capture.
+function Timing:rate(pps)
+    self.obj.mode = "TIMING_MODE_RATE"
+    self.obj.rate = pps
+    self.obj.rate_step = 0
+end
+
+-- Set the timing mode to a rate that starts at
+-- .I pps
+-- packets per second and is increased by
+-- .I step
+-- every
+-- .I interval
+-- seconds, up to
+-- .I max
+-- packets per second (nil or 0 for no limit).
+-- If
+-- .I linear
+-- is true the rate is increased continuously instead of in steps.
+-- For example
+-- .I ramp(10000, 10000, 30)
+-- adds 10k QPS every 30 seconds.
+function Timing:ramp(pps, step, interval, max, linear)
+    self.obj.mode = "TIMING_MODE_RATE"
+    self.obj.rate = pps
+    self.obj.rate_step = step
+    self.obj.rate_interval = math.floor(interval * 1000000000)
+    self.obj.rate_max = max or 0
+    if linear == true then
+        self.obj.rate_linear = 1
+    else
+        self.obj.rate_linear = 0
+    end
+end
+
+-- Set the timing mode to release packets as a Poisson process, with the
+-- gaps between packets drawn from an exponential distribution with a mean
+-- rate of
+-- .I pps
+-- packets per second.
+-- The optional
+-- .I seed
+-- (default 1) makes the arrivals reproducible.
+-- If called after
+-- .I ramp()
+-- with
+-- .I pps
+-- as nil the mean rate follows the ramp.
+function Timing:poisson(pps, seed)
+    self.obj.mode = "TIMING_MODE_POISSON"
+    if pps ~= nil then
+        self.obj.rate = pps
+        self.obj.rate_step = 0
+    end
+    self.obj.seed = seed or 1
+end
+
+-- Return the current target rate, in packets per second, of the rate and
+-- poisson modes.
+function Timing:target_rate()
+    return C.filter_timing_target_rate(self.obj)
+end
+
+-- Return the rate, in packets per second, achieved since the first packet.
+function Timing:achieved_rate()
+    return C.filter_timing_achieved_rate(self.obj)
+end
+
+-- Return when the last packet was due, in nanoseconds since the first
+-- packet, as computed by the schedule and regardless of when it was
+-- released.
+-- Not used in the realtime mode.
+function Timing:scheduled()
+    return tonumber(C.filter_timing_scheduled(self.obj))
+end
+
+-- Return the number of packets released.
+function Timing:released()
+    return tonumber(self.obj.released)
+end
+
+-- Set the number of nanoseconds within which packets are released
+-- together without waiting or reading the clock, default 0.
+-- A quantum of some microseconds greatly reduces the overhead at high
+-- packet rates at the cost of releasing packets up to that much early.
+function Timing:quantum(ns)
+    self.obj.quantum = ns
+end
+
+-- Set the number of nanoseconds before a packet is due to stop sleeping and
+-- poll the clock instead, default 50000 (50us).
+-- Waits shorter than this never sleep.
+function Timing:spin(ns)
+    self.obj.spin = ns
+end
+
+-- Return the histogram, as
+-- .IR dnsjit.lib.histogram ,
+-- of how many nanoseconds late the packets were released.
+-- Not used in the realtime mode.
+function Timing:lateness()
+    return Histogram.wrap(self.obj.lateness)
+end
+
+-- Return the number of times the filter slept.
+function Timing:sleeps()
+    return tonumber(self.obj.sleeps)
+end
+
 -- Return the C functions and context for receiving objects.
 function Timing:receive()
     return C.filter_timing_receiver(), self.obj
@@ -120,4 +249,5 @@ function Timing:producer(o)
     self._producer = o
 end
 
+-- dnsjit.lib.histogram (3)
 return Timing
@@ -0,0 +1,594 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "filter/topk.h"
+#include "core/assert.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define _NONE UINT32_MAX
+#define _CMS_DEPTH 4
+
+/*
+ * Space-Saving counter, the key is stored separately in the summary.
+ */
+typedef struct _counter {
+    uint64_t count;
+    uint64_t error;
+    uint64_t hash;
+    uint32_t heap;
+    uint16_t len;
+} _counter_t;
+
+/*
+ * Heavy-hitter summary of one dimension: k Space-Saving counters found via
+ * an open addressing hash table (linear probing) and ordered in a min-heap
+ * by count, optionally backed by a Count-Min sketch that tightens the
+ * estimate of newly monitored keys.
+ */
+typedef struct _summary {
+    size_t   key_size;
+    size_t   used;
+    uint64_t total;
+
+    _counter_t* counters;
+    uint8_t*    keys;
+    uint32_t*   heap;
+
+    /* Counter index + 1, 0 is an empty slot. */
+    uint32_t* slots;
+    size_t    mask;
+
+    uint64_t* cms;
+} _summary_t;
+
+typedef struct _filter_topk {
+    filter_topk_t pub;
+
+    _summary_t dim[FILTER_TOPK_DIMS];
+} _filter_topk_t;
+
+#define _self ((_filter_topk_t*)self)
+
+static core_log_t    _log      = LOG_T_INIT("filter.topk");
+static filter_topk_t _defaults = {
+    LOG_T_INIT_OBJ("filter.topk"),
+    0, 0,
+    0, 0,
+    0, 0, 0,
+};
+
+static const size_t _key_size[FILTER_TOPK_DIMS] = {
+    255, /* QNAME */
+    2, /* QTYPE */
+    16, /* CLIENT */
+    1, /* RCODE */
+};
+
+core_log_t* filter_topk_log()
+{
+    return &_log;
+}
+
+static void _summary_init(_summary_t* s, size_t k, size_t key_size, size_t cms_width)
+{
+    size_t slots = 1;
+
+    s->key_size = key_size;
+    s->used     = 0;
+    s->total    = 0;
+
+    /* Keep the load factor of the table at most 0.5. */
+    while (slots < k * 2)
+        slots <<= 1;
+    s->mask = slots - 1;
+
+    glfatal_oom(s->counters = malloc(k * sizeof(_counter_t)));
+    glfatal_oom(s->keys = malloc(k * key_size));
+    glfatal_oom(s->heap = malloc(k * sizeof(uint32_t)));
+    glfatal_oom(s->slots = calloc(slots, sizeof(uint32_t)));
+    s->cms = 0;
+    if (cms_width) {
+        glfatal_oom(s->cms = calloc(_CMS_DEPTH * cms_width, sizeof(uint64_t)));
+    }
+}
+
+static void _summary_reset(_summary_t* s, size_t cms_width)
+{
+    s->used  = 0;
+    s->total = 0;
+    memset(s->slots, 0, (s->mask + 1) * sizeof(uint32_t));
+    if (s->cms)
+        memset(s->cms, 0, _CMS_DEPTH * cms_width * sizeof(uint64_t));
+}
+
+static void _summary_free(_summary_t* s)
+{
+    free(s->counters);
+    free(s->keys);
+    free(s->heap);
+    free(s->slots);
+    free(s->cms);
+}
+
+filter_topk_t* filter_topk_new(size_t k, size_t cms_width)
+{
+    filter_topk_t* self;
+    int            i;
+
+    mlassert(k > 0 && k < _NONE / 2, "invalid k");
+    mlassert(!(cms_width & (cms_width - 1)), "cms_width must be 0 or a power of 2");
+
+    mlfatal_oom(self = malloc(sizeof(_filter_topk_t)));
+    *self           = _defaults;
+    self->k         = k;
+    self->cms_width = cms_width;
+
+    for (i = 0; i < FILTER_TOPK_DIMS; i++)
+        _summary_init(&_self->dim[i], k, _key_size[i], cms_width);
+
+    return self;
+}
+
+void filter_topk_free(filter_topk_t* self)
+{
+    int i;
+    mlassert_self();
+
+    for (i = 0; i < FILTER_TOPK_DIMS; i++)
+        _summary_free(&_self->dim[i]);
+    free(self);
+}
+
+void filter_topk_reset(filter_topk_t* self)
+{
+    int i;
+    mlassert_self();
+
+    for (i = 0; i < FILTER_TOPK_DIMS; i++)
+        _summary_reset(&_self->dim[i], self->cms_width);
+    self->queries   = 0;
+    self->responses = 0;
+    self->discarded = 0;
+}
+
+/*
+ * FNV-1a with a final avalanche, keys are short and already normalized.
+ */
+static inline uint64_t _hash(const uint8_t* key, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (len--)
+        h = (h ^ *key++) * 1099511628211ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint8_t* _key(_summary_t* s, uint32_t idx)
+{
+    return s->keys + idx * s->key_size;
+}
+
+static uint32_t _find(_summary_t* s, const uint8_t* key, size_t len, uint64_t hash)
+{
+    size_t      i = hash & s->mask;
+    _counter_t* c;
+
+    while (s->slots[i]) {
+        c = &s->counters[s->slots[i] - 1];
+        if (c->hash == hash && c->len == len && !memcmp(_key(s, s->slots[i] - 1), key, len))
+            return s->slots[i] - 1;
+        i = (i + 1) & s->mask;
+    }
+    return _NONE;
+}
+
+static void _table_insert(_summary_t* s, uint32_t idx)
+{
+    size_t i = s->counters[idx].hash & s->mask;
+
+    while (s->slots[i])
+        i = (i + 1) & s->mask;
+    s->slots[i] = idx + 1;
+}
+
+static void _table_remove(_summary_t* s, uint32_t idx)
+{
+    size_t i = s->counters[idx].hash & s->mask, j, k;
+
+    while (s->slots[i] != idx + 1)
+        i = (i + 1) & s->mask;
+
+    /* Backward shift deletion, keeps probe sequences intact without
+     * tombstones. */
+    for (j = i;;) {
+        j = (j + 1) & s->mask;
+        if (!s->slots[j])
+            break;
+        k = s->counters[s->slots[j] - 1].hash & s->mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            s->slots[i] = s->slots[j];
+            i           = j;
+        }
+    }
+    s->slots[i] = 0;
+}
+
+static inline void _heap_set(_summary_t* s, uint32_t pos, uint32_t idx)
+{
+    s->heap[pos]          = idx;
+    s->counters[idx].heap = pos;
+}
+
+static void _sift_down(_summary_t* s, uint32_t pos)
+{
+    uint32_t idx   = s->heap[pos], child;
+    uint64_t count = s->counters[idx].count;
+
+    while ((child = pos * 2 + 1) < s->used) {
+        if (child + 1 < s->used && s->counters[s->heap[child + 1]].count < s->counters[s->heap[child]].count)
+            child++;
+        if (count <= s->counters[s->heap[child]].count)
+            break;
+        _heap_set(s, pos, s->heap[child]);
+        pos = child;
+    }
+    _heap_set(s, pos, idx);
+}
+
+static void _sift_up(_summary_t* s, uint32_t pos)
+{
+    uint32_t idx   = s->heap[pos], parent;
+    uint64_t count = s->counters[idx].count;
+
+    while (pos) {
+        parent = (pos - 1) / 2;
+        if (s->counters[s->heap[parent]].count <= count)
+            break;
+        _heap_set(s, pos, s->heap[parent]);
+        pos = parent;
+    }
+    _heap_set(s, pos, idx);
+}
+
+/*
+ * Count-Min rows are indexed by double hashing of the key hash.
+ */
+static uint64_t _cms_add(_summary_t* s, size_t width, uint64_t hash, uint64_t n)
+{
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    uint64_t est = UINT64_MAX, *cell;
+    int      row;
+
+    for (row = 0; row < _CMS_DEPTH; row++) {
+        cell = &s->cms[row * width + ((h1 + row * h2) & (width - 1))];
+        *cell += n;
+        if (*cell < est)
+            est = *cell;
+    }
+    return est;
+}
+
+static uint64_t _cms_get(_summary_t* s, size_t width, uint64_t hash)
+{
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    uint64_t est = UINT64_MAX, cell;
+    int      row;
+
+    for (row = 0; row < _CMS_DEPTH; row++) {
+        cell = s->cms[row * width + ((h1 + row * h2) & (width - 1))];
+        if (cell < est)
+            est = cell;
+    }
+    return est;
+}
+
+static void _add(filter_topk_t* self, _summary_t* s, const uint8_t* key, size_t len, uint64_t n)
+{
+    uint64_t    hash = _hash(key, len), est = UINT64_MAX, min;
+    uint32_t    idx;
+    _counter_t* c;
+
+    s->total += n;
+    if (s->cms)
+        est = _cms_add(s, self->cms_width, hash, n);
+
+    if ((idx = _find(s, key, len, hash)) != _NONE) {
+        s->counters[idx].count += n;
+        _sift_down(s, s->counters[idx].heap);
+        return;
+    }
+
+    if (s->used < self->k) {
+        idx      = s->used++;
+        c        = &s->counters[idx];
+        c->count = n;
+        c->error = 0;
+        c->hash  = hash;
+        c->len   = len;
+        memcpy(_key(s, idx), key, len);
+        _table_insert(s, idx);
+        s->heap[idx] = idx;
+        _sift_up(s, idx);
+        return;
+    }
+
+    /* Replace the counter with the lowest count, the new key may have been
+     * seen up to that many times before. The Count-Min estimate is also an
+     * upper bound and is used if it is lower. */
+    idx = s->heap[0];
+    c   = &s->counters[idx];
+    min = c->count;
+    _table_remove(s, idx);
+
+    c->count = min + n;
+    c->error = min;
+    if (est < c->count) {
+        c->count = est;
+        c->error = est - n;
+    }
+    c->hash = hash;
+    c->len  = len;
+    memcpy(_key(s, idx), key, len);
+    _table_insert(s, idx);
+    _sift_down(s, 0);
+}
+
+void filter_topk_add(filter_topk_t* self, filter_topk_dim_t dim, const uint8_t* key, size_t len, uint64_t n)
+{
+    mlassert_self();
+    lassert(dim < FILTER_TOPK_DIMS, "invalid dim");
+    lassert(key, "key is nil");
+    lassert(len <= _key_size[dim], "key too long");
+
+    _add(self, &_self->dim[dim], key, len, n);
+}
+
+uint64_t filter_topk_total(filter_topk_t* self, filter_topk_dim_t dim)
+{
+    mlassert_self();
+    lassert(dim < FILTER_TOPK_DIMS, "invalid dim");
+
+    return _self->dim[dim].total;
+}
+
+uint64_t filter_topk_estimate(filter_topk_t* self, filter_topk_dim_t dim, const uint8_t* key, size_t len)
+{
+    _summary_t* s;
+    uint64_t    hash, est;
+    uint32_t    idx;
+    mlassert_self();
+    lassert(dim < FILTER_TOPK_DIMS, "invalid dim");
+    lassert(key, "key is nil");
+
+    s    = &_self->dim[dim];
+    hash = _hash(key, len);
+    if ((idx = _find(s, key, len, hash)) != _NONE)
+        return s->counters[idx].count;
+    if (s->used < self->k)
+        return 0;
+
+    est = s->counters[s->heap[0]].count;
+    if (s->cms) {
+        uint64_t cms = _cms_get(s, self->cms_width, hash);
+        if (cms < est)
+            est = cms;
+    }
+    return est;
+}
+
+static int _item_cmp(const void* a, const void* b)
+{
+    uint64_t ca = ((const filter_topk_item_t*)a)->count, cb = ((const filter_topk_item_t*)b)->count;
+
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static void _collect(_summary_t* s, filter_topk_item_t* items)
+{
+    size_t i;
+
+    for (i = 0; i < s->used; i++) {
+        items[i].count = s->counters[i].count;
+        items[i].error = s->counters[i].error;
+        items[i].len   = s->counters[i].len;
+        memcpy(items[i].key, _key(s, i), s->counters[i].len);
+    }
+}
+
+size_t filter_topk_snapshot(filter_topk_t* self, filter_topk_dim_t dim, filter_topk_item_t* items, size_t n)
+{
+    _summary_t*         s;
+    filter_topk_item_t* all;
+    mlassert_self();
+    lassert(dim < FILTER_TOPK_DIMS, "invalid dim");
+    lassert(items || !n, "items is nil");
+
+    s = &_self->dim[dim];
+    if (!s->used || !n)
+        return 0;
+
+    lfatal_oom(all = malloc(s->used * sizeof(filter_topk_item_t)));
+    _collect(s, all);
+    qsort(all, s->used, sizeof(filter_topk_item_t), _item_cmp);
+    if (n > s->used)
+        n = s->used;
+    memcpy(items, all, n * sizeof(filter_topk_item_t));
+    free(all);
+
+    return n;
+}
+
+/*
+ * Merge two summaries as described for mergeable Space-Saving summaries:
+ * keys missing from one side may have been counted up to its lowest count,
+ * so that is added to both count and error, then the k largest are kept.
+ */
+static void _merge(filter_topk_t* self, _summary_t* s, _summary_t* o)
+{
+    filter_topk_item_t* items;
+    uint64_t            s_min = 0, o_min = 0;
+    size_t              i, n, width = self->cms_width;
+    uint32_t            idx;
+    uint8_t*            seen;
+
+    if (s->used == self->k)
+        s_min = s->counters[s->heap[0]].count;
+    if (o->used == self->k)
+        o_min = o->counters[o->heap[0]].count;
+
+    glfatal_oom(items = malloc((s->used + o->used) * sizeof(filter_topk_item_t)));
+    glfatal_oom(seen = calloc(s->used ? s->used : 1, 1));
+    _collect(s, items);
+    n = s->used;
+
+    for (i = 0; i < o->used; i++) {
+        idx = _find(s, _key(o, i), o->counters[i].len, o->counters[i].hash);
+        if (idx != _NONE) {
+            items[idx].count += o->counters[i].count;
+            items[idx].error += o->counters[i].error;
+            seen[idx] = 1;
+            continue;
+        }
+        items[n].count = o->counters[i].count + s_min;
+        items[n].error = o->counters[i].error + s_min;
+        items[n].len   = o->counters[i].len;
+        memcpy(items[n].key, _key(o, i), o->counters[i].len);
+        n++;
+    }
+    for (i = 0; i < s->used; i++) {
+        if (!seen[i]) {
+            items[i].count += o_min;
+            items[i].error += o_min;
+        }
+    }
+    free(seen);
+
+    qsort(items, n, sizeof(filter_topk_item_t), _item_cmp);
+    if (n > self->k)
+        n = self->k;
+
+    memset(s->slots, 0, (s->mask + 1) * sizeof(uint32_t));
+    for (i = 0; i < n; i++) {
+        s->counters[i].count = items[i].count;
+        s->counters[i].error = items[i].error;
+        s->counters[i].len   = items[i].len;
+        s->counters[i].hash  = _hash(items[i].key, items[i].len);
+        memcpy(_key(s, i), items[i].key, items[i].len);
+        _table_insert(s, i);
+        _heap_set(s, i, i);
+    }
+    s->used = n;
+    for (i = n / 2; i--;)
+        _sift_down(s, i);
+    free(items);
+
+    s->total += o->total;
+    if (s->cms) {
+        for (i = 0; i < _CMS_DEPTH * width; i++)
+            s->cms[i] += o->cms[i];
+    }
+}
+
+int filter_topk_merge(filter_topk_t* self, filter_topk_t* other)
+{
+    int i;
+    mlassert_self();
+    lassert(other, "other is nil");
+
+    if (other->k != self->k || other->cms_width != self->cms_width) {
+        lcritical("unable to merge, k and cms_width must be the same");
+        return -1;
+    }
+
+    for (i = 0; i < FILTER_TOPK_DIMS; i++)
+        _merge(self, &_self->dim[i], &((_filter_topk_t*)other)->dim[i]);
+    self->queries += other->queries;
+    self->responses += other->responses;
+    self->discarded += other->discarded;
+
+    return 0;
+}
+
+int filter_topk_process(filter_topk_t* self, const core_object_t* obj)
+{
+    core_object_dns_layers_t layers;
+    uint8_t                  qname[255];
+    size_t                   len;
+    mlassert_self();
+
+    if (core_object_dns_layers(&layers, obj)) {
+        self->discarded++;
+        ldebug("packet discarded (missing payload, udp/tcp or ip/ip6 object)");
+        return -1;
+    }
+
+    core_object_dns_t dns = CORE_OBJECT_DNS_INIT(layers.payload);
+    dns.includes_dnslen   = layers.proto->obj_type == CORE_OBJECT_TCP;
+    if (core_object_dns_parse_header(&dns)) {
+        self->discarded++;
+        ldebug("packet discarded (malformed DNS header)");
+        return -1;
+    }
+
+    if (dns.qr) {
+        self->responses++;
+        _add(self, &_self->dim[FILTER_TOPK_RCODE], &dns.rcode, 1, 1);
+        return 0;
+    }
+
+    self->queries++;
+    if (layers.ip->obj_type == CORE_OBJECT_IP)
+        _add(self, &_self->dim[FILTER_TOPK_CLIENT], ((const core_object_ip_t*)layers.ip)->src, 4, 1);
+    else
+        _add(self, &_self->dim[FILTER_TOPK_CLIENT], ((const core_object_ip6_t*)layers.ip)->src, 16, 1);
+
+    if (dns.qdcount && (len = core_object_dns_name_copy_lower(qname, dns.at, dns.left))) {
+        _add(self, &_self->dim[FILTER_TOPK_QNAME], qname, len, 1);
+        /* QTYPE follows the QNAME, kept in network byte order. */
+        if (dns.left >= len + 2)
+            _add(self, &_self->dim[FILTER_TOPK_QTYPE], dns.at + len, 2, 1);
+    }
+
+    return 0;
+}
+
+static void _receive(filter_topk_t* self, const core_object_t* obj)
+{
+    mlassert_self();
+
+    filter_topk_process(self, obj);
+    if (self->recv)
+        self->recv(self->recv_ctx, obj);
+}
+
+core_receiver_t filter_topk_receiver(filter_topk_t* self)
+{
+    return (core_receiver_t)_receive;
+}
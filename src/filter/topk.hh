@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+
+typedef enum filter_topk_dim {
+    FILTER_TOPK_QNAME,
+    FILTER_TOPK_QTYPE,
+    FILTER_TOPK_CLIENT,
+    FILTER_TOPK_RCODE,
+    FILTER_TOPK_DIMS
+} filter_topk_dim_t;
+
+typedef struct filter_topk_item {
+    /* Estimated count, the true count is between count - error and count. */
+    uint64_t count;
+    uint64_t error;
+
+    /* Lowercased uncompressed wire-format QNAME, QTYPE and RCODE in network
+     * byte order or client address (4 or 16 bytes). */
+    uint16_t len;
+    uint8_t  key[255];
+} filter_topk_item_t;
+
+typedef struct filter_topk {
+    core_log_t _log;
+
+    /* Receiver to pass all objects on to. */
+    core_receiver_t recv;
+    void*           recv_ctx;
+
+    size_t k;
+    size_t cms_width;
+
+    uint64_t queries;
+    uint64_t responses;
+    uint64_t discarded;
+} filter_topk_t;
+
+core_log_t* filter_topk_log();
+
+filter_topk_t* filter_topk_new(size_t k, size_t cms_width);
+void filter_topk_free(filter_topk_t* self);
+void filter_topk_reset(filter_topk_t* self);
+int filter_topk_process(filter_topk_t* self, const core_object_t* obj);
+void filter_topk_add(filter_topk_t* self, filter_topk_dim_t dim, const uint8_t* key, size_t len, uint64_t n);
+uint64_t filter_topk_total(filter_topk_t* self, filter_topk_dim_t dim);
+uint64_t filter_topk_estimate(filter_topk_t* self, filter_topk_dim_t dim, const uint8_t* key, size_t len);
+size_t filter_topk_snapshot(filter_topk_t* self, filter_topk_dim_t dim, filter_topk_item_t* items, size_t n);
+int filter_topk_merge(filter_topk_t* self, filter_topk_t* other);
+
+core_receiver_t filter_topk_receiver(filter_topk_t* self);
@@ -0,0 +1,276 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.filter.topk
+-- Bounded memory top-K statistics of DNS traffic
+--   local topk = require("dnsjit.filter.topk").new(100)
+--   layer:receiver(topk)
+--   ...
+--   for _, item in pairs(topk:top("qname", 10)) do
+--       print(item.key, item.count, item.error)
+--   end
+--
+-- Filter that keeps approximate counts of the most frequent QNAMEs, QTYPEs
+-- and clients (source address) of queries and RCODEs of responses using a
+-- fixed amount of memory regardless of the number of distinct keys.
+-- The object chain must contain a payload, UDP or TCP and IPv4 or IPv6
+-- object (see dnsjit.filter.layer), anything else is discarded.
+-- QNAMEs are counted case-insensitively and only if not compressed.
+-- .P
+-- Each dimension is a Space-Saving summary of
+-- .I k
+-- counters, the reported count of a key is never lower than the true count
+-- and at most
+-- .I error
+-- higher.
+-- Any key that occurs more than
+-- .I total/k
+-- times is guaranteed to be in the summary.
+-- An optional Count-Min sketch tightens the counts of keys that replace
+-- others in the summary and gives an upper bound for keys not in it.
+-- .P
+-- Snapshots can be taken at any time with
+-- .IR top() ,
+-- followed by
+-- .I reset()
+-- to count per interval.
+-- The state of instances with the same parameters can be merged, for
+-- example to count in multiple threads:
+--   local topk = require("dnsjit.filter.topk")
+--   local total, per_thread = topk.new(1000), {}
+--   for n = 1, 4 do
+--       per_thread[n] = topk.new(1000)
+--       thr[n]:push(per_thread[n])
+--   end
+--   -- in the thread: local tk = require("dnsjit.filter.topk").wrap(thr:pop())
+--   ...
+--   for n = 1, 4 do
+--       total:merge(per_thread[n])
+--   end
+--
+-- When used as a receiver all objects are passed on to the set receiver
+-- after being counted.
+module(...,package.seeall)
+
+require("dnsjit.filter.topk_h")
+local ffi = require("ffi")
+local C = ffi.C
+local bit = require("bit")
+
+local TopK = {}
+
+local _dims = {
+    qname = C.FILTER_TOPK_QNAME,
+    qtype = C.FILTER_TOPK_QTYPE,
+    client = C.FILTER_TOPK_CLIENT,
+    rcode = C.FILTER_TOPK_RCODE,
+}
+
+local function _dim(dim)
+    local d = _dims[dim]
+    if d == nil then
+        error("invalid dimension "..tostring(dim))
+    end
+    return d
+end
+
+-- Convert a key in the format returned by top() to the binary form.
+local function _key(dim, key)
+    if dim == "qname" then
+        return string.lower(require("dnsjit.core.object.dns.name").wire(key))
+    elseif dim == "qtype" then
+        return string.char(bit.band(bit.rshift(key, 8), 0xff), bit.band(key, 0xff))
+    elseif dim == "rcode" then
+        return string.char(key)
+    end
+    local a, b, c, d = string.match(key, "^(%d+)%.(%d+)%.(%d+)%.(%d+)$")
+    if a ~= nil then
+        return string.char(a, b, c, d)
+    end
+    local bytes = {}
+    for hex in string.gmatch(string.gsub(key, ":", ""), "%x%x") do
+        table.insert(bytes, string.char(tonumber(hex, 16)))
+    end
+    return table.concat(bytes)
+end
+
+local function _tostring(dim, item)
+    if dim == "qname" then
+        local labels, at = {}, 0
+        while at < item.len and item.key[at] > 0 do
+            table.insert(labels, ffi.string(item.key + at + 1, item.key[at]))
+            at = at + 1 + item.key[at]
+        end
+        if #labels == 0 then
+            return "."
+        end
+        return table.concat(labels, ".").."."
+    elseif dim == "qtype" then
+        return item.key[0] * 256 + item.key[1]
+    elseif dim == "rcode" then
+        return item.key[0]
+    elseif item.len == 4 then
+        return item.key[0] ..".".. item.key[1] ..".".. item.key[2] ..".".. item.key[3]
+    end
+    return string.format("%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x",
+        item.key[0], item.key[1], item.key[2], item.key[3],
+        item.key[4], item.key[5], item.key[6], item.key[7],
+        item.key[8], item.key[9], item.key[10], item.key[11],
+        item.key[12], item.key[13], item.key[14], item.key[15])
+end
+
+-- Create a new TopK filter that keeps
+-- .I k
+-- counters per dimension (default 1000) and a Count-Min sketch of
+-- .I cms_width
+-- counters per row (default 16384, must be a power of 2 or 0 to disable).
+function TopK.new(k, cms_width)
+    if cms_width == nil then
+        cms_width = 16384
+    end
+    local self = {
+        obj = C.filter_topk_new(k or 1000, cms_width),
+    }
+    ffi.gc(self.obj, C.filter_topk_free)
+    return setmetatable(self, { __index = TopK })
+end
+
+-- Wrap a shared filter_topk_t object, for example one received by a thread.
+-- The object is not freed by the wrapper.
+function TopK.wrap(obj)
+    return setmetatable({ obj = obj }, { __index = TopK })
+end
+
+-- Return information to use when sharing this object between threads.
+function TopK:share()
+    return ffi.cast("void*", self.obj), "filter_topk_t*", "dnsjit.filter.topk_h"
+end
+
+-- Return the Log object to control logging of this instance or module.
+function TopK:log()
+    if self == nil then
+        return C.filter_topk_log()
+    end
+    return self.obj._log
+end
+
+-- Return the C functions and context for receiving objects.
+function TopK:receive()
+    local recv = C.filter_topk_receiver(self.obj)
+    return recv, self.obj
+end
+
+-- Set the receiver to pass objects to.
+function TopK:receiver(o)
+    self.obj.recv, self.obj.recv_ctx = o:receive()
+end
+
+-- Count an object, return 0 on success or -1 if it was discarded.
+function TopK:process(obj)
+    return C.filter_topk_process(self.obj, obj)
+end
+
+-- Return the
+-- .I n
+-- (default 10) keys with the highest count in the dimension
+-- .I dim
+-- ("qname", "qtype", "client" or "rcode") as a list of tables with
+-- .IR key ,
+-- .I count
+-- and
+-- .IR error .
+-- QNAMEs are returned lowercased with a trailing dot, clients in the same
+-- format as
+-- .I source()
+-- of the IP objects and QTYPEs and RCODEs as numbers.
+function TopK:top(dim, n)
+    n = n or 10
+    local items = ffi.new("filter_topk_item_t[?]", n)
+    local ret = {}
+    for i = 0, tonumber(C.filter_topk_snapshot(self.obj, _dim(dim), items, n)) - 1 do
+        table.insert(ret, {
+            key = _tostring(dim, items[i]),
+            count = tonumber(items[i].count),
+            error = tonumber(items[i].error),
+        })
+    end
+    return ret
+end
+
+-- Return the upper bound of the count of a key, in the format returned by
+-- .IR top() ,
+-- in the dimension
+-- .IR dim .
+function TopK:estimate(dim, key)
+    local k = _key(dim, key)
+    return tonumber(C.filter_topk_estimate(self.obj, _dim(dim), k, #k))
+end
+
+-- Count a key, in the format returned by
+-- .IR top() ,
+-- .I n
+-- times (default 1) in the dimension
+-- .IR dim .
+function TopK:add(dim, key, n)
+    local k = _key(dim, key)
+    C.filter_topk_add(self.obj, _dim(dim), k, #k, n or 1)
+end
+
+-- Return the total count of the dimension
+-- .IR dim .
+function TopK:total(dim)
+    return tonumber(C.filter_topk_total(self.obj, _dim(dim)))
+end
+
+-- Clear all counters.
+function TopK:reset()
+    C.filter_topk_reset(self.obj)
+end
+
+-- Merge the counters of another TopK filter (or shared filter_topk_t
+-- object) into this one, they must have the same
+-- .I k
+-- and
+-- .IR cms_width .
+-- Returns 0 on success.
+function TopK:merge(other)
+    if type(other) == "table" then
+        other = other.obj
+    end
+    return C.filter_topk_merge(self.obj, other)
+end
+
+-- Return the number of queries counted.
+function TopK:queries()
+    return tonumber(self.obj.queries)
+end
+
+-- Return the number of responses counted.
+function TopK:responses()
+    return tonumber(self.obj.responses)
+end
+
+-- Return the number of objects discarded.
+function TopK:discarded()
+    return tonumber(self.obj.discarded)
+end
+
+-- dnsjit.filter.layer (3),
+-- dnsjit.filter.qrmatch (3),
+-- dnsjit.core.thread (3)
+return TopK
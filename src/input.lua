@@ -22,7 +22,9 @@
 -- Input modules used to read DNS messages in various ways.
 module(...,package.seeall)
 
+-- dnsjit.input.dnsgen (3),
 -- dnsjit.input.fpcap (3),
+-- dnsjit.input.merge (3),
 -- dnsjit.input.mmpcap (3),
 -- dnsjit.input.pcap (3),
 -- dnsjit.input.zero (3)
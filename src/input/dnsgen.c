@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "input/dnsgen.h"
+#include "core/assert.h"
+#include "core/metrics.h"
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <pcap/pcap.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/*
+ * All packets are built up front into one buffer (the pool), producing a
+ * packet only points the pcap object at the next one in the pool and
+ * advances the timestamp so the cost per packet is a few stores.
+ */
+
+/* Ethernet, IPv6, UDP, DNS header, QNAME, QTYPE/QCLASS and OPT */
+#define _PKT_MAX (14 + 40 + 8 + 12 + 255 + 4 + 11)
+
+typedef struct _range {
+    int      family;
+    uint8_t  base[16];
+    unsigned bits;
+} _range_t;
+
+typedef struct _name {
+    uint8_t len;
+    uint8_t wire[255];
+} _name_t;
+
+typedef struct _qtype {
+    uint16_t type;
+    double   weight;
+} _qtype_t;
+
+typedef struct _slot {
+    size_t   off;
+    uint16_t len;
+} _slot_t;
+
+typedef struct _input_dnsgen {
+    input_dnsgen_t pub;
+
+    _range_t* client;
+    size_t    clients;
+    uint8_t   server4[4], server6[16];
+    _name_t*  name;
+    size_t    names;
+    _qtype_t* qtype;
+    size_t    qtypes;
+
+    int      prepared;
+    uint64_t rand;
+    uint8_t* pool;
+    _slot_t* slot;
+    size_t   slots, at;
+
+    /* Timestamp of the next packet, advanced by step_ns and carrying the
+     * remainder of 1e9 / rate in step_err. */
+    uint64_t step_ns, step_rem, step_err;
+} _input_dnsgen_t;
+
+#define _self ((_input_dnsgen_t*)self)
+
+static core_log_t     _log      = LOG_T_INIT("input.dnsgen");
+static input_dnsgen_t _defaults = {
+    LOG_T_INIT_OBJ("input.dnsgen"),
+    0, 0,
+    65536, 0,
+    0,
+    1000000, { 0, 0 },
+    0.0,
+    0.0, 8,
+    0.0, 1232, 0.0,
+    53,
+    0,
+    CORE_OBJECT_PCAP_INIT(0)
+};
+
+static size_t _m_pkts = 0;
+
+core_log_t* input_dnsgen_log()
+{
+    return &_log;
+}
+
+input_dnsgen_t* input_dnsgen_new()
+{
+    input_dnsgen_t* self;
+
+    mlfatal_oom(self = calloc(1, sizeof(_input_dnsgen_t)));
+    *self = _defaults;
+    inet_pton(AF_INET, "192.0.2.1", _self->server4);
+    inet_pton(AF_INET6, "2001:db8::1", _self->server6);
+
+    core_metrics_counter(&_m_pkts, "dnsjit_input_packets_total", "module=\"input.dnsgen\"", "Packets read by input modules");
+
+    return self;
+}
+
+void input_dnsgen_free(input_dnsgen_t* self)
+{
+    mlassert_self();
+
+    free(_self->client);
+    free(_self->name);
+    free(_self->qtype);
+    free(_self->pool);
+    free(_self->slot);
+    free(self);
+}
+
+static void _check_not_prepared(input_dnsgen_t* self)
+{
+    if (_self->prepared) {
+        lfatal("can not be changed after packets have been built");
+    }
+}
+
+int input_dnsgen_client(input_dnsgen_t* self, const char* cidr)
+{
+    _range_t r;
+    char     addr[INET6_ADDRSTRLEN];
+    char*    slash;
+    size_t   n, len;
+    int      prefix;
+    mlassert_self();
+    lassert(cidr, "cidr is nil");
+    _check_not_prepared(self);
+
+    memset(&r, 0, sizeof(r));
+    if ((slash = strchr(cidr, '/'))) {
+        len    = slash - cidr;
+        prefix = atoi(slash + 1);
+    } else {
+        len    = strlen(cidr);
+        prefix = -1;
+    }
+    if (len >= sizeof(addr)) {
+        lcritical("invalid client range %s", cidr);
+        return -1;
+    }
+    memcpy(addr, cidr, len);
+    addr[len] = 0;
+
+    if (inet_pton(AF_INET, addr, r.base) == 1) {
+        r.family = AF_INET;
+        len      = 4;
+    } else if (inet_pton(AF_INET6, addr, r.base) == 1) {
+        r.family = AF_INET6;
+        len      = 16;
+    } else {
+        lcritical("invalid client range %s", cidr);
+        return -1;
+    }
+    if (prefix < 0) {
+        prefix = len * 8;
+    }
+    if (prefix > (int)len * 8) {
+        lcritical("invalid prefix length in client range %s", cidr);
+        return -1;
+    }
+    r.bits = len * 8 - prefix;
+
+    /* clear the host bits */
+    for (n = len; n-- > 0;) {
+        unsigned bit = (len - 1 - n) * 8;
+        if (bit >= r.bits) {
+            break;
+        }
+        if (r.bits - bit >= 8) {
+            r.base[n] = 0;
+        } else {
+            r.base[n] &= ~((1 << (r.bits - bit)) - 1);
+        }
+    }
+
+    lfatal_oom(_self->client = realloc(_self->client, (_self->clients + 1) * sizeof(_range_t)));
+    _self->client[_self->clients++] = r;
+
+    return 0;
+}
+
+int input_dnsgen_server(input_dnsgen_t* self, const char* ip)
+{
+    mlassert_self();
+    lassert(ip, "ip is nil");
+    _check_not_prepared(self);
+
+    if (inet_pton(AF_INET, ip, _self->server4) == 1 || inet_pton(AF_INET6, ip, _self->server6) == 1) {
+        return 0;
+    }
+    lcritical("invalid server address %s", ip);
+    return -1;
+}
+
+int input_dnsgen_name(input_dnsgen_t* self, const char* name)
+{
+    _name_t     n;
+    const char* label;
+    size_t      len;
+    mlassert_self();
+    lassert(name, "name is nil");
+    _check_not_prepared(self);
+
+    n.len = 0;
+    for (label = name; *label;) {
+        len = strcspn(label, ".");
+        if (!len) {
+            if (label[1]) {
+                lcritical("empty label in name %s", name);
+                return -1;
+            }
+            break;
+        }
+        if (len > 63 || n.len + 1 + len + 1 > sizeof(n.wire)) {
+            lcritical("label or name too long in name %s", name);
+            return -1;
+        }
+        n.wire[n.len++] = len;
+        memcpy(&n.wire[n.len], label, len);
+        n.len += len;
+        label += len;
+        if (*label) {
+            label++;
+        }
+    }
+    n.wire[n.len++] = 0;
+
+    lfatal_oom(_self->name = realloc(_self->name, (_self->names + 1) * sizeof(_name_t)));
+    _self->name[_self->names++] = n;
+
+    return 0;
+}
+
+void input_dnsgen_qtype(input_dnsgen_t* self, uint16_t qtype, double weight)
+{
+    mlassert_self();
+    _check_not_prepared(self);
+
+    lfatal_oom(_self->qtype = realloc(_self->qtype, (_self->qtypes + 1) * sizeof(_qtype_t)));
+    _self->qtype[_self->qtypes].type   = qtype;
+    _self->qtype[_self->qtypes].weight = weight;
+    _self->qtypes++;
+}
+
+/*
+ * Building
+ */
+
+/* xorshift64* */
+static inline uint64_t _random(input_dnsgen_t* self)
+{
+    _self->rand ^= _self->rand >> 12;
+    _self->rand ^= _self->rand << 25;
+    _self->rand ^= _self->rand >> 27;
+    return _self->rand * 0x2545f4914f6cdd1dULL;
+}
+
+static inline double _uniform(input_dnsgen_t* self)
+{
+    return (_random(self) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Return the index of the first cumulative weight above a uniform random
+ * value. */
+static size_t _pick(input_dnsgen_t* self, const double* cdf, size_t n)
+{
+    double v  = _uniform(self) * cdf[n - 1];
+    size_t lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cdf[mid] > v) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static uint32_t _csum_add(uint32_t sum, const uint8_t* p, size_t len)
+{
+    size_t n;
+
+    for (n = 0; n + 1 < len; n += 2) {
+        sum += (p[n] << 8) | p[n + 1];
+    }
+    if (n < len) {
+        sum += p[n] << 8;
+    }
+    return sum;
+}
+
+static uint16_t _csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
+}
+
+static inline void _put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static size_t _build(input_dnsgen_t* self, uint8_t* pkt, const _range_t* client, const _name_t* name, uint16_t qtype)
+{
+    static const char _chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    uint8_t *         ip, *udp, *dns, *p;
+    uint8_t           src[16];
+    size_t            alen = client->family == AF_INET ? 4 : 16, n, len;
+    uint32_t          sum;
+
+    /* random host bits of the client address */
+    memcpy(src, client->base, alen);
+    for (n = alen; n-- > 0;) {
+        unsigned bit = (alen - 1 - n) * 8;
+        if (bit >= client->bits) {
+            break;
+        }
+        if (client->bits - bit >= 8) {
+            src[n] = _random(self) >> 56;
+        } else {
+            src[n] |= (_random(self) >> 56) & ((1 << (client->bits - bit)) - 1);
+        }
+    }
+
+    /* Ethernet */
+    memcpy(pkt, "\x02\x00\x00\x00\x00\x02\x02\x00\x00\x00\x00\x01", 12);
+    _put16(pkt + 12, client->family == AF_INET ? 0x0800 : 0x86dd);
+    ip  = pkt + 14;
+    udp = ip + (alen == 4 ? 20 : 40);
+    dns = udp + 8;
+
+    /* DNS */
+    _put16(dns, _random(self) >> 48);
+    _put16(dns + 2, 0x0100);
+    _put16(dns + 4, 1);
+    _put16(dns + 6, 0);
+    _put16(dns + 8, 0);
+    p = dns + 12;
+    if (self->subdomain > 0.0 && _uniform(self) < self->subdomain
+        && self->subdomain_len > 0 && self->subdomain_len < 64
+        && name->len + 1 + self->subdomain_len <= 255) {
+        *p++ = self->subdomain_len;
+        for (n = 0; n < self->subdomain_len; n++) {
+            *p++ = _chars[(_random(self) >> 32) % (sizeof(_chars) - 1)];
+        }
+    }
+    memcpy(p, name->wire, name->len);
+    p += name->len;
+    _put16(p, qtype);
+    _put16(p + 2, 1);
+    p += 4;
+    if (self->edns > 0.0 && _uniform(self) < self->edns) {
+        _put16(dns + 10, 1);
+        *p++ = 0;
+        _put16(p, 41);
+        _put16(p + 2, self->edns_size);
+        _put16(p + 4, 0);
+        _put16(p + 6, self->dnssec_ok > 0.0 && _uniform(self) < self->dnssec_ok ? 0x8000 : 0);
+        _put16(p + 8, 0);
+        p += 10;
+    } else {
+        _put16(dns + 10, 0);
+    }
+    len = p - udp;
+
+    /* UDP */
+    _put16(udp, 1024 + (_random(self) >> 32) % 64512);
+    _put16(udp + 2, self->port);
+    _put16(udp + 4, len);
+    _put16(udp + 6, 0);
+
+    /* IP */
+    if (alen == 4) {
+        ip[0] = 0x45;
+        ip[1] = 0;
+        _put16(ip + 2, 20 + len);
+        _put16(ip + 4, _random(self) >> 48);
+        _put16(ip + 6, 0x4000);
+        ip[8] = 64;
+        ip[9] = 17;
+        _put16(ip + 10, 0);
+        memcpy(ip + 12, src, 4);
+        memcpy(ip + 16, _self->server4, 4);
+        _put16(ip + 10, _csum_fold(_csum_add(0, ip, 20)));
+    } else {
+        _put16(ip, 0x6000);
+        _put16(ip + 2, 0);
+        _put16(ip + 4, len);
+        ip[6] = 17;
+        ip[7] = 64;
+        memcpy(ip + 8, src, 16);
+        memcpy(ip + 24, _self->server6, 16);
+    }
+
+    /* UDP checksum over the pseudo header */
+    sum = _csum_add(0, ip + (alen == 4 ? 12 : 8), alen * 2);
+    sum += 17 + len;
+    sum = _csum_fold(_csum_add(sum, udp, len));
+    _put16(udp + 6, sum ? sum : 0xffff);
+
+    return p - pkt;
+}
+
+int input_dnsgen_prepare(input_dnsgen_t* self)
+{
+    double * client_cdf = 0, *name_cdf = 0, *qtype_cdf = 0, sum;
+    size_t   n, off;
+    uint8_t* pool;
+    mlassert_self();
+    _check_not_prepared(self);
+
+    if (!self->pool_size) {
+        lcritical("pool size must be greater than 0");
+        return -1;
+    }
+    if (!_self->clients && input_dnsgen_client(self, "10.0.0.0/16")) {
+        return -1;
+    }
+    if (!_self->names && input_dnsgen_name(self, "example.com.")) {
+        return -1;
+    }
+    if (!_self->qtypes) {
+        input_dnsgen_qtype(self, 1, 1.0);
+    }
+    _self->rand = self->seed * 0x9e3779b97f4a7c15ULL + 1;
+
+    lfatal_oom(client_cdf = malloc(_self->clients * sizeof(double)));
+    for (sum = 0, n = 0; n < _self->clients; n++) {
+        sum += ldexp(1.0, _self->client[n].bits);
+        client_cdf[n] = sum;
+    }
+    lfatal_oom(name_cdf = malloc(_self->names * sizeof(double)));
+    for (sum = 0, n = 0; n < _self->names; n++) {
+        sum += self->zipf > 0.0 ? 1.0 / pow(n + 1, self->zipf) : 1.0;
+        name_cdf[n] = sum;
+    }
+    lfatal_oom(qtype_cdf = malloc(_self->qtypes * sizeof(double)));
+    for (sum = 0, n = 0; n < _self->qtypes; n++) {
+        sum += _self->qtype[n].weight > 0.0 ? _self->qtype[n].weight : 0.0;
+        qtype_cdf[n] = sum;
+    }
+    if (sum <= 0.0) {
+        lcritical("qtype weights must be greater than 0");
+        free(client_cdf);
+        free(name_cdf);
+        free(qtype_cdf);
+        return -1;
+    }
+
+    lfatal_oom(pool = malloc(self->pool_size * _PKT_MAX));
+    lfatal_oom(_self->slot = malloc(self->pool_size * sizeof(_slot_t)));
+    for (off = 0, n = 0; n < self->pool_size; n++) {
+        _self->slot[n].off = off;
+        _self->slot[n].len = _build(self, pool + off,
+            &_self->client[_pick(self, client_cdf, _self->clients)],
+            &_self->name[_pick(self, name_cdf, _self->names)],
+            _self->qtype[_pick(self, qtype_cdf, _self->qtypes)].type);
+        off += _self->slot[n].len;
+    }
+    /* give back what was reserved for the largest packets */
+    if (!(_self->pool = realloc(pool, off))) {
+        _self->pool = pool;
+    }
+    _self->slots = self->pool_size;
+    _self->at    = 0;
+    free(client_cdf);
+    free(name_cdf);
+    free(qtype_cdf);
+
+    if (!self->start.sec && !self->start.nsec) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        self->start.sec  = ts.tv_sec;
+        self->start.nsec = ts.tv_nsec;
+    }
+    self->prod_pkt.snaplen  = _PKT_MAX;
+    self->prod_pkt.linktype = DLT_EN10MB;
+    self->prod_pkt.ts       = self->start;
+    if (self->rate) {
+        _self->step_ns  = 1000000000 / self->rate;
+        _self->step_rem = 1000000000 % self->rate;
+    }
+    _self->step_err = 0;
+    _self->prepared = 1;
+
+    ldebug("built %zu packets in %zu bytes", self->pool_size, off);
+
+    return 0;
+}
+
+static const core_object_t* _produce(input_dnsgen_t* self)
+{
+    const _slot_t* s;
+
+    if (self->limit && self->pkts >= self->limit) {
+        return 0;
+    }
+
+    s = &_self->slot[_self->at];
+    if (++_self->at == _self->slots) {
+        _self->at = 0;
+    }
+    if (self->pkts) {
+        self->prod_pkt.ts.nsec += _self->step_ns;
+        if ((_self->step_err += _self->step_rem) >= self->rate && self->rate) {
+            _self->step_err -= self->rate;
+            self->prod_pkt.ts.nsec++;
+        }
+        if (self->prod_pkt.ts.nsec >= 1000000000) {
+            self->prod_pkt.ts.nsec -= 1000000000;
+            self->prod_pkt.ts.sec++;
+        }
+    }
+    self->prod_pkt.bytes  = _self->pool + s->off;
+    self->prod_pkt.caplen = s->len;
+    self->prod_pkt.len    = s->len;
+
+    self->pkts++;
+    core_metrics_inc(_m_pkts);
+
+    return (core_object_t*)&self->prod_pkt;
+}
+
+void input_dnsgen_run(input_dnsgen_t* self, uint64_t num)
+{
+    const core_object_t* obj;
+    int                  unlimited = !num;
+    mlassert_self();
+
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+    if (!num && !self->limit) {
+        lfatal("no number of packets or limit set");
+    }
+    if (!_self->prepared && input_dnsgen_prepare(self)) {
+        lfatal("building packets failed");
+    }
+
+    while ((unlimited || num--) && (obj = _produce(self))) {
+        self->recv(self->ctx, obj);
+    }
+}
+
+core_producer_t input_dnsgen_producer(input_dnsgen_t* self)
+{
+    mlassert_self();
+
+    if (!_self->prepared && input_dnsgen_prepare(self)) {
+        lfatal("building packets failed");
+    }
+
+    return (core_producer_t)_produce;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.core.producer_h")
+//lua:require("dnsjit.core.object.pcap_h")
+
+typedef struct input_dnsgen {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    /* Number of different packets built, they are produced in a loop. */
+    size_t   pool_size;
+    uint64_t seed;
+
+    /* Packets to produce, 0 for no limit. */
+    uint64_t limit;
+
+    /* Packets per second of the timestamps starting at start, if start is
+     * zero the current time is used. */
+    uint64_t        rate;
+    core_timespec_t start;
+
+    /* Exponent of the Zipf distribution of the names by the order they were
+     * added, 0 for a uniform distribution. */
+    double zipf;
+
+    /* Probability of prepending a random label of subdomain_len characters
+     * to the name. */
+    double subdomain;
+    size_t subdomain_len;
+
+    /* Probability of adding an EDNS0 OPT record with edns_size as UDP
+     * payload size, and of setting the DO bit in it. */
+    double   edns;
+    uint16_t edns_size;
+    double   dnssec_ok;
+
+    uint16_t port;
+
+    uint64_t pkts;
+
+    core_object_pcap_t prod_pkt;
+} input_dnsgen_t;
+
+core_log_t* input_dnsgen_log();
+
+input_dnsgen_t* input_dnsgen_new();
+void input_dnsgen_free(input_dnsgen_t* self);
+int input_dnsgen_client(input_dnsgen_t* self, const char* cidr);
+int input_dnsgen_server(input_dnsgen_t* self, const char* ip);
+int input_dnsgen_name(input_dnsgen_t* self, const char* name);
+void input_dnsgen_qtype(input_dnsgen_t* self, uint16_t qtype, double weight);
+int input_dnsgen_prepare(input_dnsgen_t* self);
+void input_dnsgen_run(input_dnsgen_t* self, uint64_t num);
+
+core_producer_t input_dnsgen_producer(input_dnsgen_t* self);
@@ -0,0 +1,231 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.input.dnsgen
+-- Generate synthetic DNS queries
+--   local input = require("dnsjit.input.dnsgen").new()
+--   input:client("10.0.0.0/16")
+--   input:name({ "example.com", "example.net" })
+--   input:qtype("A", 3)
+--   input:qtype("AAAA", 1)
+--   input:zipf(1.0)
+--   input:limit(1000000)
+--   layer:producer(input)
+--
+-- Produce DNS queries over UDP as Ethernet frames, without the need for a
+-- capture, to benchmark and load test with traffic of a known shape.
+-- The packets are
+-- .I dnsjit.core.object.pcap
+-- objects with link type Ethernet and can be parsed by
+-- .IR dnsjit.filter.layer .
+-- .P
+-- A pool of packets is built once, before the first packet is produced,
+-- from the client ranges, server addresses, names and query types set up
+-- and the packets of the pool are produced in a loop so producing a packet
+-- costs about as much as reading one from memory.
+-- The pool is built from a pseudo-random sequence seeded with
+-- .I seed()
+-- so the same setup always generates the same packets.
+-- The setup can not be changed once the pool has been built.
+-- .P
+-- The client address of each packet is picked uniformly among all the
+-- addresses of all client ranges, the names by a Zipf distribution over
+-- the order they were added and the query types by their weights.
+-- The timestamps start at
+-- .I start()
+-- (or the current time) and advance at the rate of
+-- .IR rate() .
+-- Without client ranges, names or query types the defaults are
+-- 10.0.0.0/16, example.com and A.
+module(...,package.seeall)
+
+require("dnsjit.input.dnsgen_h")
+local Dns = require("dnsjit.core.object.dns")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Dnsgen = {}
+
+-- Create a new Dnsgen input.
+function Dnsgen.new()
+    local self = {
+        _receiver = nil,
+        obj = C.input_dnsgen_new(),
+    }
+    ffi.gc(self.obj, C.input_dnsgen_free)
+    return setmetatable(self, { __index = Dnsgen })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Dnsgen:log()
+    if self == nil then
+        return C.input_dnsgen_log()
+    end
+    return self.obj._log
+end
+
+-- Add a range of client (source) addresses in CIDR notation, IPv4 or IPv6,
+-- a single address can be given without a prefix length.
+-- Returns 0 on success.
+function Dnsgen:client(cidr)
+    return C.input_dnsgen_client(self.obj, cidr)
+end
+
+-- Set the server (destination) address for either IPv4 or IPv6 queries,
+-- the defaults are 192.0.2.1 and 2001:db8::1, and optionally the port
+-- (default 53).
+-- Returns 0 on success.
+function Dnsgen:server(ip, port)
+    if port then
+        self.obj.port = port
+    end
+    return C.input_dnsgen_server(self.obj, ip)
+end
+
+-- Add one or more names to query, as arguments or as a table of names.
+-- Returns 0 on success.
+function Dnsgen:name(...)
+    local names = { ... }
+    if type(names[1]) == "table" then
+        names = names[1]
+    end
+    for _, name in ipairs(names) do
+        local ret = C.input_dnsgen_name(self.obj, name)
+        if ret ~= 0 then
+            return ret
+        end
+    end
+    return 0
+end
+
+-- Add a query type to use, by number or name (such as "AAAA"), with an
+-- optional weight relative to the other types (default 1).
+function Dnsgen:qtype(qtype, weight)
+    if type(qtype) == "string" then
+        local num = Dns.TYPE[string.upper(qtype)]
+        if not num then
+            error("unknown query type " .. qtype)
+        end
+        qtype = num
+    end
+    C.input_dnsgen_qtype(self.obj, qtype, weight or 1)
+end
+
+-- Set the exponent of the Zipf distribution of the names, 0 picks the names
+-- uniformly, or return the current exponent if
+-- .I s
+-- is not specified.
+function Dnsgen:zipf(s)
+    if s == nil then
+        return self.obj.zipf
+    end
+    self.obj.zipf = s
+end
+
+-- Set the probability (0.0 - 1.0) of prepending a random label to the name,
+-- to simulate random subdomain queries, and optionally the length of the
+-- label (default 8).
+function Dnsgen:subdomain(prob, len)
+    self.obj.subdomain = prob
+    if len then
+        self.obj.subdomain_len = len
+    end
+end
+
+-- Set the probability (0.0 - 1.0) of adding an EDNS0 OPT record, optionally
+-- with the UDP payload size (default 1232) and the probability of setting
+-- the DO bit in it.
+function Dnsgen:edns(prob, size, do_prob)
+    self.obj.edns = prob
+    if size then
+        self.obj.edns_size = size
+    end
+    if do_prob then
+        self.obj.dnssec_ok = do_prob
+    end
+end
+
+-- Set the packets per second of the timestamps (default 1000000), or return
+-- the current rate if
+-- .I pps
+-- is not specified.
+function Dnsgen:rate(pps)
+    if pps == nil then
+        return tonumber(self.obj.rate)
+    end
+    self.obj.rate = pps
+end
+
+-- Set the timestamp of the first packet, by default the current time when
+-- the pool is built.
+function Dnsgen:start(sec, nsec)
+    self.obj.start.sec = sec
+    self.obj.start.nsec = nsec or 0
+end
+
+-- Set the number of packets to produce before ending, 0 (default) to
+-- produce packets until the program ends.
+function Dnsgen:limit(num)
+    self.obj.limit = num
+end
+
+-- Set the number of different packets to build (default 65536).
+function Dnsgen:pool(size)
+    self.obj.pool_size = size
+end
+
+-- Set the seed of the pseudo-random sequence the pool is built from.
+function Dnsgen:seed(seed)
+    self.obj.seed = seed
+end
+
+-- Build the pool of packets, this is otherwise done by
+-- .I produce()
+-- or
+-- .IR run() .
+-- Returns 0 on success.
+function Dnsgen:prepare()
+    return C.input_dnsgen_prepare(self.obj)
+end
+
+-- Set the receiver to pass objects to.
+function Dnsgen:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+    self._receiver = o
+end
+
+-- Return the C functions and context for producing objects.
+function Dnsgen:produce()
+    return C.input_dnsgen_producer(self.obj), self.obj
+end
+
+-- Send
+-- .I num
+-- packets, or until the limit is reached if not specified, to the receiver.
+function Dnsgen:run(num)
+    C.input_dnsgen_run(self.obj, num or 0)
+end
+
+-- Return the number of packets generated.
+function Dnsgen:packets()
+    return tonumber(self.obj.pkts)
+end
+
+-- dnsjit.filter.layer (3),
+-- dnsjit.input.zero (3)
+return Dnsgen
@@ -22,6 +22,7 @@
 
 #include "input/fpcap.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 #include "core/object/pcap.h"
 
 #include <stdio.h>
@@ -65,6 +66,8 @@ static input_fpcap_t _defaults = {
     0
 };
 
+static size_t _m_pkts = 0;
+
 core_log_t* input_fpcap_log()
 {
     return &_log;
@@ -75,6 +78,8 @@ void input_fpcap_init(input_fpcap_t* self)
     mlassert_self();
 
     *self = _defaults;
+
+    core_metrics_counter(&_m_pkts, "dnsjit_input_packets_total", "module=\"input.fpcap\"", "Packets read by input modules");
 }
 
 void input_fpcap_destroy(input_fpcap_t* self)
@@ -224,6 +229,7 @@ int input_fpcap_run(input_fpcap_t* self)
         }
 
         self->pkts++;
+        core_metrics_inc(_m_pkts);
 
         pkt.ts.sec = hdr.ts_sec;
         if (self->is_nanosec) {
@@ -286,6 +292,7 @@ static const core_object_t* _produce(input_fpcap_t* self)
     }
 
     self->pkts++;
+    core_metrics_inc(_m_pkts);
 
     self->prod_pkt.ts.sec = hdr.ts_sec;
     if (self->is_nanosec) {
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "input/merge.h"
+#include "core/assert.h"
+#include "core/object/pcap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _source {
+    core_producer_t           prod;
+    void*                     ctx;
+    const core_object_pcap_t* head;
+    uint64_t                  pkts;
+
+    /* Added to the timestamp of all packets of this source, in ns. */
+    int64_t offset;
+
+    /* Packets read ahead, their bytes are copied into the arena. */
+    core_object_pcap_t* ra;
+    size_t*             ra_off;
+    size_t              ra_n, ra_at;
+    uint8_t*            arena;
+    size_t              arena_size;
+} _source_t;
+
+typedef struct _input_merge {
+    input_merge_t pub;
+
+    _source_t* source;
+
+    /* Min-heap of the source indexes ordered by the timestamp of their
+     * head packet. */
+    size_t* heap;
+    size_t  heap_n;
+
+    int started;
+    int advance;
+} _input_merge_t;
+
+#define _self ((_input_merge_t*)self)
+
+static core_log_t    _log      = LOG_T_INIT("input.merge");
+static input_merge_t _defaults = {
+    LOG_T_INIT_OBJ("input.merge"),
+    0, 0,
+    1, 0,
+    0, 0,
+    CORE_OBJECT_PCAP_INIT(0)
+};
+
+core_log_t* input_merge_log()
+{
+    return &_log;
+}
+
+input_merge_t* input_merge_new()
+{
+    input_merge_t* self;
+
+    mlfatal_oom(self = calloc(1, sizeof(_input_merge_t)));
+    *self = _defaults;
+
+    return self;
+}
+
+void input_merge_free(input_merge_t* self)
+{
+    size_t n;
+    mlassert_self();
+
+    for (n = 0; n < self->sources; n++) {
+        free(_self->source[n].ra);
+        free(_self->source[n].ra_off);
+        free(_self->source[n].arena);
+    }
+    free(_self->source);
+    free(_self->heap);
+    free(self);
+}
+
+void input_merge_add(input_merge_t* self, core_producer_t prod, void* ctx)
+{
+    _source_t* s;
+    mlassert_self();
+    lassert(prod, "prod is nil");
+
+    if (_self->started) {
+        lfatal("sources can not be added after producing has started");
+    }
+
+    lfatal_oom(_self->source = realloc(_self->source, (self->sources + 1) * sizeof(_source_t)));
+    lfatal_oom(_self->heap = realloc(_self->heap, (self->sources + 1) * sizeof(size_t)));
+    s = &_self->source[self->sources++];
+    memset(s, 0, sizeof(*s));
+    s->prod = prod;
+    s->ctx  = ctx;
+}
+
+void input_merge_offset(input_merge_t* self, size_t source, int64_t offset)
+{
+    mlassert_self();
+    lassert(source < self->sources, "source out of range");
+
+    if (_self->started) {
+        lfatal("offset can not be changed after producing has started");
+    }
+    _self->source[source].offset = offset;
+}
+
+uint64_t input_merge_source_packets(input_merge_t* self, size_t source)
+{
+    mlassert_self();
+    lassert(source < self->sources, "source out of range");
+
+    return _self->source[source].pkts;
+}
+
+static const core_object_pcap_t* _next(input_merge_t* self, _source_t* s)
+{
+    const core_object_t* obj;
+    size_t               used;
+
+    if (self->readahead < 2) {
+        if ((obj = s->prod(s->ctx)) && obj->obj_type != CORE_OBJECT_PCAP) {
+            lfatal("source did not produce a pcap object");
+        }
+        return (const core_object_pcap_t*)obj;
+    }
+
+    if (s->ra_at < s->ra_n) {
+        return &s->ra[s->ra_at++];
+    }
+
+    /* Read the next batch of packets from this source in one go, keeping
+     * the reads of each file sequential. */
+    if (!s->ra) {
+        lfatal_oom(s->ra = malloc(self->readahead * sizeof(core_object_pcap_t)));
+        lfatal_oom(s->ra_off = malloc(self->readahead * sizeof(size_t)));
+    }
+    s->ra_n  = 0;
+    s->ra_at = 0;
+    used     = 0;
+    while (s->ra_n < self->readahead && (obj = s->prod(s->ctx))) {
+        if (obj->obj_type != CORE_OBJECT_PCAP) {
+            lfatal("source did not produce a pcap object");
+        }
+        s->ra[s->ra_n] = *(const core_object_pcap_t*)obj;
+        if (used + s->ra[s->ra_n].caplen > s->arena_size) {
+            s->arena_size = (used + s->ra[s->ra_n].caplen) * 2;
+            lfatal_oom(s->arena = realloc(s->arena, s->arena_size));
+        }
+        memcpy(s->arena + used, s->ra[s->ra_n].bytes, s->ra[s->ra_n].caplen);
+        s->ra_off[s->ra_n++] = used;
+        used += s->ra[s->ra_n - 1].caplen;
+    }
+    for (used = 0; used < s->ra_n; used++) {
+        s->ra[used].bytes = s->arena + s->ra_off[used];
+    }
+
+    if (!s->ra_n) {
+        return 0;
+    }
+    return &s->ra[s->ra_at++];
+}
+
+static inline int64_t _ts(const _source_t* s)
+{
+    return s->head->ts.sec * 1000000000 + s->head->ts.nsec + s->offset;
+}
+
+static inline int _less(input_merge_t* self, size_t a, size_t b)
+{
+    int64_t x = _ts(&_self->source[a]);
+    int64_t y = _ts(&_self->source[b]);
+
+    if (x != y) {
+        return x < y;
+    }
+    /* Keep the order of the sources for equal timestamps. */
+    return a < b;
+}
+
+static void _sift_down(input_merge_t* self, size_t i)
+{
+    size_t* heap = _self->heap;
+    size_t  n    = _self->heap_n, c, tmp;
+
+    for (;;) {
+        c = 2 * i + 1;
+        if (c >= n) {
+            break;
+        }
+        if (c + 1 < n && _less(self, heap[c + 1], heap[c])) {
+            c++;
+        }
+        if (!_less(self, heap[c], heap[i])) {
+            break;
+        }
+        tmp     = heap[i];
+        heap[i] = heap[c];
+        heap[c] = tmp;
+        i       = c;
+    }
+}
+
+static void _start(input_merge_t* self)
+{
+    size_t n;
+
+    _self->heap_n = 0;
+    for (n = 0; n < self->sources; n++) {
+        if ((_self->source[n].head = _next(self, &_self->source[n]))) {
+            _self->heap[_self->heap_n++] = n;
+        }
+    }
+    for (n = _self->heap_n / 2; n > 0; n--) {
+        _sift_down(self, n - 1);
+    }
+    _self->started = 1;
+}
+
+static const core_object_t* _produce(input_merge_t* self)
+{
+    _source_t* s;
+    mlassert_self();
+
+    if (!_self->started) {
+        _start(self);
+    } else if (_self->advance) {
+        /* The packet returned last time came from the top of the heap,
+         * replace it with the next packet of that source. */
+        s = &_self->source[_self->heap[0]];
+        if (!(s->head = _next(self, s))) {
+            _self->heap[0] = _self->heap[--_self->heap_n];
+        }
+        _sift_down(self, 0);
+    }
+
+    if (!_self->heap_n) {
+        _self->advance = 0;
+        return 0;
+    }
+
+    s              = &_self->source[_self->heap[0]];
+    _self->advance = 1;
+    s->pkts++;
+    self->pkts++;
+
+    if (self->tag || s->offset) {
+        self->prod_pkt = *s->head;
+        if (self->tag) {
+            self->prod_pkt.source = _self->heap[0];
+        }
+        if (s->offset) {
+            self->prod_pkt.ts.sec  = _ts(s) / 1000000000;
+            self->prod_pkt.ts.nsec = _ts(s) % 1000000000;
+            if (self->prod_pkt.ts.nsec < 0) {
+                self->prod_pkt.ts.sec -= 1;
+                self->prod_pkt.ts.nsec += 1000000000;
+            }
+        }
+        return (const core_object_t*)&self->prod_pkt;
+    }
+    return (const core_object_t*)s->head;
+}
+
+int input_merge_run(input_merge_t* self)
+{
+    const core_object_t* obj;
+    mlassert_self();
+
+    if (!self->recv) {
+        lfatal("no receiver set");
+    }
+
+    while ((obj = _produce(self))) {
+        self->recv(self->ctx, obj);
+    }
+
+    return 0;
+}
+
+core_producer_t input_merge_producer(input_merge_t* self)
+{
+    mlassert_self();
+
+    if (!self->sources) {
+        lfatal("no sources added");
+    }
+
+    return (core_producer_t)_produce;
+}
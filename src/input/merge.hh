@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.core.producer_h")
+//lua:require("dnsjit.core.object.pcap_h")
+
+typedef struct input_merge {
+    core_log_t      _log;
+    core_receiver_t recv;
+    void*           ctx;
+
+    /* Number of packets to read from a source at a time, if more then 1
+     * the packets are copied. */
+    size_t readahead;
+
+    /* If set, the packets produced are copies with the source index set,
+     * packets from sources with a time offset are always copies. */
+    int tag;
+
+    size_t   sources;
+    uint64_t pkts;
+
+    core_object_pcap_t prod_pkt;
+} input_merge_t;
+
+core_log_t* input_merge_log();
+
+input_merge_t* input_merge_new();
+void input_merge_free(input_merge_t* self);
+void input_merge_add(input_merge_t* self, core_producer_t prod, void* ctx);
+void input_merge_offset(input_merge_t* self, size_t source, int64_t offset);
+int input_merge_run(input_merge_t* self);
+uint64_t input_merge_source_packets(input_merge_t* self, size_t source);
+
+core_producer_t input_merge_producer(input_merge_t* self);
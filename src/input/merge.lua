@@ -0,0 +1,181 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.input.merge
+-- Merge packets from several inputs in timestamp order
+--   local merge = require("dnsjit.input.merge").new()
+--   for _, file in pairs(files) do
+--       local input = require("dnsjit.input.mmpcap").new()
+--       input:open(file)
+--       merge:add(input)
+--   end
+--   merge:tag()
+--   layer:producer(merge)
+--
+-- Produce the packets of a number of PCAP inputs, such as
+-- .I dnsjit.input.mmpcap
+-- or
+-- .IR dnsjit.input.fpcap ,
+-- as one stream ordered by timestamp, replacing a merge of the files
+-- beforehand.
+-- The inputs must each be in timestamp order and produce
+-- .I dnsjit.core.object.pcap
+-- objects, packets with equal timestamps are produced in the order the
+-- inputs were added.
+-- .P
+-- The timestamps of an input can be shifted by an offset, which can be
+-- used to overlay copies of the same capture to replay it at a multiple of
+-- its rate while each client keeps the timing between its own queries,
+-- see
+-- .IR overlay() .
+-- .P
+-- The next packet of each input is kept in a min-heap.
+-- By default the packet objects of the inputs are passed on as is, with
+-- read-ahead the packets of an input are read and copied in batches so the
+-- reads of each file stay sequential.
+module(...,package.seeall)
+
+require("dnsjit.input.merge_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Merge = {}
+
+-- Create a new Merge input.
+function Merge.new()
+    local self = {
+        _receiver = nil,
+        _sources = {},
+        obj = C.input_merge_new(),
+    }
+    ffi.gc(self.obj, C.input_merge_free)
+    return setmetatable(self, { __index = Merge })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Merge:log()
+    if self == nil then
+        return C.input_merge_log()
+    end
+    return self.obj._log
+end
+
+-- Add an input to merge, the input must have a
+-- .I produce()
+-- function.
+-- The optional
+-- .I offset
+-- in seconds (float) is added to the timestamps of all packets of the
+-- input.
+-- Returns the index of the input, starting at 0, which is its source index.
+function Merge:add(o, offset)
+    local prod, ctx = o:produce()
+    C.input_merge_add(self.obj, prod, ctx)
+    table.insert(self._sources, o)
+    if offset ~= nil then
+        C.input_merge_offset(self.obj, #self._sources - 1, math.floor(offset * 1000000000))
+    end
+    return #self._sources - 1
+end
+
+-- Overlay
+-- .I copies
+-- copies of a capture, each delayed by
+-- .I spacing
+-- seconds (float, default 1.0) more than the one before, to replay the
+-- capture at about
+-- .I copies
+-- times its rate.
+-- The function
+-- .I func
+-- is called to create and open each copy of the input, for example:
+-- .P
+--   merge:overlay(function()
+--       local input = require("dnsjit.input.mmpcap").new()
+--       input:open("file.pcap")
+--       return input
+--   end, 10)
+-- .P
+-- Tagging is enabled so that
+-- .I dnsjit.filter.ipsplit
+-- and
+-- .I dnsjit.output.pcapshard
+-- consider the same client in different copies as different clients, so
+-- each client keeps the timing between its own queries and connection
+-- reuse is not mixed between copies.
+-- Replay the result with
+-- .I dnsjit.filter.timing
+-- in the keep mode.
+function Merge:overlay(func, copies, spacing)
+    spacing = spacing or 1.0
+    for n = 0, copies - 1 do
+        self:add(func(), n * spacing)
+    end
+    self:tag()
+end
+
+-- Set the number of packets to read at a time from each input, default 1
+-- which does not copy the packets.
+function Merge:readahead(packets)
+    self.obj.readahead = packets
+end
+
+-- Tag each packet with the source index of the input it came from, see
+-- .I source
+-- in
+-- .IR dnsjit.core.object.pcap .
+-- Default false.
+function Merge:tag(bool)
+    if bool == false then
+        self.obj.tag = 0
+    else
+        self.obj.tag = 1
+    end
+end
+
+-- Set the receiver to pass objects to.
+function Merge:receiver(o)
+    self.obj.recv, self.obj.ctx = o:receive()
+    self._receiver = o
+end
+
+-- Return the C functions and context for producing objects.
+function Merge:produce()
+    return C.input_merge_producer(self.obj), self.obj
+end
+
+-- Pass all packets to the receiver, returns 0 on success.
+function Merge:run()
+    return C.input_merge_run(self.obj)
+end
+
+-- Return the number of packets produced, in total or from the input with
+-- the given source index.
+function Merge:packets(source)
+    if source ~= nil then
+        return tonumber(C.input_merge_source_packets(self.obj, source))
+    end
+    return tonumber(self.obj.pkts)
+end
+
+-- dnsjit.input.fpcap (3),
+-- dnsjit.input.mmpcap (3),
+-- dnsjit.core.object.pcap (3),
+-- dnsjit.filter.ipsplit (3),
+-- dnsjit.filter.timing (3)
+return Merge
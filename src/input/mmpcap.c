@@ -22,6 +22,7 @@
 
 #include "input/mmpcap.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 #include "core/object/pcap.h"
 
 #include <sys/mman.h>
@@ -68,6 +69,8 @@ static input_mmpcap_t _defaults = {
     0
 };
 
+static size_t _m_pkts = 0;
+
 core_log_t* input_mmpcap_log()
 {
     return &_log;
@@ -78,6 +81,8 @@ void input_mmpcap_init(input_mmpcap_t* self)
     mlassert_self();
 
     *self = _defaults;
+
+    core_metrics_counter(&_m_pkts, "dnsjit_input_packets_total", "module=\"input.mmpcap\"", "Packets read by input modules");
 }
 
 void input_mmpcap_destroy(input_mmpcap_t* self)
@@ -236,6 +241,7 @@ int input_mmpcap_run(input_mmpcap_t* self)
         }
 
         self->pkts++;
+        core_metrics_inc(_m_pkts);
 
         pkt.ts.sec = hdr.ts_sec;
         if (self->is_nanosec) {
@@ -302,6 +308,7 @@ static const core_object_t* _produce(input_mmpcap_t* self)
     }
 
     self->pkts++;
+    core_metrics_inc(_m_pkts);
 
     self->prod_pkt.ts.sec = hdr.ts_sec;
     if (self->is_nanosec) {
@@ -22,6 +22,7 @@
 
 #include "input/pcap.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 #include "core/object/pcap.h"
 
 static core_log_t   _log      = LOG_T_INIT("input.pcap");
@@ -34,6 +35,8 @@ static input_pcap_t _defaults = {
     0, 0
 };
 
+static size_t _m_pkts = 0;
+
 core_log_t* input_pcap_log()
 {
     return &_log;
@@ -44,6 +47,8 @@ void input_pcap_init(input_pcap_t* self)
     mlassert_self();
 
     *self = _defaults;
+
+    core_metrics_counter(&_m_pkts, "dnsjit_input_packets_total", "module=\"input.pcap\"", "Packets read by input modules");
 }
 
 void input_pcap_destroy(input_pcap_t* self)
@@ -134,6 +139,7 @@ static void _handler(u_char* user, const struct pcap_pkthdr* h, const u_char* by
     lassert(bytes, "bytes is nil");
 
     self->pkts++;
+    core_metrics_inc(_m_pkts);
 
     pkt.snaplen    = self->snaplen;
     pkt.linktype   = self->linktype;
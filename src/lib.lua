@@ -22,5 +22,7 @@ module(...,package.seeall)
 
 -- dnsjit.lib.clock (3),
 -- dnsjit.lib.getopt (3),
--- dnsjit.lib.parseconf (3)
+-- dnsjit.lib.histogram (3),
+-- dnsjit.lib.parseconf (3),
+-- dnsjit.lib.responder (3)
 return
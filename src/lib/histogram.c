@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "lib/histogram.h"
+#include "core/assert.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Values are shifted right by unit_bits and the result is counted in a
+ * log-linear bucket: values below 2^sub_bucket_bits have a bucket each,
+ * every following power of two is split into 2^(sub_bucket_bits - 1)
+ * buckets of equal width. The relative error of a bucket is thus at most
+ * 2^-(sub_bucket_bits - 1).
+ */
+
+static size_t _index(const lib_histogram_t* self, uint64_t value)
+{
+    uint64_t v = value >> self->unit_bits;
+    if (v < (1ULL << self->sub_bucket_bits))
+        return v;
+
+    int exp = (63 - __builtin_clzll(v)) - self->sub_bucket_bits + 1;
+    return ((size_t)exp << (self->sub_bucket_bits - 1)) + (v >> exp);
+}
+
+lib_histogram_t* lib_histogram_new(uint64_t lowest, uint64_t highest, int significant_digits)
+{
+    lib_histogram_t* self;
+    uint64_t         sub_buckets = 2;
+    int              i;
+
+    glassert(lowest > 0, "lowest must be greater than 0");
+    glassert(highest >= lowest, "highest must not be lower than lowest");
+    glassert(significant_digits >= 1 && significant_digits <= 5, "significant digits must be between 1 and 5");
+
+    glfatal_oom(self = calloc(1, sizeof(lib_histogram_t)));
+    self->unit_bits = 63 - __builtin_clzll(lowest);
+    for (i = 0; i < significant_digits; i++)
+        sub_buckets *= 10;
+    while ((1ULL << self->sub_bucket_bits) < sub_buckets)
+        self->sub_bucket_bits++;
+    self->highest = highest;
+
+    self->counts_max = _index(self, highest) + 1;
+    self->min        = UINT64_MAX;
+
+    return self;
+}
+
+static void _grow(lib_histogram_t* self, size_t len)
+{
+    size_t half = (size_t)1 << (self->sub_bucket_bits - 1);
+
+    /* Grow by whole powers of two to keep the number of reallocations low. */
+    len = (len + half - 1) & ~(half - 1);
+    if (len < 2 * half)
+        len = 2 * half;
+    if (len > self->counts_max)
+        len = self->counts_max;
+    if (len <= self->counts_len)
+        return;
+
+    glfatal_oom(self->counts = realloc(self->counts, len * sizeof(uint64_t)));
+    memset(&self->counts[self->counts_len], 0, (len - self->counts_len) * sizeof(uint64_t));
+    self->counts_len = len;
+}
+
+void lib_histogram_free(lib_histogram_t* self)
+{
+    if (self) {
+        free(self->counts);
+        free(self);
+    }
+}
+
+void lib_histogram_reset(lib_histogram_t* self)
+{
+    glassert_self();
+    if (self->counts)
+        memset(self->counts, 0, self->counts_len * sizeof(uint64_t));
+    self->total = 0;
+    self->sum   = 0;
+    self->min   = UINT64_MAX;
+    self->max   = 0;
+}
+
+void lib_histogram_record_n(lib_histogram_t* self, uint64_t value, uint64_t count)
+{
+    size_t index;
+
+    glassert_self();
+
+    if (value > self->highest)
+        value = self->highest;
+
+    index = _index(self, value);
+    if (index >= self->counts_len)
+        _grow(self, index + 1);
+    self->counts[index] += count;
+    self->total += count;
+    self->sum += value * count;
+    if (value < self->min)
+        self->min = value;
+    if (value > self->max)
+        self->max = value;
+}
+
+void lib_histogram_record(lib_histogram_t* self, uint64_t value)
+{
+    lib_histogram_record_n(self, value, 1);
+}
+
+int lib_histogram_merge(lib_histogram_t* self, const lib_histogram_t* other)
+{
+    size_t i;
+
+    glassert_self();
+    glassert(other, "other is nil");
+
+    if (self->unit_bits != other->unit_bits || self->sub_bucket_bits != other->sub_bucket_bits)
+        return -1;
+
+    if (other->counts_len > self->counts_len)
+        _grow(self, other->counts_len);
+    for (i = 0; i < other->counts_len; i++) {
+        if (i < self->counts_len)
+            self->counts[i] += other->counts[i];
+        else
+            self->counts[self->counts_len - 1] += other->counts[i];
+    }
+
+    self->total += other->total;
+    self->sum += other->sum;
+    if (other->min < self->min)
+        self->min = other->min > self->highest ? self->highest : other->min;
+    if (other->max > self->max)
+        self->max = other->max > self->highest ? self->highest : other->max;
+
+    return 0;
+}
+
+uint64_t lib_histogram_bucket_lowest(const lib_histogram_t* self, size_t index)
+{
+    size_t half = (size_t)1 << (self->sub_bucket_bits - 1);
+    size_t exp;
+
+    glassert_self();
+
+    if (index < 2 * half)
+        return (uint64_t)index << self->unit_bits;
+
+    exp = index / half - 1;
+    return ((uint64_t)(index - exp * half) << exp) << self->unit_bits;
+}
+
+uint64_t lib_histogram_bucket_highest(const lib_histogram_t* self, size_t index)
+{
+    size_t half = (size_t)1 << (self->sub_bucket_bits - 1);
+    size_t exp  = index < 2 * half ? 0 : index / half - 1;
+
+    return lib_histogram_bucket_lowest(self, index) + (((uint64_t)1 << (exp + self->unit_bits)) - 1);
+}
+
+uint64_t lib_histogram_percentile(const lib_histogram_t* self, double percentile)
+{
+    uint64_t target, cumulative = 0, value;
+    size_t   i;
+
+    glassert_self();
+
+    if (self->total == 0)
+        return 0;
+    if (percentile < 0.0)
+        percentile = 0.0;
+    if (percentile > 100.0)
+        percentile = 100.0;
+
+    target = (uint64_t)(percentile / 100.0 * self->total + 0.5);
+    if (target < 1)
+        target = 1;
+
+    for (i = 0; i < self->counts_len; i++) {
+        cumulative += self->counts[i];
+        if (cumulative >= target)
+            break;
+    }
+
+    /* Report the highest value equivalent to the bucket, within the observed range. */
+    value = lib_histogram_bucket_highest(self, i < self->counts_len ? i : self->counts_len - 1);
+    if (value > self->max)
+        value = self->max;
+    if (value < self->min)
+        value = self->min;
+    return value;
+}
+
+double lib_histogram_mean(const lib_histogram_t* self)
+{
+    glassert_self();
+
+    if (self->total == 0)
+        return 0.0;
+    return (double)self->sum / self->total;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+typedef struct lib_histogram {
+    /* Values are recorded in units of 2^unit_bits, each power of two above
+     * 2^sub_bucket_bits units is split into 2^(sub_bucket_bits - 1) buckets. */
+    uint8_t unit_bits;
+    uint8_t sub_bucket_bits;
+    uint64_t highest;
+
+    /* The counts are allocated on demand up to the highest bucket recorded
+     * so far, counts_max is the number of buckets needed for highest. */
+    size_t counts_len;
+    size_t counts_max;
+    uint64_t* counts;
+
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} lib_histogram_t;
+
+lib_histogram_t* lib_histogram_new(uint64_t lowest, uint64_t highest, int significant_digits);
+void lib_histogram_free(lib_histogram_t* self);
+void lib_histogram_reset(lib_histogram_t* self);
+void lib_histogram_record(lib_histogram_t* self, uint64_t value);
+void lib_histogram_record_n(lib_histogram_t* self, uint64_t value, uint64_t count);
+int lib_histogram_merge(lib_histogram_t* self, const lib_histogram_t* other);
+uint64_t lib_histogram_percentile(const lib_histogram_t* self, double percentile);
+double lib_histogram_mean(const lib_histogram_t* self);
+uint64_t lib_histogram_bucket_lowest(const lib_histogram_t* self, size_t index);
+uint64_t lib_histogram_bucket_highest(const lib_histogram_t* self, size_t index);
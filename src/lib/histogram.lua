@@ -0,0 +1,148 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.lib.histogram
+-- Log-linear histogram with bounded relative error
+--   local Histogram = require("dnsjit.lib.histogram")
+--   local hist = Histogram.new(1000, 2000000000, 2)
+--   hist:record(1500000)
+--   print(hist:percentile(99))
+--
+-- Histogram in the style of HdrHistogram, used for latency measurements.
+-- Values between
+-- .I lowest
+-- and
+-- .I highest
+-- are counted in buckets whose width grows with the value so that the
+-- relative error stays within the configured number of significant decimal
+-- digits, recording a value is O(1) and the memory use only grows with the
+-- logarithm of the range.
+-- Values above
+-- .I highest
+-- are counted as
+-- .IR highest .
+-- Histograms created with the same
+-- .I lowest
+-- and significant digits can be merged cheaply, for example to aggregate
+-- results from multiple threads.
+module(...,package.seeall)
+
+require("dnsjit.lib.histogram_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+Histogram = {}
+
+-- Create a new histogram for values from
+-- .I lowest
+-- to
+-- .I highest
+-- (both greater than zero) with
+-- .I significant_digits
+-- decimal digits of precision (1 to 5, default 2).
+function Histogram.new(lowest, highest, significant_digits)
+    local self = {
+        obj = C.lib_histogram_new(lowest, highest, significant_digits or 2),
+    }
+    ffi.gc(self.obj, C.lib_histogram_free)
+    return setmetatable(self, { __index = Histogram })
+end
+
+-- Wrap an existing histogram C object, for example one from the statistics
+-- of another module, without taking ownership of it.
+function Histogram.wrap(obj)
+    return setmetatable({ obj = obj }, { __index = Histogram })
+end
+
+-- Record a value, optionally
+-- .I count
+-- times.
+function Histogram:record(value, count)
+    if count then
+        C.lib_histogram_record_n(self.obj, value, count)
+    else
+        C.lib_histogram_record(self.obj, value)
+    end
+end
+
+-- Clear all recorded values.
+function Histogram:reset()
+    C.lib_histogram_reset(self.obj)
+end
+
+-- Add all values recorded in another histogram (object or C object) to this
+-- one, returns false if the histograms have incompatible precision.
+function Histogram:merge(other)
+    if type(other) == "table" then
+        other = other.obj
+    end
+    return C.lib_histogram_merge(self.obj, other) == 0
+end
+
+-- Return the number of recorded values.
+function Histogram:count()
+    return tonumber(self.obj.total)
+end
+
+-- Return the lowest recorded value, or 0 if none.
+function Histogram:min()
+    if self.obj.total == 0 then
+        return 0
+    end
+    return tonumber(self.obj.min)
+end
+
+-- Return the highest recorded value.
+function Histogram:max()
+    return tonumber(self.obj.max)
+end
+
+-- Return the mean of the recorded values.
+function Histogram:mean()
+    return C.lib_histogram_mean(self.obj)
+end
+
+-- Return the value at the given percentile (0 to 100).
+function Histogram:percentile(percentile)
+    return tonumber(C.lib_histogram_percentile(self.obj, percentile))
+end
+
+-- Return an iterator over the non-empty buckets, each step returns the
+-- lowest and highest value of the bucket and its count.
+--   for lowest, highest, count in hist:buckets() do
+--       ...
+--   end
+function Histogram:buckets()
+    local obj = self.obj
+    local i = -1
+    local len = tonumber(obj.counts_len)
+    return function()
+        i = i + 1
+        while i < len and obj.counts[i] == 0 do
+            i = i + 1
+        end
+        if i >= len then
+            return
+        end
+        return tonumber(C.lib_histogram_bucket_lowest(obj, i)),
+            tonumber(C.lib_histogram_bucket_highest(obj, i)),
+            tonumber(obj.counts[i])
+    end
+end
+
+return Histogram
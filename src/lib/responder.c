@@ -0,0 +1,1422 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "lib/responder.h"
+#include "core/assert.h"
+#include "core/metrics.h"
+
+#include <ck_pr.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/x509.h>
+#include <math.h>
+#include <nghttp2/nghttp2.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Each thread owns a UDP socket and TCP, TLS and HTTPS listening sockets
+ * bound to
+ * the same addresses as the sockets of the other threads (SO_REUSEPORT, so
+ * the kernel spreads the queries and connections over the threads) and runs
+ * its own poll() loop without sharing anything with the others. Delayed
+ * answers wait in a per-thread heap ordered by the time they are due.
+ */
+
+#define _ANSWER_MAX 288
+#define _IN_MIN 4096
+#define _OUT_MAX (1024 * 1024)
+#define _UDP_BATCH 64
+#define _MAX_THREADS 256
+#define _LISTENERS 4
+#define _H2_MAX_STREAMS 100
+#define _H2_MAX_DNSMSG 65535
+
+/* A DNS-over-HTTPS request, its query and later its answer. */
+typedef struct _stream _stream_t;
+struct _stream {
+    _stream_t* next;
+    int32_t    id;
+    uint8_t*   buf;
+    size_t     len, pos, size;
+};
+
+typedef struct _conn {
+    struct _worker*  w;
+    int              fd;
+    gnutls_session_t session;
+    int              handshaked, blocked;
+
+    /* HTTP/2 session and open streams of DNS-over-HTTPS connections,
+     * streams above last_stream were refused by a GOAWAY. */
+    int              https2, h2_recv;
+    nghttp2_session* h2;
+    _stream_t*       streams;
+    size_t           num_streams;
+    int32_t          last_stream;
+
+    /* Incremented when the slot is reused, delayed answers for an earlier
+     * connection in the slot are discarded. */
+    uint64_t gen;
+
+    uint8_t* in;
+    size_t   in_len, in_size;
+    uint8_t* out;
+    size_t   out_len, out_sent, out_size;
+} _conn_t;
+
+typedef struct _pending _pending_t;
+struct _pending {
+    _pending_t*             next;
+    uint64_t                at;
+    _conn_t*                conn;
+    uint64_t                gen;
+    int32_t                 stream;
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+    size_t                  len;
+    uint8_t                 buf[_ANSWER_MAX];
+};
+
+typedef struct _worker {
+    lib_responder_t* self;
+    pthread_t        thread;
+    int              started;
+    int              udp, tcp, tls, https2;
+    uint64_t         rand;
+
+    _conn_t*       conns;
+    size_t         num_conns;
+    struct pollfd* pfd;
+    _conn_t**      pfd_conn;
+
+    _pending_t** heap;
+    size_t       heap_len, heap_size;
+    _pending_t*  free_list;
+
+    lib_responder_stats_t stats;
+} _worker_t;
+
+typedef struct _lib_responder {
+    lib_responder_t pub;
+
+    struct sockaddr_storage          udp_addr, tcp_addr, tls_addr, https2_addr;
+    socklen_t                        udp_addr_len, tcp_addr_len, tls_addr_len, https2_addr_len;
+    gnutls_certificate_credentials_t cred;
+
+    _worker_t* workers;
+    size_t     num_workers;
+    int        stop[2];
+
+    /* Statistics of the threads of earlier runs. */
+    lib_responder_stats_t total;
+} _lib_responder_t;
+
+#define _self ((_lib_responder_t*)self)
+
+static core_log_t      _log      = LOG_T_INIT("lib.responder");
+static lib_responder_t _defaults = {
+    LOG_T_INIT_OBJ("lib.responder"),
+    1, 0, 0.0,
+    LIB_RESPONDER_LATENCY_FIXED, 0, 0, 0,
+    1024, 0,
+    0, 0, 0, 0
+};
+
+static size_t _m_queries = 0, _m_answers = 0, _m_dropped = 0;
+
+core_log_t* lib_responder_log()
+{
+    return &_log;
+}
+
+lib_responder_t* lib_responder_new()
+{
+    lib_responder_t* self;
+
+    mlfatal_oom(self = calloc(1, sizeof(_lib_responder_t)));
+    *self          = _defaults;
+    _self->stop[0] = -1;
+    _self->stop[1] = -1;
+
+    core_metrics_counter(&_m_queries, "dnsjit_responder_queries_total", 0, "Queries received by lib.responder");
+    core_metrics_counter(&_m_answers, "dnsjit_responder_answers_total", 0, "Answers sent by lib.responder");
+    core_metrics_counter(&_m_dropped, "dnsjit_responder_dropped_total", 0, "Queries not answered on purpose by lib.responder");
+
+    return self;
+}
+
+void lib_responder_free(lib_responder_t* self)
+{
+    mlassert_self();
+
+    lib_responder_stop(self);
+    if (_self->cred) {
+        gnutls_certificate_free_credentials(_self->cred);
+    }
+    free(self);
+}
+
+static int _resolve(lib_responder_t* self, const char* host, const char* port, int socktype, struct sockaddr_storage* addr, socklen_t* addr_len)
+{
+    struct addrinfo hints, *res;
+    int             err;
+
+    lassert(port, "port is nil");
+    if (_self->workers) {
+        lfatal("already started");
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = socktype;
+    hints.ai_flags    = AI_PASSIVE;
+    if ((err = getaddrinfo(host, port, &hints, &res))) {
+        lcritical("getaddrinfo(%s, %s) error %s", host ? host : "*", port, gai_strerror(err));
+        return -1;
+    }
+    if (!res) {
+        lcritical("getaddrinfo failed, no address returned");
+        return -1;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+int lib_responder_udp(lib_responder_t* self, const char* host, const char* port)
+{
+    mlassert_self();
+    return _resolve(self, host, port, SOCK_DGRAM, &_self->udp_addr, &_self->udp_addr_len);
+}
+
+int lib_responder_tcp(lib_responder_t* self, const char* host, const char* port)
+{
+    mlassert_self();
+    return _resolve(self, host, port, SOCK_STREAM, &_self->tcp_addr, &_self->tcp_addr_len);
+}
+
+/* Generate a throw-away self-signed ECDSA certificate, clients used for
+ * load testing do not verify it. */
+static int _self_signed(lib_responder_t* self)
+{
+    gnutls_x509_privkey_t key = 0;
+    gnutls_x509_crt_t     crt = 0;
+    time_t                now = time(0);
+    unsigned char         serial[8];
+    int                   err;
+
+    memcpy(serial, &now, sizeof(serial) < sizeof(now) ? sizeof(serial) : sizeof(now));
+    if ((err = gnutls_x509_privkey_init(&key)) < 0
+        || (err = gnutls_x509_privkey_generate(key, GNUTLS_PK_ECDSA, GNUTLS_CURVE_TO_BITS(GNUTLS_ECC_CURVE_SECP256R1), 0)) < 0
+        || (err = gnutls_x509_crt_init(&crt)) < 0
+        || (err = gnutls_x509_crt_set_version(crt, 3)) < 0
+        || (err = gnutls_x509_crt_set_serial(crt, serial, sizeof(serial))) < 0
+        || (err = gnutls_x509_crt_set_activation_time(crt, now - 3600)) < 0
+        || (err = gnutls_x509_crt_set_expiration_time(crt, now + 365 * 86400)) < 0
+        || (err = gnutls_x509_crt_set_dn(crt, "CN=dnsjit responder", 0)) < 0
+        || (err = gnutls_x509_crt_set_key(crt, key)) < 0
+        || (err = gnutls_x509_crt_sign2(crt, crt, key, GNUTLS_DIG_SHA256, 0)) < 0
+        || (err = gnutls_certificate_set_x509_key(_self->cred, &crt, 1, key)) < 0) {
+        lcritical("generating self-signed certificate failed: %s", gnutls_strerror(err));
+    }
+    if (crt) {
+        gnutls_x509_crt_deinit(crt);
+    }
+    if (key) {
+        gnutls_x509_privkey_deinit(key);
+    }
+
+    return err < 0 ? -1 : 0;
+}
+
+/* Load the certificate or generate one, the credentials of an earlier
+ * call are kept if no certificate is given. */
+static int _credentials(lib_responder_t* self, const char* certfile, const char* keyfile)
+{
+    int err;
+
+    if (_self->cred) {
+        if (!certfile) {
+            return 0;
+        }
+        gnutls_certificate_free_credentials(_self->cred);
+        _self->cred = 0;
+    }
+
+    gnutls_global_init();
+    if ((err = gnutls_certificate_allocate_credentials(&_self->cred)) != GNUTLS_E_SUCCESS) {
+        lfatal("gnutls_certificate_allocate_credentials() error: %s", gnutls_strerror(err));
+    }
+    if (!certfile) {
+        err = _self_signed(self);
+    } else if ((err = gnutls_certificate_set_x509_key_file(_self->cred, certfile, keyfile ? keyfile : certfile, GNUTLS_X509_FMT_PEM)) < 0) {
+        lcritical("gnutls_certificate_set_x509_key_file(%s) error: %s", certfile, gnutls_strerror(err));
+    }
+    if (err < 0) {
+        gnutls_certificate_free_credentials(_self->cred);
+        _self->cred = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+int lib_responder_tls(lib_responder_t* self, const char* host, const char* port, const char* certfile, const char* keyfile)
+{
+    mlassert_self();
+
+    if (_resolve(self, host, port, SOCK_STREAM, &_self->tls_addr, &_self->tls_addr_len)) {
+        return -1;
+    }
+    if (_credentials(self, certfile, keyfile)) {
+        _self->tls_addr_len = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+int lib_responder_https2(lib_responder_t* self, const char* host, const char* port, const char* certfile, const char* keyfile)
+{
+    mlassert_self();
+
+    if (_resolve(self, host, port, SOCK_STREAM, &_self->https2_addr, &_self->https2_addr_len)) {
+        return -1;
+    }
+    if (_credentials(self, certfile, keyfile)) {
+        _self->https2_addr_len = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Answers
+ */
+
+size_t lib_responder_answer(const lib_responder_t* self, const uint8_t* query, size_t len, uint8_t* answer)
+{
+    size_t  n = 12;
+    uint8_t rcode;
+    mlassert_self();
+
+    if (len < 12 || query[2] & 0x80) {
+        return 0;
+    }
+    rcode = self->rcode & 0xf;
+
+    /* echo the question if there is exactly one and it's uncompressed,
+     * otherwise answer FORMERR */
+    if (query[4] == 0 && query[5] == 1) {
+        for (;;) {
+            if (n >= len || n - 12 > 255 || query[n] & 0xc0) {
+                n = 0;
+                break;
+            }
+            if (!query[n]) {
+                n++;
+                break;
+            }
+            n += query[n] + 1;
+        }
+        if (n && n + 4 <= len) {
+            n += 4;
+        } else {
+            n = 0;
+        }
+    } else {
+        n = 0;
+    }
+    if (!n) {
+        n     = 12;
+        rcode = 1;
+    }
+
+    memcpy(answer, query, n);
+    /* QR, keep opcode and RD, clear AA and TC */
+    answer[2] = 0x80 | (query[2] & 0x79);
+    /* RA and rcode, clear Z, AD and CD */
+    answer[3]  = 0x80 | rcode;
+    answer[4]  = 0;
+    answer[5]  = n > 12 ? 1 : 0;
+    answer[6]  = 0;
+    answer[7]  = 0;
+    answer[8]  = 0;
+    answer[9]  = 0;
+    answer[10] = 0;
+    answer[11] = 0;
+
+    return n;
+}
+
+/*
+ * Worker
+ */
+
+#define _stat_inc(w, field) ck_pr_store_64(&(w)->stats.field, (w)->stats.field + 1)
+
+static inline uint64_t _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, returns a double in [0, 1) */
+static inline double _random(_worker_t* w)
+{
+    w->rand ^= w->rand >> 12;
+    w->rand ^= w->rand << 25;
+    w->rand ^= w->rand >> 27;
+    return ((w->rand * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint64_t _delay(_worker_t* w)
+{
+    lib_responder_t* self = w->self;
+
+    switch (self->latency) {
+    case LIB_RESPONDER_LATENCY_UNIFORM:
+        return self->latency_ns + (uint64_t)(_random(w) * self->jitter_ns);
+    case LIB_RESPONDER_LATENCY_EXPONENTIAL:
+        return self->latency_ns + (uint64_t)(-log(1.0 - _random(w)) * self->jitter_ns);
+    default:
+        break;
+    }
+    return self->latency_ns;
+}
+
+static void _heap_push(_worker_t* w, _pending_t* p)
+{
+    lib_responder_t* self = w->self;
+    size_t           i;
+
+    if (w->heap_len == w->heap_size) {
+        w->heap_size = w->heap_size ? w->heap_size * 2 : 256;
+        lfatal_oom(w->heap = realloc(w->heap, w->heap_size * sizeof(_pending_t*)));
+    }
+    for (i = w->heap_len++; i; i = (i - 1) / 2) {
+        if (w->heap[(i - 1) / 2]->at <= p->at) {
+            break;
+        }
+        w->heap[i] = w->heap[(i - 1) / 2];
+    }
+    w->heap[i] = p;
+}
+
+static _pending_t* _heap_pop(_worker_t* w)
+{
+    _pending_t *top = w->heap[0], *last = w->heap[--w->heap_len];
+    size_t      i = 0, c;
+
+    while ((c = i * 2 + 1) < w->heap_len) {
+        if (c + 1 < w->heap_len && w->heap[c + 1]->at < w->heap[c]->at) {
+            c++;
+        }
+        if (last->at <= w->heap[c]->at) {
+            break;
+        }
+        w->heap[i] = w->heap[c];
+        i          = c;
+    }
+    if (w->heap_len) {
+        w->heap[i] = last;
+    }
+
+    return top;
+}
+
+static void _conn_close(_worker_t* w, _conn_t* c)
+{
+    _stream_t* s;
+
+    if (c->h2) {
+        nghttp2_session_del(c->h2);
+        c->h2 = 0;
+    }
+    while ((s = c->streams)) {
+        c->streams = s->next;
+        free(s->buf);
+        free(s);
+    }
+    c->num_streams = 0;
+    c->last_stream = 0;
+    if (c->session) {
+        gnutls_deinit(c->session);
+        c->session = 0;
+    }
+    close(c->fd);
+    c->fd = -1;
+    c->gen++;
+    c->in_len = c->out_len = c->out_sent = 0;
+    c->handshaked = c->blocked = 0;
+}
+
+/* Write out as much of the output buffer as possible, returns -1 if the
+ * connection failed. */
+static int _conn_flush(_worker_t* w, _conn_t* c)
+{
+    ssize_t n;
+
+    while (c->out_sent < c->out_len) {
+        if (c->session) {
+            /* after GNUTLS_E_AGAIN the send must be resumed without data,
+             * gnutls has a copy of the record */
+            if (c->blocked) {
+                n = gnutls_record_send(c->session, 0, 0);
+            } else {
+                n = gnutls_record_send(c->session, c->out + c->out_sent, c->out_len - c->out_sent);
+            }
+            if (n == GNUTLS_E_AGAIN || n == GNUTLS_E_INTERRUPTED) {
+                c->blocked = 1;
+                return 0;
+            }
+            c->blocked = 0;
+            if (n < 0) {
+                return -1;
+            }
+        } else {
+#ifdef MSG_NOSIGNAL
+            n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+#else
+            n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, 0);
+#endif
+            if (n < 0) {
+                switch (errno) {
+                case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+                case EWOULDBLOCK:
+#endif
+                case EINTR:
+                    return 0;
+                default:
+                    return -1;
+                }
+            }
+        }
+        c->out_sent += n;
+    }
+    c->out_len = c->out_sent = 0;
+
+    return 0;
+}
+
+/* Return room for len more bytes in the output buffer, or NULL if the
+ * client is not reading its answers. */
+static uint8_t* _conn_out(_worker_t* w, _conn_t* c, size_t len)
+{
+    lib_responder_t* self = w->self;
+
+    if (c->out_len + len > _OUT_MAX) {
+        return 0;
+    }
+    if (c->out_len + len > c->out_size) {
+        while (c->out_len + len > c->out_size) {
+            c->out_size = c->out_size ? c->out_size * 2 : _IN_MIN;
+        }
+        lfatal_oom(c->out = realloc(c->out, c->out_size));
+    }
+
+    return c->out + c->out_len;
+}
+
+/* Move the frames nghttp2 has queued to the output buffer and write them
+ * out, returns -1 if the connection failed. */
+static int _h2_flush(_worker_t* w, _conn_t* c)
+{
+    const uint8_t* data;
+    uint8_t*       out;
+    ssize_t        n;
+
+    while ((n = nghttp2_session_mem_send(c->h2, &data)) > 0) {
+        if (!(out = _conn_out(w, c, n))) {
+            return -1;
+        }
+        memcpy(out, data, n);
+        c->out_len += n;
+    }
+    if (n < 0) {
+        return -1;
+    }
+
+    return c->blocked ? 0 : _conn_flush(w, c);
+}
+
+static ssize_t _h2_read_answer(nghttp2_session* session, int32_t id, uint8_t* buf, size_t length, uint32_t* flags, nghttp2_data_source* source, void* user_data)
+{
+    _stream_t* s = (_stream_t*)source->ptr;
+
+    if (length > s->len - s->pos) {
+        length = s->len - s->pos;
+    }
+    memcpy(buf, s->buf + s->pos, length);
+    s->pos += length;
+    if (s->pos == s->len) {
+        *flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+
+    return length;
+}
+
+#define _H2_NV(NAME, VALUE, VALUELEN) \
+    {                                 \
+        (uint8_t*)NAME, (uint8_t*)VALUE, sizeof(NAME) - 1, VALUELEN, NGHTTP2_NV_FLAG_NONE }
+
+static _stream_t* _h2_stream(_conn_t* c, int32_t id)
+{
+    _stream_t* s;
+
+    for (s = c->streams; s && s->id != id; s = s->next)
+        ;
+
+    return s;
+}
+
+/* Submit a response with the answer, or with the status only if answer
+ * is NULL. Returns 1 if the client already closed the stream. */
+static int _h2_respond(_worker_t* w, _conn_t* c, int32_t id, const char* status, const uint8_t* answer, size_t len)
+{
+    lib_responder_t*      self = w->self;
+    _stream_t*            s;
+    nghttp2_data_provider body;
+    char                  clen[8];
+    int                   n;
+
+    if (!(s = _h2_stream(c, id))) {
+        return 1;
+    }
+    if (!answer) {
+        nghttp2_nv hdrs[] = { _H2_NV(":status", status, 3) };
+        return nghttp2_submit_response(c->h2, id, hdrs, 1, 0) ? -1 : 0;
+    }
+
+    if (len > s->size) {
+        lfatal_oom(s->buf = realloc(s->buf, len));
+        s->size = len;
+    }
+    memcpy(s->buf, answer, len);
+    s->len = len;
+    s->pos = 0;
+
+    n = snprintf(clen, sizeof(clen), "%zu", len);
+    nghttp2_nv hdrs[] = {
+        _H2_NV(":status", status, 3),
+        _H2_NV("content-type", "application/dns-message", 23),
+        _H2_NV("content-length", clen, n)
+    };
+    body.source.ptr    = s;
+    body.read_callback = _h2_read_answer;
+
+    return nghttp2_submit_response(c->h2, id, hdrs, sizeof(hdrs) / sizeof(hdrs[0]), &body) ? -1 : 0;
+}
+
+static void _send(_worker_t* w, _conn_t* c, int32_t stream, const struct sockaddr_storage* addr, socklen_t addr_len, const uint8_t* answer, size_t len)
+{
+    uint8_t* out;
+    int      err;
+
+    if (!c) {
+        if (sendto(w->udp, answer, len, 0, (const struct sockaddr*)addr, addr_len) < 0) {
+            _stat_inc(w, errors);
+            return;
+        }
+    } else if (c->h2) {
+        if ((err = _h2_respond(w, c, stream, "200", answer, len)) > 0) {
+            return;
+        }
+        /* frames are written out after the input has been processed */
+        if (err || (!c->h2_recv && _h2_flush(w, c))) {
+            _stat_inc(w, errors);
+            if (!c->h2_recv) {
+                _conn_close(w, c);
+            }
+            return;
+        }
+    } else {
+        if (!(out = _conn_out(w, c, 2 + len))) {
+            _stat_inc(w, errors);
+            _conn_close(w, c);
+            return;
+        }
+        out[0] = len >> 8;
+        out[1] = len & 0xff;
+        memcpy(out + 2, answer, len);
+        c->out_len += 2 + len;
+        if (!c->blocked && _conn_flush(w, c)) {
+            _stat_inc(w, errors);
+            _conn_close(w, c);
+            return;
+        }
+    }
+    _stat_inc(w, answers);
+    core_metrics_inc(_m_answers);
+}
+
+static void _query(_worker_t* w, _conn_t* c, int32_t stream, const struct sockaddr_storage* addr, socklen_t addr_len, const uint8_t* query, size_t len, uint64_t now)
+{
+    lib_responder_t* self = w->self;
+    _pending_t*      p;
+    uint8_t          answer[_ANSWER_MAX];
+    size_t           n;
+    uint64_t         delay;
+
+    _stat_inc(w, queries);
+    core_metrics_inc(_m_queries);
+    if (!(n = lib_responder_answer(self, query, len, answer))) {
+        _stat_inc(w, malformed);
+        if (c && c->h2 && _h2_respond(w, c, stream, "400", 0, 0) < 0) {
+            _stat_inc(w, errors);
+        }
+        return;
+    }
+    if (self->drop > 0.0 && _random(w) < self->drop) {
+        _stat_inc(w, dropped);
+        core_metrics_inc(_m_dropped);
+        return;
+    }
+    if (!(delay = _delay(w))) {
+        _send(w, c, stream, addr, addr_len, answer, n);
+        return;
+    }
+
+    if ((p = w->free_list)) {
+        w->free_list = p->next;
+    } else {
+        lfatal_oom(p = malloc(sizeof(_pending_t)));
+    }
+    p->at     = now + delay;
+    p->conn   = c;
+    p->gen    = c ? c->gen : 0;
+    p->stream = stream;
+    if (!c) {
+        memcpy(&p->addr, addr, addr_len);
+        p->addr_len = addr_len;
+    }
+    memcpy(p->buf, answer, n);
+    p->len = n;
+    _heap_push(w, p);
+}
+
+static void _due(_worker_t* w, uint64_t now)
+{
+    _pending_t* p;
+
+    while (w->heap_len && w->heap[0]->at <= now) {
+        p = _heap_pop(w);
+        if (!p->conn || (p->conn->fd > -1 && p->conn->gen == p->gen)) {
+            _send(w, p->conn, p->stream, &p->addr, p->addr_len, p->buf, p->len);
+        }
+        p->next      = w->free_list;
+        w->free_list = p;
+    }
+}
+
+static void _udp_read(_worker_t* w, uint64_t now)
+{
+    uint8_t                 buf[64 * 1024];
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+    ssize_t                 n;
+    int                     i;
+
+    for (i = 0; i < _UDP_BATCH; i++) {
+        addr_len = sizeof(addr);
+        if ((n = recvfrom(w->udp, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&addr, &addr_len)) < 0) {
+            break;
+        }
+        _query(w, 0, 0, &addr, addr_len, buf, n, now);
+    }
+}
+
+/*
+ * DNS-over-HTTPS
+ */
+
+/* Decode base64url without padding (RFC 8484, Section 4.1), returns -1
+ * on invalid input. */
+static ssize_t _base64url_decode(const uint8_t* in, size_t len, uint8_t* out)
+{
+    uint32_t acc  = 0;
+    size_t   bits = 0, n = 0, i;
+    int      v;
+
+    for (i = 0; i < len; i++) {
+        if (in[i] >= 'A' && in[i] <= 'Z') {
+            v = in[i] - 'A';
+        } else if (in[i] >= 'a' && in[i] <= 'z') {
+            v = in[i] - 'a' + 26;
+        } else if (in[i] >= '0' && in[i] <= '9') {
+            v = in[i] - '0' + 52;
+        } else if (in[i] == '-') {
+            v = 62;
+        } else if (in[i] == '_') {
+            v = 63;
+        } else {
+            return -1;
+        }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[n++] = acc >> bits;
+        }
+    }
+
+    return n;
+}
+
+static int _h2_begin_headers(nghttp2_session* session, const nghttp2_frame* frame, void* user_data)
+{
+    _conn_t*         c    = (_conn_t*)user_data;
+    lib_responder_t* self = c->w->self;
+    _stream_t*       s;
+
+    if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+        return 0;
+    }
+    if (c->last_stream && frame->hd.stream_id > c->last_stream) {
+        /* refused by the GOAWAY, the client retries it elsewhere */
+        return 0;
+    }
+
+    lfatal_oom(s = calloc(1, sizeof(_stream_t)));
+    s->id      = frame->hd.stream_id;
+    s->next    = c->streams;
+    c->streams = s;
+
+    if (self->goaway_after && ++c->num_streams == self->goaway_after) {
+        c->last_stream = s->id;
+        if (nghttp2_submit_goaway(session, NGHTTP2_FLAG_NONE, s->id, NGHTTP2_NO_ERROR, 0, 0)) {
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+    }
+
+    return 0;
+}
+
+static int _h2_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen, const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data)
+{
+    _conn_t*         c    = (_conn_t*)user_data;
+    lib_responder_t* self = c->w->self;
+    _stream_t*       s;
+    size_t           i;
+    ssize_t          n;
+
+    if (frame->hd.type != NGHTTP2_HEADERS || !(s = _h2_stream(c, frame->hd.stream_id))) {
+        return 0;
+    }
+    if (namelen != 5 || memcmp(name, ":path", 5)) {
+        return 0;
+    }
+
+    /* GET, the query is the dns parameter */
+    for (i = 0; i + 4 < valuelen; i++) {
+        if ((value[i] == '?' || value[i] == '&') && !memcmp(value + i + 1, "dns=", 4)) {
+            break;
+        }
+    }
+    if (i + 4 >= valuelen) {
+        return 0;
+    }
+    value += i + 5;
+    valuelen -= i + 5;
+    for (i = 0; i < valuelen && value[i] != '&'; i++)
+        ;
+    if (!i) {
+        return 0;
+    }
+    if (i > _H2_MAX_DNSMSG / 3 * 4 + 3) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    lfatal_oom(s->buf = realloc(s->buf, i));
+    s->size = i;
+    if ((n = _base64url_decode(value, i, s->buf)) < 0) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    s->len = n;
+
+    return 0;
+}
+
+static int _h2_data_chunk(nghttp2_session* session, uint8_t flags, int32_t id, const uint8_t* data, size_t len, void* user_data)
+{
+    _conn_t*         c    = (_conn_t*)user_data;
+    lib_responder_t* self = c->w->self;
+    _stream_t*       s;
+
+    if (!(s = _h2_stream(c, id))) {
+        return 0;
+    }
+    /* POST, the query is the body */
+    if (s->len + len > _H2_MAX_DNSMSG) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    if (s->len + len > s->size) {
+        lfatal_oom(s->buf = realloc(s->buf, s->len + len));
+        s->size = s->len + len;
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+
+    return 0;
+}
+
+static int _h2_frame(nghttp2_session* session, const nghttp2_frame* frame, void* user_data)
+{
+    _conn_t*   c = (_conn_t*)user_data;
+    _stream_t* s;
+
+    if ((frame->hd.type == NGHTTP2_HEADERS || frame->hd.type == NGHTTP2_DATA)
+        && frame->hd.flags & NGHTTP2_FLAG_END_STREAM
+        && (s = _h2_stream(c, frame->hd.stream_id))) {
+        _query(c->w, c, s->id, 0, 0, s->buf, s->len, _now());
+    }
+
+    return 0;
+}
+
+static int _h2_stream_close(nghttp2_session* session, int32_t id, uint32_t error_code, void* user_data)
+{
+    _conn_t*    c = (_conn_t*)user_data;
+    _stream_t** s;
+    _stream_t*  found;
+
+    for (s = &c->streams; *s; s = &(*s)->next) {
+        if ((*s)->id == id) {
+            found = *s;
+            *s    = found->next;
+            free(found->buf);
+            free(found);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Start the HTTP/2 session once the TLS handshake is done. */
+static int _h2_init(_worker_t* w, _conn_t* c)
+{
+    lib_responder_t*           self = w->self;
+    nghttp2_session_callbacks* callbacks;
+    nghttp2_settings_entry     settings[] = {
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, _H2_MAX_STREAMS }
+    };
+    int err;
+
+    if ((err = nghttp2_session_callbacks_new(&callbacks))) {
+        lfatal("nghttp2_session_callbacks_new() error: %s", nghttp2_strerror(err));
+    }
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, _h2_begin_headers);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, _h2_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, _h2_data_chunk);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, _h2_frame);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, _h2_stream_close);
+    err = nghttp2_session_server_new(&c->h2, callbacks, c);
+    nghttp2_session_callbacks_del(callbacks);
+    if (err) {
+        lcritical("nghttp2_session_server_new() error: %s", nghttp2_strerror(err));
+        return -1;
+    }
+    if ((err = nghttp2_submit_settings(c->h2, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0])))) {
+        ldebug("nghttp2_submit_settings() error: %s", nghttp2_strerror(err));
+        return -1;
+    }
+
+    return _h2_flush(w, c);
+}
+
+static void _accept(_worker_t* w, int fd, int tls, int https2)
+{
+    lib_responder_t* self = w->self;
+    _conn_t*         c;
+    size_t           i;
+    int              cfd, flags, one = 1, err;
+
+    while ((cfd = accept(fd, 0, 0)) > -1) {
+        c = 0;
+        for (i = 0; i < w->num_conns; i++) {
+            if (w->conns[i].fd < 0) {
+                c = &w->conns[i];
+                break;
+            }
+        }
+        if (!c) {
+            lwarning("too many connections, closing new connection");
+            _stat_inc(w, errors);
+            close(cfd);
+            continue;
+        }
+
+        if ((flags = fcntl(cfd, F_GETFL)) == -1 || fcntl(cfd, F_SETFL, flags | O_NONBLOCK)) {
+            lcritical("fcntl() error %s", core_log_errstr(errno));
+            close(cfd);
+            continue;
+        }
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (tls) {
+            if ((err = gnutls_init(&c->session, GNUTLS_SERVER | GNUTLS_NONBLOCK)) != GNUTLS_E_SUCCESS) {
+                lcritical("gnutls_init() error: %s", gnutls_strerror(err));
+                close(cfd);
+                continue;
+            }
+            if ((err = gnutls_set_default_priority(c->session)) != GNUTLS_E_SUCCESS
+                || (err = gnutls_credentials_set(c->session, GNUTLS_CRD_CERTIFICATE, _self->cred)) != GNUTLS_E_SUCCESS) {
+                lcritical("gnutls session setup error: %s", gnutls_strerror(err));
+                gnutls_deinit(c->session);
+                c->session = 0;
+                close(cfd);
+                continue;
+            }
+            gnutls_certificate_server_set_request(c->session, GNUTLS_CERT_IGNORE);
+            if (https2) {
+                gnutls_datum_t proto = { (unsigned char*)"h2", 2 };
+                gnutls_alpn_set_protocols(c->session, &proto, 1, GNUTLS_ALPN_MANDATORY);
+            }
+            gnutls_transport_set_int(c->session, cfd);
+        } else {
+            c->handshaked = 1;
+        }
+        c->w      = w;
+        c->https2 = https2;
+        c->fd     = cfd;
+        _stat_inc(w, connections);
+    }
+}
+
+/* Read and answer all complete queries on the connection, returns -1 if
+ * it should be closed. */
+static int _conn_read(_worker_t* w, _conn_t* c, uint64_t now)
+{
+    lib_responder_t* self = w->self;
+    ssize_t          n;
+    size_t           at, len;
+    int              err;
+
+    if (!c->handshaked) {
+        if ((err = gnutls_handshake(c->session)) == GNUTLS_E_SUCCESS) {
+            c->handshaked = 1;
+            if (c->https2 && _h2_init(w, c)) {
+                return -1;
+            }
+        } else if (gnutls_error_is_fatal(err)) {
+            ldebug("gnutls_handshake() error: %s", gnutls_strerror(err));
+            return -1;
+        } else {
+            return 0;
+        }
+    }
+
+    for (;;) {
+        if (c->in_len == c->in_size) {
+            c->in_size = c->in_size ? c->in_size * 2 : _IN_MIN;
+            lfatal_oom(c->in = realloc(c->in, c->in_size));
+        }
+        if (c->session) {
+            n = gnutls_record_recv(c->session, c->in + c->in_len, c->in_size - c->in_len);
+            if (n == GNUTLS_E_AGAIN || n == GNUTLS_E_INTERRUPTED) {
+                break;
+            }
+            if (n <= 0) {
+                return -1;
+            }
+        } else {
+            n = recv(c->fd, c->in + c->in_len, c->in_size - c->in_len, 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                break;
+            }
+            if (n <= 0) {
+                return -1;
+            }
+        }
+        if (c->h2) {
+            c->h2_recv = 1;
+            n          = nghttp2_session_mem_recv(c->h2, c->in, n);
+            c->h2_recv = 0;
+            if (n < 0) {
+                ldebug("nghttp2_session_mem_recv() error: %s", nghttp2_strerror(n));
+                return -1;
+            }
+            if (_h2_flush(w, c)) {
+                return -1;
+            }
+            continue;
+        }
+        c->in_len += n;
+
+        for (at = 0; at + 2 <= c->in_len; at += 2 + len) {
+            len = (c->in[at] << 8) | c->in[at + 1];
+            if (at + 2 + len > c->in_len) {
+                break;
+            }
+            _query(w, c, 0, 0, 0, c->in + at + 2, len, now);
+            if (c->fd < 0) {
+                return 0;
+            }
+        }
+        if (at) {
+            memmove(c->in, c->in + at, c->in_len - at);
+            c->in_len -= at;
+        }
+        /* make room for the whole message */
+        if (c->in_len >= 2) {
+            len = 2 + ((c->in[0] << 8) | c->in[1]);
+            if (len > c->in_size) {
+                c->in_size = len;
+                lfatal_oom(c->in = realloc(c->in, c->in_size));
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void* _run(void* arg)
+{
+    _worker_t*       w    = (_worker_t*)arg;
+    lib_responder_t* self = w->self;
+    size_t           i, npfd;
+    int              timeout, n;
+    uint64_t         now;
+    short            events;
+
+    for (;;) {
+        w->pfd[0].fd     = _self->stop[0];
+        w->pfd[0].events = POLLIN;
+        w->pfd[1].fd     = w->udp;
+        w->pfd[1].events = POLLIN;
+        w->pfd[2].fd     = w->tcp;
+        w->pfd[2].events = POLLIN;
+        w->pfd[3].fd     = w->tls;
+        w->pfd[3].events = POLLIN;
+        w->pfd[4].fd     = w->https2;
+        w->pfd[4].events = POLLIN;
+        npfd             = _LISTENERS + 1;
+        for (i = 0; i < w->num_conns; i++) {
+            _conn_t* c = &w->conns[i];
+            if (c->fd < 0) {
+                continue;
+            }
+            events = POLLIN;
+            if (c->out_len || (!c->handshaked && gnutls_record_get_direction(c->session))) {
+                events |= POLLOUT;
+            }
+            w->pfd[npfd].fd       = c->fd;
+            w->pfd[npfd].events   = events;
+            w->pfd[npfd].revents  = 0;
+            w->pfd_conn[npfd - _LISTENERS - 1] = c;
+            npfd++;
+        }
+
+        timeout = -1;
+        if (w->heap_len) {
+            now     = _now();
+            timeout = w->heap[0]->at > now ? (w->heap[0]->at - now + 999999) / 1000000 : 0;
+        }
+
+        if ((n = poll(w->pfd, npfd, timeout)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lcritical("poll() error %s", core_log_errstr(errno));
+            break;
+        }
+        if (w->pfd[0].revents) {
+            break;
+        }
+
+        now = _now();
+        _due(w, now);
+        if (!n) {
+            continue;
+        }
+
+        if (w->pfd[1].revents & POLLIN) {
+            _udp_read(w, now);
+        }
+        if (w->pfd[2].revents & POLLIN) {
+            _accept(w, w->tcp, 0, 0);
+        }
+        if (w->pfd[3].revents & POLLIN) {
+            _accept(w, w->tls, 1, 0);
+        }
+        if (w->pfd[4].revents & POLLIN) {
+            _accept(w, w->https2, 1, 1);
+        }
+        for (i = _LISTENERS + 1; i < npfd; i++) {
+            _conn_t* c = w->pfd_conn[i - _LISTENERS - 1];
+            if (!w->pfd[i].revents || c->fd != w->pfd[i].fd) {
+                continue;
+            }
+            if (w->pfd[i].revents & POLLOUT && c->handshaked && _conn_flush(w, c)) {
+                _conn_close(w, c);
+                continue;
+            }
+            if (w->pfd[i].revents & (POLLIN | POLLHUP | POLLERR) || !c->handshaked) {
+                if (_conn_read(w, c, now)) {
+                    _conn_close(w, c);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Start and stop
+ */
+
+/* Create a socket bound to the address, if the port is 0 the port bound by
+ * the first thread is used by the rest and returned in port. */
+static int _socket(lib_responder_t* self, const struct sockaddr_storage* bind_addr, socklen_t addr_len, int type, uint16_t* port)
+{
+    struct sockaddr_storage addr = *bind_addr;
+    int                     fd, one = 1, flags;
+
+    if ((fd = socket(addr.ss_family, type, 0)) < 0) {
+        lcritical("socket() error %s", core_log_errstr(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+        lcritical("setsockopt(SO_REUSEPORT) error %s", core_log_errstr(errno));
+        close(fd);
+        return -1;
+    }
+#endif
+
+    if (*port) {
+        if (addr.ss_family == AF_INET) {
+            ((struct sockaddr_in*)&addr)->sin_port = htons(*port);
+        } else if (addr.ss_family == AF_INET6) {
+            ((struct sockaddr_in6*)&addr)->sin6_port = htons(*port);
+        }
+    }
+    if (bind(fd, (struct sockaddr*)&addr, addr_len)) {
+        lcritical("bind() error %s", core_log_errstr(errno));
+        close(fd);
+        return -1;
+    }
+    if (type == SOCK_STREAM) {
+        if ((flags = fcntl(fd, F_GETFL)) == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+            lcritical("fcntl() error %s", core_log_errstr(errno));
+            close(fd);
+            return -1;
+        }
+        if (listen(fd, 1024)) {
+            lcritical("listen() error %s", core_log_errstr(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (!*port) {
+        struct sockaddr_storage bound;
+        socklen_t               bound_len = sizeof(bound);
+
+        if (getsockname(fd, (struct sockaddr*)&bound, &bound_len)) {
+            lcritical("getsockname() error %s", core_log_errstr(errno));
+            close(fd);
+            return -1;
+        }
+        if (bound.ss_family == AF_INET) {
+            *port = ntohs(((struct sockaddr_in*)&bound)->sin_port);
+        } else if (bound.ss_family == AF_INET6) {
+            *port = ntohs(((struct sockaddr_in6*)&bound)->sin6_port);
+        }
+    }
+
+    return fd;
+}
+
+/* Without SO_REUSEPORT all threads share the sockets of the first. */
+static int _socket_for(lib_responder_t* self, size_t n, const struct sockaddr_storage* addr, socklen_t addr_len, int type, uint16_t* port, int first)
+{
+    if (!addr_len) {
+        return -1;
+    }
+#ifndef SO_REUSEPORT
+    if (n) {
+        return dup(first);
+    }
+#endif
+    return _socket(self, addr, addr_len, type, port);
+}
+
+int lib_responder_start(lib_responder_t* self)
+{
+    _worker_t* w;
+    size_t     n;
+    int        err;
+    mlassert_self();
+
+    if (_self->workers) {
+        lfatal("already started");
+    }
+    if (!_self->udp_addr_len && !_self->tcp_addr_len && !_self->tls_addr_len && !_self->https2_addr_len) {
+        lfatal("no transport configured");
+    }
+    if (self->threads < 1 || self->threads > _MAX_THREADS) {
+        lfatal("threads must be between 1 and %d", _MAX_THREADS);
+    }
+    if (pipe(_self->stop)) {
+        lcritical("pipe() error %s", core_log_errstr(errno));
+        return -1;
+    }
+    self->udp_port = self->tcp_port = self->tls_port = self->https2_port = 0;
+
+    lfatal_oom(_self->workers = calloc(self->threads, sizeof(_worker_t)));
+    _self->num_workers = self->threads;
+    for (n = 0; n < self->threads; n++) {
+        w       = &_self->workers[n];
+        w->self = self;
+        w->udp = w->tcp = w->tls = w->https2 = -1;
+        w->rand                  = (self->seed + n) * 0x9e3779b97f4a7c15ULL + 1;
+        w->num_conns             = self->max_conns;
+        lfatal_oom(w->conns = calloc(w->num_conns ? w->num_conns : 1, sizeof(_conn_t)));
+        lfatal_oom(w->pfd = calloc(_LISTENERS + 1 + w->num_conns, sizeof(struct pollfd)));
+        lfatal_oom(w->pfd_conn = calloc(w->num_conns ? w->num_conns : 1, sizeof(_conn_t*)));
+        for (size_t i = 0; i < w->num_conns; i++) {
+            w->conns[i].fd = -1;
+        }
+
+        if ((_self->udp_addr_len && (w->udp = _socket_for(self, n, &_self->udp_addr, _self->udp_addr_len, SOCK_DGRAM, &self->udp_port, _self->workers[0].udp)) < 0)
+            || (_self->tcp_addr_len && (w->tcp = _socket_for(self, n, &_self->tcp_addr, _self->tcp_addr_len, SOCK_STREAM, &self->tcp_port, _self->workers[0].tcp)) < 0)
+            || (_self->tls_addr_len && (w->tls = _socket_for(self, n, &_self->tls_addr, _self->tls_addr_len, SOCK_STREAM, &self->tls_port, _self->workers[0].tls)) < 0)
+            || (_self->https2_addr_len && (w->https2 = _socket_for(self, n, &_self->https2_addr, _self->https2_addr_len, SOCK_STREAM, &self->https2_port, _self->workers[0].https2)) < 0)) {
+            lib_responder_stop(self);
+            return -1;
+        }
+    }
+
+    for (n = 0; n < self->threads; n++) {
+        w = &_self->workers[n];
+        if ((err = pthread_create(&w->thread, 0, _run, w))) {
+            lcritical("pthread_create() error: %s", core_log_errstr(err));
+            lib_responder_stop(self);
+            return -1;
+        }
+        w->started = 1;
+    }
+    ldebug("started %zu threads, udp port %u tcp port %u tls port %u https2 port %u", self->threads, self->udp_port, self->tcp_port, self->tls_port, self->https2_port);
+
+    return 0;
+}
+
+void lib_responder_stop(lib_responder_t* self)
+{
+    _worker_t*  w;
+    _pending_t* p;
+    size_t      n, i;
+    mlassert_self();
+
+    if (!_self->workers) {
+        return;
+    }
+
+    if (write(_self->stop[1], "", 1) != 1) {
+        lcritical("write() error %s", core_log_errstr(errno));
+    }
+    for (n = 0; n < _self->num_workers; n++) {
+        w = &_self->workers[n];
+        if (w->started) {
+            pthread_join(w->thread, 0);
+        }
+    }
+
+    for (n = 0; n < _self->num_workers; n++) {
+        w = &_self->workers[n];
+        for (i = 0; i < w->num_conns; i++) {
+            if (w->conns[i].fd > -1) {
+                _conn_close(w, &w->conns[i]);
+            }
+            free(w->conns[i].in);
+            free(w->conns[i].out);
+        }
+        while (w->heap_len) {
+            free(_heap_pop(w));
+        }
+        while ((p = w->free_list)) {
+            w->free_list = p->next;
+            free(p);
+        }
+        if (w->udp > -1) {
+            close(w->udp);
+        }
+        if (w->tcp > -1) {
+            close(w->tcp);
+        }
+        if (w->tls > -1) {
+            close(w->tls);
+        }
+        if (w->https2 > -1) {
+            close(w->https2);
+        }
+        free(w->heap);
+        free(w->conns);
+        free(w->pfd);
+        free(w->pfd_conn);
+    }
+
+    lib_responder_stats(self, &_self->total);
+    free(_self->workers);
+    _self->workers     = 0;
+    _self->num_workers = 0;
+    close(_self->stop[0]);
+    close(_self->stop[1]);
+    _self->stop[0] = -1;
+    _self->stop[1] = -1;
+}
+
+void lib_responder_stats(const lib_responder_t* self, lib_responder_stats_t* stats)
+{
+    size_t n;
+    mlassert_self();
+
+    *stats = _self->total;
+    for (n = 0; n < _self->num_workers; n++) {
+        lib_responder_stats_t* s = &_self->workers[n].stats;
+
+        stats->queries += ck_pr_load_64(&s->queries);
+        stats->answers += ck_pr_load_64(&s->answers);
+        stats->dropped += ck_pr_load_64(&s->dropped);
+        stats->malformed += ck_pr_load_64(&s->malformed);
+        stats->connections += ck_pr_load_64(&s->connections);
+        stats->errors += ck_pr_load_64(&s->errors);
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+
+typedef enum lib_responder_latency {
+    LIB_RESPONDER_LATENCY_FIXED,
+    LIB_RESPONDER_LATENCY_UNIFORM,
+    LIB_RESPONDER_LATENCY_EXPONENTIAL
+} lib_responder_latency_t;
+
+typedef struct lib_responder_stats {
+    uint64_t queries;
+    uint64_t answers;
+    uint64_t dropped;
+    uint64_t malformed;
+    uint64_t connections;
+    uint64_t errors;
+} lib_responder_stats_t;
+
+typedef struct lib_responder {
+    core_log_t _log;
+
+    /* Number of threads, each with its own sockets (using SO_REUSEPORT
+     * where available) for every transport. */
+    size_t threads;
+
+    /* Rcode (0 to 15) set in the answers. */
+    uint8_t rcode;
+
+    /* Probability (0.0 to 1.0) of not answering a query. */
+    double drop;
+
+    /* Delay of the answers, latency_ns plus nothing (fixed), a random
+     * delay up to jitter_ns (uniform) or a random delay with a mean of
+     * jitter_ns (exponential). */
+    lib_responder_latency_t latency;
+    uint64_t                latency_ns;
+    uint64_t                jitter_ns;
+    uint64_t                seed;
+
+    /* Maximum number of TCP, TLS and HTTPS connections per thread. */
+    size_t max_conns;
+
+    /* Send an HTTP/2 GOAWAY after this many streams of a connection, the
+     * client has to send later queries over a new connection, 0 for never. */
+    size_t goaway_after;
+
+    /* The ports bound, available after start. */
+    uint16_t udp_port, tcp_port, tls_port, https2_port;
+} lib_responder_t;
+
+core_log_t* lib_responder_log();
+
+lib_responder_t* lib_responder_new();
+void lib_responder_free(lib_responder_t* self);
+int lib_responder_udp(lib_responder_t* self, const char* host, const char* port);
+int lib_responder_tcp(lib_responder_t* self, const char* host, const char* port);
+int lib_responder_tls(lib_responder_t* self, const char* host, const char* port, const char* certfile, const char* keyfile);
+int lib_responder_https2(lib_responder_t* self, const char* host, const char* port, const char* certfile, const char* keyfile);
+int lib_responder_start(lib_responder_t* self);
+void lib_responder_stop(lib_responder_t* self);
+void lib_responder_stats(const lib_responder_t* self, lib_responder_stats_t* stats);
+size_t lib_responder_answer(const lib_responder_t* self, const uint8_t* query, size_t len, uint8_t* answer);
@@ -0,0 +1,232 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.lib.responder
+-- Local DNS responder for load testing
+--   local Responder = require("dnsjit.lib.responder")
+--   local resp = Responder.new()
+--   resp:threads(4)
+--   resp:udp("127.0.0.1", 0)
+--   resp:tcp("127.0.0.1", 0)
+--   resp:tls("127.0.0.1", 0)
+--   resp:https2("127.0.0.1", 0)
+--   resp:latency("exponential", 0.001, 0.002)
+--   resp:start()
+--   local udp, tcp, tls, https2 = resp:ports()
+--   ...
+--   resp:stop()
+--   print(resp:stats().answers)
+--
+-- A fast and deterministic stand-in for a DNS server, used to benchmark
+-- and calibrate the output modules (such as output.dnssim, output.udpcli,
+-- output.tcpcli and output.tlscli) without a real resolver.
+-- Each query is answered by echoing its header and question with the QR and
+-- RA bits and a configurable rcode set and no records, queries that are not
+-- a single uncompressed question are answered with FORMERR.
+-- Answers can be delayed by a fixed, uniformly or exponentially distributed
+-- latency and a share of the queries can be dropped (not answered).
+-- .LP
+-- The responder runs in its own threads, each with its own UDP, TCP, TLS
+-- and HTTPS sockets bound to the same address using
+-- .B SO_REUSEPORT
+-- (where available) so the kernel spreads the load over the threads, and
+-- keeps running until stopped or the object is garbage collected.
+-- TCP and TLS queries may be pipelined, answers are sent as they become due.
+-- HTTPS is DNS-over-HTTPS (RFC 8484) over HTTP/2 with GET and POST requests
+-- on any path, each query in its own stream.
+-- For TLS and HTTPS a self-signed certificate is generated unless a
+-- certificate and key are given.
+-- .LP
+-- The responder also updates the metrics
+-- dnsjit_responder_queries_total, dnsjit_responder_answers_total and
+-- dnsjit_responder_dropped_total (see dnsjit.core.metrics).
+module(...,package.seeall)
+
+require("dnsjit.lib.responder_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+Responder = {}
+
+local _latency = {
+    fixed = "LIB_RESPONDER_LATENCY_FIXED",
+    uniform = "LIB_RESPONDER_LATENCY_UNIFORM",
+    exponential = "LIB_RESPONDER_LATENCY_EXPONENTIAL",
+}
+
+-- Create a new responder.
+function Responder.new()
+    local self = {
+        obj = C.lib_responder_new(),
+    }
+    ffi.gc(self.obj, C.lib_responder_free)
+    return setmetatable(self, { __index = Responder })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Responder:log()
+    if self == nil then
+        return C.lib_responder_log()
+    end
+    return self.obj._log
+end
+
+-- Set the number of threads (default 1), must be set before
+-- .IR start ().
+function Responder:threads(threads)
+    self.obj.threads = threads
+end
+
+-- Set the rcode of the answers (0 to 15, default 0 NOERROR).
+function Responder:rcode(rcode)
+    self.obj.rcode = rcode
+end
+
+-- Set the probability (0.0 to 1.0, default 0) of dropping a query.
+function Responder:drop(probability)
+    self.obj.drop = probability
+end
+
+-- Set the latency of the answers,
+-- .I dist
+-- is
+-- .B fixed
+-- (always
+-- .I seconds
+-- ),
+-- .B uniform
+-- .RI ( seconds
+-- plus a random delay up to
+-- .IR jitter )
+-- or
+-- .B exponential
+-- .RI ( seconds
+-- plus a random delay with a mean of
+-- .IR jitter ).
+-- The optional
+-- .I seed
+-- makes the random delays and drops reproducible.
+function Responder:latency(dist, seconds, jitter, seed)
+    local latency = _latency[dist]
+    if latency == nil then
+        error("invalid latency distribution: " .. tostring(dist))
+    end
+    self.obj.latency = latency
+    self.obj.latency_ns = math.floor((seconds or 0) * 1000000000)
+    self.obj.jitter_ns = math.floor((jitter or 0) * 1000000000)
+    if seed then
+        self.obj.seed = seed
+    end
+end
+
+-- Set the maximum number of TCP, TLS and HTTPS connections per thread
+-- (default 1024).
+function Responder:max_conns(max_conns)
+    self.obj.max_conns = max_conns
+end
+
+-- Send an HTTP/2 GOAWAY after the given number of streams of an HTTPS
+-- connection (default 0, never), later streams are refused and have to be
+-- sent by the client over a new connection.
+function Responder:goaway_after(streams)
+    self.obj.goaway_after = streams
+end
+
+-- Answer queries over UDP on the given host and port, a
+-- .I host
+-- of nil binds to all addresses and a
+-- .I port
+-- of 0 to a random port (see
+-- .IR ports ()).
+-- Returns 0 on success.
+function Responder:udp(host, port)
+    return C.lib_responder_udp(self.obj, host, tostring(port))
+end
+
+-- Answer queries over TCP on the given host and port, see
+-- .IR udp ().
+-- Returns 0 on success.
+function Responder:tcp(host, port)
+    return C.lib_responder_tcp(self.obj, host, tostring(port))
+end
+
+-- Answer queries over TLS on the given host and port, see
+-- .IR udp ().
+-- The optional
+-- .I certfile
+-- and
+-- .I keyfile
+-- are PEM files, the key may also be in the certificate file.
+-- Returns 0 on success.
+function Responder:tls(host, port, certfile, keyfile)
+    return C.lib_responder_tls(self.obj, host, tostring(port), certfile, keyfile)
+end
+
+-- Answer queries over HTTP/2 over TLS (DNS-over-HTTPS) on the given host
+-- and port, see
+-- .IR udp ().
+-- The certificate is the same as for
+-- .IR tls (),
+-- the one given last is used.
+-- Returns 0 on success.
+function Responder:https2(host, port, certfile, keyfile)
+    return C.lib_responder_https2(self.obj, host, tostring(port), certfile, keyfile)
+end
+
+-- Start the threads and begin answering queries.
+-- Returns 0 on success.
+function Responder:start()
+    return C.lib_responder_start(self.obj)
+end
+
+-- Stop answering queries and wait for the threads to finish, connections
+-- are closed and answers not yet due are discarded.
+function Responder:stop()
+    C.lib_responder_stop(self.obj)
+end
+
+-- Return the UDP, TCP, TLS and HTTPS ports bound (0 if not used),
+-- available after
+-- .IR start ().
+function Responder:ports()
+    return self.obj.udp_port, self.obj.tcp_port, self.obj.tls_port, self.obj.https2_port
+end
+
+-- Return a table with the number of queries, answers, dropped queries,
+-- malformed queries (not answered), accepted connections and errors, of
+-- the current and all earlier runs.
+-- Can be called while running.
+function Responder:stats()
+    local stats = ffi.new("lib_responder_stats_t")
+    C.lib_responder_stats(self.obj, stats)
+    return {
+        queries = tonumber(stats.queries),
+        answers = tonumber(stats.answers),
+        dropped = tonumber(stats.dropped),
+        malformed = tonumber(stats.malformed),
+        connections = tonumber(stats.connections),
+        errors = tonumber(stats.errors),
+    }
+end
+
+-- dnsjit.output.dnssim (3),
+-- dnsjit.output.udpcli (3),
+-- dnsjit.output.tcpcli (3),
+-- dnsjit.output.tlscli (3),
+-- dnsjit.core.metrics (3)
+return Responder
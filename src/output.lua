@@ -23,9 +23,11 @@
 -- replay them against other targets.
 module(...,package.seeall)
 
+-- dnsjit.output.columnar (3),
 -- dnsjit.output.dnscli (3),
 -- dnsjit.output.null (3),
 -- dnsjit.output.pcap (3),
+-- dnsjit.output.pcapshard (3),
 -- dnsjit.output.respdiff (3),
 -- dnsjit.output.tcpcli (3),
 -- dnsjit.output.tlscli (3),
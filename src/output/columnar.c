@@ -0,0 +1,1015 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/columnar.h"
+#include "core/assert.h"
+#include "core/object/dns.h"
+#include "core/object/dns/name.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+#include "core/object/payload.h"
+#include "core/object/pcap.h"
+#include "core/object/tcp.h"
+#include "core/object/udp.h"
+
+#include <ck_pr.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#include <zstd.h>
+#define _HAVE_ZSTD 1
+#endif
+
+/*
+ * Arrow IPC streaming format, see
+ * https://arrow.apache.org/docs/format/Columnar.html#ipc-streaming-format
+ *
+ * Each message is a FlatBuffers encoded Message (Message.fbs and
+ * Schema.fbs) followed by a body of 8 byte aligned buffers. The small
+ * subset of FlatBuffers needed is encoded by hand below.
+ */
+
+/* MetadataVersion.V5 */
+#define _ARROW_VERSION 4
+
+/* MessageHeader union */
+#define _MSG_SCHEMA 1
+#define _MSG_DICTIONARY_BATCH 2
+#define _MSG_RECORD_BATCH 3
+
+/* Type union */
+#define _TYPE_INT 2
+#define _TYPE_UTF8 5
+#define _TYPE_TIMESTAMP 10
+#define _TYPE_FIXED_SIZE_BINARY 15
+#define _TYPE_DURATION 18
+
+/* TimeUnit.NANOSECOND */
+#define _UNIT_NS 3
+
+/* CompressionType.ZSTD */
+#define _CODEC_ZSTD 1
+
+typedef struct _column {
+    const char* name;
+    int         type;
+    size_t      width;
+    int         is_signed;
+    int         nullable;
+    int         dictionary;
+} _column_t;
+
+enum {
+    _COL_TS,
+    _COL_SRC,
+    _COL_DST,
+    _COL_SPORT,
+    _COL_DPORT,
+    _COL_TRANSPORT,
+    _COL_ID,
+    _COL_FLAGS,
+    _COL_QNAME,
+    _COL_QTYPE,
+    _COL_RCODE,
+    _COL_SIZE,
+    _COL_RTT,
+    _COLUMNS
+};
+
+/*
+ * Addresses are stored as 16 bytes, IPv4 as IPv4-mapped IPv6 addresses.
+ * The QNAME is dictionary encoded, the width is that of the index.
+ */
+static const _column_t _columns[_COLUMNS] = {
+    { "ts", _TYPE_TIMESTAMP, 8, 1, 0, 0 },
+    { "src", _TYPE_FIXED_SIZE_BINARY, 16, 0, 0, 0 },
+    { "dst", _TYPE_FIXED_SIZE_BINARY, 16, 0, 0, 0 },
+    { "sport", _TYPE_INT, 2, 0, 0, 0 },
+    { "dport", _TYPE_INT, 2, 0, 0, 0 },
+    { "transport", _TYPE_INT, 1, 0, 0, 0 },
+    { "id", _TYPE_INT, 2, 0, 0, 0 },
+    { "flags", _TYPE_INT, 2, 0, 0, 0 },
+    { "qname", _TYPE_UTF8, 4, 1, 1, 1 },
+    { "qtype", _TYPE_INT, 2, 0, 1, 0 },
+    { "rcode", _TYPE_INT, 1, 0, 0, 0 },
+    { "size", _TYPE_INT, 4, 0, 0, 0 },
+    { "rtt", _TYPE_DURATION, 8, 1, 1, 0 },
+};
+
+typedef struct _col {
+    uint8_t* values;
+    uint8_t* valid;
+    size_t   nulls;
+} _col_t;
+
+/*
+ * A record batch being filled or written, with the dictionary of the
+ * QNAMEs in it which is written as a replacement dictionary before it.
+ */
+typedef struct _batch {
+    size_t rows;
+    _col_t col[_COLUMNS];
+
+    uint32_t* slots;
+    size_t    mask;
+    uint64_t* dict_hash;
+    int32_t*  dict_offsets;
+    char*     dict_data;
+    size_t    dict_n, dict_size;
+} _batch_t;
+
+typedef struct _buf {
+    uint8_t* data;
+    size_t   len, size;
+} _buf_t;
+
+typedef struct _output_columnar {
+    output_columnar_t pub;
+
+    FILE* fp;
+    int   error;
+
+    _batch_t*  filling;
+    _batch_t** free;
+    size_t     nfree;
+    _batch_t** pending;
+    size_t     head, npending;
+    int        stop;
+
+    pthread_t       thr_id;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    /* Only used by the writer thread after open. */
+    _buf_t meta, body;
+#ifdef _HAVE_ZSTD
+    ZSTD_CCtx* zctx;
+#endif
+} _output_columnar_t;
+
+#define _self ((_output_columnar_t*)self)
+
+static core_log_t        _log      = LOG_T_INIT("output.columnar");
+static output_columnar_t _defaults = {
+    LOG_T_INIT_OBJ("output.columnar"),
+    0, 2,
+    OUTPUT_COLUMNAR_NONE, 3,
+    0,
+    0, 0, 0, 0
+};
+
+core_log_t* output_columnar_log()
+{
+    return &_log;
+}
+
+output_columnar_t* output_columnar_new(size_t batch_rows)
+{
+    output_columnar_t* self;
+
+    mlassert(batch_rows > 0 && batch_rows < INT32_MAX / 2, "invalid batch_rows");
+
+    mlfatal_oom(self = calloc(1, sizeof(_output_columnar_t)));
+    *self            = _defaults;
+    self->batch_rows = batch_rows;
+
+    return self;
+}
+
+static void _batch_free(_batch_t* b)
+{
+    int i;
+
+    if (!b)
+        return;
+    for (i = 0; i < _COLUMNS; i++) {
+        free(b->col[i].values);
+        free(b->col[i].valid);
+    }
+    free(b->slots);
+    free(b->dict_hash);
+    free(b->dict_offsets);
+    free(b->dict_data);
+    free(b);
+}
+
+static void _batch_reset(output_columnar_t* self, _batch_t* b)
+{
+    int i;
+
+    b->rows = 0;
+    for (i = 0; i < _COLUMNS; i++) {
+        if (b->col[i].valid)
+            memset(b->col[i].valid, 0, (self->batch_rows + 7) / 8);
+        b->col[i].nulls = 0;
+    }
+    memset(b->slots, 0, (b->mask + 1) * sizeof(uint32_t));
+    b->dict_n          = 0;
+    b->dict_offsets[0] = 0;
+}
+
+static _batch_t* _batch_new(output_columnar_t* self)
+{
+    _batch_t* b;
+    size_t    slots = 1;
+    int       i;
+
+    lfatal_oom(b = calloc(1, sizeof(_batch_t)));
+    for (i = 0; i < _COLUMNS; i++) {
+        lfatal_oom(b->col[i].values = malloc(self->batch_rows * _columns[i].width));
+        if (_columns[i].nullable) {
+            lfatal_oom(b->col[i].valid = malloc((self->batch_rows + 7) / 8));
+        }
+    }
+
+    while (slots < self->batch_rows * 2)
+        slots <<= 1;
+    b->mask = slots - 1;
+    lfatal_oom(b->slots = malloc(slots * sizeof(uint32_t)));
+    lfatal_oom(b->dict_hash = malloc(self->batch_rows * sizeof(uint64_t)));
+    lfatal_oom(b->dict_offsets = malloc((self->batch_rows + 1) * sizeof(int32_t)));
+    b->dict_size = 64 * 1024;
+    lfatal_oom(b->dict_data = malloc(b->dict_size));
+
+    _batch_reset(self, b);
+    return b;
+}
+
+void output_columnar_free(output_columnar_t* self)
+{
+    mlassert_self();
+
+    if (_self->fp)
+        output_columnar_close(self);
+    free(self);
+}
+
+int output_columnar_have_zstd()
+{
+#ifdef _HAVE_ZSTD
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+uint64_t output_columnar_batches(output_columnar_t* self)
+{
+    mlassert_self();
+    return ck_pr_load_64(&self->batches);
+}
+
+uint64_t output_columnar_bytes(output_columnar_t* self)
+{
+    mlassert_self();
+    return ck_pr_load_64(&self->bytes);
+}
+
+/*
+ * FlatBuffers encoding, written front to back. Offsets must point forward
+ * so a referenced object is always written after the field referencing
+ * it and patched in with _fb_patch(). Scalars are little-endian.
+ */
+
+static void _buf_reserve(_buf_t* b, size_t n)
+{
+    if (b->len + n <= b->size)
+        return;
+    while (b->len + n > b->size)
+        b->size = b->size ? b->size * 2 : 4096;
+    glfatal_oom(b->data = realloc(b->data, b->size));
+}
+
+static size_t _buf_align(_buf_t* b, size_t align)
+{
+    _buf_reserve(b, align);
+    while (b->len % align)
+        b->data[b->len++] = 0;
+    return b->len;
+}
+
+static void _fb_scalar_at(_buf_t* b, size_t pos, uint64_t value, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++, value >>= 8)
+        b->data[pos + i] = value & 0xff;
+}
+
+static void _fb_patch(_buf_t* b, size_t field, size_t target)
+{
+    _fb_scalar_at(b, field, target - field, 4);
+}
+
+typedef struct _fb_field {
+    /* 0 if absent, otherwise 1, 2, 4 or 8 (offsets are 4). */
+    size_t   size;
+    uint64_t value;
+    size_t   pos;
+} _fb_field_t;
+
+/*
+ * Write a vtable followed by the table, return the position of the table.
+ * The position of each field is stored in the field for patching offsets.
+ */
+static size_t _fb_table(_buf_t* b, _fb_field_t* fields, size_t n)
+{
+    size_t rel[16], off = 4, vt, table, i;
+
+    glassert(n <= 16, "too many fields");
+
+    /* Layout the fields assuming the table starts 8 byte aligned. */
+    for (i = 0; i < n; i++) {
+        if (!fields[i].size) {
+            rel[i] = 0;
+            continue;
+        }
+        off    = (off + fields[i].size - 1) & ~(fields[i].size - 1);
+        rel[i] = off;
+        off += fields[i].size;
+    }
+
+    vt = _buf_align(b, 2);
+    _buf_reserve(b, 4 + n * 2);
+    _fb_scalar_at(b, vt, 4 + n * 2, 2);
+    _fb_scalar_at(b, vt + 2, off, 2);
+    for (i = 0; i < n; i++)
+        _fb_scalar_at(b, vt + 4 + i * 2, rel[i], 2);
+    b->len += 4 + n * 2;
+
+    table = _buf_align(b, 8);
+    _buf_reserve(b, off);
+    memset(b->data + table, 0, off);
+    _fb_scalar_at(b, table, table - vt, 4);
+    for (i = 0; i < n; i++) {
+        fields[i].pos = table + rel[i];
+        if (fields[i].size)
+            _fb_scalar_at(b, fields[i].pos, fields[i].value, fields[i].size);
+    }
+    b->len += off;
+
+    return table;
+}
+
+/*
+ * Write a vector of n elements, return the position of its length. The
+ * elements are zero if data is NULL, for vectors of offsets.
+ */
+static size_t _fb_vector(_buf_t* b, const void* data, size_t n, size_t elem, size_t align)
+{
+    size_t pos;
+
+    if (align < 4)
+        align = 4;
+    _buf_reserve(b, align + 4 + n * elem);
+    while ((b->len + 4) % align)
+        b->data[b->len++] = 0;
+    pos = b->len;
+    _fb_scalar_at(b, pos, n, 4);
+    if (data)
+        memcpy(b->data + pos + 4, data, n * elem);
+    else
+        memset(b->data + pos + 4, 0, n * elem);
+    b->len += 4 + n * elem;
+
+    return pos;
+}
+
+static size_t _fb_string(_buf_t* b, const char* str)
+{
+    size_t len = strlen(str), pos;
+
+    pos = _fb_vector(b, str, len, 1, 4);
+    _buf_reserve(b, 1);
+    b->data[b->len++] = 0;
+    return pos;
+}
+
+/*
+ * Start a Message, return the position of its header field for patching.
+ */
+static size_t _fb_message(_buf_t* b, int header_type, uint64_t body_length)
+{
+    _fb_field_t msg[4] = {
+        { 2, _ARROW_VERSION },
+        { 1, header_type },
+        { 4, 0 },
+        { 8, body_length },
+    };
+    size_t      root, table;
+
+    b->len = 0;
+    root   = _buf_align(b, 4);
+    _buf_reserve(b, 4);
+    b->len += 4;
+
+    table = _fb_table(b, msg, 4);
+    _fb_patch(b, root, table);
+    return msg[2].pos;
+}
+
+static size_t _fb_int(_buf_t* b, size_t width, int is_signed)
+{
+    _fb_field_t f[2] = {
+        { 4, width * 8 },
+        { 1, is_signed },
+    };
+
+    return _fb_table(b, f, 2);
+}
+
+static void _fb_schema(_buf_t* b)
+{
+    _fb_field_t schema[2] = {
+        { 2, 0 },
+        { 4, 0 },
+    };
+    size_t      header, vec, i;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    schema[0].value = 1;
+#endif
+
+    header = _fb_message(b, _MSG_SCHEMA, 0);
+    _fb_patch(b, header, _fb_table(b, schema, 2));
+
+    vec = _fb_vector(b, 0, _COLUMNS, 4, 4);
+    _fb_patch(b, schema[1].pos, vec);
+
+    for (i = 0; i < _COLUMNS; i++) {
+        const _column_t* c        = &_columns[i];
+        _fb_field_t      field[6] = {
+            { 4, 0 },
+            { 1, c->nullable },
+            { 1, c->type },
+            { 4, 0 },
+            { c->dictionary ? 4 : 0, 0 },
+            { 4, 0 },
+        };
+
+        _fb_patch(b, vec + 4 + i * 4, _fb_table(b, field, 6));
+        _fb_patch(b, field[0].pos, _fb_string(b, c->name));
+
+        switch (c->type) {
+        case _TYPE_INT:
+            _fb_patch(b, field[3].pos, _fb_int(b, c->width, c->is_signed));
+            break;
+        case _TYPE_FIXED_SIZE_BINARY: {
+            _fb_field_t t[1] = { { 4, c->width } };
+            _fb_patch(b, field[3].pos, _fb_table(b, t, 1));
+            break;
+        }
+        case _TYPE_TIMESTAMP: {
+            _fb_field_t t[2] = { { 2, _UNIT_NS }, { 4, 0 } };
+            _fb_patch(b, field[3].pos, _fb_table(b, t, 2));
+            _fb_patch(b, t[1].pos, _fb_string(b, "UTC"));
+            break;
+        }
+        case _TYPE_DURATION: {
+            _fb_field_t t[1] = { { 2, _UNIT_NS } };
+            _fb_patch(b, field[3].pos, _fb_table(b, t, 1));
+            break;
+        }
+        default:
+            _fb_patch(b, field[3].pos, _fb_table(b, 0, 0));
+            break;
+        }
+
+        if (c->dictionary) {
+            _fb_field_t dict[2] = {
+                { 8, i },
+                { 4, 0 },
+            };
+            _fb_patch(b, field[4].pos, _fb_table(b, dict, 2));
+            _fb_patch(b, dict[1].pos, _fb_int(b, c->width, c->is_signed));
+        }
+
+        _fb_patch(b, field[5].pos, _fb_vector(b, 0, 0, 4, 4));
+    }
+
+    _buf_align(b, 8);
+}
+
+/*
+ * Write a RecordBatch table, nodes and buffers are pairs of int64.
+ */
+static size_t _fb_record_batch(_buf_t* b, size_t length, const int64_t* nodes, size_t nnodes, const int64_t* buffers, size_t nbuffers, int compressed)
+{
+    _fb_field_t rb[4] = {
+        { 8, length },
+        { 4, 0 },
+        { 4, 0 },
+        { compressed ? 4 : 0, 0 },
+    };
+    size_t      table, pos, i;
+
+    table = _fb_table(b, rb, 4);
+
+    pos = _fb_vector(b, 0, nnodes, 16, 8);
+    for (i = 0; i < nnodes * 2; i++)
+        _fb_scalar_at(b, pos + 4 + i * 8, nodes[i], 8);
+    _fb_patch(b, rb[1].pos, pos);
+
+    pos = _fb_vector(b, 0, nbuffers, 16, 8);
+    for (i = 0; i < nbuffers * 2; i++)
+        _fb_scalar_at(b, pos + 4 + i * 8, buffers[i], 8);
+    _fb_patch(b, rb[2].pos, pos);
+
+    if (compressed) {
+        _fb_field_t comp[2] = {
+            { 1, _CODEC_ZSTD },
+            { 1, 0 },
+        };
+        _fb_patch(b, rb[3].pos, _fb_table(b, comp, 2));
+    }
+
+    return table;
+}
+
+/*
+ * Append a buffer to the body, compressed if enabled, and record its
+ * offset and length.
+ */
+static int _body_add(output_columnar_t* self, int64_t* buffer, const void* data, size_t len)
+{
+    _buf_t* b = &_self->body;
+
+    _buf_align(b, 8);
+    buffer[0] = b->len;
+
+    if (!len) {
+        buffer[1] = 0;
+        return 0;
+    }
+
+#ifdef _HAVE_ZSTD
+    if (self->compression == OUTPUT_COLUMNAR_ZSTD) {
+        size_t n;
+
+        _buf_reserve(b, 8 + ZSTD_compressBound(len));
+        _fb_scalar_at(b, b->len, len, 8);
+        n = ZSTD_compressCCtx(_self->zctx, b->data + b->len + 8, ZSTD_compressBound(len), data, len, self->compression_level);
+        if (ZSTD_isError(n)) {
+            lcritical("ZSTD_compressCCtx() error: %s", ZSTD_getErrorName(n));
+            return -1;
+        }
+        buffer[1] = 8 + n;
+        b->len += 8 + n;
+        return 0;
+    }
+#endif
+
+    _buf_reserve(b, len);
+    memcpy(b->data + b->len, data, len);
+    buffer[1] = len;
+    b->len += len;
+    return 0;
+}
+
+static int _write(output_columnar_t* self, const void* data, size_t len)
+{
+    if (fwrite(data, 1, len, _self->fp) != len) {
+        lcritical("fwrite() error: %s", core_log_errstr(errno));
+        return -1;
+    }
+    ck_pr_add_64(&self->bytes, len);
+    return 0;
+}
+
+/*
+ * Write an encapsulated message: continuation marker, metadata length
+ * (padded so the body is 8 byte aligned), metadata and body.
+ */
+static int _write_message(output_columnar_t* self, const _buf_t* body)
+{
+    uint8_t prefix[8] = { 0xff, 0xff, 0xff, 0xff };
+    _buf_t* meta      = &_self->meta;
+
+    _buf_align(meta, 8);
+    prefix[4] = meta->len & 0xff;
+    prefix[5] = (meta->len >> 8) & 0xff;
+    prefix[6] = (meta->len >> 16) & 0xff;
+    prefix[7] = (meta->len >> 24) & 0xff;
+
+    if (_write(self, prefix, sizeof(prefix)) || _write(self, meta->data, meta->len))
+        return -1;
+    if (body && body->len && _write(self, body->data, body->len))
+        return -1;
+    return 0;
+}
+
+static int _write_batch(output_columnar_t* self, _batch_t* batch)
+{
+    int64_t nodes[_COLUMNS * 2], buffers[_COLUMNS * 2 * 2];
+    size_t  header, i, nbuf = 0;
+    int     compressed = self->compression != OUTPUT_COLUMNAR_NONE;
+
+    /* Replacement dictionary of the QNAMEs in this batch. */
+    _self->body.len = 0;
+    nodes[0]        = batch->dict_n;
+    nodes[1]        = 0;
+    if (_body_add(self, &buffers[0], 0, 0)
+        || _body_add(self, &buffers[2], batch->dict_offsets, (batch->dict_n + 1) * sizeof(int32_t))
+        || _body_add(self, &buffers[4], batch->dict_data, batch->dict_offsets[batch->dict_n]))
+        return -1;
+    _buf_align(&_self->body, 8);
+
+    header = _fb_message(&_self->meta, _MSG_DICTIONARY_BATCH, _self->body.len);
+    {
+        _fb_field_t dict[3] = {
+            { 8, _COL_QNAME },
+            { 4, 0 },
+            { 1, 0 },
+        };
+        _fb_patch(&_self->meta, header, _fb_table(&_self->meta, dict, 3));
+        _fb_patch(&_self->meta, dict[1].pos, _fb_record_batch(&_self->meta, batch->dict_n, nodes, 1, buffers, 3, compressed));
+    }
+    if (_write_message(self, &_self->body))
+        return -1;
+
+    _self->body.len = 0;
+    for (i = 0; i < _COLUMNS; i++) {
+        nodes[i * 2]     = batch->rows;
+        nodes[i * 2 + 1] = batch->col[i].nulls;
+
+        if (_body_add(self, &buffers[nbuf++ * 2], batch->col[i].valid, batch->col[i].nulls ? (batch->rows + 7) / 8 : 0)
+            || _body_add(self, &buffers[nbuf++ * 2], batch->col[i].values, batch->rows * _columns[i].width))
+            return -1;
+    }
+    _buf_align(&_self->body, 8);
+
+    header = _fb_message(&_self->meta, _MSG_RECORD_BATCH, _self->body.len);
+    _fb_patch(&_self->meta, header, _fb_record_batch(&_self->meta, batch->rows, nodes, _COLUMNS, buffers, nbuf, compressed));
+    if (_write_message(self, &_self->body))
+        return -1;
+
+    ck_pr_inc_64(&self->batches);
+    return 0;
+}
+
+static void* _writer(void* arg)
+{
+    output_columnar_t* self = (output_columnar_t*)arg;
+    _batch_t*          batch;
+
+    for (;;) {
+        pthread_mutex_lock(&_self->lock);
+        while (!_self->npending && !_self->stop)
+            pthread_cond_wait(&_self->cond, &_self->lock);
+        if (!_self->npending) {
+            pthread_mutex_unlock(&_self->lock);
+            break;
+        }
+        batch       = _self->pending[_self->head];
+        _self->head = (_self->head + 1) % (self->queue + 1);
+        _self->npending--;
+        pthread_mutex_unlock(&_self->lock);
+
+        if (!_self->error && _write_batch(self, batch))
+            _self->error = 1;
+        _batch_reset(self, batch);
+
+        pthread_mutex_lock(&_self->lock);
+        _self->free[_self->nfree++] = batch;
+        pthread_cond_broadcast(&_self->cond);
+        pthread_mutex_unlock(&_self->lock);
+    }
+
+    return 0;
+}
+
+/*
+ * Hand the filling batch to the writer and take a free one, waits if all
+ * batches are queued.
+ */
+static void _flush(output_columnar_t* self)
+{
+    pthread_mutex_lock(&_self->lock);
+    _self->pending[(_self->head + _self->npending) % (self->queue + 1)] = _self->filling;
+    _self->npending++;
+    pthread_cond_broadcast(&_self->cond);
+    while (!_self->nfree)
+        pthread_cond_wait(&_self->cond, &_self->lock);
+    _self->filling = _self->free[--_self->nfree];
+    pthread_mutex_unlock(&_self->lock);
+}
+
+int output_columnar_open(output_columnar_t* self, const char* file)
+{
+    size_t i;
+    int    err;
+    mlassert_self();
+    lassert(file, "file is nil");
+    lassert(self->queue > 0, "queue must be at least 1");
+
+    if (_self->fp) {
+        lfatal("already opened");
+    }
+    if (self->compression == OUTPUT_COLUMNAR_ZSTD && !output_columnar_have_zstd()) {
+        lcritical("zstd compression not supported, dnsjit built without libzstd");
+        return -1;
+    }
+
+    if (!(_self->fp = fopen(file, "wb"))) {
+        lcritical("fopen(%s) error: %s", file, core_log_errstr(errno));
+        return -1;
+    }
+#ifdef _HAVE_ZSTD
+    if (self->compression == OUTPUT_COLUMNAR_ZSTD) {
+        lfatal_oom(_self->zctx = ZSTD_createCCtx());
+    }
+#endif
+
+    _self->error = 0;
+    _fb_schema(&_self->meta);
+    if (_write_message(self, 0)) {
+        fclose(_self->fp);
+        _self->fp = 0;
+        return -1;
+    }
+
+    /*
+     * One batch being filled and the rest free or pending, all of them can
+     * be pending before the writer takes the first.
+     */
+    lfatal_oom(_self->free = malloc((self->queue + 1) * sizeof(_batch_t*)));
+    lfatal_oom(_self->pending = malloc((self->queue + 1) * sizeof(_batch_t*)));
+    for (i = 0; i < self->queue; i++)
+        _self->free[i] = _batch_new(self);
+    _self->nfree    = self->queue;
+    _self->filling  = _batch_new(self);
+    _self->head     = 0;
+    _self->npending = 0;
+    _self->stop     = 0;
+
+    if (pthread_mutex_init(&_self->lock, 0) || pthread_cond_init(&_self->cond, 0)) {
+        lfatal("mutex/cond init failed");
+    }
+    if ((err = pthread_create(&_self->thr_id, 0, _writer, self))) {
+        lfatal("pthread_create() error: %s", core_log_errstr(err));
+    }
+
+    return 0;
+}
+
+int output_columnar_close(output_columnar_t* self)
+{
+    static const uint8_t eos[8] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+    size_t               i;
+    int                  err, ret = 0;
+    mlassert_self();
+
+    if (!_self->fp)
+        return 0;
+
+    if (_self->filling->rows)
+        _flush(self);
+
+    pthread_mutex_lock(&_self->lock);
+    _self->stop = 1;
+    pthread_cond_broadcast(&_self->cond);
+    pthread_mutex_unlock(&_self->lock);
+    if ((err = pthread_join(_self->thr_id, 0))) {
+        lcritical("pthread_join() error: %s", core_log_errstr(err));
+        ret = -1;
+    }
+    pthread_mutex_destroy(&_self->lock);
+    pthread_cond_destroy(&_self->cond);
+
+    if (_self->error || _write(self, eos, sizeof(eos)))
+        ret = -1;
+    if (fclose(_self->fp)) {
+        lcritical("fclose() error: %s", core_log_errstr(errno));
+        ret = -1;
+    }
+    _self->fp = 0;
+
+    _batch_free(_self->filling);
+    _self->filling = 0;
+    for (i = 0; i < _self->nfree; i++)
+        _batch_free(_self->free[i]);
+    free(_self->free);
+    free(_self->pending);
+    _self->free = _self->pending = 0;
+    free(_self->meta.data);
+    free(_self->body.data);
+    memset(&_self->meta, 0, sizeof(_buf_t));
+    memset(&_self->body, 0, sizeof(_buf_t));
+#ifdef _HAVE_ZSTD
+    if (_self->zctx) {
+        ZSTD_freeCCtx(_self->zctx);
+        _self->zctx = 0;
+    }
+#endif
+
+    return ret;
+}
+
+/*
+ * Convert a lowercased wire-format name (see
+ * core_object_dns_name_copy_lower()) to presentation format, return the
+ * length of the text.
+ */
+static size_t _qname(char* out, const uint8_t* name)
+{
+    size_t  pos = 0, len = 0;
+    uint8_t label, c;
+
+    for (;;) {
+        label = name[pos++];
+        if (!label) {
+            if (!len)
+                out[len++] = '.';
+            return len;
+        }
+        for (; label; label--) {
+            c = name[pos++];
+            if (c == '.' || c == '\\') {
+                out[len++] = '\\';
+                out[len++] = c;
+            } else if (c <= ' ' || c >= 0x7f) {
+                out[len++] = '\\';
+                out[len++] = '0' + c / 100;
+                out[len++] = '0' + c / 10 % 10;
+                out[len++] = '0' + c % 10;
+            } else {
+                out[len++] = c;
+            }
+        }
+        out[len++] = '.';
+    }
+}
+
+static int32_t _dict(output_columnar_t* self, _batch_t* b, const char* name, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t   i, n;
+    int32_t  off;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)name[i]) * 1099511628211ULL;
+
+    for (i = hash & b->mask; b->slots[i]; i = (i + 1) & b->mask) {
+        n = b->slots[i] - 1;
+        if (b->dict_hash[n] == hash
+            && (size_t)(b->dict_offsets[n + 1] - b->dict_offsets[n]) == len
+            && !memcmp(b->dict_data + b->dict_offsets[n], name, len))
+            return n;
+    }
+
+    n   = b->dict_n++;
+    off = b->dict_offsets[n];
+    if (off + len > b->dict_size) {
+        while (off + len > b->dict_size)
+            b->dict_size *= 2;
+        lfatal_oom(b->dict_data = realloc(b->dict_data, b->dict_size));
+    }
+    memcpy(b->dict_data + off, name, len);
+    b->dict_offsets[n + 1] = off + len;
+    b->dict_hash[n]        = hash;
+    b->slots[i]            = n + 1;
+
+    return n;
+}
+
+#define _set(b, c, row, v) memcpy((b)->col[c].values + (row)*_columns[c].width, (v), _columns[c].width)
+
+static inline void _valid(_batch_t* b, int c, size_t row)
+{
+    b->col[c].valid[row / 8] |= 1 << (row % 8);
+}
+
+static inline void _null(_batch_t* b, int c, size_t row)
+{
+    memset(b->col[c].values + row * _columns[c].width, 0, _columns[c].width);
+    b->col[c].nulls++;
+}
+
+static void _receive(output_columnar_t* self, const core_object_t* obj)
+{
+    core_object_dns_layers_t      layers;
+    const core_object_t *         ip, *proto;
+    const filter_qrmatch_match_t* match = NULL;
+    _batch_t*                     b;
+    size_t                        row, len, wire;
+    uint8_t                       addr[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    uint16_t                      u16;
+    uint32_t                      u32;
+    int64_t                       i64;
+    int32_t                       idx;
+    uint8_t                       name[255];
+    char                          qname[1024];
+    mlassert_self();
+
+    if (core_object_dns_layers(&layers, obj)) {
+        self->discarded++;
+        ldebug("packet discarded (missing payload, udp/tcp or ip/ip6 object)");
+        return;
+    }
+    ip    = layers.ip;
+    proto = layers.proto;
+
+    core_object_dns_t dns = CORE_OBJECT_DNS_INIT(layers.payload);
+    dns.includes_dnslen   = proto->obj_type == CORE_OBJECT_TCP;
+    if (core_object_dns_parse_header(&dns)) {
+        self->discarded++;
+        ldebug("packet discarded (malformed DNS header)");
+        return;
+    }
+    if (self->qrmatch)
+        match = filter_qrmatch_process(self->qrmatch, obj);
+
+    b   = _self->filling;
+    row = b->rows;
+
+    i64 = layers.pcap ? layers.pcap->ts.sec * 1000000000 + layers.pcap->ts.nsec : 0;
+    _set(b, _COL_TS, row, &i64);
+
+    if (ip->obj_type == CORE_OBJECT_IP) {
+        memcpy(addr + 12, ((const core_object_ip_t*)ip)->src, 4);
+        _set(b, _COL_SRC, row, addr);
+        memcpy(addr + 12, ((const core_object_ip_t*)ip)->dst, 4);
+        _set(b, _COL_DST, row, addr);
+    } else {
+        _set(b, _COL_SRC, row, ((const core_object_ip6_t*)ip)->src);
+        _set(b, _COL_DST, row, ((const core_object_ip6_t*)ip)->dst);
+    }
+    b->col[_COL_TRANSPORT].values[row] = proto->obj_type == CORE_OBJECT_TCP ? IPPROTO_TCP : IPPROTO_UDP;
+
+    if (proto->obj_type == CORE_OBJECT_UDP) {
+        _set(b, _COL_SPORT, row, &((const core_object_udp_t*)proto)->sport);
+        _set(b, _COL_DPORT, row, &((const core_object_udp_t*)proto)->dport);
+    } else {
+        _set(b, _COL_SPORT, row, &((const core_object_tcp_t*)proto)->sport);
+        _set(b, _COL_DPORT, row, &((const core_object_tcp_t*)proto)->dport);
+    }
+
+    _set(b, _COL_ID, row, &dns.id);
+    u16 = dns.payload[dns.includes_dnslen ? 4 : 2] << 8 | dns.payload[dns.includes_dnslen ? 5 : 3];
+    _set(b, _COL_FLAGS, row, &u16);
+    b->col[_COL_RCODE].values[row] = dns.rcode;
+    u32                            = dns.len - (dns.includes_dnslen ? 2 : 0);
+    _set(b, _COL_SIZE, row, &u32);
+
+    if (dns.qdcount && (wire = core_object_dns_name_copy_lower(name, dns.at, dns.left))) {
+        len = _qname(qname, name);
+        idx = _dict(self, b, qname, len);
+        _set(b, _COL_QNAME, row, &idx);
+        _valid(b, _COL_QNAME, row);
+        if (dns.left >= wire + 2) {
+            u16 = dns.at[wire] << 8 | dns.at[wire + 1];
+            _set(b, _COL_QTYPE, row, &u16);
+            _valid(b, _COL_QTYPE, row);
+        } else {
+            _null(b, _COL_QTYPE, row);
+        }
+    } else {
+        _null(b, _COL_QNAME, row);
+        _null(b, _COL_QTYPE, row);
+    }
+
+    if (match) {
+        i64 = match->rtt_ns;
+        _set(b, _COL_RTT, row, &i64);
+        _valid(b, _COL_RTT, row);
+    } else {
+        _null(b, _COL_RTT, row);
+    }
+
+    b->rows++;
+    self->rows++;
+    if (b->rows == self->batch_rows)
+        _flush(self);
+}
+
+core_receiver_t output_columnar_receiver(output_columnar_t* self)
+{
+    if (!_self->fp) {
+        lfatal("not opened");
+    }
+
+    return (core_receiver_t)_receive;
+}
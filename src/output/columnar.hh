@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.filter.qrmatch_h")
+
+typedef enum output_columnar_compression {
+    OUTPUT_COLUMNAR_NONE,
+    OUTPUT_COLUMNAR_ZSTD
+} output_columnar_compression_t;
+
+typedef struct output_columnar {
+    core_log_t _log;
+
+    /* Rows per record batch and the number of batches that can be filled
+     * while others are being written. */
+    size_t batch_rows;
+    size_t queue;
+
+    output_columnar_compression_t compression;
+    int                           compression_level;
+
+    /* Optional, used to add the round-trip time to matched responses. */
+    filter_qrmatch_t* qrmatch;
+
+    uint64_t rows;
+    uint64_t discarded;
+
+    /* Written by the writer thread, see output_columnar_batches() and
+     * output_columnar_bytes(). */
+    uint64_t batches;
+    uint64_t bytes;
+} output_columnar_t;
+
+core_log_t* output_columnar_log();
+
+output_columnar_t* output_columnar_new(size_t batch_rows);
+void output_columnar_free(output_columnar_t* self);
+int output_columnar_have_zstd();
+uint64_t output_columnar_batches(output_columnar_t* self);
+uint64_t output_columnar_bytes(output_columnar_t* self);
+int output_columnar_open(output_columnar_t* self, const char* file);
+int output_columnar_close(output_columnar_t* self);
+
+core_receiver_t output_columnar_receiver(output_columnar_t* self);
@@ -0,0 +1,170 @@
+-- Copyright (c) 2018-2019, OARC, Inc.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.output.columnar
+-- Output parsed DNS messages in the Arrow IPC columnar format
+--   local output = require("dnsjit.output.columnar").new()
+--   output:compression("zstd")
+--   output:open("dns.arrows")
+--   layer:receiver(output)
+--   input:run()
+--   output:close()
+--
+-- Output the decoded fields of DNS messages as an Arrow IPC stream, which
+-- can be read by pyarrow, pandas, polars, DuckDB and others, for example:
+--   pyarrow.ipc.open_stream("dns.arrows").read_all()
+-- .P
+-- Each message is a row with the columns:
+-- .TP
+-- ts
+-- PCAP timestamp (timestamp[ns, UTC]), 0 if there is no PCAP object.
+-- .TP
+-- src, dst
+-- Addresses (fixed_size_binary[16]), IPv4 as IPv4-mapped IPv6 addresses.
+-- .TP
+-- sport, dport, transport
+-- Ports (uint16) and the IP protocol number of the transport (uint8).
+-- .TP
+-- id, flags, rcode, size
+-- Message ID and flags (uint16, the second 16 bits of the header), RCODE
+-- (uint8) and the size of the DNS message (uint32).
+-- .TP
+-- qname, qtype
+-- The lowercased QNAME in presentation format (dictionary encoded string)
+-- and QTYPE (uint16), null if the message has no (or a compressed)
+-- question.
+-- .TP
+-- rtt
+-- Round-trip time of responses (duration[ns]) if a
+-- .I dnsjit.filter.qrmatch
+-- is set with
+-- .IR qrmatch() ,
+-- null for queries and unmatched responses.
+-- .LP
+-- The object chain must contain a payload, UDP or TCP and IPv4 or IPv6
+-- object (see dnsjit.filter.layer), anything else is discarded.
+-- .P
+-- Rows are collected into record batches that are encoded, optionally
+-- compressed with zstd and written by a background thread while the next
+-- batch is filled.
+-- Each batch is preceded by a dictionary of the QNAMEs in it.
+module(...,package.seeall)
+
+require("dnsjit.output.columnar_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local Columnar = {}
+
+-- Create a new Columnar output writing record batches of
+-- .I batch_rows
+-- rows (default 65536).
+function Columnar.new(batch_rows)
+    local self = {
+        obj = C.output_columnar_new(batch_rows or 65536),
+    }
+    ffi.gc(self.obj, C.output_columnar_free)
+    return setmetatable(self, { __index = Columnar })
+end
+
+-- Return true if dnsjit was built with zstd support.
+function Columnar.have_zstd()
+    return C.output_columnar_have_zstd() == 1
+end
+
+-- Return the Log object to control logging of this instance or module.
+function Columnar:log()
+    if self == nil then
+        return C.output_columnar_log()
+    end
+    return self.obj._log
+end
+
+-- Set the compression of the record batches, "none" (default) or "zstd"
+-- with an optional
+-- .I level
+-- (default 3).
+-- Must be set before opening.
+function Columnar:compression(type, level)
+    if type == "zstd" then
+        self.obj.compression = "OUTPUT_COLUMNAR_ZSTD"
+    elseif type == "none" then
+        self.obj.compression = "OUTPUT_COLUMNAR_NONE"
+    else
+        error("invalid compression "..tostring(type))
+    end
+    if level ~= nil then
+        self.obj.compression_level = level
+    end
+end
+
+-- Set the number of record batches that can be queued for writing before
+-- receiving blocks (default 2).
+-- Must be set before opening.
+function Columnar:queue(batches)
+    self.obj.queue = batches
+end
+
+-- Use a
+-- .I dnsjit.filter.qrmatch
+-- object to match responses to queries and add the round-trip time.
+-- All received objects are processed by it.
+function Columnar:qrmatch(qrmatch)
+    self._qrmatch = qrmatch
+    self.obj.qrmatch = qrmatch.obj
+end
+
+-- Open the file to write to, return 0 on success.
+function Columnar:open(file)
+    return C.output_columnar_open(self.obj, file)
+end
+
+-- Write the remaining rows and close the file, return 0 on success.
+function Columnar:close()
+    return C.output_columnar_close(self.obj)
+end
+
+-- Return the C functions and context for receiving objects.
+function Columnar:receive()
+    return C.output_columnar_receiver(self.obj), self.obj
+end
+
+-- Return the number of rows received.
+function Columnar:rows()
+    return tonumber(self.obj.rows)
+end
+
+-- Return the number of record batches written.
+function Columnar:batches()
+    return tonumber(C.output_columnar_batches(self.obj))
+end
+
+-- Return the number of bytes written.
+function Columnar:bytes()
+    return tonumber(C.output_columnar_bytes(self.obj))
+end
+
+-- Return the number of objects discarded.
+function Columnar:discarded()
+    return tonumber(self.obj.discarded)
+end
+
+-- dnsjit.filter.layer (3),
+-- dnsjit.filter.qrmatch (3),
+-- dnsjit.output.pcap (3)
+return Columnar
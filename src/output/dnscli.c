@@ -22,6 +22,7 @@
 
 #include "output/dnscli.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 #include "core/object/dns.h"
 #include "core/object/payload.h"
 #include "core/object/udp.h"
@@ -76,6 +77,8 @@ static output_dnscli_t _defaults = {
     0, 0
 };
 
+static size_t _m_pkts = 0, _m_recv = 0, _m_errs = 0;
+
 core_log_t* output_dnscli_log()
 {
     return &_log;
@@ -89,6 +92,10 @@ void output_dnscli_init(output_dnscli_t* self, output_dnscli_mode_t mode)
     self->mode        = mode;
     self->pkt.payload = self->recvbuf;
 
+    core_metrics_counter(&_m_pkts, "dnsjit_output_packets_total", "module=\"output.dnscli\"", "Packets sent by output modules");
+    core_metrics_counter(&_m_recv, "dnsjit_output_received_total", "module=\"output.dnscli\"", "Packets received by output modules");
+    core_metrics_counter(&_m_errs, "dnsjit_output_errors_total", "module=\"output.dnscli\"", "Errors of output modules");
+
     switch (mode & OUTPUT_DNSCLI_MODE_MODES) {
     case OUTPUT_DNSCLI_MODE_UDP:
     case OUTPUT_DNSCLI_MODE_TCP:
@@ -248,7 +255,7 @@ int output_dnscli_connect(output_dnscli_t* self, const char* host, const char* p
     return 0;
 }
 
-inline ssize_t _send_udp(output_dnscli_t* self, const uint8_t* payload, size_t len, size_t sent)
+static inline ssize_t _send_udp(output_dnscli_t* self, const uint8_t* payload, size_t len, size_t sent)
 {
     ssize_t n;
 
@@ -261,6 +268,7 @@ inline ssize_t _send_udp(output_dnscli_t* self, const uint8_t* payload, size_t l
                 return -1;
             }
             self->errs++;
+            core_metrics_inc(_m_errs);
             return -2;
         }
     }
@@ -317,6 +325,7 @@ static void _receive_udp(output_dnscli_t* self, const core_object_t* obj)
                 continue;
             }
             self->pkts++;
+            core_metrics_inc(_m_pkts);
             return;
         }
         if (n == -1) {
@@ -329,9 +338,10 @@ static void _receive_udp(output_dnscli_t* self, const core_object_t* obj)
         break;
     }
     self->errs++;
+    core_metrics_inc(_m_errs);
 }
 
-inline ssize_t _send_tcp(output_dnscli_t* self, const uint8_t* payload, size_t len, size_t sent)
+static inline ssize_t _send_tcp(output_dnscli_t* self, const uint8_t* payload, size_t len, size_t sent)
 {
     ssize_t n;
 
@@ -344,6 +354,7 @@ inline ssize_t _send_tcp(output_dnscli_t* self, const uint8_t* payload, size_t l
                 return -1;
             }
             self->errs++;
+            core_metrics_inc(_m_errs);
             return -2;
         }
     }
@@ -395,6 +406,7 @@ static void _receive_tcp(output_dnscli_t* self, const core_object_t* obj)
                     continue;
                 }
                 self->errs++;
+                core_metrics_inc(_m_errs);
                 return;
             }
             sent = 0;
@@ -418,6 +430,7 @@ static void _receive_tcp(output_dnscli_t* self, const core_object_t* obj)
                 continue;
             }
             self->pkts++;
+            core_metrics_inc(_m_pkts);
             return;
         }
         if (n == -1) {
@@ -430,9 +443,10 @@ static void _receive_tcp(output_dnscli_t* self, const core_object_t* obj)
         break;
     }
     self->errs++;
+    core_metrics_inc(_m_errs);
 }
 
-inline ssize_t _send_tls(output_dnscli_t* self, const uint8_t* payload, size_t len, size_t sent)
+static inline ssize_t _send_tls(output_dnscli_t* self, const uint8_t* payload, size_t len, size_t sent)
 {
     ssize_t n;
 
@@ -482,6 +496,7 @@ static void _receive_tls(output_dnscli_t* self, const core_object_t* obj)
                     continue;
                 }
                 self->errs++;
+                core_metrics_inc(_m_errs);
                 return;
             }
             sent = 0;
@@ -505,6 +520,7 @@ static void _receive_tls(output_dnscli_t* self, const core_object_t* obj)
                 continue;
             }
             self->pkts++;
+            core_metrics_inc(_m_pkts);
             return;
         }
         if (n == -1) {
@@ -517,6 +533,7 @@ static void _receive_tls(output_dnscli_t* self, const core_object_t* obj)
         break;
     }
     self->errs++;
+    core_metrics_inc(_m_errs);
 }
 
 luajit_ssize_t output_dnscli_send(output_dnscli_t* self, const core_object_t* obj, size_t sent)
@@ -649,6 +666,7 @@ static const core_object_t* _produce_udp(output_dnscli_t* self)
                     return (core_object_t*)&self->pkt;
                 } else {
                     self->errs++;
+                    core_metrics_inc(_m_errs);
                 }
                 return 0;
             }
@@ -672,6 +690,7 @@ static const core_object_t* _produce_udp(output_dnscli_t* self)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 
@@ -680,6 +699,7 @@ static const core_object_t* _produce_udp(output_dnscli_t* self)
     }
 
     self->pkts_recv++;
+    core_metrics_inc(_m_recv);
     self->pkt.len = n;
     return (core_object_t*)&self->pkt;
 }
@@ -706,6 +726,7 @@ static const core_object_t* _produce_tcp(output_dnscli_t* self)
     }
     if (self->have_dnslen && self->recv >= self->dnslen + sizeof(self->dnslen)) {
         self->pkts_recv++;
+        core_metrics_inc(_m_recv);
         self->pkt.len  = self->dnslen + sizeof(self->dnslen);
         self->have_pkt = 1;
         return (core_object_t*)&self->pkt;
@@ -722,6 +743,7 @@ static const core_object_t* _produce_tcp(output_dnscli_t* self)
                     return (core_object_t*)&self->pkt;
                 } else {
                     self->errs++;
+                    core_metrics_inc(_m_errs);
                 }
                 return 0;
             }
@@ -736,6 +758,7 @@ static const core_object_t* _produce_tcp(output_dnscli_t* self)
             }
             if (self->have_dnslen && self->recv >= self->dnslen + sizeof(self->dnslen)) {
                 self->pkts_recv++;
+                core_metrics_inc(_m_recv);
                 self->pkt.len  = self->dnslen + sizeof(self->dnslen);
                 self->have_pkt = 1;
                 return (core_object_t*)&self->pkt;
@@ -764,6 +787,7 @@ static const core_object_t* _produce_tcp(output_dnscli_t* self)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 
@@ -797,6 +821,7 @@ static const core_object_t* _produce_tls(output_dnscli_t* self)
     }
     if (self->have_dnslen && self->recv >= self->dnslen + sizeof(self->dnslen)) {
         self->pkts_recv++;
+        core_metrics_inc(_m_recv);
         self->pkt.len  = self->dnslen + sizeof(self->dnslen);
         self->have_pkt = 1;
         return (core_object_t*)&self->pkt;
@@ -813,6 +838,7 @@ static const core_object_t* _produce_tls(output_dnscli_t* self)
                     return (core_object_t*)&self->pkt;
                 } else {
                     self->errs++;
+                    core_metrics_inc(_m_errs);
                 }
                 return 0;
             }
@@ -827,6 +853,7 @@ static const core_object_t* _produce_tls(output_dnscli_t* self)
             }
             if (self->have_dnslen && self->recv >= self->dnslen + sizeof(self->dnslen)) {
                 self->pkts_recv++;
+                core_metrics_inc(_m_recv);
                 self->pkt.len  = self->dnslen + sizeof(self->dnslen);
                 self->have_pkt = 1;
                 return (core_object_t*)&self->pkt;
@@ -853,6 +880,7 @@ static const core_object_t* _produce_tls(output_dnscli_t* self)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 
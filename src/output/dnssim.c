@@ -22,6 +22,9 @@
 #include "output/dnssim/common.c"
 #include "output/dnssim/udp.c"
 #include "output/dnssim/tcp.c"
+#include "output/dnssim/tls.c"
+#include "output/dnssim/https2.c"
+#include "output/dnssim/quic.c"
 
 
 core_log_t* output_dnssim_log()
@@ -29,18 +32,96 @@ core_log_t* output_dnssim_log()
     return &_log;
 }
 
+#define _HANDSHAKE_LATENCY_MAX_NS (3600 * 1000000000ULL)
+
+static output_dnssim_stats_t* _stats_new(output_dnssim_t* self)
+{
+    output_dnssim_stats_t* stats;
+    uint64_t timeout_ns = self->timeout_ms * 1000000;
+    lfatal_oom(stats = calloc(1, sizeof(output_dnssim_stats_t)));
+
+    /* Latencies are recorded with a resolution of at least 1us. The
+     * histograms only allocate buckets up to the highest recorded value, so
+     * the generous bound for handshakes (whose timeout may be changed at
+     * any time) costs nothing. Histograms of other transports than the one
+     * in use are left NULL, a set of them is allocated for every interval. */
+    stats->latency = lib_histogram_new(1000, timeout_ns, self->latency_precision);
+    switch (_self->transport) {
+    case OUTPUT_DNSSIM_TRANSPORT_HTTPS2:
+        stats->http2_stream_latency = lib_histogram_new(1000, timeout_ns, self->latency_precision);
+        /* fall through */
+    case OUTPUT_DNSSIM_TRANSPORT_TCP:
+    case OUTPUT_DNSSIM_TRANSPORT_TLS:
+        stats->conn_handshake_latency = lib_histogram_new(1000, _HANDSHAKE_LATENCY_MAX_NS, self->latency_precision);
+        break;
+    case OUTPUT_DNSSIM_TRANSPORT_QUIC:
+        stats->quic_handshake_latency = lib_histogram_new(1000, _HANDSHAKE_LATENCY_MAX_NS, self->latency_precision);
+        stats->quic_stream_latency = lib_histogram_new(1000, timeout_ns, self->latency_precision);
+        break;
+    default:
+        break;
+    }
+    return stats;
+}
+
+static void _stats_free(output_dnssim_stats_t* stats)
+{
+    lib_histogram_free(stats->latency);
+    lib_histogram_free(stats->conn_handshake_latency);
+    lib_histogram_free(stats->http2_stream_latency);
+    lib_histogram_free(stats->quic_handshake_latency);
+    lib_histogram_free(stats->quic_stream_latency);
+    free(stats);
+}
+
+static void _stats_init(output_dnssim_t* self)
+{
+    if (self->stats_sum != NULL)
+        _stats_free(self->stats_sum);
+    if (self->stats_current != NULL)
+        _stats_free(self->stats_current);
+
+    self->stats_sum = _stats_new(self);
+    self->stats_current = _stats_new(self);
+
+    self->stats_first = self->stats_current;
+}
+
+static void _metrics_register()
+{
+    /* 1ms to 5s, in nanoseconds */
+    static const uint64_t bounds[] = {
+        1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000,
+        250000000, 500000000, 1000000000, 2500000000ULL, 5000000000ULL
+    };
+
+    core_metrics_counter(&_m_requests, "dnsjit_dnssim_requests_total", 0, "Requests sent by output.dnssim");
+    core_metrics_counter(&_m_answers, "dnsjit_dnssim_answers_total", 0, "Answers received by output.dnssim");
+    core_metrics_counter(&_m_discarded, "dnsjit_dnssim_discarded_total", 0, "Packets discarded by output.dnssim");
+    core_metrics_gauge(&_m_ongoing, "dnsjit_dnssim_ongoing", 0, "Ongoing requests of output.dnssim");
+    core_metrics_histogram(&_m_latency, "dnsjit_dnssim_latency_seconds", 0, "Request latency of output.dnssim",
+        bounds, sizeof(bounds) / sizeof(bounds[0]), 1e-9);
+}
+
 output_dnssim_t* output_dnssim_new(size_t max_clients)
 {
     output_dnssim_t* self;
     int ret;
 
     mlfatal_oom(self = calloc(1, sizeof(_output_dnssim_t)));
+    _metrics_register();
     self->handshake_timeout_ms = 5000;
     self->idle_timeout_ms = 10000;
+    self->latency_precision = 1;
     output_dnssim_timeout_ms(self, 2000);
 
     _self->source = NULL;
     _self->transport = OUTPUT_DNSSIM_TRANSPORT_UDP_ONLY;
+    _self->tls_priority = NULL;
+    _self->tls_cred = NULL;
+    _self->h2_method = OUTPUT_DNSSIM_H2_POST;
+    _self->h2_max_concurrent_streams = 100;
+    lfatal_oom(_self->h2_uri_path = strdup("/dns-query"));
 
     self->max_clients = max_clients;
     lfatal_oom(_self->client_arr = calloc(
@@ -65,12 +146,10 @@ void output_dnssim_free(output_dnssim_t* self)
     _output_dnssim_source_t* first = _self->source;
     output_dnssim_stats_t* stats_prev;
 
-    free(self->stats_sum->latency);
-    free(self->stats_sum);
+    _stats_free(self->stats_sum);
     do {
         stats_prev = self->stats_current->prev;
-        free(self->stats_current->latency);
-        free(self->stats_current);
+        _stats_free(self->stats_current);
         self->stats_current = stats_prev;
     } while (self->stats_current != NULL);
 
@@ -83,8 +162,22 @@ void output_dnssim_free(output_dnssim_t* self)
         } while (_self->source != first);
     }
 
+    for (int i = 0; i < self->max_clients; ++i) {
+        gnutls_free(_self->client_arr[i].tls_ticket.data);
+        free(_self->client_arr[i].quic_params);
+    }
     free(_self->client_arr);
 
+    if (_self->tls_priority != NULL) {
+        gnutls_priority_deinit(*_self->tls_priority);
+        free(_self->tls_priority);
+    }
+    if (_self->tls_cred != NULL)
+        gnutls_certificate_free_credentials(_self->tls_cred);
+    free(_self->tls_server_name);
+    free(_self->h2_uri_path);
+    free(_self->h2_authority);
+
     ret = uv_loop_close(&_self->loop);
     if (ret < 0) {
         lcritical("failed to close uv_loop (%s)", uv_strerror(ret));
@@ -95,6 +188,8 @@ void output_dnssim_free(output_dnssim_t* self)
     free(self);
 }
 
+/* Client ID is stored in the first four bytes of the destination address,
+ * which is the entire address for IPv4. */
 static uint32_t _extract_client(const core_object_t* obj) {
     uint32_t client;
     uint8_t* ip;
@@ -131,6 +226,7 @@ static void _receive(output_dnssim_t* self, const core_object_t* obj)
         }
         if (current->obj_prev == NULL) {
             self->discarded++;
+            core_metrics_inc(_m_discarded);
             lwarning("packet discarded (missing payload object)");
             return;
         }
@@ -145,6 +241,7 @@ static void _receive(output_dnssim_t* self, const core_object_t* obj)
         }
         if (current->obj_prev == NULL) {
             self->discarded++;
+            core_metrics_inc(_m_discarded);
             lwarning("packet discarded (missing ip/ip6 object)");
             return;
         }
@@ -166,6 +263,7 @@ static void _receive(output_dnssim_t* self, const core_object_t* obj)
 
     if (client >= self->max_clients) {
         self->discarded++;
+        core_metrics_inc(_m_discarded);
         lwarning("packet discarded (client exceeded max_clients)");
         return;
     }
@@ -189,35 +287,183 @@ void output_dnssim_set_transport(output_dnssim_t* self, output_dnssim_transport_
     case OUTPUT_DNSSIM_TRANSPORT_TCP:
         lnotice("transport set to TCP");
         break;
-    case OUTPUT_DNSSIM_TRANSPORT_UDP:
     case OUTPUT_DNSSIM_TRANSPORT_TLS:
+        if (_self->tls_priority == NULL)
+            output_dnssim_tls_priority(self, NULL);
+        lnotice("transport set to TLS");
+        break;
+    case OUTPUT_DNSSIM_TRANSPORT_HTTPS2:
+        if (_self->tls_priority == NULL)
+            output_dnssim_tls_priority(self, NULL);
+        lnotice("transport set to HTTPS2");
+        break;
+    case OUTPUT_DNSSIM_TRANSPORT_QUIC:
+        if (!output_dnssim_have_quic())
+            lfatal("QUIC transport is not available, dnsjit was built without ngtcp2");
+        if (_self->tls_priority == NULL)
+            output_dnssim_tls_priority(self, _QUIC_TLS_PRIORITY);
+        lnotice("transport set to QUIC");
+        break;
+    case OUTPUT_DNSSIM_TRANSPORT_UDP:
     default:
         lfatal("unknown or unsupported transport");
         break;
     }
 
+    if (self->stats_interval_ms != 0) {
+        lfatal("transport must be set before statistics collection");
+    }
+
     _self->transport = tr;
+    _stats_init(self);
 }
 
-int output_dnssim_target(output_dnssim_t* self, const char* ip, uint16_t port) {
+bool output_dnssim_have_quic(void)
+{
+#ifdef OUTPUT_DNSSIM_QUIC
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void _tls_cred_alloc(output_dnssim_t* self)
+{
+    int ret;
+
+    if (_self->tls_cred == NULL) {
+        ret = gnutls_certificate_allocate_credentials(&_self->tls_cred);
+        if (ret < 0)
+            lfatal("failed to allocate tls credentials: %s", gnutls_strerror(ret));
+    }
+}
+
+void output_dnssim_tls_priority(output_dnssim_t* self, const char* priority)
+{
     int ret;
     mlassert_self();
+
+    _tls_cred_alloc(self);
+
+    if (_self->tls_priority != NULL) {
+        gnutls_priority_deinit(*_self->tls_priority);
+    } else {
+        lfatal_oom(_self->tls_priority = malloc(sizeof(gnutls_priority_t)));
+    }
+
+    if (priority == NULL) {
+        ret = gnutls_priority_init(_self->tls_priority, NULL, NULL);
+        if (ret < 0)
+            lfatal("failed to set default tls priority: %s", gnutls_strerror(ret));
+        return;
+    }
+
+    ret = gnutls_priority_init(_self->tls_priority, priority, NULL);
+    if (ret < 0)
+        lfatal("failed to set tls priority \"%s\": %s", priority, gnutls_strerror(ret));
+    lnotice("tls priority set to \"%s\"", priority);
+}
+
+void output_dnssim_tls_server_name(output_dnssim_t* self, const char* name)
+{
+    mlassert_self();
+    lassert(name, "name is nil");
+
+    free(_self->tls_server_name);
+    lfatal_oom(_self->tls_server_name = strdup(name));
+    lnotice("tls server name set to \"%s\"", name);
+}
+
+void output_dnssim_tls_verify(output_dnssim_t* self, const char* cafile)
+{
+    int ret;
+    mlassert_self();
+
+    _tls_cred_alloc(self);
+    if (cafile != NULL) {
+        ret = gnutls_certificate_set_x509_trust_file(_self->tls_cred, cafile, GNUTLS_X509_FMT_PEM);
+        if (ret < 0)
+            lfatal("failed to load trusted certificates from \"%s\": %s", cafile, gnutls_strerror(ret));
+    } else {
+        ret = gnutls_certificate_set_x509_system_trust(_self->tls_cred);
+        if (ret < 0)
+            lwarning("failed to load the system's trusted certificates: %s", gnutls_strerror(ret));
+    }
+    if (ret <= 0)
+        lwarning("no trusted certificates loaded, all servers will be rejected");
+    else
+        lnotice("tls certificate verification enabled, %d trusted certificates", ret);
+    _self->tls_verify = true;
+}
+
+void output_dnssim_h2_uri_path(output_dnssim_t* self, const char* uri_path)
+{
+    mlassert_self();
+    lassert(uri_path, "uri_path is nil");
+    lassert(uri_path[0] == '/', "uri_path must start with /");
+
+    free(_self->h2_uri_path);
+    lfatal_oom(_self->h2_uri_path = strdup(uri_path));
+    lnotice("http2 uri path set to \"%s\"", uri_path);
+}
+
+void output_dnssim_h2_authority(output_dnssim_t* self, const char* authority)
+{
+    mlassert_self();
+    lassert(authority, "authority is nil");
+
+    free(_self->h2_authority);
+    lfatal_oom(_self->h2_authority = strdup(authority));
+    lnotice("http2 authority set to \"%s\"", authority);
+}
+
+void output_dnssim_h2_method(output_dnssim_t* self, output_dnssim_h2_method_t method)
+{
+    mlassert_self();
+
+    switch (method) {
+    case OUTPUT_DNSSIM_H2_GET:
+        lnotice("http2 method set to GET");
+        break;
+    case OUTPUT_DNSSIM_H2_POST:
+        lnotice("http2 method set to POST");
+        break;
+    default:
+        lfatal("unknown http2 method");
+        break;
+    }
+
+    _self->h2_method = method;
+}
+
+void output_dnssim_h2_max_concurrent_streams(output_dnssim_t* self, uint32_t max_streams)
+{
+    mlassert_self();
+    lassert(max_streams > 0, "max_streams must be greater than 0");
+
+    _self->h2_max_concurrent_streams = max_streams;
+    lnotice("http2 max concurrent streams per connection set to %u", max_streams);
+}
+
+int output_dnssim_target(output_dnssim_t* self, const char* ip, uint16_t port) {
+    struct sockaddr_storage addr;
+    mlassert_self();
     lassert(ip, "ip is nil");
     lassert(port, "port is nil");
 
-    ret = uv_ip6_addr(ip, port, (struct sockaddr_in6*)&_self->target);
-    if (ret != 0) {
-        lcritical("failed to parse IPv6 from \"%s\"", ip);
+    /* Parse into a temporary, uv_ip6_addr() sets the family even when it
+     * fails and would leave a bogus IPv6 target behind. */
+    if (uv_ip6_addr(ip, port, (struct sockaddr_in6*)&addr) == 0) {
+        memcpy(&_self->target_ip6, &addr, sizeof(addr));
+        lnotice("set IPv6 target to %s port %d", ip, port);
+    } else if (uv_ip4_addr(ip, port, (struct sockaddr_in*)&addr) == 0) {
+        memcpy(&_self->target_ip4, &addr, sizeof(addr));
+        lnotice("set IPv4 target to %s port %d", ip, port);
+    } else {
+        lcritical("failed to parse IP/IP6 from \"%s\"", ip);
         return -1;
-        // TODO IPv4 support
-        //ret = uv_ip4_addr(ip, port, (struct sockaddr_in*)&_self->target);
-        //if (ret != 0) {
-        //    lcritical("failed to parse IP/IP6 from \"%s\"", ip);
-        //    return -1;
-        //}
     }
 
-    lnotice("set target to %s port %d", ip, port);
     return 0;
 }
 
@@ -231,9 +477,11 @@ int output_dnssim_bind(output_dnssim_t* self, const char* ip) {
 
     ret = uv_ip6_addr(ip, 0, (struct sockaddr_in6*)&source->addr);
     if (ret != 0) {
-        lfatal("failed to parse IPv6 from \"%s\"", ip);
-        return -1;
-        // TODO IPv4 support
+        ret = uv_ip4_addr(ip, 0, (struct sockaddr_in*)&source->addr);
+        if (ret != 0) {
+            lfatal("failed to parse IP/IP6 from \"%s\"", ip);
+            return -1;
+        }
     }
 
     if (_self->source == NULL) {
@@ -260,20 +508,21 @@ void output_dnssim_timeout_ms(output_dnssim_t* self, uint64_t timeout_ms)
     mlassert_self();
     lassert(timeout_ms > 0, "timeout must be greater than 0");
 
-    if (self->stats_sum != NULL)
-        free(self->stats_sum);
-    if (self->stats_current != NULL)
-        free(self->stats_current);
-
     self->timeout_ms = timeout_ms;
+    _stats_init(self);
+}
 
-    lfatal_oom(self->stats_sum = calloc(1, sizeof(output_dnssim_stats_t)));
-    lfatal_oom(self->stats_sum->latency = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+void output_dnssim_latency_precision(output_dnssim_t* self, int significant_digits)
+{
+    mlassert_self();
+    lassert(significant_digits >= 1 && significant_digits <= 5, "significant digits must be between 1 and 5");
 
-    lfatal_oom(self->stats_current = calloc(1, sizeof(output_dnssim_stats_t)));
-    lfatal_oom(self->stats_current->latency = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+    if (self->stats_interval_ms != 0) {
+        lfatal("latency precision must be set before statistics collection");
+    }
 
-    self->stats_first = self->stats_current;
+    self->latency_precision = significant_digits;
+    _stats_init(self);
 }
 
 static void _on_stats_timer_tick(uv_timer_t* handle)
@@ -284,9 +533,7 @@ static void _on_stats_timer_tick(uv_timer_t* handle)
         self->processed, self->stats_sum->answers, self->discarded,
         self->ongoing);
 
-    output_dnssim_stats_t* stats_next;
-    lfatal_oom(stats_next = calloc(1, sizeof(output_dnssim_stats_t)));
-    lfatal_oom(stats_next->latency = calloc(self->timeout_ms + 1, sizeof(uint64_t)));
+    output_dnssim_stats_t* stats_next = _stats_new(self);
 
     self->stats_current->until_ms = now_ms;
     stats_next->since_ms = now_ms;
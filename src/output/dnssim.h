@@ -21,12 +21,14 @@
 #include "config.h"
 #include "core/assert.h"
 #include "core/log.h"
+#include "core/metrics.h"
 #include "core/object/dns.h"
 #include "core/object/ip.h"
 #include "core/object/ip6.h"
 #include "core/object/payload.h"
 #include "core/producer.h"
 #include "core/receiver.h"
+#include "lib/histogram.h"
 
 #ifndef __dnsjit_output_dnssim_h
 #define __dnsjit_output_dnssim_h
@@ -34,8 +36,20 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <uv.h>
 #include <ck_ring.h>
+#include <gnutls/gnutls.h>
+#include <nghttp2/nghttp2.h>
+
+#if defined(HAVE_NGTCP2_NGTCP2_H) && defined(HAVE_NGTCP2_NGTCP2_CRYPTO_GNUTLS_H) \
+    && defined(HAVE_LIBNGTCP2) && defined(HAVE_LIBNGTCP2_CRYPTO_GNUTLS)
+#define OUTPUT_DNSSIM_QUIC 1
+#include <ngtcp2/ngtcp2.h>
+#include <ngtcp2/ngtcp2_crypto.h>
+#include <ngtcp2/ngtcp2_crypto_gnutls.h>
+#include <gnutls/crypto.h>
+#endif
 
 #include "output/dnssim.hh"
 #include "output/dnssim/internal.h"
@@ -20,20 +20,39 @@
 
 //lua:require("dnsjit.core.log")
 //lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.lib.histogram_h")
 
 typedef enum output_dnssim_transport {
     OUTPUT_DNSSIM_TRANSPORT_UDP_ONLY,
     OUTPUT_DNSSIM_TRANSPORT_UDP,
     OUTPUT_DNSSIM_TRANSPORT_TCP,
-    OUTPUT_DNSSIM_TRANSPORT_TLS
+    OUTPUT_DNSSIM_TRANSPORT_TLS,
+    OUTPUT_DNSSIM_TRANSPORT_HTTPS2,
+    OUTPUT_DNSSIM_TRANSPORT_QUIC
 } output_dnssim_transport_t;
 
+typedef enum output_dnssim_h2_method {
+    OUTPUT_DNSSIM_H2_GET,
+    OUTPUT_DNSSIM_H2_POST
+} output_dnssim_h2_method_t;
+
 typedef struct output_dnssim_stats output_dnssim_stats_t;
 struct output_dnssim_stats {
     output_dnssim_stats_t* prev;
     output_dnssim_stats_t* next;
 
-    uint64_t* latency;
+    /* Histogram of request latency in ns, from sending the request until
+     * the answer is received (or timeout). */
+    lib_histogram_t* latency;
+
+    /* Histograms of connection handshake (TCP and TLS, if used), HTTP/2 and
+     * QUIC stream (from opening the stream until it's closed or the response
+     * is received) and QUIC handshake latency in ns, NULL unless used by the
+     * transport. */
+    lib_histogram_t* conn_handshake_latency;
+    lib_histogram_t* http2_stream_latency;
+    lib_histogram_t* quic_handshake_latency;
+    lib_histogram_t* quic_stream_latency;
 
     uint64_t since_ms;
     uint64_t until_ms;
@@ -42,6 +61,12 @@ struct output_dnssim_stats {
     uint64_t ongoing;
     uint64_t answers;
 
+    /* Number of requests sent and answers received over IPv4 and IPv6. */
+    uint64_t requests_ip4;
+    uint64_t requests_ip6;
+    uint64_t answers_ip4;
+    uint64_t answers_ip6;
+
     /* Number of connections that are open at the end of the stats interval. */
     uint64_t conn_active;
 
@@ -51,6 +76,25 @@ struct output_dnssim_stats {
     /* Number of timed out connection handshakes during the stats interval. */
     uint64_t conn_handshakes_failed;
 
+    /* Number of completed connection handshakes (TCP and TLS, if used)
+     * during the stats interval. */
+    uint64_t conn_handshakes_done;
+
+    /* Number of resumed TLS sessions during the stats interval. */
+    uint64_t conn_resumed;
+
+    /* Number of HTTP/2 streams that were closed. */
+    uint64_t http2_streams;
+
+    /* Number of HTTP/2 responses with other status than 200. */
+    uint64_t http2_status_other;
+
+    /* Number of QUIC connections whose 0-RTT data was accepted. */
+    uint64_t conn_quic_0rtt;
+
+    /* Number of QUIC streams that received a response. */
+    uint64_t quic_streams;
+
     uint64_t rcode_noerror;
     uint64_t rcode_formerr;
     uint64_t rcode_servfail;
@@ -91,6 +135,9 @@ typedef struct output_dnssim {
     uint64_t idle_timeout_ms;
     uint64_t handshake_timeout_ms;
     uint64_t stats_interval_ms;
+
+    /* Number of significant decimal digits of the latency histograms. */
+    int latency_precision;
 } output_dnssim_t;
 
 core_log_t* output_dnssim_log();
@@ -99,10 +146,19 @@ output_dnssim_t* output_dnssim_new(size_t max_clients);
 void output_dnssim_free(output_dnssim_t* self);
 
 void output_dnssim_set_transport(output_dnssim_t* self, output_dnssim_transport_t tr);
+bool output_dnssim_have_quic(void);
+void output_dnssim_tls_priority(output_dnssim_t* self, const char* priority);
+void output_dnssim_tls_server_name(output_dnssim_t* self, const char* name);
+void output_dnssim_tls_verify(output_dnssim_t* self, const char* cafile);
+void output_dnssim_h2_uri_path(output_dnssim_t* self, const char* uri_path);
+void output_dnssim_h2_authority(output_dnssim_t* self, const char* authority);
+void output_dnssim_h2_method(output_dnssim_t* self, output_dnssim_h2_method_t method);
+void output_dnssim_h2_max_concurrent_streams(output_dnssim_t* self, uint32_t max_streams);
 int output_dnssim_target(output_dnssim_t* self, const char* ip, uint16_t port);
 int output_dnssim_bind(output_dnssim_t* self, const char* ip);
 int output_dnssim_run_nowait(output_dnssim_t* self);
 void output_dnssim_timeout_ms(output_dnssim_t* self, uint64_t timeout_ms);
+void output_dnssim_latency_precision(output_dnssim_t* self, int significant_digits);
 void output_dnssim_stats_collect(output_dnssim_t* self, uint64_t interval_ms);
 void output_dnssim_stats_finish(output_dnssim_t* self);
 
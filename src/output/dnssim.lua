@@ -41,12 +41,13 @@ module(...,package.seeall)
 require("dnsjit.output.dnssim_h")
 local bit = require("bit")
 local object = require("dnsjit.core.objects")
+local Histogram = require("dnsjit.lib.histogram")
 local ffi = require("ffi")
 local C = ffi.C
 
 local DnsSim = {}
 
-local _DNSSIM_JSON_VERSION = 20200406
+local _DNSSIM_JSON_VERSION = 20200511
 
 -- Create a new DnsSim output for up to max_clients.
 function DnsSim.new(max_clients)
@@ -68,7 +69,10 @@ end
 
 -- Set the target server where queries will be sent to. Returns 0 on success.
 --
--- Only IPv6 target are supported for now.
+-- The ip can be either IPv4 or IPv6. For dual-stack operation, call this
+-- once for each address family; queries are then sent to the target of the
+-- same family as the source address selected by bind(), or to both targets
+-- in turns if no source address is set.
 function DnsSim:target(ip, port)
     local nport = tonumber(port)
     if nport == nil then
@@ -83,7 +87,8 @@ function DnsSim:target(ip, port)
 end
 
 -- Specify source address for sending queries. Can be set multiple times. Adresses
--- are selected round-robin when sending.
+-- are selected round-robin when sending. Both IPv4 and IPv6 addresses may be
+-- used, sources without a target of the same family are skipped.
 function DnsSim:bind(ip)
     return C.output_dnssim_bind(self.obj, ip)
 end
@@ -103,11 +108,89 @@ function DnsSim:tcp()
     C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_TCP)
 end
 
--- Set the transport to TLS.
-function DnsSim:tls()
+-- Set the transport to TLS. The optional tls_priority string sets the
+-- GnuTLS priority string (see gnutls_priority_init(3)), otherwise the
+-- default priorities are used. Connections of the same client resume
+-- the previous TLS session, if the server supports it.
+-- No server name is sent and the server's certificate is accepted without
+-- any checks unless set with tls_server_name() and tls_verify().
+function DnsSim:tls(tls_priority)
+    if tls_priority ~= nil then
+        C.output_dnssim_tls_priority(self.obj, tls_priority)
+    end
     C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_TLS)
 end
 
+-- Send the server name (SNI) with the TLS, HTTPS and QUIC handshakes, with
+-- tls_verify() it is also checked against the server's certificate.
+function DnsSim:tls_server_name(name)
+    C.output_dnssim_tls_server_name(self.obj, name)
+end
+
+-- Verify the server's certificate, against the certificates in the PEM
+-- file cafile or, if not given, the system's trusted certificates.
+-- Handshakes with servers whose certificate does not verify fail.
+function DnsSim:tls_verify(cafile)
+    C.output_dnssim_tls_verify(self.obj, cafile)
+end
+
+-- Set the transport to HTTP/2 over TLS (DNS-over-HTTPS, RFC 8484). The
+-- optional http2_options table may contain the following keys:
+-- .B method
+-- (either "GET" or "POST", default "POST"),
+-- .B uri_path
+-- (default "/dns-query"),
+-- .B authority
+-- (the :authority sent with each request, e.g. the server's hostname;
+-- default is the address and port of the connection's target) and
+-- .B max_concurrent_streams
+-- (maximum number of outstanding queries per connection, default 100; the
+-- server's SETTINGS_MAX_CONCURRENT_STREAMS is respected if it's lower).
+-- Queries above the limit wait until a stream is closed.
+-- The tls_priority is the same as for tls().
+function DnsSim:https2(http2_options, tls_priority)
+    if tls_priority ~= nil then
+        C.output_dnssim_tls_priority(self.obj, tls_priority)
+    end
+    if http2_options ~= nil then
+        if http2_options.method == "GET" then
+            C.output_dnssim_h2_method(self.obj, C.OUTPUT_DNSSIM_H2_GET)
+        elseif http2_options.method == "POST" then
+            C.output_dnssim_h2_method(self.obj, C.OUTPUT_DNSSIM_H2_POST)
+        elseif http2_options.method ~= nil then
+            self.obj._log:fatal("unsupported http2 method: "..http2_options.method)
+        end
+        if http2_options.uri_path ~= nil then
+            C.output_dnssim_h2_uri_path(self.obj, http2_options.uri_path)
+        end
+        if http2_options.authority ~= nil then
+            C.output_dnssim_h2_authority(self.obj, http2_options.authority)
+        end
+        if http2_options.max_concurrent_streams ~= nil then
+            C.output_dnssim_h2_max_concurrent_streams(self.obj, http2_options.max_concurrent_streams)
+        end
+    end
+    C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_HTTPS2)
+end
+
+-- Set the transport to QUIC (DNS-over-QUIC, RFC 9250). Each query is sent
+-- over its own stream and connections are reused the same way as with TCP.
+-- Clients resume the previous session and send queries as 0-RTT data, if
+-- the server allows it. The optional tls_priority must only enable TLS 1.3,
+-- by default "%DISABLE_TLS13_COMPAT_MODE:NORMAL:-VERS-ALL:+VERS-TLS1.3" is
+-- used. Only available when dnsjit is built with ngtcp2, see have_quic().
+function DnsSim:quic(tls_priority)
+    if tls_priority ~= nil then
+        C.output_dnssim_tls_priority(self.obj, tls_priority)
+    end
+    C.output_dnssim_set_transport(self.obj, C.OUTPUT_DNSSIM_TRANSPORT_QUIC)
+end
+
+-- Return true if QUIC transport is available.
+function DnsSim.have_quic()
+    return C.output_dnssim_have_quic()
+end
+
 -- Set timeout for the individual requests in seconds (default 2s). Beware:
 -- increasing this value while the target resolver isn't very responsive (cold
 -- cache, heavy load) may degrade shotgun's performance and skew the results.
@@ -119,6 +202,15 @@ function DnsSim:timeout(seconds)
     C.output_dnssim_timeout_ms(self.obj, timeout_ms)
 end
 
+-- Set the precision of the latency histograms as the number of significant
+-- decimal digits (1 to 5, default 1), i.e. a relative error of 10% to
+-- 0.001%. Latencies are measured with a monotonic nanosecond clock and
+-- recorded with a resolution of at least 1us. Must be set before
+-- .IR stats_collect() .
+function DnsSim:latency_precision(significant_digits)
+    C.output_dnssim_latency_precision(self.obj, significant_digits)
+end
+
 -- Set TCP connection idle timeout for connection reuse according to RFC7766,
 -- Section 6.2.3. When set to zero, connections are closed immediately after
 -- there are no more pending queries. Defaults to 10s.
@@ -129,9 +221,10 @@ function DnsSim:idle_timeout(seconds)
     self.obj.idle_timeout_ms = math.floor(seconds * 1000)
 end
 
--- Set TCP connection handshake timeout. During heavy load, the server may no
--- longer accept new connections. This parameter ensures such connection
--- attempts are aborted after the timeout expires. Defaults to 5s.
+-- Set TCP connection handshake timeout (including the TLS handshake, if
+-- used). During heavy load, the server may no longer accept new connections.
+-- This parameter ensures such connection attempts are aborted after the
+-- timeout expires. Defaults to 5s.
 function DnsSim:handshake_timeout(seconds)
     if seconds == nil then
         seconds = 5
@@ -172,6 +265,20 @@ function DnsSim:noerror()
     return tonumber(self.obj.stats_sum.rcode_noerror)
 end
 
+-- Return the histogram of request latencies in ns over the whole run as a
+-- dnsjit.lib.histogram object, for example to merge the results of dnssim
+-- instances running in multiple threads.
+-- The histogram is owned by this DnsSim and must not be used after it's freed.
+function DnsSim:latency()
+    return Histogram.wrap(self.obj.stats_sum.latency)
+end
+
+-- Return the request latency in ms at the given percentile (0 to 100) over
+-- the whole run.
+function DnsSim:latency_percentile(percentile)
+    return tonumber(C.lib_histogram_percentile(self.obj.stats_sum.latency, percentile)) / 1000000
+end
+
 -- Configure statistics to be collected every N seconds.
 function DnsSim:stats_collect(seconds)
     if seconds == nil then
@@ -194,6 +301,33 @@ function DnsSim:export(filename)
         return
     end
 
+    -- Histograms are written as summary values and a sparse list of the
+    -- non-empty buckets ([lowest, highest, count]), all values are in ns.
+    local function write_histogram(file, name, obj)
+        local hist = Histogram.wrap(obj)
+        file:write(
+            ',"', name, '":{',
+                '"count":', hist:count(), ',',
+                '"min":', hist:min(), ',',
+                '"max":', hist:max(), ',',
+                '"mean":', string.format("%.0f", hist:mean()), ',',
+                '"p50":', hist:percentile(50), ',',
+                '"p90":', hist:percentile(90), ',',
+                '"p95":', hist:percentile(95), ',',
+                '"p99":', hist:percentile(99), ',',
+                '"p999":', hist:percentile(99.9), ',',
+                '"buckets":[')
+        local first = true
+        for lowest, highest, count in hist:buckets() do
+            if not first then
+                file:write(',')
+            end
+            first = false
+            file:write('[', lowest, ',', highest, ',', count, ']')
+        end
+        file:write("]}")
+    end
+
     local function write_stats(file, stats)
         file:write(
             "{ ",
@@ -202,9 +336,19 @@ function DnsSim:export(filename)
                 '"requests":', tonumber(stats.requests), ',',
                 '"ongoing":', tonumber(stats.ongoing), ',',
                 '"answers":', tonumber(stats.answers), ',',
+                '"requests_ip4":', tonumber(stats.requests_ip4), ',',
+                '"requests_ip6":', tonumber(stats.requests_ip6), ',',
+                '"answers_ip4":', tonumber(stats.answers_ip4), ',',
+                '"answers_ip6":', tonumber(stats.answers_ip6), ',',
                 '"conn_active":', tonumber(stats.conn_active), ',',
                 '"conn_handshakes":', tonumber(stats.conn_handshakes), ',',
                 '"conn_handshakes_failed":', tonumber(stats.conn_handshakes_failed), ',',
+                '"conn_handshakes_done":', tonumber(stats.conn_handshakes_done), ',',
+                '"conn_resumed":', tonumber(stats.conn_resumed), ',',
+                '"http2_streams":', tonumber(stats.http2_streams), ',',
+                '"http2_status_other":', tonumber(stats.http2_status_other), ',',
+                '"conn_quic_0rtt":', tonumber(stats.conn_quic_0rtt), ',',
+                '"quic_streams":', tonumber(stats.quic_streams), ',',
                 '"rcode_noerror":', tonumber(stats.rcode_noerror), ',',
                 '"rcode_formerr":', tonumber(stats.rcode_formerr), ',',
                 '"rcode_servfail":', tonumber(stats.rcode_servfail), ',',
@@ -224,13 +368,15 @@ function DnsSim:export(filename)
                 '"rcode_badalg":', tonumber(stats.rcode_badalg), ',',
                 '"rcode_badtrunc":', tonumber(stats.rcode_badtrunc), ',',
                 '"rcode_badcookie":', tonumber(stats.rcode_badcookie), ',',
-                '"rcode_other":', tonumber(stats.rcode_other), ',',
-                '"latency":[')
-        file:write(tonumber(stats.latency[0]))
-        for i=1,tonumber(self.obj.timeout_ms) do
-            file:write(',', tonumber(stats.latency[i]))
+                '"rcode_other":', tonumber(stats.rcode_other))
+        -- only the histograms of the transport in use are allocated
+        for _, name in ipairs({ "latency", "conn_handshake_latency", "http2_stream_latency",
+                "quic_handshake_latency", "quic_stream_latency" }) do
+            if stats[name] ~= nil then
+                write_histogram(file, name, stats[name])
+            end
         end
-        file:write("]}")
+        file:write("}")
     end
 
     file:write(
@@ -239,6 +385,7 @@ function DnsSim:export(filename)
             '"merged":false,',
             '"stats_interval_ms":', tonumber(self.obj.stats_interval_ms), ',',
             '"timeout_ms":', tonumber(self.obj.timeout_ms), ',',
+            '"latency_precision":', tonumber(self.obj.latency_precision), ',',
             '"idle_timeout_ms":', tonumber(self.obj.idle_timeout_ms), ',',
             '"handshake_timeout_ms":', tonumber(self.obj.handshake_timeout_ms), ',',
             '"discarded":', self:discarded(), ',',
@@ -275,5 +422,6 @@ end
 -- dnsjit.filter.ipsplit (3),
 -- dnsjit.filter.core.object.ip (3),
 -- dnsjit.filter.core.object.ip6 (3),
+-- dnsjit.lib.responder (3),
 -- https://gitlab.labs.nic.cz/knot/shotgun
 return DnsSim
@@ -49,6 +49,7 @@ static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* clie
     req->dns_q = core_object_dns_new();
     req->dns_q->obj_prev = (core_object_t*)req->payload;
     req->dnssim->ongoing++;
+    core_metrics_inc(_m_ongoing);
     req->state = _OUTPUT_DNSSIM_REQ_ONGOING;
     req->stats = self->stats_current;
 
@@ -59,6 +60,7 @@ static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* clie
     }
 
     req->dnssim->stats_sum->requests++;
+    core_metrics_inc(_m_requests);
     req->stats->requests++;
 
     switch(_self->transport) {
@@ -67,6 +69,9 @@ static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* clie
         ret = _create_query_udp(self, req);
         break;
     case OUTPUT_DNSSIM_TRANSPORT_TCP:
+    case OUTPUT_DNSSIM_TRANSPORT_TLS:
+    case OUTPUT_DNSSIM_TRANSPORT_HTTPS2:
+    case OUTPUT_DNSSIM_TRANSPORT_QUIC:
         ret = _create_query_tcp(self, req);
         break;
     default:
@@ -77,8 +82,8 @@ static void _create_request(output_dnssim_t* self, _output_dnssim_client_t* clie
         goto failure;
     }
 
-    req->created_at = uv_now(&_self->loop);
-    req->ended_at = req->created_at + self->timeout_ms;
+    req->created_at = uv_hrtime();
+    req->ended_at = req->created_at + self->timeout_ms * 1000000;
     lfatal_oom(req->timer = malloc(sizeof(uv_timer_t)));
     uv_timer_init(&_self->loop, req->timer);
     req->timer->data = req;
@@ -91,30 +96,87 @@ failure:
     return;
 }
 
-/* Bind before connect to be able to send from different source IPs. */
-static int _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle)
+static const struct sockaddr* _get_target(output_dnssim_t* self, sa_family_t family)
 {
-    if (_self->source != NULL) {
-        struct sockaddr* addr = (struct sockaddr*)&_self->source->addr;
-        int ret;
-        switch(handle->type) {
-        case UV_UDP:
-            ret = uv_udp_bind((uv_udp_t*)handle, addr, 0);
-            break;
-        case UV_TCP:
-            ret = uv_tcp_bind((uv_tcp_t*)handle, addr, 0);
-            break;
-        default:
-            lfatal("bind before connect: unsupported handle type");
-            break;
-        }
-        if (ret < 0) {
-            lwarning("failed to bind to address: %s", uv_strerror(ret));
-            return ret;
+    if (family == AF_INET6 && _self->target_ip6.ss_family == AF_INET6)
+        return (struct sockaddr*)&_self->target_ip6;
+    if (family == AF_INET && _self->target_ip4.ss_family == AF_INET)
+        return (struct sockaddr*)&_self->target_ip4;
+    return NULL;
+}
+
+/* Bind before connect to be able to send from different source IPs.
+ *
+ * Sources are used round-robin, skipping those without a target of the same
+ * address family. Without any sources, targets of both families (if set) are
+ * used in turns. Returns the target to send to, or NULL on failure. */
+static const struct sockaddr* _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle)
+{
+    const struct sockaddr* target = NULL;
+    _output_dnssim_source_t* source = _self->source;
+
+    if (source == NULL) {
+        if (_self->last_family == AF_INET6)
+            target = _get_target(self, AF_INET);
+        if (target == NULL)
+            target = _get_target(self, AF_INET6);
+        if (target == NULL)
+            target = _get_target(self, AF_INET);
+        if (target == NULL) {
+            lwarning("no target set");
+            return NULL;
         }
-        _self->source = _self->source->next;
+        _self->last_family = target->sa_family;
+        return target;
+    }
+
+    do {
+        target = _get_target(self, source->addr.ss_family);
+        if (target != NULL)
+            break;
+        source = source->next;
+    } while (source != _self->source);
+    if (target == NULL) {
+        lwarning("no target with the same address family as any of the sources");
+        return NULL;
+    }
+
+    struct sockaddr* addr = (struct sockaddr*)&source->addr;
+    int ret;
+    switch(handle->type) {
+    case UV_UDP:
+        ret = uv_udp_bind((uv_udp_t*)handle, addr, 0);
+        break;
+    case UV_TCP:
+        ret = uv_tcp_bind((uv_tcp_t*)handle, addr, 0);
+        break;
+    default:
+        lfatal("bind before connect: unsupported handle type");
+        break;
+    }
+    _self->source = source->next;
+    if (ret < 0) {
+        lwarning("failed to bind to address: %s", uv_strerror(ret));
+        return NULL;
+    }
+    return target;
+}
+
+/* Account the request as sent over the given address family. Queries
+ * re-sent over another connection are only counted once. */
+static void _request_sent(_output_dnssim_request_t* req, sa_family_t family)
+{
+    if (req->family != 0)
+        return;
+    req->family = family;
+
+    if (family == AF_INET6) {
+        req->dnssim->stats_sum->requests_ip6++;
+        req->stats->requests_ip6++;
+    } else {
+        req->dnssim->stats_sum->requests_ip4++;
+        req->stats->requests_ip4++;
     }
-    return 0;
 }
 
 static void _maybe_free_request(_output_dnssim_request_t* req)
@@ -135,6 +197,9 @@ static void _close_query(_output_dnssim_query_t* qry)
         _close_query_udp((_output_dnssim_query_udp_t*)qry);
         break;
     case OUTPUT_DNSSIM_TRANSPORT_TCP:
+    case OUTPUT_DNSSIM_TRANSPORT_TLS:
+    case OUTPUT_DNSSIM_TRANSPORT_HTTPS2:
+    case OUTPUT_DNSSIM_TRANSPORT_QUIC:
         _close_query_tcp((_output_dnssim_query_tcp_t*)qry);
         break;
     default:
@@ -150,17 +215,19 @@ static void _close_request(_output_dnssim_request_t* req)
     mlassert(req->state == _OUTPUT_DNSSIM_REQ_ONGOING, "request to be closed must be ongoing");
     req->state = _OUTPUT_DNSSIM_REQ_CLOSING;
     req->dnssim->ongoing--;
+    core_metrics_dec(_m_ongoing);
 
     /* Calculate latency. */
     uint64_t latency;
-    req->ended_at = uv_now(&((_output_dnssim_t*)req->dnssim)->loop);
+    req->ended_at = uv_hrtime();
     latency = req->ended_at - req->created_at;
-    if (latency > req->dnssim->timeout_ms) {
-        req->ended_at = req->created_at + req->dnssim->timeout_ms;
-        latency = req->dnssim->timeout_ms;
+    if (latency > req->dnssim->timeout_ms * 1000000) {
+        req->ended_at = req->created_at + req->dnssim->timeout_ms * 1000000;
+        latency = req->dnssim->timeout_ms * 1000000;
     }
-    req->stats->latency[latency]++;
-    req->dnssim->stats_sum->latency[latency]++;
+    lib_histogram_record(req->stats->latency, latency);
+    lib_histogram_record(req->dnssim->stats_sum->latency, latency);
+    core_metrics_observe(_m_latency, latency);
 
     if (req->timer != NULL) {
         uv_timer_stop(req->timer);
@@ -192,7 +259,15 @@ static void _on_request_timeout(uv_timer_t* handle)
 static void _request_answered(_output_dnssim_request_t* req, core_object_dns_t* msg)
 {
     req->dnssim->stats_sum->answers++;
+    core_metrics_inc(_m_answers);
     req->stats->answers++;
+    if (req->family == AF_INET6) {
+        req->dnssim->stats_sum->answers_ip6++;
+        req->stats->answers_ip6++;
+    } else if (req->family == AF_INET) {
+        req->dnssim->stats_sum->answers_ip4++;
+        req->stats->answers_ip4++;
+    }
 
     switch(msg->rcode) {
     case CORE_OBJECT_DNS_RCODE_NOERROR:
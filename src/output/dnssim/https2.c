@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _HTTP2_MAX_DNSMSG_SIZE 65535
+#define _HTTP2_CONTENT_TYPE "application/dns-message"
+
+#define _HTTP2_NV(NAME, VALUE, VALUELEN)                                    \
+    {                                                                       \
+        (uint8_t*)NAME, (uint8_t*)VALUE, sizeof(NAME) - 1, VALUELEN,        \
+            NGHTTP2_NV_FLAG_NONE                                            \
+    }
+
+static const char _base64url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* Encode data as base64url without padding (RFC 8484, Section 4.1). */
+static size_t _base64url_encode(const uint8_t* in, size_t len, char* out)
+{
+    size_t i, pos = 0;
+
+    for (i = 0; i + 2 < len; i += 3) {
+        out[pos++] = _base64url[in[i] >> 2];
+        out[pos++] = _base64url[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+        out[pos++] = _base64url[((in[i + 1] & 0x0f) << 2) | (in[i + 2] >> 6)];
+        out[pos++] = _base64url[in[i + 2] & 0x3f];
+    }
+    if (len - i == 1) {
+        out[pos++] = _base64url[in[i] >> 2];
+        out[pos++] = _base64url[(in[i] & 0x03) << 4];
+    } else if (len - i == 2) {
+        out[pos++] = _base64url[in[i] >> 2];
+        out[pos++] = _base64url[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+        out[pos++] = _base64url[(in[i + 1] & 0x0f) << 2];
+    }
+    out[pos] = 0;
+
+    return pos;
+}
+
+static ssize_t _http2_send(nghttp2_session* session, const uint8_t* data, size_t length, int flags, void* user_data)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)user_data;
+    mlassert(conn->tls, "http2 conn must have tls context");
+
+    ssize_t ret = gnutls_record_send(conn->tls->session, data, length);
+    if (ret < 0) {
+        mlinfo("http2 gnutls_record_send() failed: %s", gnutls_strerror(ret));
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+
+    return ret;
+}
+
+static ssize_t _http2_read_body(nghttp2_session* session, int32_t stream_id, uint8_t* buf, size_t length,
+    uint32_t* data_flags, nghttp2_data_source* source, void* user_data)
+{
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (qry == NULL)
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+
+    core_object_payload_t* payload = (core_object_payload_t*)qry->qry.req->dns_q->obj_prev;
+    size_t left = payload->len - qry->send_pos;
+    if (length > left)
+        length = left;
+
+    memcpy(buf, payload->payload + qry->send_pos, length);
+    qry->send_pos += length;
+    if (qry->send_pos == payload->len)
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+
+    return length;
+}
+
+static int _http2_on_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen,
+    const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data)
+{
+    if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_RESPONSE)
+        return 0;
+
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (qry == NULL)
+        return 0;
+
+    if (namelen == 7 && !memcmp(name, ":status", 7)) {
+        char status[4] = { 0 };
+        if (valuelen != 3)
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        memcpy(status, value, 3);
+        qry->http_status = atoi(status);
+    }
+
+    return 0;
+}
+
+static int _http2_on_data_chunk_recv(nghttp2_session* session, uint8_t flags, int32_t stream_id, const uint8_t* data,
+    size_t len, void* user_data)
+{
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (qry == NULL)
+        return 0;
+
+    if (qry->recv_len + len > _HTTP2_MAX_DNSMSG_SIZE) {
+        mlwarning("http2 response exceeds maximum dns message size");
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+
+    mlfatal_oom(qry->recv_buf = realloc(qry->recv_buf, qry->recv_len + len));
+    memcpy(qry->recv_buf + qry->recv_len, data, len);
+    qry->recv_len += len;
+
+    return 0;
+}
+
+static void _http2_process_response(_output_dnssim_query_tcp_t* qry)
+{
+    _output_dnssim_request_t* req = qry->qry.req;
+    core_object_payload_t payload = CORE_OBJECT_PAYLOAD_INIT(NULL);
+    core_object_dns_t dns_a = CORE_OBJECT_DNS_INIT(&payload);
+
+    if (qry->http_status != 200) {
+        mldebug("http2 response status %d", qry->http_status);
+        req->stats->http2_status_other++;
+        req->dnssim->stats_sum->http2_status_other++;
+        return;
+    }
+
+    payload.payload = qry->recv_buf;
+    payload.len = qry->recv_len;
+
+    dns_a.obj_prev = (core_object_t*)&payload;
+    if (core_object_dns_parse_header(&dns_a) != 0) {
+        mldebug("http2 response malformed");
+        return;
+    }
+    if (dns_a.id != req->dns_q->id) {
+        mldebug("http2 response msgid mismatch %x(q) != %x(a)", req->dns_q->id, dns_a.id);
+        return;
+    }
+
+    _request_answered(req, &dns_a);
+}
+
+static int _http2_on_stream_close(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)user_data;
+    mlassert(conn->http2, "conn must have http2 context");
+    mlassert(conn->http2->open_streams > 0, "no open http2 streams");
+    conn->http2->open_streams--;
+
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)nghttp2_session_get_stream_user_data(session, stream_id);
+    if (qry == NULL)
+        return 0;
+    nghttp2_session_set_stream_user_data(session, stream_id, NULL);
+    qry->stream_id = -1;
+
+    if (error_code == NGHTTP2_REFUSED_STREAM && conn->http2->draining) {
+        /* Stream above GOAWAY's last stream ID, the server never processed
+         * it: queue the query again to be sent over another connection. */
+        _ll_remove(conn->sent, &qry->qry);
+        qry->conn = NULL;
+        free(qry->recv_buf);
+        qry->recv_buf = NULL;
+        qry->recv_len = 0;
+        qry->qry.state = _OUTPUT_DNSSIM_QUERY_PENDING_WRITE;
+        _ll_append(conn->client->pending, &qry->qry);
+        return 0;
+    }
+
+    output_dnssim_t* dnssim = conn->client->dnssim;
+    uint64_t latency = uv_hrtime() - qry->stream_started_at;
+    output_dnssim_stats_t* stats = qry->qry.req->stats;
+    stats->http2_streams++;
+    lib_histogram_record(stats->http2_stream_latency, latency);
+    dnssim->stats_sum->http2_streams++;
+    lib_histogram_record(dnssim->stats_sum->http2_stream_latency, latency);
+
+    if (error_code == NGHTTP2_NO_ERROR)
+        _http2_process_response(qry);
+    else
+        mldebug("http2 stream closed with error: %s", nghttp2_http2_strerror(error_code));
+
+    return 0;
+}
+
+static int _http2_on_frame_recv(nghttp2_session* session, const nghttp2_frame* frame, void* user_data)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)user_data;
+    output_dnssim_t* self = conn->client->dnssim;
+
+    if (frame->hd.type == NGHTTP2_SETTINGS && !(frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+        uint32_t remote = nghttp2_session_get_remote_settings(session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+        conn->http2->max_concurrent_streams = _self->h2_max_concurrent_streams;
+        if (remote < conn->http2->max_concurrent_streams)
+            conn->http2->max_concurrent_streams = remote;
+        mldebug("http2 max concurrent streams: %u", conn->http2->max_concurrent_streams);
+    } else if (frame->hd.type == NGHTTP2_GOAWAY) {
+        mldebug("http2 received GOAWAY, last stream id: %d", frame->goaway.last_stream_id);
+        conn->http2->draining = true;
+    }
+
+    return 0;
+}
+
+/* Write out any frames nghttp2 has queued, coalesced into as few TLS records as possible. */
+static int _http2_flush(_output_dnssim_connection_t* conn)
+{
+    if (!nghttp2_session_want_write(conn->http2->session))
+        return 0;
+
+    gnutls_record_cork(conn->tls->session);
+    int ret = nghttp2_session_send(conn->http2->session);
+    if (ret < 0) {
+        mlinfo("http2 nghttp2_session_send() failed: %s", nghttp2_strerror(ret));
+        gnutls_record_uncork(conn->tls->session, 0);
+        return ret;
+    }
+    ret = gnutls_record_uncork(conn->tls->session, GNUTLS_RECORD_WAIT);
+    if (ret < 0) {
+        mlinfo("http2 gnutls_record_uncork() failed: %s", gnutls_strerror(ret));
+        return ret;
+    }
+    return 0;
+}
+
+static int _http2_init_session(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->tls, "conn must have tls context");
+    mlassert(conn->http2 == NULL, "conn already has http2 context");
+    output_dnssim_t* self = conn->client->dnssim;
+    mlassert_self();
+
+    gnutls_datum_t proto;
+    if (gnutls_alpn_get_selected_protocol(conn->tls->session, &proto) != GNUTLS_E_SUCCESS ||
+        proto.size != 2 || memcmp(proto.data, "h2", 2)) {
+        lwarning("http2: server didn't negotiate h2 via ALPN");
+        return -1;
+    }
+
+    _output_dnssim_http2_ctx_t* http2;
+    lfatal_oom(http2 = calloc(1, sizeof(_output_dnssim_http2_ctx_t)));
+
+    /* Connections of the same instance may go to targets of different
+     * families, so the :authority is built from each connection's target. */
+    if (_self->h2_authority != NULL) {
+        lfatal_oom(http2->authority = strdup(_self->h2_authority));
+    } else {
+        char addr[INET6_ADDRSTRLEN] = { 0 };
+        char authority[INET6_ADDRSTRLEN + 9];
+        if (conn->target->sa_family == AF_INET6) {
+            struct sockaddr_in6* sin6 = (struct sockaddr_in6*)conn->target;
+            uv_ip6_name(sin6, addr, sizeof(addr));
+            snprintf(authority, sizeof(authority), "[%s]:%d", addr, ntohs(sin6->sin6_port));
+        } else {
+            struct sockaddr_in* sin = (struct sockaddr_in*)conn->target;
+            uv_ip4_name(sin, addr, sizeof(addr));
+            snprintf(authority, sizeof(authority), "%s:%d", addr, ntohs(sin->sin_port));
+        }
+        lfatal_oom(http2->authority = strdup(authority));
+    }
+    /* Until the server's SETTINGS arrive, assume the RFC 7540 recommended minimum. */
+    http2->max_concurrent_streams = _self->h2_max_concurrent_streams < 100 ? _self->h2_max_concurrent_streams : 100;
+
+    nghttp2_session_callbacks* callbacks;
+    if (nghttp2_session_callbacks_new(&callbacks) != 0)
+        lfatal("out of memory");
+    nghttp2_session_callbacks_set_send_callback(callbacks, _http2_send);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, _http2_on_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, _http2_on_data_chunk_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, _http2_on_stream_close);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, _http2_on_frame_recv);
+
+    int ret = nghttp2_session_client_new(&http2->session, callbacks, conn);
+    nghttp2_session_callbacks_del(callbacks);
+    if (ret < 0) {
+        lwarning("http2: failed to create session: %s", nghttp2_strerror(ret));
+        free(http2->authority);
+        free(http2);
+        return -1;
+    }
+    conn->http2 = http2;
+
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, _self->h2_max_concurrent_streams }
+    };
+    ret = nghttp2_submit_settings(http2->session, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0]));
+    if (ret < 0) {
+        lwarning("http2: failed to submit settings: %s", nghttp2_strerror(ret));
+        return -1;
+    }
+
+    return _http2_flush(conn);
+}
+
+static void _http2_close_session(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->http2, "conn must have http2 context");
+
+    nghttp2_session_del(conn->http2->session);
+    free(conn->http2->authority);
+    free(conn->http2);
+    conn->http2 = NULL;
+}
+
+static void _http2_process_input_data(_output_dnssim_connection_t* conn, ssize_t nread, const char* data)
+{
+    mlassert(conn->http2, "conn must have http2 context");
+
+    ssize_t ret = nghttp2_session_mem_recv(conn->http2->session, (const uint8_t*)data, nread);
+    if (ret < 0) {
+        mlinfo("http2 nghttp2_session_mem_recv() failed: %s", nghttp2_strerror(ret));
+        _close_connection(conn);
+        return;
+    }
+
+    if (conn->http2->draining) {
+        /* Close the connection once its streams are finished (the last
+         * answer may have closed it already) and send the refused queries
+         * over a new one. */
+        if (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE)
+            _maybe_close_connection(conn);
+        if (_handle_pending_queries(conn->client) < 0)
+            mlinfo("http2: failed to open new connection after GOAWAY");
+        return;
+    }
+
+    if (conn->state != _OUTPUT_DNSSIM_CONN_ACTIVE)
+        return;
+
+    /* Answered streams may have made room for pending queries; this also
+     * sends out any frames (e.g. SETTINGS ACK) nghttp2 has queued. */
+    _send_pending_queries(conn);
+}
+
+static int _http2_write_query(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->http2, "conn must have http2 context");
+    mlassert(qry, "qry can't be nil");
+    output_dnssim_t* self = conn->client->dnssim;
+    mlassert_self();
+
+    core_object_payload_t* payload = (core_object_payload_t*)qry->qry.req->dns_q->obj_prev;
+    int32_t stream_id;
+    char content_length[6];
+    char* path = NULL;
+
+    if (_self->h2_method == OUTPUT_DNSSIM_H2_POST) {
+        int len = snprintf(content_length, sizeof(content_length), "%u", (unsigned int)payload->len);
+        const nghttp2_nv hdrs[] = {
+            _HTTP2_NV(":method", "POST", 4),
+            _HTTP2_NV(":scheme", "https", 5),
+            _HTTP2_NV(":authority", conn->http2->authority, strlen(conn->http2->authority)),
+            _HTTP2_NV(":path", _self->h2_uri_path, strlen(_self->h2_uri_path)),
+            _HTTP2_NV("accept", _HTTP2_CONTENT_TYPE, sizeof(_HTTP2_CONTENT_TYPE) - 1),
+            _HTTP2_NV("content-type", _HTTP2_CONTENT_TYPE, sizeof(_HTTP2_CONTENT_TYPE) - 1),
+            _HTTP2_NV("content-length", content_length, len)
+        };
+        nghttp2_data_provider body = { { 0 }, _http2_read_body };
+
+        qry->send_pos = 0;
+        stream_id = nghttp2_submit_request(conn->http2->session, NULL, hdrs, sizeof(hdrs) / sizeof(hdrs[0]), &body, qry);
+    } else {
+        size_t uri_len = strlen(_self->h2_uri_path);
+        lfatal_oom(path = malloc(uri_len + 5 + ((payload->len + 2) / 3) * 4 + 1));
+        memcpy(path, _self->h2_uri_path, uri_len);
+        memcpy(path + uri_len, "?dns=", 5);
+        size_t path_len = uri_len + 5 + _base64url_encode(payload->payload, payload->len, path + uri_len + 5);
+        const nghttp2_nv hdrs[] = {
+            _HTTP2_NV(":method", "GET", 3),
+            _HTTP2_NV(":scheme", "https", 5),
+            _HTTP2_NV(":authority", conn->http2->authority, strlen(conn->http2->authority)),
+            _HTTP2_NV(":path", path, path_len),
+            _HTTP2_NV("accept", _HTTP2_CONTENT_TYPE, sizeof(_HTTP2_CONTENT_TYPE) - 1)
+        };
+
+        stream_id = nghttp2_submit_request(conn->http2->session, NULL, hdrs, sizeof(hdrs) / sizeof(hdrs[0]), NULL, qry);
+        free(path);
+    }
+
+    if (stream_id < 0) {
+        lwarning("http2: failed to submit request: %s", nghttp2_strerror(stream_id));
+        return stream_id;
+    }
+
+    conn->http2->open_streams++;
+    qry->stream_id = stream_id;
+    qry->stream_started_at = uv_hrtime();
+    qry->http_status = 0;
+
+    qry->conn = conn;
+    _ll_remove(conn->client->pending, &qry->qry);
+    _ll_append(conn->sent, &qry->qry);
+    qry->qry.state = _OUTPUT_DNSSIM_QUERY_SENT;
+
+    /* Stop idle timer, since there are queries to answer now. */
+    if (conn->idle_timer != NULL) {
+        conn->is_idle = false;
+        uv_timer_stop(conn->idle_timer);
+    }
+
+    return 0;
+}
+
+/* Detach the query from its stream, e.g. when the request has timed out. */
+static void _http2_cancel_stream(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry)
+{
+    mlassert(conn->http2, "conn must have http2 context");
+
+    if (qry->stream_id < 0)
+        return;
+
+    nghttp2_session_set_stream_user_data(conn->http2->session, qry->stream_id, NULL);
+    if (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE) {
+        nghttp2_submit_rst_stream(conn->http2->session, NGHTTP2_FLAG_NONE, qry->stream_id, NGHTTP2_CANCEL);
+        _http2_flush(conn);
+    }
+    qry->stream_id = -1;
+}
@@ -80,6 +80,25 @@ struct _output_dnssim_query_tcp {
 
     /* Send buffers for libuv; 0 is for dnslen, 1 is for dnsmsg. */
     uv_buf_t bufs[2];
+
+    /* HTTP/2 or QUIC stream of this query, -1 if none has been opened. */
+    int64_t stream_id;
+    uint64_t stream_started_at; /* monotonic ns */
+
+    /* HTTP/2 response status and body. */
+    int http_status;
+    uint8_t* recv_buf;
+    size_t recv_len;
+
+    /* Position in the DNS message when sending it as HTTP/2 request body,
+     * or in send_buf when passing it to QUIC stream. */
+    size_t send_pos;
+
+    /* DoQ message (dnslen and dnsmsg with Message ID 0) and whether the
+     * response has been fully received on the QUIC stream. */
+    uint8_t* send_buf;
+    size_t send_len;
+    bool recv_done;
 };
 
 struct _output_dnssim_request {
@@ -93,7 +112,7 @@ struct _output_dnssim_request {
     core_object_payload_t* payload;
     core_object_dns_t* dns_q;
 
-    /* Timestamps for latency calculation. */
+    /* Monotonic timestamps (ns) for latency calculation. */
     uint64_t created_at;
     uint64_t ended_at;
 
@@ -111,6 +130,9 @@ struct _output_dnssim_request {
 
     /* Statistics interval in which this request is tracked. */
     output_dnssim_stats_t* stats;
+
+    /* Address family the query has been sent over, 0 if not sent yet. */
+    sa_family_t family;
 };
 
 
@@ -118,6 +140,58 @@ struct _output_dnssim_request {
  * Connection-related structures.
  */
 
+/* TLS-related data for a single connection. */
+typedef struct _output_dnssim_tls_ctx {
+    gnutls_session_t session;
+
+    /* Encrypted data received from the network, consumed by gnutls pull. */
+    const uint8_t* buf;
+    ssize_t buf_len;
+    ssize_t buf_pos;
+
+    /* Number of bytes written by gnutls push that are still queued in libuv. */
+    size_t write_queue_size;
+} _output_dnssim_tls_ctx_t;
+
+/* HTTP/2-related data for a single connection. */
+typedef struct _output_dnssim_http2_ctx {
+    nghttp2_session* session;
+
+    /* Number of currently open streams and the limit of concurrent streams
+     * (the lower one of the local limit and the server's setting). */
+    uint32_t open_streams;
+    uint32_t max_concurrent_streams;
+
+    /* Value of the :authority pseudo-header sent with each request. */
+    char* authority;
+
+    /* Server sent GOAWAY: no new streams are opened, the connection is
+     * closed once the streams the server accepted are finished. */
+    bool draining;
+} _output_dnssim_http2_ctx_t;
+
+typedef struct _output_dnssim_quic_ctx _output_dnssim_quic_ctx_t;
+#ifdef OUTPUT_DNSSIM_QUIC
+/* QUIC-related data for a single connection. */
+struct _output_dnssim_quic_ctx {
+    ngtcp2_conn* conn;
+    ngtcp2_crypto_conn_ref conn_ref;
+    ngtcp2_path_storage ps;
+    gnutls_session_t session;
+
+    /* Connected UDP socket and timer for ngtcp2 expiry (retransmission, ACKs). */
+    uv_udp_t* handle;
+    uv_timer_t* timer;
+
+    /* Whether 0-RTT is attempted with the resumed session. */
+    bool early_data;
+
+    /* Flags set from ngtcp2 callbacks, processed after the packet is read. */
+    bool handshake_completed;
+    bool recv_done;
+};
+#endif
+
 /* Read-state of connection's data stream. */
 typedef enum _output_dnssim_read_state {
     _OUTPUT_DNSSIM_READ_STATE_CLEAN,
@@ -131,6 +205,9 @@ struct _output_dnssim_connection {
 
     uv_tcp_t* handle;
 
+    /* Target address of the same family as the source this connection is bound to. */
+    const struct sockaddr* target;
+
     /* Timeout timer for establishing the connection. */
     uv_timer_t* handshake_timer;
 
@@ -151,6 +228,7 @@ struct _output_dnssim_connection {
     enum {
         _OUTPUT_DNSSIM_CONN_INITIALIZED,
         _OUTPUT_DNSSIM_CONN_CONNECTING,
+        _OUTPUT_DNSSIM_CONN_TLS_HANDSHAKE,
         _OUTPUT_DNSSIM_CONN_ACTIVE,
         _OUTPUT_DNSSIM_CONN_CLOSING,
         _OUTPUT_DNSSIM_CONN_CLOSED
@@ -169,6 +247,19 @@ struct _output_dnssim_connection {
     char* recv_data;
     bool recv_free_after_use;
 
+    /* TLS context, only used when transport is TLS or HTTPS2. */
+    _output_dnssim_tls_ctx_t* tls;
+
+    /* HTTP/2 context, only used when transport is HTTPS2. */
+    _output_dnssim_http2_ctx_t* http2;
+
+    /* QUIC context, only used when transport is QUIC (handle is unused then). */
+    _output_dnssim_quic_ctx_t* quic;
+
+    /* Monotonic time (ns) when the connection attempt has started, for
+     * handshake latency. */
+    uint64_t handshake_started_at;
+
     /* Statistics interval in which the handshake is tracked. */
     output_dnssim_stats_t* stats;
 };
@@ -189,6 +280,13 @@ struct _output_dnssim_client {
 
     /* List of queries that are pending to be sent over any available connection. */
     _output_dnssim_query_t* pending;
+
+    /* TLS session data of the last established connection, for resumption. */
+    gnutls_datum_t tls_ticket;
+
+    /* Server's QUIC transport parameters remembered for 0-RTT. */
+    uint8_t* quic_params;
+    size_t quic_params_len;
 };
 
 
@@ -209,10 +307,34 @@ struct _output_dnssim {
     uv_loop_t loop;
     uv_timer_t stats_timer;
 
-    struct sockaddr_storage target;
+    /* Targets for each address family, ss_family is 0 when not set. */
+    struct sockaddr_storage target_ip4;
+    struct sockaddr_storage target_ip6;
+
+    /* Circular list of source addresses, possibly of both families. */
     _output_dnssim_source_t* source;
+
+    /* Family of the last target used when there are no sources to bind to. */
+    sa_family_t last_family;
+
     output_dnssim_transport_t transport;
 
+    /* TLS priority and credentials shared by all TLS sessions. */
+    gnutls_priority_t* tls_priority;
+    gnutls_certificate_credentials_t tls_cred;
+    /* Server name sent as SNI, NULL to send none. */
+    char* tls_server_name;
+    /* Verify the server's certificate against the trusted certificates of
+     * tls_cred and, if set, tls_server_name. */
+    bool tls_verify;
+
+    /* HTTP/2 settings used for DNS-over-HTTPS. */
+    output_dnssim_h2_method_t h2_method;
+    char* h2_uri_path;
+    /* Configured :authority, NULL to use the address of each connection's target. */
+    char* h2_authority;
+    uint32_t h2_max_concurrent_streams;
+
     /* Array of clients, mapped by client ID (ranges from 0 to max_clients). */
     _output_dnssim_client_t* client_arr;
 };
@@ -222,7 +344,8 @@ struct _output_dnssim {
  * Forward function declarations.
  */
 
-static int _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle);
+static const struct sockaddr* _bind_before_connect(output_dnssim_t* self, uv_handle_t* handle);
+static void _request_sent(_output_dnssim_request_t* req, sa_family_t family);
 static int _create_query_udp(output_dnssim_t* self, _output_dnssim_request_t* req);
 static int _create_query_tcp(output_dnssim_t* self, _output_dnssim_request_t* req);
 static void _close_query_udp(_output_dnssim_query_udp_t* qry);
@@ -237,6 +360,32 @@ static void _maybe_free_request(_output_dnssim_request_t* req);
 static void _close_query(_output_dnssim_query_t* qry);
 static void _on_uv_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
 static int _handle_pending_queries(_output_dnssim_client_t* client);
+static void _process_tcp_data(_output_dnssim_connection_t* conn, ssize_t nread, const char* data);
+static void _conn_handshake_done(_output_dnssim_connection_t* conn);
+static void _conn_init_timers(output_dnssim_t* self, _output_dnssim_connection_t* conn);
+static void _move_queries_to_pending(_output_dnssim_query_tcp_t* qry);
+static void _maybe_free_connection(_output_dnssim_connection_t* conn);
+static void _send_pending_queries(_output_dnssim_connection_t* conn);
+static int _tls_init_session(_output_dnssim_connection_t* conn);
+static int _tls_set_server(output_dnssim_t* self, gnutls_session_t session);
+static void _tls_close_session(_output_dnssim_connection_t* conn);
+static void _tls_store_ticket(_output_dnssim_client_t* client, gnutls_session_t session);
+static int _tls_handshake(_output_dnssim_connection_t* conn);
+static void _tls_process_input_data(_output_dnssim_connection_t* conn, ssize_t nread, const char* data);
+static int _tls_write_query(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry);
+static int _http2_init_session(_output_dnssim_connection_t* conn);
+static void _http2_close_session(_output_dnssim_connection_t* conn);
+static int _http2_flush(_output_dnssim_connection_t* conn);
+static void _http2_process_input_data(_output_dnssim_connection_t* conn, ssize_t nread, const char* data);
+static int _http2_write_query(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry);
+static void _http2_cancel_stream(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry);
+static int _quic_connect(output_dnssim_t* self, _output_dnssim_connection_t* conn);
+static bool _quic_early_data(_output_dnssim_connection_t* conn);
+static bool _quic_streams_left(_output_dnssim_connection_t* conn);
+static int _quic_flush(_output_dnssim_connection_t* conn);
+static int _quic_write_query(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry);
+static void _quic_cancel_stream(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry);
+static void _quic_close(_output_dnssim_connection_t* conn);
 
 
 /*
@@ -245,4 +394,6 @@ static int _handle_pending_queries(_output_dnssim_client_t* client);
 
 static core_log_t _log = LOG_T_INIT("output.dnssim");
 
+static size_t _m_requests = 0, _m_answers = 0, _m_discarded = 0, _m_ongoing = 0, _m_latency = 0;
+
 #endif
@@ -0,0 +1,773 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef OUTPUT_DNSSIM_QUIC
+
+#define _QUIC_MAX_UDP_PAYLOAD 1452
+#define _QUIC_MAX_DNSMSG_SIZE (65535 + 2)
+#define _QUIC_DCID_LEN 18
+#define _QUIC_SCID_LEN 16
+
+/* DoQ error codes, RFC 9250, Section 4.3. */
+#define _DOQ_NO_ERROR 0x0
+#define _DOQ_REQUEST_CANCELLED 0x3
+
+/* QUIC mandates TLS 1.3 (RFC 9001, Section 4.2). */
+#define _QUIC_TLS_PRIORITY "%DISABLE_TLS13_COMPAT_MODE:NORMAL:-VERS-ALL:+VERS-TLS1.3"
+
+static ngtcp2_conn* _quic_get_conn(ngtcp2_crypto_conn_ref* conn_ref)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)conn_ref->user_data;
+    return conn->quic->conn;
+}
+
+static void _quic_rand(uint8_t* dest, size_t destlen, const ngtcp2_rand_ctx* rand_ctx)
+{
+    if (gnutls_rnd(GNUTLS_RND_RANDOM, dest, destlen) != 0)
+        mlfatal("quic: gnutls_rnd() failed");
+}
+
+static int _quic_get_new_connection_id(ngtcp2_conn* qconn, ngtcp2_cid* cid, uint8_t* token, size_t cidlen,
+    void* user_data)
+{
+    if (gnutls_rnd(GNUTLS_RND_RANDOM, cid->data, cidlen) != 0 ||
+        gnutls_rnd(GNUTLS_RND_RANDOM, token, NGTCP2_STATELESS_RESET_TOKENLEN) != 0)
+        return NGTCP2_ERR_CALLBACK_FAILURE;
+    cid->datalen = cidlen;
+    return 0;
+}
+
+/* Return queries sent as 0-RTT data back to pending, so that they are sent
+ * again once the handshake is complete. */
+static void _quic_requeue_early_data(_output_dnssim_connection_t* conn)
+{
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)conn->sent;
+    _output_dnssim_query_tcp_t* next;
+
+    while (qry != NULL) {
+        next = (_output_dnssim_query_tcp_t*)qry->qry.next;
+        if (qry->stream_id >= 0)
+            ngtcp2_conn_set_stream_user_data(conn->quic->conn, qry->stream_id, NULL);
+        _ll_remove(conn->sent, &qry->qry);
+        _ll_append(conn->client->pending, &qry->qry);
+        qry->conn = NULL;
+        qry->qry.state = _OUTPUT_DNSSIM_QUERY_PENDING_WRITE;
+        qry->stream_id = -1;
+        free(qry->send_buf);
+        qry->send_buf = NULL;
+        free(qry->recv_buf);
+        qry->recv_buf = NULL;
+        qry->recv_len = 0;
+        qry = next;
+    }
+}
+
+/* Most of the work can't be done from within ngtcp2 callbacks, since it'd
+ * call back into ngtcp2. Callbacks only set flags which are processed once
+ * ngtcp2_conn_read_pkt() returns.
+ *
+ * Rejected 0-RTT data is the exception: GnuTLS only tells whether the server
+ * accepted early data once the handshake is done, and ngtcp2 has to learn
+ * about the rejection right away, before it processes the rest of the packet
+ * and keeps the 0-RTT streams around. */
+static int _quic_on_handshake_completed(ngtcp2_conn* qconn, void* user_data)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)user_data;
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+
+    quic->handshake_completed = true;
+    if (quic->early_data && !(gnutls_session_get_flags(quic->session) & GNUTLS_SFLAGS_EARLY_DATA)) {
+        mldebug("quic 0-RTT data rejected");
+        quic->early_data = false;
+        _quic_requeue_early_data(conn);
+        if (ngtcp2_conn_tls_early_data_rejected(qconn) != 0)
+            return NGTCP2_ERR_CALLBACK_FAILURE;
+    }
+    return 0;
+}
+
+static int _quic_on_recv_stream_data(ngtcp2_conn* qconn, uint32_t flags, int64_t stream_id, uint64_t offset,
+    const uint8_t* data, size_t datalen, void* user_data, void* stream_user_data)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)user_data;
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)stream_user_data;
+
+    /* The data is consumed right away, so the flow control credit is returned. */
+    ngtcp2_conn_extend_max_stream_offset(qconn, stream_id, datalen);
+    ngtcp2_conn_extend_max_offset(qconn, datalen);
+
+    if (qry == NULL)
+        return 0;
+
+    if (qry->recv_len + datalen > _QUIC_MAX_DNSMSG_SIZE) {
+        mlwarning("quic response exceeds maximum dns message size");
+        return NGTCP2_ERR_CALLBACK_FAILURE;
+    }
+
+    if (datalen > 0) {
+        mlfatal_oom(qry->recv_buf = realloc(qry->recv_buf, qry->recv_len + datalen));
+        memcpy(qry->recv_buf + qry->recv_len, data, datalen);
+        qry->recv_len += datalen;
+    }
+
+    if (flags & NGTCP2_STREAM_DATA_FLAG_FIN) {
+        ngtcp2_conn_set_stream_user_data(qconn, stream_id, NULL);
+        qry->stream_id = -1;
+        qry->recv_done = true;
+        conn->quic->recv_done = true;
+
+        output_dnssim_t* dnssim = conn->client->dnssim;
+        uint64_t latency = uv_hrtime() - qry->stream_started_at;
+        output_dnssim_stats_t* stats = qry->qry.req->stats;
+        stats->quic_streams++;
+        lib_histogram_record(stats->quic_stream_latency, latency);
+        dnssim->stats_sum->quic_streams++;
+        lib_histogram_record(dnssim->stats_sum->quic_stream_latency, latency);
+    }
+
+    return 0;
+}
+
+static int _quic_on_stream_close(ngtcp2_conn* qconn, uint32_t flags, int64_t stream_id, uint64_t app_error_code,
+    void* user_data, void* stream_user_data)
+{
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)stream_user_data;
+
+    /* Stream was closed (e.g. reset by server) without a complete response,
+     * the query is left to time out. */
+    if (qry != NULL) {
+        mldebug("quic stream closed without response, error: 0x%lx", app_error_code);
+        qry->stream_id = -1;
+    }
+
+    return 0;
+}
+
+static const ngtcp2_callbacks _quic_callbacks = {
+    .client_initial = ngtcp2_crypto_client_initial_cb,
+    .recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb,
+    .encrypt = ngtcp2_crypto_encrypt_cb,
+    .decrypt = ngtcp2_crypto_decrypt_cb,
+    .hp_mask = ngtcp2_crypto_hp_mask_cb,
+    .recv_retry = ngtcp2_crypto_recv_retry_cb,
+    .update_key = ngtcp2_crypto_update_key_cb,
+    .delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb,
+    .delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb,
+    .get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb,
+    .version_negotiation = ngtcp2_crypto_version_negotiation_cb,
+    .rand = _quic_rand,
+    .get_new_connection_id = _quic_get_new_connection_id,
+    .handshake_completed = _quic_on_handshake_completed,
+    .recv_stream_data = _quic_on_recv_stream_data,
+    .stream_close = _quic_on_stream_close,
+};
+
+static void _on_quic_timer(uv_timer_t* handle);
+
+/* Re-arm the timer to the next ngtcp2 expiry (loss detection, ACK delay, ...). */
+static void _quic_update_timer(_output_dnssim_connection_t* conn)
+{
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+    ngtcp2_tstamp expiry = ngtcp2_conn_get_expiry(quic->conn);
+    ngtcp2_tstamp now = uv_hrtime();
+
+    if (expiry == UINT64_MAX) {
+        uv_timer_stop(quic->timer);
+        return;
+    }
+
+    uint64_t timeout_ms = 0;
+    if (expiry > now)
+        timeout_ms = (expiry - now + NGTCP2_MILLISECONDS - 1) / NGTCP2_MILLISECONDS;
+    uv_timer_start(quic->timer, _on_quic_timer, timeout_ms, 0);
+}
+
+static int _quic_send_packet(_output_dnssim_connection_t* conn, const uint8_t* data, size_t len)
+{
+    uv_buf_t buf = uv_buf_init((char*)data, len);
+    int ret = uv_udp_try_send(conn->quic->handle, &buf, 1, NULL);
+    if (ret < 0 && ret != UV_EAGAIN) {
+        mldebug("quic send failed: %s", uv_strerror(ret));
+        return ret;
+    }
+    /* Packets dropped due to full socket buffer are recovered by QUIC loss detection. */
+    return 0;
+}
+
+/* Write out stream data of sent queries and any other frames ngtcp2 has
+ * queued, coalescing data of multiple streams into as few packets as possible. */
+static int _quic_flush(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn->quic, "conn must have quic context");
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+    uint8_t buf[_QUIC_MAX_UDP_PAYLOAD];
+    ngtcp2_pkt_info pi;
+    ngtcp2_tstamp ts = uv_hrtime();
+    _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)conn->sent;
+
+    for (;;) {
+        /* Skip queries whose stream data has been fully passed to ngtcp2. */
+        while (qry != NULL && (qry->stream_id < 0 || qry->send_pos >= qry->send_len))
+            qry = (_output_dnssim_query_tcp_t*)qry->qry.next;
+
+        int64_t stream_id = -1;
+        ngtcp2_vec datav = { NULL, 0 };
+        uint32_t flags = NGTCP2_WRITE_STREAM_FLAG_MORE;
+        if (qry != NULL) {
+            stream_id = qry->stream_id;
+            datav.base = qry->send_buf + qry->send_pos;
+            datav.len = qry->send_len - qry->send_pos;
+            flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
+        }
+
+        ngtcp2_ssize ndatalen = -1;
+        ngtcp2_ssize nwrite = ngtcp2_conn_writev_stream(quic->conn, &quic->ps.path, &pi, buf, sizeof(buf),
+            &ndatalen, flags, stream_id, qry != NULL ? &datav : NULL, qry != NULL ? 1 : 0, ts);
+        if (qry != NULL && ndatalen >= 0)
+            qry->send_pos += ndatalen;
+
+        if (nwrite < 0) {
+            switch (nwrite) {
+            case NGTCP2_ERR_WRITE_MORE:
+                /* Packet has room for data of another stream. */
+                continue;
+            case NGTCP2_ERR_STREAM_DATA_BLOCKED:
+            case NGTCP2_ERR_STREAM_SHUT_WR:
+            case NGTCP2_ERR_STREAM_NOT_FOUND:
+                /* Stream can't take more data at the moment. */
+                qry = (_output_dnssim_query_tcp_t*)qry->qry.next;
+                continue;
+            default:
+                mldebug("quic ngtcp2_conn_writev_stream() failed: %s", ngtcp2_strerror(nwrite));
+                return -1;
+            }
+        }
+
+        /* Nothing more to write or congestion limited. */
+        if (nwrite == 0)
+            break;
+
+        if (_quic_send_packet(conn, buf, nwrite) < 0)
+            return -1;
+    }
+
+    _quic_update_timer(conn);
+    return 0;
+}
+
+static void _on_quic_timer(uv_timer_t* handle)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
+
+    int ret = ngtcp2_conn_handle_expiry(conn->quic->conn, uv_hrtime());
+    if (ret != 0) {
+        mldebug("quic connection expired: %s", ngtcp2_strerror(ret));
+        _close_connection(conn);
+        return;
+    }
+
+    if (_quic_flush(conn) < 0)
+        _close_connection(conn);
+}
+
+static void _quic_process_response(_output_dnssim_query_tcp_t* qry)
+{
+    _output_dnssim_request_t* req = qry->qry.req;
+    core_object_payload_t payload = CORE_OBJECT_PAYLOAD_INIT(NULL);
+    core_object_dns_t dns_a = CORE_OBJECT_DNS_INIT(&payload);
+
+    qry->recv_done = false;
+    if (qry->recv_len < 2 || ((qry->recv_buf[0] << 8) | qry->recv_buf[1]) != qry->recv_len - 2) {
+        mldebug("quic response malformed: invalid dnslen");
+        return;
+    }
+
+    payload.payload = qry->recv_buf + 2;
+    payload.len = qry->recv_len - 2;
+
+    dns_a.obj_prev = (core_object_t*)&payload;
+    if (core_object_dns_parse_header(&dns_a) != 0) {
+        mldebug("quic response malformed");
+        return;
+    }
+
+    /* NOTE: Message ID is always 0 with DoQ (RFC 9250, Section 4.2.1), the
+     * stream itself identifies the query. */
+    _request_answered(req, &dns_a);
+}
+
+static void _quic_handshake_completed(_output_dnssim_connection_t* conn)
+{
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+    _output_dnssim_client_t* client = conn->client;
+    output_dnssim_t* dnssim = client->dnssim;
+
+    if (gnutls_session_is_resumed(quic->session)) {
+        conn->stats->conn_resumed++;
+        dnssim->stats_sum->conn_resumed++;
+    }
+    /* Rejected 0-RTT data was already handled in the callback. */
+    if (quic->early_data) {
+        quic->early_data = false;
+        conn->stats->conn_quic_0rtt++;
+        dnssim->stats_sum->conn_quic_0rtt++;
+    }
+
+    /* Remember server's transport parameters for 0-RTT of the next connection. */
+    uint8_t params[256];
+    ngtcp2_ssize len = ngtcp2_conn_encode_0rtt_transport_params(quic->conn, params, sizeof(params));
+    if (len > 0) {
+        mlfatal_oom(client->quic_params = realloc(client->quic_params, len));
+        memcpy(client->quic_params, params, len);
+        client->quic_params_len = len;
+    }
+
+    uint64_t latency = uv_hrtime() - conn->handshake_started_at;
+    lib_histogram_record(conn->stats->quic_handshake_latency, latency);
+    lib_histogram_record(dnssim->stats_sum->quic_handshake_latency, latency);
+
+    _conn_handshake_done(conn);
+}
+
+static void _quic_process_input_data(_output_dnssim_connection_t* conn, ssize_t nread, const char* data)
+{
+    mlassert(conn->quic, "conn must have quic context");
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+
+    ngtcp2_pkt_info pi = { 0 };
+    int ret = ngtcp2_conn_read_pkt(quic->conn, &quic->ps.path, &pi, (const uint8_t*)data, nread, uv_hrtime());
+    if (ret != 0) {
+        if (ret != NGTCP2_ERR_DRAINING)
+            mlinfo("quic ngtcp2_conn_read_pkt() failed: %s", ngtcp2_strerror(ret));
+        _close_connection(conn);
+        return;
+    }
+
+    if (quic->handshake_completed && conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING) {
+        _quic_handshake_completed(conn);
+        if (conn->state != _OUTPUT_DNSSIM_CONN_ACTIVE)
+            return;
+    }
+
+    if (quic->recv_done) {
+        quic->recv_done = false;
+        _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)conn->sent;
+        _output_dnssim_query_tcp_t* next;
+        while (qry != NULL) {
+            next = (_output_dnssim_query_tcp_t*)qry->qry.next;
+            if (qry->recv_done)
+                _quic_process_response(qry);
+            qry = next;
+        }
+        if (conn->state == _OUTPUT_DNSSIM_CONN_CLOSING || conn->state == _OUTPUT_DNSSIM_CONN_CLOSED)
+            return;
+    }
+
+    /* Newly available streams may be used by pending queries; this also
+     * sends out ACKs and any other frames ngtcp2 has queued. */
+    _send_pending_queries(conn);
+}
+
+static void _on_quic_recv(uv_udp_t* handle, ssize_t nread, const uv_buf_t* buf,
+    const struct sockaddr* addr, unsigned flags)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
+
+    if (nread > 0) {
+        if (conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING || conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE)
+            _quic_process_input_data(conn, nread, buf->base);
+    } else if (nread < 0) {
+        mlinfo("quic recv failed: %s", uv_strerror(nread));
+        _close_connection(conn);
+    }
+
+    if (buf->base != NULL)
+        free(buf->base);
+}
+
+static int _quic_init_tls(_output_dnssim_connection_t* conn)
+{
+    output_dnssim_t* self = conn->client->dnssim;
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+    lassert(_self->tls_priority, "tls priority must be set");
+
+    int ret = gnutls_init(&quic->session, GNUTLS_CLIENT | GNUTLS_ENABLE_EARLY_DATA | GNUTLS_NO_END_OF_EARLY_DATA);
+    if (ret < 0) {
+        lwarning("gnutls_init() failed: %s", gnutls_strerror(ret));
+        quic->session = NULL;
+        return -1;
+    }
+
+    ret = gnutls_priority_set(quic->session, *_self->tls_priority);
+    if (ret < 0) {
+        lwarning("gnutls_priority_set() failed: %s", gnutls_strerror(ret));
+        return -1;
+    }
+
+    ret = gnutls_credentials_set(quic->session, GNUTLS_CRD_CERTIFICATE, _self->tls_cred);
+    if (ret < 0) {
+        lwarning("gnutls_credentials_set() failed: %s", gnutls_strerror(ret));
+        return -1;
+    }
+
+    if (_tls_set_server(self, quic->session) < 0)
+        return -1;
+
+    ret = ngtcp2_crypto_gnutls_configure_client_session(quic->session);
+    if (ret != 0) {
+        lwarning("quic: failed to configure tls session");
+        return -1;
+    }
+
+    const gnutls_datum_t proto = { (unsigned char*)"doq", 3 };
+    ret = gnutls_alpn_set_protocols(quic->session, &proto, 1, GNUTLS_ALPN_MANDATORY);
+    if (ret < 0) {
+        lwarning("gnutls_alpn_set_protocols() failed: %s", gnutls_strerror(ret));
+        return -1;
+    }
+
+    /* Resume the previous session of this client, if possible. */
+    if (conn->client->tls_ticket.size != 0) {
+        ret = gnutls_session_set_data(quic->session,
+            conn->client->tls_ticket.data, conn->client->tls_ticket.size);
+        if (ret < 0)
+            ldebug("gnutls_session_set_data() failed: %s", gnutls_strerror(ret));
+    }
+
+    gnutls_session_set_ptr(quic->session, &quic->conn_ref);
+    return 0;
+}
+
+static int _quic_init_conn(_output_dnssim_connection_t* conn)
+{
+    output_dnssim_t* self = conn->client->dnssim;
+    _output_dnssim_client_t* client = conn->client;
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+
+    uint8_t cid_data[_QUIC_DCID_LEN + _QUIC_SCID_LEN];
+    if (gnutls_rnd(GNUTLS_RND_NONCE, cid_data, sizeof(cid_data)) != 0) {
+        lwarning("quic: gnutls_rnd() failed");
+        return -1;
+    }
+    ngtcp2_cid dcid, scid;
+    ngtcp2_cid_init(&dcid, cid_data, _QUIC_DCID_LEN);
+    ngtcp2_cid_init(&scid, cid_data + _QUIC_DCID_LEN, _QUIC_SCID_LEN);
+
+    ngtcp2_settings settings;
+    ngtcp2_settings_default(&settings);
+    settings.initial_ts = uv_hrtime();
+    settings.max_tx_udp_payload_size = _QUIC_MAX_UDP_PAYLOAD;
+
+    ngtcp2_transport_params params;
+    ngtcp2_transport_params_default(&params);
+    params.initial_max_stream_data_bidi_local = _QUIC_MAX_DNSMSG_SIZE;
+    params.initial_max_data = 1 << 20;
+    params.initial_max_streams_bidi = 0;
+    params.initial_max_streams_uni = 0;
+    params.max_idle_timeout = self->idle_timeout_ms * NGTCP2_MILLISECONDS;
+
+    int ret = ngtcp2_conn_client_new(&quic->conn, &dcid, &scid, &quic->ps.path, NGTCP2_PROTO_VER_V1,
+        &_quic_callbacks, &settings, &params, NULL, conn);
+    if (ret != 0) {
+        lwarning("quic: failed to create connection: %s", ngtcp2_strerror(ret));
+        quic->conn = NULL;
+        return -1;
+    }
+    ngtcp2_conn_set_tls_native_handle(quic->conn, quic->session);
+
+    /* Attempt 0-RTT when resuming the previous connection of this client. */
+    if (client->quic_params_len != 0 && client->tls_ticket.size != 0) {
+        ret = ngtcp2_conn_decode_and_set_0rtt_transport_params(quic->conn, client->quic_params, client->quic_params_len);
+        if (ret == 0)
+            quic->early_data = true;
+        else
+            ldebug("quic: failed to set 0-RTT transport params: %s", ngtcp2_strerror(ret));
+    }
+
+    return 0;
+}
+
+static int _quic_connect(output_dnssim_t* self, _output_dnssim_connection_t* conn)
+{
+    mlassert_self();
+    lassert(conn, "connection can't be null");
+    lassert(conn->quic == NULL, "connection already has quic context");
+    lassert(conn->state == _OUTPUT_DNSSIM_CONN_INITIALIZED, "connection state != INITIALIZED");
+
+    int ret;
+    _output_dnssim_quic_ctx_t* quic;
+    lfatal_oom(quic = calloc(1, sizeof(_output_dnssim_quic_ctx_t)));
+    quic->conn_ref.get_conn = _quic_get_conn;
+    quic->conn_ref.user_data = conn;
+    conn->quic = quic;
+
+    lfatal_oom(quic->timer = malloc(sizeof(uv_timer_t)));
+    uv_timer_init(&_self->loop, quic->timer);
+    quic->timer->data = (void*)conn;
+
+    lfatal_oom(quic->handle = malloc(sizeof(uv_udp_t)));
+    ret = uv_udp_init(&_self->loop, quic->handle);
+    if (ret < 0) {
+        lwarning("failed to init uv_udp_t");
+        free(quic->handle);
+        quic->handle = NULL;
+        goto failure;
+    }
+    quic->handle->data = (void*)conn;
+
+    conn->target = _bind_before_connect(self, (uv_handle_t*)quic->handle);
+    if (conn->target == NULL) {
+        ret = -1;
+        goto failure;
+    }
+
+    ret = uv_udp_connect(quic->handle, conn->target);
+    if (ret < 0) {
+        lwarning("quic: failed to connect udp socket: %s", uv_strerror(ret));
+        goto failure;
+    }
+
+    struct sockaddr_storage local;
+    int local_len = sizeof(local);
+    ret = uv_udp_getsockname(quic->handle, (struct sockaddr*)&local, &local_len);
+    if (ret < 0) {
+        lwarning("quic: failed to get local address: %s", uv_strerror(ret));
+        goto failure;
+    }
+    ngtcp2_path_storage_init(&quic->ps, (ngtcp2_sockaddr*)&local, local_len,
+        (ngtcp2_sockaddr*)conn->target,
+        conn->target->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in),
+        NULL);
+
+    if ((ret = _quic_init_tls(conn)) < 0)
+        goto failure;
+    if ((ret = _quic_init_conn(conn)) < 0)
+        goto failure;
+
+    ret = uv_udp_recv_start(quic->handle, _on_uv_alloc, _on_quic_recv);
+    if (ret < 0) {
+        lwarning("failed uv_udp_recv_start(): %s", uv_strerror(ret));
+        goto failure;
+    }
+
+    _conn_init_timers(self, conn);
+
+    conn->stats->conn_handshakes++;
+    conn->client->dnssim->stats_sum->conn_handshakes++;
+    conn->handshake_started_at = uv_hrtime();
+    conn->state = _OUTPUT_DNSSIM_CONN_CONNECTING;
+
+    /* Send the Initial packet right away. */
+    if ((ret = _quic_flush(conn)) < 0)
+        goto failure;
+
+    return 0;
+failure:
+    _close_connection(conn);
+    return ret < 0 ? ret : -1;
+}
+
+static bool _quic_early_data(_output_dnssim_connection_t* conn)
+{
+    return conn->quic != NULL && conn->quic->early_data && conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING;
+}
+
+static bool _quic_streams_left(_output_dnssim_connection_t* conn)
+{
+    return ngtcp2_conn_get_streams_bidi_left(conn->quic->conn) > 0;
+}
+
+static int _quic_write_query(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->quic, "conn must have quic context");
+    mlassert(qry, "qry can't be nil");
+    output_dnssim_t* self = conn->client->dnssim;
+    mlassert_self();
+
+    core_object_payload_t* payload = (core_object_payload_t*)qry->qry.req->dns_q->obj_prev;
+    int64_t stream_id;
+    int ret = ngtcp2_conn_open_bidi_stream(conn->quic->conn, &stream_id, qry);
+    if (ret != 0) {
+        lwarning("quic: failed to open stream: %s", ngtcp2_strerror(ret));
+        return -1;
+    }
+
+    /* DoQ message is prefixed with 2-octet length and its Message ID
+     * must be 0 (RFC 9250, Section 4.2). */
+    free(qry->send_buf);
+    lfatal_oom(qry->send_buf = malloc(payload->len + 2));
+    qry->send_buf[0] = payload->len >> 8;
+    qry->send_buf[1] = payload->len & 0xff;
+    memcpy(qry->send_buf + 2, payload->payload, payload->len);
+    if (payload->len >= 2)
+        qry->send_buf[2] = qry->send_buf[3] = 0;
+    qry->send_len = payload->len + 2;
+    qry->send_pos = 0;
+
+    qry->stream_id = stream_id;
+    qry->stream_started_at = uv_hrtime();
+    qry->recv_done = false;
+
+    qry->conn = conn;
+    _ll_remove(conn->client->pending, &qry->qry);
+    _ll_append(conn->sent, &qry->qry);
+    qry->qry.state = _OUTPUT_DNSSIM_QUERY_SENT;
+
+    /* Stop idle timer, since there are queries to answer now. */
+    if (conn->idle_timer != NULL) {
+        conn->is_idle = false;
+        uv_timer_stop(conn->idle_timer);
+    }
+
+    return 0;
+}
+
+/* Detach the query from its stream, e.g. when the request has timed out. */
+static void _quic_cancel_stream(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry)
+{
+    mlassert(conn->quic, "conn must have quic context");
+
+    free(qry->send_buf);
+    qry->send_buf = NULL;
+    if (qry->stream_id < 0 || conn->quic->conn == NULL)
+        return;
+
+    ngtcp2_conn_set_stream_user_data(conn->quic->conn, qry->stream_id, NULL);
+    if (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE || conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING) {
+        ngtcp2_conn_shutdown_stream(conn->quic->conn, NGTCP2_SHUTDOWN_STREAM_FLAG_NONE, qry->stream_id,
+            _DOQ_REQUEST_CANCELLED);
+        _quic_flush(conn);
+    }
+    qry->stream_id = -1;
+}
+
+static void _quic_maybe_free(_output_dnssim_connection_t* conn)
+{
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+    if (quic->handle != NULL || quic->timer != NULL)
+        return;
+
+    conn->state = _OUTPUT_DNSSIM_CONN_CLOSED;
+
+    /* Orphan any queries that are still unresolved. */
+    _move_queries_to_pending((_output_dnssim_query_tcp_t*)conn->queued);
+    conn->queued = NULL;
+    _move_queries_to_pending((_output_dnssim_query_tcp_t*)conn->sent);
+    conn->sent = NULL;
+
+    if (quic->conn != NULL)
+        ngtcp2_conn_del(quic->conn);
+    if (quic->session != NULL) {
+        _tls_store_ticket(conn->client, quic->session);
+        gnutls_deinit(quic->session);
+    }
+    free(quic);
+    conn->quic = NULL;
+    _maybe_free_connection(conn);
+}
+
+static void _on_quic_handle_closed(uv_handle_t* handle)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
+    free(conn->quic->handle);
+    conn->quic->handle = NULL;
+    _quic_maybe_free(conn);
+}
+
+static void _on_quic_timer_closed(uv_handle_t* handle)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
+    free(conn->quic->timer);
+    conn->quic->timer = NULL;
+    _quic_maybe_free(conn);
+}
+
+static void _quic_close(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn->quic, "conn must have quic context");
+    _output_dnssim_quic_ctx_t* quic = conn->quic;
+
+    /* Let the server know the connection is going away. */
+    if (quic->conn != NULL && quic->handle != NULL &&
+        !ngtcp2_conn_in_closing_period(quic->conn) && !ngtcp2_conn_in_draining_period(quic->conn)) {
+        uint8_t buf[_QUIC_MAX_UDP_PAYLOAD];
+        ngtcp2_pkt_info pi;
+        ngtcp2_ccerr ccerr;
+        ngtcp2_ccerr_default(&ccerr);
+        ngtcp2_ccerr_set_application_error(&ccerr, _DOQ_NO_ERROR, NULL, 0);
+        ngtcp2_ssize nwrite = ngtcp2_conn_write_connection_close(quic->conn, &quic->ps.path, &pi,
+            buf, sizeof(buf), &ccerr, uv_hrtime());
+        if (nwrite > 0)
+            _quic_send_packet(conn, buf, nwrite);
+    }
+
+    if (quic->timer != NULL) {
+        uv_timer_stop(quic->timer);
+        uv_close((uv_handle_t*)quic->timer, _on_quic_timer_closed);
+    }
+    if (quic->handle != NULL) {
+        uv_udp_recv_stop(quic->handle);
+        uv_close((uv_handle_t*)quic->handle, _on_quic_handle_closed);
+    }
+    if (quic->timer == NULL && quic->handle == NULL)
+        _quic_maybe_free(conn);
+}
+
+#else
+
+#define _QUIC_TLS_PRIORITY NULL
+
+/* QUIC support is not compiled in, conn->quic is never set. */
+static int _quic_connect(output_dnssim_t* self, _output_dnssim_connection_t* conn)
+{
+    mlfatal("quic support is not available");
+    return -1;
+}
+
+static bool _quic_early_data(_output_dnssim_connection_t* conn)
+{
+    return false;
+}
+
+static bool _quic_streams_left(_output_dnssim_connection_t* conn)
+{
+    return false;
+}
+
+static int _quic_flush(_output_dnssim_connection_t* conn)
+{
+    return -1;
+}
+
+static int _quic_write_query(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry)
+{
+    return -1;
+}
+
+static void _quic_cancel_stream(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry)
+{
+}
+
+static void _quic_close(_output_dnssim_connection_t* conn)
+{
+}
+
+#endif
@@ -22,7 +22,7 @@ static void _maybe_free_connection(_output_dnssim_connection_t* conn)
 {
     mlassert(conn, "conn can't be nil");
     mlassert(conn->client, "conn must belong to a client");
-    if (conn->handle == NULL && conn->handshake_timer == NULL && conn->idle_timer == NULL) {
+    if (conn->handle == NULL && conn->quic == NULL && conn->handshake_timer == NULL && conn->idle_timer == NULL) {
         _ll_remove(conn->client->conn, conn);
         free(conn);
     }
@@ -40,6 +40,12 @@ static void _move_queries_to_pending(_output_dnssim_query_tcp_t* qry)
         _ll_append(qry->conn->client->pending, &qry->qry);
         qry->conn = NULL;
         qry->qry.state = _OUTPUT_DNSSIM_QUERY_ORPHANED;
+        qry->stream_id = -1;
+        free(qry->recv_buf);
+        qry->recv_buf = NULL;
+        qry->recv_len = 0;
+        free(qry->send_buf);
+        qry->send_buf = NULL;
         qry = qry_tmp;
     }
 }
@@ -65,6 +71,11 @@ static void _on_tcp_handle_closed(uv_handle_t* handle)
     //if (_handle_pending_queries(conn->client) != 0)
     //    mlinfo("tcp: orphaned queries failed to be re-sent");
 
+    if (conn->http2 != NULL)
+        _http2_close_session(conn);
+    if (conn->tls != NULL)
+        _tls_close_session(conn);
+
     mlassert(conn->handle, "conn must have tcp handle when closing it");
     free(conn->handle);
     conn->handle = NULL;
@@ -136,11 +147,28 @@ static void _write_tcp_query(_output_dnssim_query_tcp_t* qry, _output_dnssim_con
     mlassert(qry->qry.req->dns_q, "dns_q can't be null");
     mlassert(qry->qry.req->dns_q->obj_prev, "payload can't be null");
     mlassert(conn, "conn can't be null");
-    mlassert(conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE, "connection state != ACTIVE");
+    mlassert(conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE || _quic_early_data(conn), "connection state != ACTIVE");
     mlassert(conn->client, "conn must be associated with client");
     mlassert(conn->client->pending, "conn has no pending queries");
 
     mldebug("tcp write dnsmsg id: %04x", qry->qry.req->dns_q->id);
+    _request_sent(qry->qry.req, conn->target->sa_family);
+
+    if (conn->quic != NULL) {
+        if (_quic_write_query(conn, qry) < 0)
+            _close_connection(conn);
+        return;
+    }
+    if (conn->http2 != NULL) {
+        if (_http2_write_query(conn, qry) < 0)
+            _close_connection(conn);
+        return;
+    }
+    if (conn->tls != NULL) {
+        if (_tls_write_query(conn, qry) < 0)
+            _close_connection(conn);
+        return;
+    }
 
     core_object_payload_t* payload = (core_object_payload_t*)qry->qry.req->dns_q->obj_prev;
     uint16_t* len;
@@ -168,12 +196,27 @@ static void _send_pending_queries(_output_dnssim_connection_t* conn)
 {
     _output_dnssim_query_tcp_t* qry = (_output_dnssim_query_tcp_t*)conn->client->pending;
 
-    while (qry != NULL) {
+    while (qry != NULL && (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE || _quic_early_data(conn))) {
         _output_dnssim_query_tcp_t* next = (_output_dnssim_query_tcp_t*)qry->qry.next;
+        if (conn->http2 != NULL &&
+            (conn->http2->draining || conn->http2->open_streams >= conn->http2->max_concurrent_streams))
+            break;
+        if (conn->quic != NULL && !_quic_streams_left(conn))
+            break;
         if (qry->qry.state == _OUTPUT_DNSSIM_QUERY_PENDING_WRITE)
             _write_tcp_query(qry, conn);
         qry = next;
     }
+
+    if (conn->http2 != NULL && conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE) {
+        if (_http2_flush(conn) < 0)
+            _close_connection(conn);
+    }
+    if (conn->quic != NULL &&
+        (conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING || conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE)) {
+        if (_quic_flush(conn) < 0)
+            _close_connection(conn);
+    }
 }
 
 int _process_tcp_dnsmsg(_output_dnssim_connection_t* conn)
@@ -292,24 +335,32 @@ unsigned int _read_tcp_stream(_output_dnssim_connection_t* conn, size_t len, con
     return nread;
 }
 
+/* Process the (decrypted) DNS-over-TCP data stream. */
+static void _process_tcp_data(_output_dnssim_connection_t* conn, ssize_t nread, const char* data)
+{
+    int pos = 0;
+    int chunk = 0;
+    while (pos < nread) {
+        chunk = _read_tcp_stream(conn, nread - pos, data + pos);
+        if (chunk < 0) {
+            mlwarning("lost orientation in TCP stream, closing");
+            _close_connection(conn);
+            break;
+        } else {
+            pos += chunk;
+        }
+    }
+    mlassert((pos == nread) || (chunk < 0), "tcp data read invalid, pos != nread");
+}
+
 static void _on_tcp_read(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf)
 {
     _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)handle->data;
     if (nread > 0) {
-        int pos = 0;
-        int chunk = 0;
-        char* data = buf->base;
-        while (pos < nread) {
-            chunk = _read_tcp_stream(conn, nread - pos, data + pos);
-            if (chunk < 0) {
-                mlwarning("lost orientation in TCP stream, closing");
-                _close_connection(conn);
-                break;
-            } else {
-                pos += chunk;
-            }
-        }
-        mlassert((pos == nread) || (chunk < 0), "tcp data read invalid, pos != nread");
+        if (conn->tls != NULL)
+            _tls_process_input_data(conn, nread, buf->base);
+        else
+            _process_tcp_data(conn, nread, buf->base);
     } else if (nread < 0) {
         if (nread != UV_EOF)
             mlinfo("tcp conn unexpected close: %s", uv_strerror(nread));
@@ -326,7 +377,6 @@ static void _on_tcp_handle_connected(uv_connect_t* conn_req, int status)
     mlassert(conn->stats, "conn must have stats");
 
     free(conn_req);
-    uv_timer_stop(conn->handshake_timer);
 
     if (status < 0) {
         mldebug("tcp connect failed: %s", uv_strerror(status));
@@ -342,8 +392,34 @@ static void _on_tcp_handle_connected(uv_connect_t* conn_req, int status)
         return;
     }
 
+    if (conn->tls != NULL) {
+        conn->state = _OUTPUT_DNSSIM_CONN_TLS_HANDSHAKE;
+        if (_tls_handshake(conn) < 0)
+            _close_connection(conn);
+        return;
+    }
+
+    _conn_handshake_done(conn);
+}
+
+/* Mark the connection as active once all handshakes are complete. */
+static void _conn_handshake_done(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->stats, "conn must have stats");
+    output_dnssim_t* dnssim = conn->client->dnssim;
+
+    if (conn->handshake_timer != NULL)
+        uv_timer_stop(conn->handshake_timer);
+
+    uint64_t latency = uv_hrtime() - conn->handshake_started_at;
+    conn->stats->conn_handshakes_done++;
+    lib_histogram_record(conn->stats->conn_handshake_latency, latency);
+    dnssim->stats_sum->conn_handshakes_done++;
+    lib_histogram_record(dnssim->stats_sum->conn_handshake_latency, latency);
+
     conn->state = _OUTPUT_DNSSIM_CONN_ACTIVE;
-    conn->client->dnssim->stats_current->conn_active++;
+    dnssim->stats_current->conn_active++;
     conn->read_state = _OUTPUT_DNSSIM_READ_STATE_DNSLEN;
     conn->recv_len = 2;
     conn->recv_pos = 0;
@@ -359,7 +435,7 @@ static void _maybe_close_connection(_output_dnssim_connection_t* conn)
     mlassert(conn, "conn can't be nil");
 
     if (conn->queued == NULL && conn->sent == NULL) {
-        if (conn->idle_timer == NULL)
+        if (conn->idle_timer == NULL || (conn->http2 != NULL && conn->http2->draining))
             _close_connection(conn);
         else if (!conn->is_idle) {
             conn->is_idle = true;
@@ -378,6 +454,7 @@ static void _close_connection(_output_dnssim_connection_t* conn)
     case _OUTPUT_DNSSIM_CONN_CLOSED:
         return;
     case _OUTPUT_DNSSIM_CONN_CONNECTING:
+    case _OUTPUT_DNSSIM_CONN_TLS_HANDSHAKE:
         conn->stats->conn_handshakes_failed++;
         conn->client->dnssim->stats_sum->conn_handshakes_failed++;
         break;
@@ -402,6 +479,8 @@ static void _close_connection(_output_dnssim_connection_t* conn)
         uv_read_stop((uv_stream_t*)conn->handle);
         uv_close((uv_handle_t*)conn->handle, _on_tcp_handle_closed);
     }
+    if (conn->quic != NULL)
+        _quic_close(conn);
 }
 
 static void _on_connection_timeout(uv_timer_t* handle)
@@ -410,6 +489,29 @@ static void _on_connection_timeout(uv_timer_t* handle)
     _close_connection(conn);
 }
 
+/* Set connection handshake timeout and idle connection timer. */
+static void _conn_init_timers(output_dnssim_t* self, _output_dnssim_connection_t* conn)
+{
+    mlassert_self();
+    lassert(conn->handshake_timer == NULL, "connection already has a handshake timer");
+    lassert(conn->idle_timer == NULL, "connection already has idle timer");
+
+    lfatal_oom(conn->handshake_timer = malloc(sizeof(uv_timer_t)));
+    uv_timer_init(&_self->loop, conn->handshake_timer);
+    conn->handshake_timer->data = (void*)conn;
+    uv_timer_start(conn->handshake_timer, _on_connection_timeout, self->handshake_timeout_ms, 0);
+
+    if (self->idle_timeout_ms > 0) {
+        lfatal_oom(conn->idle_timer = malloc(sizeof(uv_timer_t)));
+        uv_timer_init(&_self->loop, conn->idle_timer);
+        conn->idle_timer->data = (void*)conn;
+
+        /* Start and stop the timer to set the repeat value without running the timer. */
+        uv_timer_start(conn->idle_timer, _on_connection_timeout, self->idle_timeout_ms, self->idle_timeout_ms);
+        uv_timer_stop(conn->idle_timer);
+    }
+}
+
 static int _connect_tcp_handle(output_dnssim_t* self, _output_dnssim_connection_t* conn)
 {
     mlassert_self();
@@ -427,40 +529,35 @@ static int _connect_tcp_handle(output_dnssim_t* self, _output_dnssim_connection_
         goto failure;
     }
 
-    ret = _bind_before_connect(self, (uv_handle_t*)conn->handle);
-    if (ret < 0)
+    conn->target = _bind_before_connect(self, (uv_handle_t*)conn->handle);
+    if (conn->target == NULL) {
+        ret = -1;
         goto failure;
+    }
+
+    if (_self->transport == OUTPUT_DNSSIM_TRANSPORT_TLS ||
+        _self->transport == OUTPUT_DNSSIM_TRANSPORT_HTTPS2) {
+        ret = _tls_init_session(conn);
+        if (ret < 0)
+            goto failure;
+    }
 
     /* Set connection parameters. */
     ret = uv_tcp_nodelay(conn->handle, 1);
     if (ret < 0)
         lwarning("tcp: failed to set TCP_NODELAY: %s", uv_strerror(ret));
 
-    /* Set connection handshake timeout. */
-    lfatal_oom(conn->handshake_timer = malloc(sizeof(uv_timer_t)));
-    uv_timer_init(&_self->loop, conn->handshake_timer);
-    conn->handshake_timer->data = (void*)conn;
-    uv_timer_start(conn->handshake_timer, _on_connection_timeout, self->handshake_timeout_ms, 0);
-
-    /* Set idle connection timer. */
-    if (self->idle_timeout_ms > 0) {
-        lfatal_oom(conn->idle_timer = malloc(sizeof(uv_timer_t)));
-        uv_timer_init(&_self->loop, conn->idle_timer);
-        conn->idle_timer->data = (void*)conn;
-
-        /* Start and stop the timer to set the repeat value without running the timer. */
-        uv_timer_start(conn->idle_timer, _on_connection_timeout, self->idle_timeout_ms, self->idle_timeout_ms);
-        uv_timer_stop(conn->idle_timer);
-    }
+    _conn_init_timers(self, conn);
 
     uv_connect_t* conn_req;
     lfatal_oom(conn_req = malloc(sizeof(uv_connect_t)));
-    ret = uv_tcp_connect(conn_req, conn->handle, (struct sockaddr*)&_self->target, _on_tcp_handle_connected);
+    ret = uv_tcp_connect(conn_req, conn->handle, conn->target, _on_tcp_handle_connected);
     if (ret < 0)
         goto failure;
 
     conn->stats->conn_handshakes++;
     conn->client->dnssim->stats_sum->conn_handshakes++;
+    conn->handshake_started_at = uv_hrtime();
     conn->state = _OUTPUT_DNSSIM_CONN_CONNECTING;
     return 0;
 failure:
@@ -483,9 +580,12 @@ static int _handle_pending_queries(_output_dnssim_client_t* client)
     bool is_connecting = false;
     _output_dnssim_connection_t *conn = client->conn;
     while (conn != NULL) {
-        if (conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE)
+        /* Connections draining after HTTP/2 GOAWAY don't take new queries. */
+        if ((conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE && (conn->http2 == NULL || !conn->http2->draining)) ||
+            _quic_early_data(conn))
             break;
-        else if (conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING)
+        else if (conn->state == _OUTPUT_DNSSIM_CONN_CONNECTING ||
+                 conn->state == _OUTPUT_DNSSIM_CONN_TLS_HANDSHAKE)
             is_connecting = true;
         conn = conn->next;
     }
@@ -497,10 +597,17 @@ static int _handle_pending_queries(_output_dnssim_client_t* client)
         conn->state = _OUTPUT_DNSSIM_CONN_INITIALIZED;
         conn->client = client;
         conn->stats = self->stats_current;
-        ret = _connect_tcp_handle(self, conn);
+        _ll_append(client->conn, conn);
+        if (_self->transport == OUTPUT_DNSSIM_TRANSPORT_QUIC)
+            ret = _quic_connect(self, conn);
+        else
+            ret = _connect_tcp_handle(self, conn);
         if (ret < 0)
             return ret;
-        _ll_append(client->conn, conn);
+
+        /* With 0-RTT, queries can be sent along with the handshake. */
+        if (_quic_early_data(conn))
+            _send_pending_queries(conn);
     } /* Otherwise, pending queries wil be sent after connected callback. */
 
     return ret;
@@ -518,7 +625,8 @@ static int _create_query_tcp(output_dnssim_t* self, _output_dnssim_request_t* re
 
     lfatal_oom(qry = calloc(1, sizeof(_output_dnssim_query_tcp_t)));
 
-    qry->qry.transport = OUTPUT_DNSSIM_TRANSPORT_TCP;
+    qry->qry.transport = _self->transport;
+    qry->stream_id = -1;
     qry->qry.req = req;
     qry->qry.state = _OUTPUT_DNSSIM_QUERY_PENDING_WRITE;
     req->qry = &qry->qry;  // TODO change when adding support for multiple Qs for req
@@ -544,6 +652,10 @@ static void _close_query_tcp(_output_dnssim_query_tcp_t* qry)
     _ll_try_remove(req->client->pending, &qry->qry);
     if (qry->conn) {
         _output_dnssim_connection_t* conn = qry->conn;
+        if (conn->http2 != NULL)
+            _http2_cancel_stream(conn, qry);
+        if (conn->quic != NULL)
+            _quic_cancel_stream(conn, qry);
         _ll_try_remove(conn->queued, &qry->qry);  /* edge-case of cancelled queries */
         _ll_try_remove(conn->sent, &qry->qry);
         qry->conn = NULL;
@@ -551,5 +663,7 @@ static void _close_query_tcp(_output_dnssim_query_tcp_t* qry)
     }
 
     _ll_remove(req->qry, &qry->qry);
+    free(qry->recv_buf);
+    free(qry->send_buf);
     free(qry);
 }
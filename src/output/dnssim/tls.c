@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2020, CZ.NIC, z.s.p.o.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Size of the buffer for decrypted data, which is then parsed as TCP stream. */
+#define _TLS_RECV_BUF_SIZE (16 * 1024)
+
+typedef struct _output_dnssim_tls_write_req {
+    uv_write_t req;
+    _output_dnssim_connection_t* conn;
+    char* data;
+    size_t len;
+} _output_dnssim_tls_write_req_t;
+
+static void _tls_on_write_complete(uv_write_t* req, int status)
+{
+    _output_dnssim_tls_write_req_t* wr = (_output_dnssim_tls_write_req_t*)req->data;
+    _output_dnssim_connection_t* conn = wr->conn;
+
+    if (conn->tls != NULL) {
+        mlassert(conn->tls->write_queue_size >= wr->len, "invalid tls write queue size");
+        conn->tls->write_queue_size -= wr->len;
+    }
+    free(wr->data);
+    free(wr);
+
+    if (status < 0) {
+        if (status != UV_ECANCELED)
+            mlinfo("tls write failed: %s", uv_strerror(status));
+        _close_connection(conn);
+    }
+}
+
+/* Gnutls push function: hand over the encrypted data to libuv. */
+static ssize_t _tls_vec_push(gnutls_transport_ptr_t ptr, const giovec_t* iov, int iovcnt)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)ptr;
+    uv_buf_t uv_bufs[iovcnt];
+    size_t total = 0;
+    size_t sent = 0;
+    int ret;
+
+    if (iovcnt == 0)
+        return 0;
+
+    if (conn->handle == NULL || conn->state == _OUTPUT_DNSSIM_CONN_CLOSING ||
+        conn->state == _OUTPUT_DNSSIM_CONN_CLOSED) {
+        gnutls_transport_set_errno(conn->tls->session, EIO);
+        return -1;
+    }
+
+    for (int i = 0; i < iovcnt; ++i) {
+        uv_bufs[i] = uv_buf_init(iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+    }
+
+    /* Try to write right away; libuv returns UV_EAGAIN if there are any
+     * queued writes, so the order of data is preserved. */
+    ret = uv_try_write((uv_stream_t*)conn->handle, uv_bufs, iovcnt);
+    if (ret > 0) {
+        sent = ret;
+    } else if (ret != UV_EAGAIN) {
+        mldebug("tls uv_try_write() failed: %s", uv_strerror(ret));
+        gnutls_transport_set_errno(conn->tls->session, EIO);
+        return -1;
+    }
+    if (sent == total)
+        return total;
+
+    /* Queue the rest of the data; gnutls expects it to be consumed. */
+    _output_dnssim_tls_write_req_t* wr;
+    mlfatal_oom(wr = malloc(sizeof(_output_dnssim_tls_write_req_t)));
+    wr->conn = conn;
+    wr->len = total - sent;
+    mlfatal_oom(wr->data = malloc(wr->len));
+
+    size_t pos = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size_t len = iov[i].iov_len;
+        const char* base = (const char*)iov[i].iov_base;
+        if (sent >= len) {
+            sent -= len;
+            continue;
+        }
+        memcpy(wr->data + pos, base + sent, len - sent);
+        pos += len - sent;
+        sent = 0;
+    }
+    mlassert(pos == wr->len, "tls write queue data mismatch");
+
+    uv_buf_t buf = uv_buf_init(wr->data, wr->len);
+    wr->req.data = (void*)wr;
+    ret = uv_write(&wr->req, (uv_stream_t*)conn->handle, &buf, 1, _tls_on_write_complete);
+    if (ret < 0) {
+        mldebug("tls uv_write() failed: %s", uv_strerror(ret));
+        free(wr->data);
+        free(wr);
+        gnutls_transport_set_errno(conn->tls->session, EIO);
+        return -1;
+    }
+    conn->tls->write_queue_size += wr->len;
+
+    return total;
+}
+
+/* Gnutls pull function: provide data received by libuv. */
+static ssize_t _tls_pull(gnutls_transport_ptr_t ptr, void* buf, size_t len)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)ptr;
+    _output_dnssim_tls_ctx_t* tls = conn->tls;
+    ssize_t avail = tls->buf_len - tls->buf_pos;
+
+    if (avail <= 0) {
+        gnutls_transport_set_errno(tls->session, EAGAIN);
+        return -1;
+    }
+
+    if (len > avail)
+        len = avail;
+    memcpy(buf, tls->buf + tls->buf_pos, len);
+    tls->buf_pos += len;
+
+    return len;
+}
+
+static int _tls_pull_timeout(gnutls_transport_ptr_t ptr, unsigned int ms)
+{
+    _output_dnssim_connection_t* conn = (_output_dnssim_connection_t*)ptr;
+    _output_dnssim_tls_ctx_t* tls = conn->tls;
+
+    /* Reads never block, report whether there is any buffered data. */
+    if (tls->buf_len - tls->buf_pos > 0)
+        return 1;
+    gnutls_transport_set_errno(tls->session, EAGAIN);
+    return -1;
+}
+
+/* Send the server name and set up the verification of the certificate,
+ * without tls_verify() any certificate is accepted. */
+static int _tls_set_server(output_dnssim_t* self, gnutls_session_t session)
+{
+    int ret;
+
+    if (_self->tls_server_name != NULL) {
+        ret = gnutls_server_name_set(session, GNUTLS_NAME_DNS,
+            _self->tls_server_name, strlen(_self->tls_server_name));
+        if (ret < 0) {
+            lwarning("gnutls_server_name_set() failed: %s", gnutls_strerror(ret));
+            return -1;
+        }
+    }
+    if (_self->tls_verify)
+        gnutls_session_set_verify_cert(session, _self->tls_server_name, 0);
+    return 0;
+}
+
+static int _tls_init_session(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->tls == NULL, "conn already has tls context");
+    mlassert(conn->client, "conn must belong to a client");
+    output_dnssim_t* self = conn->client->dnssim;
+    mlassert_self();
+    lassert(_self->tls_priority, "tls priority must be set");
+
+    int ret;
+    _output_dnssim_tls_ctx_t* tls;
+    lfatal_oom(tls = calloc(1, sizeof(_output_dnssim_tls_ctx_t)));
+
+    ret = gnutls_init(&tls->session, GNUTLS_CLIENT | GNUTLS_NONBLOCK);
+    if (ret < 0) {
+        lwarning("gnutls_init() failed: %s", gnutls_strerror(ret));
+        free(tls);
+        return -1;
+    }
+
+    ret = gnutls_priority_set(tls->session, *_self->tls_priority);
+    if (ret < 0) {
+        lwarning("gnutls_priority_set() failed: %s", gnutls_strerror(ret));
+        goto failure;
+    }
+
+    ret = gnutls_credentials_set(tls->session, GNUTLS_CRD_CERTIFICATE, _self->tls_cred);
+    if (ret < 0) {
+        lwarning("gnutls_credentials_set() failed: %s", gnutls_strerror(ret));
+        goto failure;
+    }
+
+    if (_tls_set_server(self, tls->session) < 0)
+        goto failure;
+
+    /* Resume the previous session of this client, if possible. */
+    if (conn->client->tls_ticket.size != 0) {
+        ret = gnutls_session_set_data(tls->session,
+            conn->client->tls_ticket.data, conn->client->tls_ticket.size);
+        if (ret < 0)
+            ldebug("gnutls_session_set_data() failed: %s", gnutls_strerror(ret));
+    }
+
+    if (_self->transport == OUTPUT_DNSSIM_TRANSPORT_HTTPS2) {
+        const gnutls_datum_t proto = { (unsigned char*)"h2", 2 };
+        ret = gnutls_alpn_set_protocols(tls->session, &proto, 1, 0);
+        if (ret < 0) {
+            lwarning("gnutls_alpn_set_protocols() failed: %s", gnutls_strerror(ret));
+            goto failure;
+        }
+    }
+
+    /* Handshake timeout is handled by conn->handshake_timer. */
+    gnutls_handshake_set_timeout(tls->session, 0);
+
+    gnutls_transport_set_pull_function(tls->session, _tls_pull);
+    gnutls_transport_set_pull_timeout_function(tls->session, _tls_pull_timeout);
+    gnutls_transport_set_vec_push_function(tls->session, _tls_vec_push);
+    gnutls_transport_set_ptr(tls->session, conn);
+
+    conn->tls = tls;
+    return 0;
+failure:
+    gnutls_deinit(tls->session);
+    free(tls);
+    return -1;
+}
+
+/* Store the session for resumption by the next connection. With TLS 1.3,
+ * the ticket is received after the handshake, so it is done at the end. */
+static void _tls_store_ticket(_output_dnssim_client_t* client, gnutls_session_t session)
+{
+    gnutls_datum_t ticket = { NULL, 0 };
+    if (gnutls_session_get_data2(session, &ticket) == GNUTLS_E_SUCCESS) {
+        if (ticket.size != 0) {
+            gnutls_free(client->tls_ticket.data);
+            client->tls_ticket = ticket;
+        } else {
+            gnutls_free(ticket.data);
+        }
+    }
+}
+
+static void _tls_close_session(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->tls, "conn must have tls context");
+
+    _tls_store_ticket(conn->client, conn->tls->session);
+    gnutls_deinit(conn->tls->session);
+    free(conn->tls);
+    conn->tls = NULL;
+}
+
+static int _tls_handshake(_output_dnssim_connection_t* conn)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->tls, "conn must have tls context");
+    mlassert(conn->state == _OUTPUT_DNSSIM_CONN_TLS_HANDSHAKE, "connection state != TLS_HANDSHAKE");
+
+    int ret = gnutls_handshake(conn->tls->session);
+    if (ret == GNUTLS_E_SUCCESS) {
+        if (gnutls_session_is_resumed(conn->tls->session)) {
+            conn->stats->conn_resumed++;
+            conn->client->dnssim->stats_sum->conn_resumed++;
+        }
+        if (((_output_dnssim_t*)conn->client->dnssim)->transport == OUTPUT_DNSSIM_TRANSPORT_HTTPS2) {
+            if (_http2_init_session(conn) < 0)
+                return -1;
+        }
+        _conn_handshake_done(conn);
+    } else if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED) {
+        /* Handshake continues when more data is received. */
+    } else if (gnutls_error_is_fatal(ret)) {
+        mldebug("tls handshake failed: %s", gnutls_strerror(ret));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void _tls_process_input_data(_output_dnssim_connection_t* conn, ssize_t nread, const char* data)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->tls, "conn must have tls context");
+    _output_dnssim_tls_ctx_t* tls = conn->tls;
+
+    tls->buf = (const uint8_t*)data;
+    tls->buf_len = nread;
+    tls->buf_pos = 0;
+
+    if (conn->state == _OUTPUT_DNSSIM_CONN_TLS_HANDSHAKE) {
+        if (_tls_handshake(conn) < 0) {
+            _close_connection(conn);
+            goto done;
+        }
+        if (conn->state != _OUTPUT_DNSSIM_CONN_ACTIVE)
+            goto done;
+    }
+
+    char recv_buf[_TLS_RECV_BUF_SIZE];
+    while (conn->tls != NULL && conn->state == _OUTPUT_DNSSIM_CONN_ACTIVE) {
+        ssize_t count = gnutls_record_recv(tls->session, recv_buf, sizeof(recv_buf));
+        if (count > 0) {
+            if (conn->http2 != NULL)
+                _http2_process_input_data(conn, count, recv_buf);
+            else
+                _process_tcp_data(conn, count, recv_buf);
+        } else if (count == GNUTLS_E_AGAIN || count == GNUTLS_E_INTERRUPTED) {
+            break;
+        } else if (count == 0) {
+            mldebug("tls peer closed connection");
+            _close_connection(conn);
+            break;
+        } else if (gnutls_error_is_fatal(count)) {
+            mlinfo("tls gnutls_record_recv() failed: %s", gnutls_strerror(count));
+            _close_connection(conn);
+            break;
+        }
+    }
+
+done:
+    if (conn->tls != NULL) {
+        conn->tls->buf = NULL;
+        conn->tls->buf_len = 0;
+        conn->tls->buf_pos = 0;
+    }
+}
+
+static int _tls_write_query(_output_dnssim_connection_t* conn, _output_dnssim_query_tcp_t* qry)
+{
+    mlassert(conn, "conn can't be nil");
+    mlassert(conn->tls, "conn must have tls context");
+    mlassert(qry, "qry can't be nil");
+
+    core_object_payload_t* payload = (core_object_payload_t*)qry->qry.req->dns_q->obj_prev;
+    uint16_t len = htons(payload->len);
+    ssize_t ret;
+
+    gnutls_record_cork(conn->tls->session);
+    ret = gnutls_record_send(conn->tls->session, &len, sizeof(len));
+    if (ret < 0)
+        goto failure;
+    ret = gnutls_record_send(conn->tls->session, payload->payload, payload->len);
+    if (ret < 0)
+        goto failure;
+    ret = gnutls_record_uncork(conn->tls->session, GNUTLS_RECORD_WAIT);
+    if (ret < 0) {
+        mlinfo("tls gnutls_record_uncork() failed: %s", gnutls_strerror(ret));
+        return ret;
+    }
+
+    /* Push function has queued all the data to libuv, the query is sent. */
+    qry->conn = conn;
+    _ll_remove(conn->client->pending, &qry->qry);
+    _ll_append(conn->sent, &qry->qry);
+    qry->qry.state = _OUTPUT_DNSSIM_QUERY_SENT;
+
+    /* Stop idle timer, since there are queries to answer now. */
+    if (conn->idle_timer != NULL) {
+        conn->is_idle = false;
+        uv_timer_stop(conn->idle_timer);
+    }
+
+    return 0;
+failure:
+    mlinfo("tls gnutls_record_send() failed: %s", gnutls_strerror(ret));
+    gnutls_record_uncork(conn->tls->session, 0);
+    return ret;
+}
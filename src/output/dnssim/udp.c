@@ -110,21 +110,22 @@ static int _create_query_udp(output_dnssim_t* self, _output_dnssim_request_t* re
     }
     _ll_append(req->qry, &qry->qry);
 
-    ret = _bind_before_connect(self, (uv_handle_t*)qry->handle);
-    if (ret < 0)
-        return ret;
+    const struct sockaddr* target = _bind_before_connect(self, (uv_handle_t*)qry->handle);
+    if (target == NULL)
+        return -1;
 
-    ret = uv_udp_try_send(qry->handle, &qry->buf, 1, (struct sockaddr*)&_self->target);
+    ret = uv_udp_try_send(qry->handle, &qry->buf, 1, target);
     if (ret < 0) {
         lwarning("failed to send udp packet: %s", uv_strerror(ret));
         return ret;
     }
+    _request_sent(req, target->sa_family);
 
-    // TODO IPv4
-    struct sockaddr_in6 src;
+    struct sockaddr_storage src;
     int addr_len = sizeof(src);
     uv_udp_getsockname(qry->handle, (struct sockaddr*)&src, &addr_len);
-    ldebug("sent udp from port: %d", ntohs(src.sin6_port));
+    ldebug("sent udp from port: %d", ntohs(src.ss_family == AF_INET6 ?
+        ((struct sockaddr_in6*)&src)->sin6_port : ((struct sockaddr_in*)&src)->sin_port));
 
     // listen for reply
     ret = uv_udp_recv_start(qry->handle, _on_uv_alloc, _on_udp_query_recv);
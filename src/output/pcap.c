@@ -24,10 +24,27 @@
 #include "core/assert.h"
 #include "core/object/pcap.h"
 
+#include <ck_pr.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define _ALIGN 4096
+
 static core_log_t    _log      = LOG_T_INIT("output.pcap");
 static output_pcap_t _defaults = {
     LOG_T_INIT_OBJ("output.pcap"),
-    0, 0
+    OUTPUT_PCAP_FORMAT_PCAP, 0, 0,
+    4 * 1024 * 1024,
+    0,
+    0, 0,
+    0, 0, 0, 0,
+    0, -1
 };
 
 core_log_t* output_pcap_log()
@@ -45,65 +62,408 @@ void output_pcap_init(output_pcap_t* self)
 void output_pcap_destroy(output_pcap_t* self)
 {
     mlassert_self();
+
+    output_pcap_close(self);
+}
+
+static void* _flusher(void* arg)
+{
+    output_pcap_t* self = (output_pcap_t*)arg;
+    const uint8_t* buf;
+    size_t         len;
+    ssize_t        n;
+    int            fd, do_close;
+
+    for (;;) {
+        pthread_mutex_lock(&self->lock);
+        while (!self->pending && !self->stop) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        if (!self->pending) {
+            pthread_mutex_unlock(&self->lock);
+            break;
+        }
+        buf      = self->flush_buf;
+        len      = self->flush_len;
+        fd       = self->flush_fd;
+        do_close = self->flush_close;
+        pthread_mutex_unlock(&self->lock);
+
+        while (len) {
+            if ((n = write(fd, buf, len)) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                lcritical("write() error: %s", core_log_errstr(errno));
+                ck_pr_inc_64(&self->errors);
+                break;
+            }
+            buf += n;
+            len -= n;
+        }
+        if (self->sync && fdatasync(fd)) {
+            lcritical("fdatasync() error: %s", core_log_errstr(errno));
+            ck_pr_inc_64(&self->errors);
+        }
+        if (do_close && close(fd)) {
+            lcritical("close() error: %s", core_log_errstr(errno));
+            ck_pr_inc_64(&self->errors);
+        }
+
+        pthread_mutex_lock(&self->lock);
+        self->pending = 0;
+        pthread_cond_broadcast(&self->cond);
+        pthread_mutex_unlock(&self->lock);
+    }
+
+    return 0;
+}
+
+/*
+ * Wait for the flushing thread to finish with the other buffer, this is
+ * the only place the receiving side can block.
+ */
+static void _wait(output_pcap_t* self)
+{
+    pthread_mutex_lock(&self->lock);
+    while (self->pending) {
+        pthread_cond_wait(&self->cond, &self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ * Hand the current buffer to the flushing thread, optionally closing the
+ * file once written, and continue filling the other buffer.
+ */
+static void _handoff(output_pcap_t* self, int do_close)
+{
+    if (!self->used && !do_close) {
+        return;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (self->pending) {
+        pthread_cond_wait(&self->cond, &self->lock);
+    }
+    self->flush_buf   = self->buf[self->cur];
+    self->flush_len   = self->used;
+    self->flush_fd    = self->fd;
+    self->flush_close = do_close;
+    self->pending     = 1;
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+
+    self->cur ^= 1;
+    self->used = 0;
+}
+
+/*
+ * Return space for len bytes in the current buffer, or null if it would
+ * never fit in which case the caller must write it directly.
+ */
+static inline uint8_t* _reserve(output_pcap_t* self, size_t len)
+{
+    uint8_t* p;
+
+    if (self->used + len > self->buffer_size) {
+        _handoff(self, 0);
+        if (len > self->buffer_size) {
+            _wait(self);
+            return 0;
+        }
+    }
+    p = self->buf[self->cur] + self->used;
+    self->used += len;
+    self->file_bytes += len;
+    self->bytes += len;
+    return p;
+}
+
+static void _write_direct(output_pcap_t* self, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    ssize_t        n;
+
+    while (len) {
+        if ((n = write(self->fd, p, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lcritical("write() error: %s", core_log_errstr(errno));
+            ck_pr_inc_64(&self->errors);
+            return;
+        }
+        p += n;
+        len -= n;
+        self->file_bytes += n;
+        self->bytes += n;
+    }
+}
+
+static void _put(output_pcap_t* self, const void* data, size_t len)
+{
+    uint8_t* p;
+
+    if ((p = _reserve(self, len))) {
+        memcpy(p, data, len);
+    } else {
+        _write_direct(self, data, len);
+    }
+}
+
+static void _put32(output_pcap_t* self, uint32_t v)
+{
+    _put(self, &v, sizeof(v));
+}
+
+static void _put16(output_pcap_t* self, uint16_t v)
+{
+    _put(self, &v, sizeof(v));
+}
+
+static void _header(output_pcap_t* self)
+{
+    switch (self->format) {
+    case OUTPUT_PCAP_FORMAT_PCAPNG:
+        /* Section Header Block */
+        _put32(self, 0x0a0d0d0a);
+        _put32(self, 28);
+        _put32(self, 0x1a2b3c4d);
+        _put16(self, 1);
+        _put16(self, 0);
+        _put32(self, 0xffffffff);
+        _put32(self, 0xffffffff);
+        _put32(self, 28);
+        /* Interface Description Block, with if_tsresol for nanoseconds */
+        _put32(self, 1);
+        _put32(self, 32);
+        _put16(self, self->linktype);
+        _put16(self, 0);
+        _put32(self, self->snaplen);
+        _put16(self, 9);
+        _put16(self, 1);
+        _put32(self, 9);
+        _put32(self, 0);
+        _put32(self, 32);
+        break;
+    default:
+        _put32(self, self->format == OUTPUT_PCAP_FORMAT_PCAP_NS ? 0xa1b23c4d : 0xa1b2c3d4);
+        _put16(self, 2);
+        _put16(self, 4);
+        _put32(self, 0);
+        _put32(self, 0);
+        _put32(self, self->snaplen);
+        _put32(self, self->linktype);
+    }
+}
+
+static size_t _header_len(output_pcap_t* self)
+{
+    return self->format == OUTPUT_PCAP_FORMAT_PCAPNG ? 60 : 24;
+}
+
+static int _open_file(output_pcap_t* self)
+{
+    char   name[PATH_MAX];
+    size_t n;
+
+    if (self->rotate_size || self->rotate_sec) {
+        n = snprintf(name, sizeof(name), "%s.%" PRIu64, self->file, self->files);
+    } else {
+        n = snprintf(name, sizeof(name), "%s", self->file);
+    }
+    if (n >= sizeof(name)) {
+        lcritical("file name too long");
+        return -1;
+    }
+
+    if ((self->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0664)) < 0) {
+        lcritical("open(%s) error: %s", name, core_log_errstr(errno));
+        return -1;
+    }
+    self->files++;
+    self->file_bytes = 0;
+    _header(self);
+
+    return 0;
+}
+
+static void _rotate(output_pcap_t* self)
+{
+    _handoff(self, 1);
+    self->fd = -1;
+    if (_open_file(self)) {
+        lfatal("unable to rotate file");
+    }
 }
 
 int output_pcap_open(output_pcap_t* self, const char* file, int linktype, int snaplen)
 {
+    int err;
     mlassert_self();
-    if (self->dumper) {
+    lassert(file, "file is nil");
+
+    if (self->fd > -1) {
         lfatal("PCAP already opened");
     }
+    if (self->buffer_size < _ALIGN) {
+        self->buffer_size = _ALIGN;
+    }
 
-    if (!(self->pcap = pcap_open_dead(linktype, snaplen))) {
-        lcritical("pcap_open_dead() failed");
-        return -1;
+    lfatal_oom(self->file = strdup(file));
+    if (posix_memalign((void**)&self->buf[0], _ALIGN, self->buffer_size)
+        || posix_memalign((void**)&self->buf[1], _ALIGN, self->buffer_size)) {
+        lfatal("posix_memalign() failed");
     }
+    self->cur        = 0;
+    self->used       = 0;
+    self->linktype   = linktype;
+    self->snaplen    = snaplen;
+    self->files      = 0;
+    self->file_start = -1;
 
-    if (!(self->dumper = pcap_dump_open(self->pcap, file))) {
-        lcritical("pcap_dump_open() failed");
-        pcap_close(self->pcap);
-        self->pcap = 0;
+    if (_open_file(self)) {
+        free(self->buf[0]);
+        free(self->buf[1]);
+        free(self->file);
+        self->buf[0] = 0;
+        self->buf[1] = 0;
+        self->file   = 0;
         return -1;
     }
 
+    if (pthread_mutex_init(&self->lock, 0) || pthread_cond_init(&self->cond, 0)) {
+        lfatal("mutex/cond init failed");
+    }
+    self->pending = 0;
+    self->stop    = 0;
+    if ((err = pthread_create(&self->flusher, 0, _flusher, self))) {
+        lfatal("pthread_create() error: %s", core_log_errstr(err));
+    }
+    self->running = 1;
+
     return 0;
 }
 
+uint64_t output_pcap_errors(output_pcap_t* self)
+{
+    mlassert_self();
+    return ck_pr_load_64(&self->errors);
+}
+
 void output_pcap_close(output_pcap_t* self)
 {
+    int err;
     mlassert_self();
-    if (self->dumper) {
-        pcap_dump_close(self->dumper);
-        self->dumper = 0;
+
+    if (self->fd < 0) {
+        return;
     }
-    if (self->pcap) {
-        pcap_close(self->pcap);
-        self->pcap = 0;
+
+    _handoff(self, 1);
+    self->fd = -1;
+
+    pthread_mutex_lock(&self->lock);
+    self->stop = 1;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    if ((err = pthread_join(self->flusher, 0))) {
+        lcritical("pthread_join() error: %s", core_log_errstr(err));
     }
+    self->running = 0;
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->cond);
+
+    free(self->buf[0]);
+    free(self->buf[1]);
+    free(self->file);
+    self->buf[0] = 0;
+    self->buf[1] = 0;
+    self->file   = 0;
 }
 
 static void _receive(output_pcap_t* self, const core_object_t* obj)
 {
-    struct pcap_pkthdr hdr;
+    const core_object_pcap_t* pkt;
+    uint8_t*                  p;
+    size_t                    len, pad;
+    uint32_t                  hdr[7];
+    uint64_t                  ts;
     mlassert_self();
 
     while (obj) {
         if (obj->obj_type == CORE_OBJECT_PCAP) {
-            hdr.ts.tv_sec  = ((const core_object_pcap_t*)obj)->ts.sec;
-            hdr.ts.tv_usec = ((const core_object_pcap_t*)obj)->ts.nsec / 1000;
-            hdr.caplen     = ((const core_object_pcap_t*)obj)->caplen;
-            hdr.len        = ((const core_object_pcap_t*)obj)->len;
-
-            pcap_dump((void*)self->dumper, &hdr, ((const core_object_pcap_t*)obj)->bytes);
-            return;
+            break;
         }
         obj = obj->obj_prev;
     }
+    if (!obj) {
+        return;
+    }
+    pkt = (const core_object_pcap_t*)obj;
+
+    if (self->rotate_sec) {
+        if (self->file_start < 0) {
+            self->file_start = pkt->ts.sec - pkt->ts.sec % self->rotate_sec;
+        } else if (pkt->ts.sec >= self->file_start + (int64_t)self->rotate_sec) {
+            self->file_start = pkt->ts.sec - pkt->ts.sec % self->rotate_sec;
+            _rotate(self);
+        }
+    }
+
+    if (self->format == OUTPUT_PCAP_FORMAT_PCAPNG) {
+        /* Enhanced Packet Block, data padded to 32 bits */
+        pad = (4 - (pkt->caplen & 3)) & 3;
+        len = 28 + pkt->caplen + pad + 4;
+        ts  = (uint64_t)pkt->ts.sec * 1000000000 + pkt->ts.nsec;
+
+        hdr[0] = 6;
+        hdr[1] = len;
+        hdr[2] = 0;
+        hdr[3] = ts >> 32;
+        hdr[4] = ts;
+        hdr[5] = pkt->caplen;
+        hdr[6] = pkt->len;
+    } else {
+        pad = 0;
+        len = 16 + pkt->caplen;
+
+        hdr[0] = pkt->ts.sec;
+        hdr[1] = self->format == OUTPUT_PCAP_FORMAT_PCAP_NS ? pkt->ts.nsec : pkt->ts.nsec / 1000;
+        hdr[2] = pkt->caplen;
+        hdr[3] = pkt->len;
+    }
+
+    if (self->rotate_size && self->file_bytes + len > self->rotate_size && self->file_bytes > _header_len(self)) {
+        _rotate(self);
+    }
+
+    if ((p = _reserve(self, len))) {
+        if (self->format == OUTPUT_PCAP_FORMAT_PCAPNG) {
+            memcpy(p, hdr, 28);
+            memcpy(p + 28, pkt->bytes, pkt->caplen);
+            memset(p + 28 + pkt->caplen, 0, pad);
+            memcpy(p + len - 4, &hdr[1], 4);
+        } else {
+            memcpy(p, hdr, 16);
+            memcpy(p + 16, pkt->bytes, pkt->caplen);
+        }
+    } else {
+        _write_direct(self, hdr, self->format == OUTPUT_PCAP_FORMAT_PCAPNG ? 28 : 16);
+        _write_direct(self, pkt->bytes, pkt->caplen);
+        if (self->format == OUTPUT_PCAP_FORMAT_PCAPNG) {
+            hdr[0] = 0;
+            _write_direct(self, hdr, pad);
+            _write_direct(self, &hdr[1], 4);
+        }
+    }
+    self->packets++;
 }
 
 core_receiver_t output_pcap_receiver(output_pcap_t* self)
 {
-    if (!self->dumper) {
+    if (self->fd < 0) {
         lfatal("PCAP not opened");
     }
 
@@ -25,7 +25,8 @@
 #ifndef __dnsjit_output_pcap_h
 #define __dnsjit_output_pcap_h
 
-#include <pcap/pcap.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include "output/pcap.hh"
 
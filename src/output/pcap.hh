@@ -18,24 +18,71 @@
  * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#if 0
-typedef struct pcap_dumper {} pcap_dumper_t;
-#endif
-
+//lua:require("dnsjit.core.compat_h")
 //lua:require("dnsjit.core.log")
 //lua:require("dnsjit.core.receiver_h")
-//lua:require("dnsjit.input.pcap_h")
+
+typedef enum output_pcap_format {
+    OUTPUT_PCAP_FORMAT_PCAP,
+    OUTPUT_PCAP_FORMAT_PCAP_NS,
+    OUTPUT_PCAP_FORMAT_PCAPNG
+} output_pcap_format_t;
 
 typedef struct output_pcap {
-    core_log_t     _log;
-    pcap_t*        pcap;
-    pcap_dumper_t* dumper;
+    core_log_t _log;
+
+    output_pcap_format_t format;
+    int                  linktype;
+    uint32_t             snaplen;
+
+    /* Size of each of the two write buffers, one is filled while the other
+     * is written to disk by the flushing thread. */
+    size_t buffer_size;
+
+    /* If set, fdatasync() the file after each buffer written. */
+    int sync;
+
+    /* Start a new file when the current has reached rotate_size bytes or
+     * when the packet timestamps pass an interval of rotate_sec seconds,
+     * 0 disables. */
+    uint64_t rotate_size;
+    uint64_t rotate_sec;
+
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t files;
+    /* Written by both threads, see output_pcap_errors(). */
+    uint64_t errors;
+
+    /* Current file. */
+    char*    file;
+    int      fd;
+    uint64_t file_bytes;
+    int64_t  file_start;
+
+    /* Buffer being filled. */
+    uint8_t* buf[2];
+    int      cur;
+    size_t   used;
+
+    /* Buffer handed to the flushing thread, and the file it belongs to. */
+    pthread_t       flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             running;
+    int             pending;
+    int             stop;
+    const uint8_t*  flush_buf;
+    size_t          flush_len;
+    int             flush_fd;
+    int             flush_close;
 } output_pcap_t;
 
 core_log_t* output_pcap_log();
 void output_pcap_init(output_pcap_t* self);
 void output_pcap_destroy(output_pcap_t* self);
 int output_pcap_open(output_pcap_t* self, const char* file, int linktype, int snaplen);
+uint64_t output_pcap_errors(output_pcap_t* self);
 void output_pcap_close(output_pcap_t* self);
 
 core_receiver_t output_pcap_receiver(output_pcap_t* self);
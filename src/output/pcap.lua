@@ -17,15 +17,28 @@
 -- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
 
 -- dnsjit.output.pcap
--- Output to a PCAP using libpcap
+-- Output to a PCAP or PCAPNG file
 --   local output = require("dnsjit.output.pcap").new()
---   output:open("file.pcap")
+--   output:format("pcapng")
+--   output:rotate(100 * 1024 * 1024)
+--   output:open("file.pcap", input:linktype(), input:snaplen())
 --   ...
 --   output:close()
 --
 -- Output module for writing
 -- .I dnsjit.core.object.pcap
 -- objects to a PCAP,
+-- in classic microsecond or nanosecond format or as PCAPNG.
+-- Packets are copied into large page aligned buffers, a full buffer is
+-- written to disk by a background thread while the other is being filled.
+-- .P
+-- The output can be rotated to a new file by size and/or by time, in which
+-- case the files are named
+-- .IR file.0 ,
+-- .I file.1
+-- and so on.
+-- Rotation by time uses the packet timestamps and intervals aligned to the
+-- epoch.
 module(...,package.seeall)
 
 require("dnsjit.output.pcap_h")
@@ -54,6 +67,55 @@ function Pcap:log()
     return self.obj._log
 end
 
+-- Set the file format, must be called before
+-- .IR open() .
+-- The format can be
+-- .I pcap
+-- (default, microsecond timestamps),
+-- .I pcap_ns
+-- (nanosecond timestamps) or
+-- .I pcapng
+-- (nanosecond timestamps).
+function Pcap:format(format)
+    if format == "pcap" then
+        self.obj.format = "OUTPUT_PCAP_FORMAT_PCAP"
+    elseif format == "pcap_ns" then
+        self.obj.format = "OUTPUT_PCAP_FORMAT_PCAP_NS"
+    elseif format == "pcapng" then
+        self.obj.format = "OUTPUT_PCAP_FORMAT_PCAPNG"
+    else
+        error("invalid format")
+    end
+end
+
+-- Set the size of each of the two write buffers, must be called before
+-- .IR open() .
+-- Default 4MB.
+function Pcap:buffer_size(bytes)
+    self.obj.buffer_size = bytes
+end
+
+-- If true, sync the file to disk after each buffer written, default false.
+function Pcap:sync(bool)
+    if bool == true then
+        self.obj.sync = 1
+    else
+        self.obj.sync = 0
+    end
+end
+
+-- Rotate to a new file when the current would grow beyond
+-- .I size
+-- bytes and/or when the packet timestamps enter a new interval of
+-- .I seconds
+-- seconds, 0 or nil disables.
+-- Must be called before
+-- .IR open() .
+function Pcap:rotate(size, seconds)
+    self.obj.rotate_size = size or 0
+    self.obj.rotate_sec = seconds or 0
+end
+
 -- Open the PCAP
 -- .I file
 -- to write to using the
@@ -65,15 +127,36 @@ function Pcap:open(file, linktype, snaplen)
     return C.output_pcap_open(self.obj, file, linktype, snaplen)
 end
 
--- Close the PCAP.
+-- Close the PCAP, waits for all buffered packets to be written.
 function Pcap:close()
     C.output_pcap_close(self.obj)
 end
 
+-- Return the number of packets written.
+function Pcap:packets()
+    return tonumber(self.obj.packets)
+end
+
+-- Return the number of bytes written, including file headers.
+function Pcap:bytes()
+    return tonumber(self.obj.bytes)
+end
+
+-- Return the number of files opened.
+function Pcap:files()
+    return tonumber(self.obj.files)
+end
+
+-- Return the number of write errors.
+function Pcap:errors()
+    return tonumber(C.output_pcap_errors(self.obj))
+end
+
 -- Return the C functions and context for receiving objects.
 function Pcap:receive()
     return C.output_pcap_receiver(self.obj), self.obj
 end
 
--- dnsjit.input.pcap (3)
+-- dnsjit.input.pcap (3),
+-- dnsjit.output.pcapshard (3)
 return Pcap
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/pcapshard.h"
+#include "core/assert.h"
+#include "core/object/ip.h"
+#include "core/object/ip6.h"
+#include "core/object/udp.h"
+#include "core/object/tcp.h"
+#include "core/object/pcap.h"
+#include "contrib/trie.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _output_pcapshard {
+    output_pcapshard_t pub;
+
+    output_pcap_t*  shard;
+    core_receiver_t recv;
+    trie_t*         trie;
+    size_t          next;
+} _output_pcapshard_t;
+
+#define _self ((_output_pcapshard_t*)self)
+
+static core_log_t         _log      = LOG_T_INIT("output.pcapshard");
+static output_pcapshard_t _defaults = {
+    LOG_T_INIT_OBJ("output.pcapshard"),
+    OUTPUT_PCAPSHARD_SEQUENTIAL, 0,
+    0, 0
+};
+
+core_log_t* output_pcapshard_log()
+{
+    return &_log;
+}
+
+output_pcapshard_t* output_pcapshard_new(size_t shards)
+{
+    output_pcapshard_t* self;
+    size_t              n;
+
+    mlassert(shards > 0, "shards must be positive");
+
+    mlfatal_oom(self = calloc(1, sizeof(_output_pcapshard_t)));
+    *self        = _defaults;
+    self->shards = shards;
+
+    lfatal_oom(_self->shard = calloc(shards, sizeof(output_pcap_t)));
+    for (n = 0; n < shards; n++) {
+        output_pcap_init(&_self->shard[n]);
+        /* Keep the memory use of many shards reasonable. */
+        _self->shard[n].buffer_size = 1024 * 1024;
+    }
+    lfatal_oom(_self->trie = trie_create(NULL));
+
+    return self;
+}
+
+void output_pcapshard_free(output_pcapshard_t* self)
+{
+    size_t n;
+    mlassert_self();
+
+    for (n = 0; n < self->shards; n++) {
+        output_pcap_destroy(&_self->shard[n]);
+    }
+    free(_self->shard);
+    trie_free(_self->trie);
+    free(self);
+}
+
+output_pcap_t* output_pcapshard_shard(output_pcapshard_t* self, size_t shard)
+{
+    mlassert_self();
+    lassert(shard < self->shards, "shard out of range");
+
+    return &_self->shard[shard];
+}
+
+int output_pcapshard_open(output_pcapshard_t* self, const char* file, int linktype, int snaplen)
+{
+    char   name[PATH_MAX];
+    size_t n;
+    mlassert_self();
+    lassert(file, "file is nil");
+
+    for (n = 0; n < self->shards; n++) {
+        if ((size_t)snprintf(name, sizeof(name), "%s.%zu", file, n) >= sizeof(name)) {
+            lcritical("file name too long");
+            output_pcapshard_close(self);
+            return -1;
+        }
+        if (output_pcap_open(&_self->shard[n], name, linktype, snaplen)) {
+            output_pcapshard_close(self);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void output_pcapshard_close(output_pcapshard_t* self)
+{
+    size_t n;
+    mlassert_self();
+
+    for (n = 0; n < self->shards; n++) {
+        output_pcap_close(&_self->shard[n]);
+    }
+}
+
+/*
+ * FNV-1a with a final mix, the shard of a client or flow only depends on
+ * the addresses and ports and is the same across runs.
+ */
+static inline uint64_t _hash(uint64_t h, const uint8_t* p, size_t len)
+{
+    while (len--) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static inline uint64_t _mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#define _FNV_BASIS 0xcbf29ce484222325ULL
+
+int output_pcapshard_select(output_pcapshard_t* self, const core_object_t* obj)
+{
+    const uint8_t *src = 0, *dst = 0;
+    size_t         alen = 0, key_len;
+    uint16_t       ports[2] = { 0, 0 };
+    uint8_t        proto    = 0;
+    uint8_t        key[16 + sizeof(uint32_t)];
+    uint32_t       source = 0;
+    uint64_t       h;
+    trie_val_t*    node;
+    int            cmp;
+    mlassert_self();
+
+    for (; obj; obj = obj->obj_prev) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_UDP:
+            ports[0] = ((const core_object_udp_t*)obj)->sport;
+            ports[1] = ((const core_object_udp_t*)obj)->dport;
+            proto    = 17;
+            continue;
+        case CORE_OBJECT_TCP:
+            ports[0] = ((const core_object_tcp_t*)obj)->sport;
+            ports[1] = ((const core_object_tcp_t*)obj)->dport;
+            proto    = 6;
+            continue;
+        case CORE_OBJECT_IP:
+            src  = ((const core_object_ip_t*)obj)->src;
+            dst  = ((const core_object_ip_t*)obj)->dst;
+            alen = 4;
+            break;
+        case CORE_OBJECT_IP6:
+            src  = ((const core_object_ip6_t*)obj)->src;
+            dst  = ((const core_object_ip6_t*)obj)->dst;
+            alen = 16;
+            break;
+        default:
+            continue;
+        }
+        break;
+    }
+    if (!src) {
+        return -1;
+    }
+    /* Overlaid copies from input.merge are different clients. */
+    for (; obj; obj = obj->obj_prev) {
+        if (obj->obj_type == CORE_OBJECT_PCAP) {
+            source = ((const core_object_pcap_t*)obj)->source;
+            break;
+        }
+    }
+    memcpy(key, src, alen);
+    key_len = alen;
+    if (source) {
+        memcpy(key + key_len, &source, sizeof(source));
+        key_len += sizeof(source);
+    }
+
+    switch (self->mode) {
+    case OUTPUT_PCAPSHARD_SEQUENTIAL:
+        /* Same assignment as filter.ipsplit in sequential mode with equal
+         * weights, the value stored is the shard + 1. */
+        node = trie_get_ins(_self->trie, (char*)key, key_len);
+        lassert(node, "trie failure");
+        if (!*node) {
+            *node = (void*)(uintptr_t)(_self->next + 1);
+            _self->next = (_self->next + 1) % self->shards;
+            self->clients++;
+        }
+        return (int)((uintptr_t)*node - 1);
+
+    case OUTPUT_PCAPSHARD_CLIENT:
+        h = _hash(_FNV_BASIS, key, key_len);
+        break;
+
+    case OUTPUT_PCAPSHARD_FLOW:
+        /* Order the endpoints so both directions land in the same shard. */
+        if (!(cmp = memcmp(src, dst, alen))) {
+            cmp = ports[0] - ports[1];
+        }
+        h = _hash(_FNV_BASIS, &proto, 1);
+        if (cmp <= 0) {
+            h = _hash(h, src, alen);
+            h = _hash(h, (uint8_t*)&ports[0], 2);
+            h = _hash(h, dst, alen);
+            h = _hash(h, (uint8_t*)&ports[1], 2);
+        } else {
+            h = _hash(h, dst, alen);
+            h = _hash(h, (uint8_t*)&ports[1], 2);
+            h = _hash(h, src, alen);
+            h = _hash(h, (uint8_t*)&ports[0], 2);
+        }
+        break;
+
+    default:
+        lfatal("invalid mode");
+    }
+
+    return (int)(_mix(h) % self->shards);
+}
+
+static void _receive(output_pcapshard_t* self, const core_object_t* obj)
+{
+    int shard;
+    mlassert_self();
+
+    if ((shard = output_pcapshard_select(self, obj)) < 0) {
+        self->discarded++;
+        ldebug("packet discarded (missing ip/ip6 object)");
+        return;
+    }
+
+    _self->recv(&_self->shard[shard], obj);
+}
+
+core_receiver_t output_pcapshard_receiver(output_pcapshard_t* self)
+{
+    size_t n;
+
+    for (n = 0; n < self->shards; n++) {
+        _self->recv = output_pcap_receiver(&_self->shard[n]);
+    }
+
+    return (core_receiver_t)_receive;
+}
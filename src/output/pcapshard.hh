@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.receiver_h")
+//lua:require("dnsjit.output.pcap_h")
+
+typedef enum output_pcapshard_mode {
+    OUTPUT_PCAPSHARD_SEQUENTIAL,
+    OUTPUT_PCAPSHARD_CLIENT,
+    OUTPUT_PCAPSHARD_FLOW
+} output_pcapshard_mode_t;
+
+typedef struct output_pcapshard {
+    core_log_t _log;
+
+    output_pcapshard_mode_t mode;
+    size_t                  shards;
+
+    uint64_t clients;
+    uint64_t discarded;
+} output_pcapshard_t;
+
+core_log_t* output_pcapshard_log();
+
+output_pcapshard_t* output_pcapshard_new(size_t shards);
+void output_pcapshard_free(output_pcapshard_t* self);
+output_pcap_t* output_pcapshard_shard(output_pcapshard_t* self, size_t shard);
+int output_pcapshard_open(output_pcapshard_t* self, const char* file, int linktype, int snaplen);
+void output_pcapshard_close(output_pcapshard_t* self);
+int output_pcapshard_select(output_pcapshard_t* self, const core_object_t* obj);
+
+core_receiver_t output_pcapshard_receiver(output_pcapshard_t* self);
@@ -0,0 +1,193 @@
+-- Copyright (c) 2020, CZ.NIC, z.s.p.o.
+-- All rights reserved.
+--
+-- This file is part of dnsjit.
+--
+-- dnsjit is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- dnsjit is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+-- dnsjit.output.pcapshard
+-- Output to a number of PCAP files by client or flow
+--   local layer = require("dnsjit.filter.layer").new()
+--   local output = require("dnsjit.output.pcapshard").new(8)
+--   output:client()
+--   output:open("shard.pcap", input:linktype(), input:snaplen())
+--   layer:receiver(output)
+--   ...
+--   output:close()
+--
+-- Split the packets into
+-- .I N
+-- PCAP files named
+-- .IR file.0 " to " file.N-1 ,
+-- for example to replay each shard in parallel later.
+-- Each shard is written by its own
+-- .I dnsjit.output.pcap
+-- with its own buffers and flushing thread.
+-- The receiver expects object chains from
+-- .I dnsjit.filter.layer
+-- and writes the
+-- .I dnsjit.core.object.pcap
+-- at the bottom of the chain, chains without an IPv4/IPv6 packet are
+-- discarded.
+-- .P
+-- The shard is selected by one of the following modes:
+-- .TP
+-- sequential
+-- Packets with the same source IP are considered the same client and each
+-- new client is assigned to the next shard, the same assignment as
+-- .I dnsjit.filter.ipsplit
+-- makes in its sequential mode with equal weights (default).
+-- .TP
+-- client
+-- The shard is selected by a hash of the source IP, this needs no state
+-- and the assignment is the same across runs and captures.
+-- .IP
+-- As with
+-- .IR dnsjit.filter.ipsplit ,
+-- packets tagged with a source index by
+-- .I dnsjit.input.merge
+-- are different clients for each source in these two modes.
+-- .TP
+-- flow
+-- The shard is selected by a hash of the protocol, addresses and ports,
+-- both directions of a flow are written to the same shard.
+module(...,package.seeall)
+
+require("dnsjit.output.pcapshard_h")
+local ffi = require("ffi")
+local C = ffi.C
+
+local PcapShard = {}
+
+-- Create a new PcapShard output writing to
+-- .I shards
+-- files (default 2).
+function PcapShard.new(shards)
+    local self = {
+        obj = C.output_pcapshard_new(shards or 2),
+    }
+    ffi.gc(self.obj, C.output_pcapshard_free)
+    return setmetatable(self, { __index = PcapShard })
+end
+
+-- Return the Log object to control logging of this instance or module.
+function PcapShard:log()
+    if self == nil then
+        return C.output_pcapshard_log()
+    end
+    return self.obj._log
+end
+
+-- Return the number of shards.
+function PcapShard:shards()
+    return tonumber(self.obj.shards)
+end
+
+-- Set the mode to sequential.
+function PcapShard:sequential()
+    self.obj.mode = "OUTPUT_PCAPSHARD_SEQUENTIAL"
+end
+
+-- Set the mode to client.
+function PcapShard:client()
+    self.obj.mode = "OUTPUT_PCAPSHARD_CLIENT"
+end
+
+-- Set the mode to flow.
+function PcapShard:flow()
+    self.obj.mode = "OUTPUT_PCAPSHARD_FLOW"
+end
+
+local function each(self, func)
+    for n = 0, tonumber(self.obj.shards) - 1 do
+        func(C.output_pcapshard_shard(self.obj, n))
+    end
+end
+
+-- Set the file format of all shards, see
+-- .IR dnsjit.output.pcap .
+function PcapShard:format(format)
+    local formats = {
+        pcap = "OUTPUT_PCAP_FORMAT_PCAP",
+        pcap_ns = "OUTPUT_PCAP_FORMAT_PCAP_NS",
+        pcapng = "OUTPUT_PCAP_FORMAT_PCAPNG",
+    }
+    if not formats[format] then
+        error("invalid format")
+    end
+    each(self, function(shard) shard.format = formats[format] end)
+end
+
+-- Set the size of the write buffers of each shard, default 1MB.
+function PcapShard:buffer_size(bytes)
+    each(self, function(shard) shard.buffer_size = bytes end)
+end
+
+-- Set the rotation by size and/or time of each shard, see
+-- .IR dnsjit.output.pcap .
+function PcapShard:rotate(size, seconds)
+    each(self, function(shard)
+        shard.rotate_size = size or 0
+        shard.rotate_sec = seconds or 0
+    end)
+end
+
+-- Open the files
+-- .I file.0
+-- and onward using the
+-- .I linktype
+-- and
+-- .IR snaplen .
+-- Returns 0 on success.
+function PcapShard:open(file, linktype, snaplen)
+    return C.output_pcapshard_open(self.obj, file, linktype, snaplen)
+end
+
+-- Close all files, waits for all buffered packets to be written.
+function PcapShard:close()
+    C.output_pcapshard_close(self.obj)
+end
+
+-- Return the C functions and context for receiving objects.
+function PcapShard:receive()
+    return C.output_pcapshard_receiver(self.obj), self.obj
+end
+
+-- Return the number of packets written to
+-- .I shard
+-- (0 to N-1) or to all shards if not given.
+function PcapShard:packets(shard)
+    if shard ~= nil then
+        return tonumber(C.output_pcapshard_shard(self.obj, shard).packets)
+    end
+    local packets = 0
+    each(self, function(s) packets = packets + tonumber(s.packets) end)
+    return packets
+end
+
+-- Return the number of clients seen in sequential mode.
+function PcapShard:clients()
+    return tonumber(self.obj.clients)
+end
+
+-- Return the number of packets discarded because of missing IPv4/IPv6
+-- packet.
+function PcapShard:discarded()
+    return tonumber(self.obj.discarded)
+end
+
+-- dnsjit.output.pcap (3),
+-- dnsjit.filter.ipsplit (3),
+-- dnsjit.filter.layer (3)
+return PcapShard
@@ -27,14 +27,36 @@
 #ifdef HAVE_LMDB_H
 #include <lmdb.h>
 #endif
+#include <ck_pr.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <string.h>
+#include <time.h>
+
+#define _QUEUE_SIZE 8192
+
+/*
+ * A record for the queries and answers tables, built on the receiving
+ * thread and written by the writer thread. The answer is the original
+ * response followed by the received response, each prefixed with the
+ * response time and length. received_ms is when it was received, used for
+ * the time based commits.
+ */
+typedef struct _record _record_t;
+struct _record {
+    _record_t* next;
+    uint32_t   id;
+    uint64_t   received_ms;
+    size_t     query_len, answer_len;
+    uint8_t    data[];
+};
 
 static core_log_t        _log      = LOG_T_INIT("output.respdiff");
 static output_respdiff_t _defaults = {
     LOG_T_INIT_OBJ("output.respdiff"),
-    0, 0, 0, 0, 0, 0
+    0, 0, 0, 0, 0, 0, 0,
+    10000, 1000,
+    0, 0
 };
 
 core_log_t* output_respdiff_log()
@@ -42,8 +64,32 @@ core_log_t* output_respdiff_log()
     return &_log;
 }
 
+int output_respdiff_have_lmdb()
+{
+#ifdef HAVE_LMDB_H
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+uint64_t output_respdiff_commits(output_respdiff_t* self)
+{
+    mlassert_self();
+    return ck_pr_load_64(&self->commits);
+}
+
+uint64_t output_respdiff_resizes(output_respdiff_t* self)
+{
+    mlassert_self();
+    return ck_pr_load_64(&self->resizes);
+}
+
 void output_respdiff_init(output_respdiff_t* self, const char* path, size_t mapsize)
 {
+#ifdef HAVE_LMDB_H
+    MDB_txn* txn;
+#endif
     mlassert_self();
 
     if (!path) {
@@ -68,30 +114,54 @@ void output_respdiff_init(output_respdiff_t* self, const char* path, size_t maps
     if (mdb_env_open((MDB_env*)self->env, path, 0, 0664)) {
         lfatal("mdb_env_open(%s) failed", path);
     }
-    if (mdb_txn_begin((MDB_env*)self->env, 0, 0, (MDB_txn**)&self->txn)) {
+    if (mdb_txn_begin((MDB_env*)self->env, 0, 0, &txn)) {
         lfatal("mdb_txn_begin failed for queries");
     }
+    /* Integer keys so that records with increasing ids can be appended. */
     lfatal_oom(self->qdb = calloc(1, sizeof(MDB_dbi)));
-    if (mdb_dbi_open((MDB_txn*)self->txn, "queries", MDB_CREATE, (MDB_dbi*)self->qdb)) {
+    if (mdb_dbi_open(txn, "queries", MDB_CREATE | MDB_INTEGERKEY, (MDB_dbi*)self->qdb)) {
         lfatal("mdb_dbi_open failed for queries");
     }
     lfatal_oom(self->rdb = calloc(1, sizeof(MDB_dbi)));
-    if (mdb_dbi_open((MDB_txn*)self->txn, "answers", MDB_CREATE, (MDB_dbi*)self->rdb)) {
+    if (mdb_dbi_open(txn, "answers", MDB_CREATE | MDB_INTEGERKEY, (MDB_dbi*)self->rdb)) {
         lfatal("mdb_dbi_open failed for responses");
     }
     lfatal_oom(self->meta = calloc(1, sizeof(MDB_dbi)));
-    if (mdb_dbi_open((MDB_txn*)self->txn, "meta", MDB_CREATE, (MDB_dbi*)self->meta)) {
+    if (mdb_dbi_open(txn, "meta", MDB_CREATE, (MDB_dbi*)self->meta)) {
         lfatal("mdb_dbi_open failed for meta");
     }
+    if (mdb_txn_commit(txn)) {
+        lfatal("mdb_txn_commit failed");
+    }
+
+    core_channel_init(&self->chan, _QUEUE_SIZE);
 #endif
 }
 
+#ifdef HAVE_LMDB_H
+static void _stop(output_respdiff_t* self)
+{
+    int err;
+
+    if (!self->running)
+        return;
+
+    core_channel_close(&self->chan);
+    if ((err = pthread_join(self->writer, 0))) {
+        lfatal("pthread_join() error: %s", core_log_errstr(err));
+    }
+    self->running = 0;
+}
+#endif
+
 void output_respdiff_destroy(output_respdiff_t* self)
 {
     mlassert_self();
 
 #ifdef HAVE_LMDB_H
+    _stop(self);
     if (self->env) {
+        core_channel_destroy(&self->chan);
         mdb_env_close((MDB_env*)self->env);
     }
     free(self->qdb);
@@ -108,111 +178,223 @@ static const char* _meta_name0       = "name0";
 static const char* _meta_name1       = "name1";
 static const char* _meta_start_time  = "start_time";
 static const char* _meta_end_time    = "end_time";
+
+/*
+ * Double the map size, the current transaction is aborted and must be
+ * redone by the caller.
+ */
+static void _grow(output_respdiff_t* self)
+{
+    MDB_envinfo info;
+
+    if (self->txn) {
+        mdb_txn_abort((MDB_txn*)self->txn);
+        self->txn = 0;
+    }
+    if (mdb_env_info((MDB_env*)self->env, &info)) {
+        lfatal("mdb_env_info failed");
+    }
+    if (mdb_env_set_mapsize((MDB_env*)self->env, info.me_mapsize * 2)) {
+        lfatal("mdb_env_set_mapsize(%zu) failed", info.me_mapsize * 2);
+    }
+    ck_pr_inc_64(&self->resizes);
+    linfo("database full, map size increased to %zu", info.me_mapsize * 2);
+}
+
+static void _begin(output_respdiff_t* self)
+{
+    if (!self->txn && mdb_txn_begin((MDB_env*)self->env, 0, 0, (MDB_txn**)&self->txn)) {
+        lfatal("mdb_txn_begin failed");
+    }
+}
 #endif
 
 void output_respdiff_commit(output_respdiff_t* self, const char* origname, const char* recvname, uint64_t start_time, uint64_t end_time)
 {
 #ifdef HAVE_LMDB_H
     MDB_val  k, v;
-    uint32_t i;
+    uint32_t servers = 2, start = start_time, end = end_time;
+    size_t   i;
     int      err;
+    struct {
+        const char* key;
+        const void* val;
+        size_t      len;
+    } meta[] = {
+        { _meta_version, _meta_version_val, strlen(_meta_version_val) },
+        { _meta_servers, &servers, 4 },
+        { _meta_name0, origname, origname ? strlen(origname) : 0 },
+        { _meta_name1, recvname, recvname ? strlen(recvname) : 0 },
+        { _meta_start_time, &start, 4 },
+        { _meta_end_time, &end, 4 },
+    };
     mlassert_self();
     lassert(origname, "origname is nil");
     lassert(recvname, "recvname is nil");
 
-    k.mv_size = strlen(_meta_version);
-    k.mv_data = (void*)_meta_version;
-    v.mv_size = strlen(_meta_version_val);
-    v.mv_data = (void*)_meta_version_val;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->meta), &k, &v, 0))) {
-        if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put meta.version failed, database is full");
-        } else {
-            lfatal("mdb_put meta.version failed (%d)", err);
-        }
+    if (!self->env) {
+        return;
     }
 
-    k.mv_size = strlen(_meta_servers);
-    k.mv_data = (void*)_meta_servers;
-    i         = 2;
-    v.mv_size = 4;
-    v.mv_data = (void*)&i;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->meta), &k, &v, 0))) {
+    /* Wait for the writer to commit all records. */
+    _stop(self);
+
+    for (;;) {
+        _begin(self);
+        for (i = 0, err = 0; i < sizeof(meta) / sizeof(meta[0]) && !err; i++) {
+            k.mv_size = strlen(meta[i].key);
+            k.mv_data = (void*)meta[i].key;
+            v.mv_size = meta[i].len;
+            v.mv_data = (void*)meta[i].val;
+            if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->meta), &k, &v, 0)) && err != MDB_MAP_FULL) {
+                lfatal("mdb_put meta.%s failed (%d)", meta[i].key, err);
+            }
+        }
+        if (!err) {
+            err       = mdb_txn_commit((MDB_txn*)self->txn);
+            self->txn = 0;
+        }
         if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put meta.servers failed, database is full");
-        } else {
-            lfatal("mdb_put meta.servers failed (%d)", err);
+            _grow(self);
+            continue;
         }
+        if (err) {
+            lfatal("mdb_txn_commit failed (%d)", err);
+        }
+        break;
     }
+#endif
+}
 
-    k.mv_size = strlen(_meta_name0);
-    k.mv_data = (void*)_meta_name0;
-    v.mv_size = strlen(origname);
-    v.mv_data = (void*)origname;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->meta), &k, &v, 0))) {
-        if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put meta.name0 failed, database is full");
-        } else {
-            lfatal("mdb_put meta.name0 failed (%d)", err);
-        }
+#ifdef HAVE_LMDB_H
+static int _put(output_respdiff_t* self, MDB_dbi dbi, uint32_t id, void* data, size_t len)
+{
+    MDB_val k, v;
+    int     err;
+
+    k.mv_size = sizeof(id);
+    k.mv_data = (void*)&id;
+    v.mv_size = len;
+    v.mv_data = data;
+    /* Ids only increase unless appending to an existing database. */
+    if ((err = mdb_put((MDB_txn*)self->txn, dbi, &k, &v, MDB_APPEND)) == MDB_KEYEXIST) {
+        err = mdb_put((MDB_txn*)self->txn, dbi, &k, &v, 0);
     }
+    return err;
+}
 
-    k.mv_size = strlen(_meta_name1);
-    k.mv_data = (void*)_meta_name1;
-    v.mv_size = strlen(recvname);
-    v.mv_data = (void*)recvname;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->meta), &k, &v, 0))) {
-        if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put meta.name1 failed, database is full");
-        } else {
-            lfatal("mdb_put meta.name1 failed (%d)", err);
+static int _write(output_respdiff_t* self, _record_t* r)
+{
+    int err;
+
+    _begin(self);
+    if ((err = _put(self, *(MDB_dbi*)self->qdb, r->id, r->data, r->query_len))
+        || (err = _put(self, *(MDB_dbi*)self->rdb, r->id, r->data + r->query_len, r->answer_len))) {
+        if (err != MDB_MAP_FULL) {
+            lfatal("mdb_put failed (%d)", err);
         }
     }
+    return err;
+}
 
-    k.mv_size = strlen(_meta_start_time);
-    k.mv_data = (void*)_meta_start_time;
-    i         = start_time;
-    v.mv_size = 4;
-    v.mv_data = (void*)&i;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->meta), &k, &v, 0))) {
-        if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put meta.start_time failed, database is full");
-        } else {
-            lfatal("mdb_put meta.start_time failed (%d)", err);
+/*
+ * Write all records of the transaction again after the map was grown.
+ */
+static void _replay(output_respdiff_t* self, _record_t* records)
+{
+    _record_t* r = records;
+
+    while (r) {
+        if (_write(self, r) == MDB_MAP_FULL) {
+            _grow(self);
+            r = records;
+            continue;
         }
+        r = r->next;
     }
+}
+
+static void _commit(output_respdiff_t* self, _record_t** records)
+{
+    _record_t *r, *next;
+    int        err;
 
-    k.mv_size = strlen(_meta_end_time);
-    k.mv_data = (void*)_meta_end_time;
-    i         = end_time;
-    v.mv_size = 4;
-    v.mv_data = (void*)&i;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->meta), &k, &v, 0))) {
+    while (self->txn) {
+        err       = mdb_txn_commit((MDB_txn*)self->txn);
+        self->txn = 0;
         if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put meta.end_time failed, database is full");
-        } else {
-            lfatal("mdb_put meta.end_time failed (%d)", err);
+            _grow(self);
+            _replay(self, *records);
+        } else if (err) {
+            lfatal("mdb_txn_commit failed (%d)", err);
         }
     }
+    ck_pr_inc_64(&self->commits);
 
-    if (self->txn) {
-        if (mdb_txn_commit((MDB_txn*)self->txn)) {
-            lfatal("mdb_txn_commit failed");
+    for (r = *records; r; r = next) {
+        next = r->next;
+        free(r);
+    }
+    *records = 0;
+}
+
+static uint64_t _now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * The time between commits is measured between the records received, a
+ * transaction left open while nothing is received is committed with the
+ * next record or when the channel is closed.
+ */
+static void* _writer(void* arg)
+{
+    output_respdiff_t* self    = (output_respdiff_t*)arg;
+    _record_t *        records = 0, **last = &records, *r;
+    size_t             n       = 0;
+    uint64_t           started = 0;
+
+    for (;;) {
+        /* Everything put before closing is still to be read. */
+        if (!(r = core_channel_get(&self->chan)) && !(r = core_channel_try_get(&self->chan)))
+            break;
+
+        if (!n)
+            started = r->received_ms;
+        r->next = 0;
+        *last   = r;
+        last    = &r->next;
+        n++;
+
+        if (_write(self, r) == MDB_MAP_FULL) {
+            _grow(self);
+            _replay(self, records);
+        }
+
+        if (n >= self->commit_count || r->received_ms - started >= self->commit_ms) {
+            _commit(self, &records);
+            last = &records;
+            n    = 0;
         }
-        self->txn = 0;
     }
-#endif
+
+    if (n)
+        _commit(self, &records);
+
+    return 0;
 }
 
-#ifdef HAVE_LMDB_H
 static void _receive(output_respdiff_t* self, const core_object_t* obj)
 {
     const core_object_payload_t *query, *original, *response;
-    MDB_val                      k, v;
-    uint8_t                      responses[132096];
+    _record_t*                   r;
+    uint8_t*                     answer;
     uint32_t                     msec;
     uint16_t                     dnslen;
-    int                          err;
     mlassert_self();
 
     if (!obj || obj->obj_type != CORE_OBJECT_PAYLOAD) {
@@ -230,62 +412,56 @@ static void _receive(output_respdiff_t* self, const core_object_t* obj)
         lfatal("invalid third object");
     }
 
-    if (12 + original->len + (response ? response->len : 0) > sizeof(responses)) {
-        lfatal("not enough buffer space for responses");
+    if (original->len > UINT16_MAX || (response && response->len > UINT16_MAX)) {
+        lfatal("response too large");
     }
 
     self->count++;
 
-    k.mv_size = sizeof(self->id);
-    k.mv_data = (void*)&self->id;
-    v.mv_size = query->len;
-    v.mv_data = (void*)query->payload;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->qdb), &k, &v, 0))) {
-        if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put query failed, database is full");
-        } else {
-            lfatal("mdb_put query failed (%d)", err);
-        }
-    }
+    lfatal_oom(r = malloc(sizeof(_record_t) + query->len + 12 + original->len + (response ? response->len : 0)));
+    r->id          = self->id++;
+    r->received_ms = _now_ms();
+    r->query_len   = query->len;
+    r->answer_len  = 12 + original->len + (response ? response->len : 0);
+    memcpy(r->data, query->payload, query->len);
 
-    msec = 1; // TODO
-    memcpy(responses, &msec, 4);
+    answer = r->data + query->len;
+    msec   = 1; // TODO
+    memcpy(answer, &msec, 4);
     dnslen = original->len;
-    memcpy(&responses[4], &dnslen, 2);
-    memcpy(&responses[6], original->payload, original->len);
+    memcpy(&answer[4], &dnslen, 2);
+    memcpy(&answer[6], original->payload, original->len);
     if (response) {
-        memcpy(&responses[6 + original->len], &msec, 4);
+        memcpy(&answer[6 + original->len], &msec, 4);
         dnslen = response->len;
-        memcpy(&responses[10 + original->len], &dnslen, 2);
-        memcpy(&responses[12 + original->len], response->payload, response->len);
+        memcpy(&answer[10 + original->len], &dnslen, 2);
+        memcpy(&answer[12 + original->len], response->payload, response->len);
     } else {
         msec = 0xffffffff;
-        memcpy(&responses[6 + original->len], &msec, 4);
+        memcpy(&answer[6 + original->len], &msec, 4);
         dnslen = 0;
-        memcpy(&responses[10 + original->len], &dnslen, 2);
-    }
-
-    v.mv_size = 12 + original->len + (response ? response->len : 0);
-    v.mv_data = (void*)responses;
-    if ((err = mdb_put((MDB_txn*)self->txn, (MDB_dbi) * ((MDB_dbi*)self->rdb), &k, &v, 0))) {
-        if (err == MDB_MAP_FULL) {
-            lfatal("mdb_put answers failed, database is full");
-        } else {
-            lfatal("mdb_put answers failed (%d)", err);
-        }
+        memcpy(&answer[10 + original->len], &dnslen, 2);
     }
 
-    self->id++;
+    core_channel_put(&self->chan, r);
 }
 
 core_receiver_t output_respdiff_receiver(output_respdiff_t* self)
 {
+    int err;
     mlassert_self();
 
-    if (!self->txn) {
+    if (!self->env) {
         lfatal("no LMDB opened");
     }
 
+    if (!self->running) {
+        if ((err = pthread_create(&self->writer, 0, _writer, self))) {
+            lfatal("pthread_create() error: %s", core_log_errstr(err));
+        }
+        self->running = 1;
+    }
+
     return (core_receiver_t)_receive;
 }
 #else
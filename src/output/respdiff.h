@@ -18,12 +18,14 @@
  * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "core/channel.h"
 #include "core/log.h"
 #include "core/receiver.h"
 
 #ifndef __dnsjit_output_respdiff_h
 #define __dnsjit_output_respdiff_h
 
+#include <pthread.h>
 #include <stdint.h>
 
 #include "output/respdiff.hh"
@@ -18,7 +18,9 @@
  * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+//lua:require("dnsjit.core.compat_h")
 //lua:require("dnsjit.core.log")
+//lua:require("dnsjit.core.channel_h")
 //lua:require("dnsjit.core.receiver_h")
 
 typedef struct output_respdiff {
@@ -26,9 +28,27 @@ typedef struct output_respdiff {
     void *     env, *txn, *qdb, *rdb, *meta;
     uint32_t   id;
     size_t     count;
+
+    /* Commit after this many records or milliseconds, whichever comes
+     * first. */
+    size_t   commit_count;
+    uint64_t commit_ms;
+
+    /* Written by the writer thread, see output_respdiff_commits() and
+     * output_respdiff_resizes(). */
+    uint64_t commits;
+    uint64_t resizes;
+
+    /* Records are passed to the writer thread through the channel. */
+    core_channel_t chan;
+    pthread_t      writer;
+    int            running;
 } output_respdiff_t;
 
 core_log_t* output_respdiff_log();
+int output_respdiff_have_lmdb();
+uint64_t output_respdiff_commits(output_respdiff_t* self);
+uint64_t output_respdiff_resizes(output_respdiff_t* self);
 void output_respdiff_init(output_respdiff_t* self, const char* path, size_t mapsize);
 void output_respdiff_destroy(output_respdiff_t* self);
 void output_respdiff_commit(output_respdiff_t* self, const char* origname, const char* recvname, uint64_t start_time, uint64_t end_time);
@@ -29,6 +29,18 @@
 -- original response and then the received response.
 -- For a timed out query; The top of the chain is the query, after it the
 -- original response.
+-- .P
+-- Records are handed to a writer thread which stores them in the database
+-- and commits every
+-- .I commit_count
+-- records or
+-- .I commit_ms
+-- milliseconds between the first and the last record received, whichever
+-- comes first (default 10000 and 1000), the map size of the database is
+-- doubled when it gets full.
+-- Records still uncommitted when nothing more is received are committed
+-- by
+-- .IR commit ().
 module(...,package.seeall)
 
 require("dnsjit.output.respdiff_h")
@@ -66,6 +78,11 @@ function Respdiff.new(path, origname, recvname, mapsize)
     return setmetatable(self, { __index = Respdiff })
 end
 
+-- Return true if dnsjit was built with LMDB support.
+function Respdiff.have_lmdb()
+    return C.output_respdiff_have_lmdb() == 1
+end
+
 -- Return the Log object to control logging of this instance or module.
 function Respdiff:log()
     if self == nil then
@@ -79,7 +96,27 @@ function Respdiff:receive()
     return C.output_respdiff_receiver(self.obj), self.obj
 end
 
--- Commit the LMDB transactions, can not store any more objects after this
+-- Set the number of records and/or milliseconds between commits of the
+-- writer thread, must be set before the first object is received.
+-- Returns the current values.
+function Respdiff:commit_interval(count, ms)
+    if count ~= nil then
+        self.obj.commit_count = count
+    end
+    if ms ~= nil then
+        self.obj.commit_ms = ms
+    end
+    return tonumber(self.obj.commit_count), tonumber(self.obj.commit_ms)
+end
+
+-- Return the number of transactions committed and the number of times the
+-- map size was increased.
+function Respdiff:commits()
+    return tonumber(C.output_respdiff_commits(self.obj)), tonumber(C.output_respdiff_resizes(self.obj))
+end
+
+-- Wait for the writer thread to store all received objects and commit the
+-- LMDB transactions, can not store any more objects after this
 -- call.
 -- The given
 -- .I start_time
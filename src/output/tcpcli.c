@@ -21,7 +21,9 @@
 #include "config.h"
 
 #include "output/tcpcli.h"
+#include "output/tcppool.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 #include "core/object/dns.h"
 #include "core/object/payload.h"
 
@@ -40,9 +42,12 @@ static output_tcpcli_t _defaults = {
     0, 0, -1,
     { 0 }, CORE_OBJECT_PAYLOAD_INIT(0),
     0, 0, 0, 0,
-    { 5, 0 }, 1
+    { 5, 0 }, 1,
+    1, 1, 0, 0
 };
 
+static size_t _m_pkts = 0, _m_recv = 0, _m_errs = 0;
+
 core_log_t* output_tcpcli_log()
 {
     return &_log;
@@ -54,6 +59,10 @@ void output_tcpcli_init(output_tcpcli_t* self)
 
     *self             = _defaults;
     self->pkt.payload = self->recvbuf;
+
+    core_metrics_counter(&_m_pkts, "dnsjit_output_packets_total", "module=\"output.tcpcli\"", "Packets sent by output modules");
+    core_metrics_counter(&_m_recv, "dnsjit_output_received_total", "module=\"output.tcpcli\"", "Packets received by output modules");
+    core_metrics_counter(&_m_errs, "dnsjit_output_errors_total", "module=\"output.tcpcli\"", "Errors of output modules");
 }
 
 void output_tcpcli_destroy(output_tcpcli_t* self)
@@ -64,6 +73,32 @@ void output_tcpcli_destroy(output_tcpcli_t* self)
         shutdown(self->fd, SHUT_RDWR);
         close(self->fd);
     }
+    if (self->pool) {
+        output_tcppool_free(self->pool);
+    }
+}
+
+int output_tcpcli_pool(output_tcpcli_t* self, size_t conns, size_t pipeline)
+{
+    mlassert_self();
+
+    if (self->fd > -1 || self->pool) {
+        lfatal("already connected");
+    }
+    if (!conns || !pipeline) {
+        lcritical("connections and pipeline must be greater than 0");
+        return -1;
+    }
+
+    self->conns    = conns;
+    self->pipeline = pipeline;
+    return 0;
+}
+
+static int _timeout(output_tcpcli_t* self)
+{
+    int to = (self->timeout.sec * 1e3) + (self->timeout.nsec / 1e6);
+    return to ? to : 1;
 }
 
 int output_tcpcli_connect(output_tcpcli_t* self, const char* host, const char* port)
@@ -74,10 +109,24 @@ int output_tcpcli_connect(output_tcpcli_t* self, const char* host, const char* p
     lassert(host, "host is nil");
     lassert(port, "port is nil");
 
-    if (self->fd > -1) {
+    if (self->fd > -1 || self->pool) {
         lfatal("already connected");
     }
 
+    if (self->conns > 1 || self->pipeline > 1) {
+        output_tcppool_t* pool = output_tcppool_new(&self->_log, self->conns, self->pipeline, 0);
+
+        pool->errs       = &self->errs;
+        pool->m_errs     = _m_errs;
+        pool->reconnects = &self->reconnects;
+        if ((err = output_tcppool_connect(pool, host, port, _timeout(self)))) {
+            output_tcppool_free(pool);
+            return err;
+        }
+        self->pool = pool;
+        return 0;
+    }
+
     if ((err = getaddrinfo(host, port, 0, &addr))) {
         lcritical("getaddrinfo(%s, %s) error %s", host, port, gai_strerror(err));
         return -1;
@@ -108,6 +157,9 @@ int output_tcpcli_nonblocking(output_tcpcli_t* self)
     int flags;
     mlassert_self();
 
+    if (self->pool) {
+        return !self->blocking;
+    }
     if (self->fd < 0) {
         lfatal("not connected");
     }
@@ -125,6 +177,10 @@ int output_tcpcli_set_nonblocking(output_tcpcli_t* self, int nonblocking)
     int flags;
     mlassert_self();
 
+    if (self->pool) {
+        self->blocking = !nonblocking;
+        return 0;
+    }
     if (self->fd < 0) {
         lfatal("not connected");
     }
@@ -188,6 +244,7 @@ static void _receive(output_tcpcli_t* self, const core_object_t* obj)
                         if (sent < len)
                             continue;
                         self->pkts++;
+                        core_metrics_inc(_m_pkts);
                         return;
                     }
                     switch (errno) {
@@ -202,6 +259,7 @@ static void _receive(output_tcpcli_t* self, const core_object_t* obj)
                     break;
                 }
                 self->errs++;
+                core_metrics_inc(_m_errs);
                 return;
             }
             switch (errno) {
@@ -216,14 +274,44 @@ static void _receive(output_tcpcli_t* self, const core_object_t* obj)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 }
 
+static void _receive_pool(output_tcpcli_t* self, const core_object_t* obj)
+{
+    mlassert_self();
+
+    for (; obj;) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_DNS:
+            obj = obj->obj_prev;
+            continue;
+        case CORE_OBJECT_PAYLOAD:
+            break;
+        default:
+            return;
+        }
+
+        if (output_tcppool_send(self->pool, ((core_object_payload_t*)obj)->payload, ((core_object_payload_t*)obj)->len, _timeout(self))) {
+            self->errs++;
+            core_metrics_inc(_m_errs);
+            return;
+        }
+        self->pkts++;
+        core_metrics_inc(_m_pkts);
+        return;
+    }
+}
+
 core_receiver_t output_tcpcli_receiver(output_tcpcli_t* self)
 {
     mlassert_self();
 
+    if (self->pool) {
+        return (core_receiver_t)_receive_pool;
+    }
     if (self->fd < 0) {
         lfatal("not connected");
     }
@@ -259,6 +347,7 @@ static const core_object_t* _produce(output_tcpcli_t* self)
 
             if (self->recv > self->dnslen) {
                 self->pkts_recv++;
+                core_metrics_inc(_m_recv);
                 self->pkt.len     = self->dnslen;
                 self->have_dnslen = 0;
                 return (core_object_t*)&self->pkt;
@@ -281,11 +370,13 @@ static const core_object_t* _produce(output_tcpcli_t* self)
             n = poll(&p, 1, to);
             if (n < 0 || (p.revents & (POLLERR | POLLHUP | POLLNVAL))) {
                 self->errs++;
+                core_metrics_inc(_m_errs);
                 return 0;
             }
             if (!n || !(p.revents & POLLIN)) {
                 if (recv) {
                     self->errs++;
+                    core_metrics_inc(_m_errs);
                     return 0;
                 }
                 self->pkt.len = 0;
@@ -312,6 +403,7 @@ static const core_object_t* _produce(output_tcpcli_t* self)
                 break;
             }
             self->errs++;
+            core_metrics_inc(_m_errs);
             break;
         }
 
@@ -328,6 +420,7 @@ static const core_object_t* _produce(output_tcpcli_t* self)
         n = poll(&p, 1, to);
         if (n < 0 || (p.revents & (POLLERR | POLLHUP | POLLNVAL))) {
             self->errs++;
+            core_metrics_inc(_m_errs);
             return 0;
         }
         if (!n || !(p.revents & POLLIN)) {
@@ -356,6 +449,7 @@ static const core_object_t* _produce(output_tcpcli_t* self)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 
@@ -364,15 +458,42 @@ static const core_object_t* _produce(output_tcpcli_t* self)
     }
 
     self->pkts_recv++;
+    core_metrics_inc(_m_recv);
     self->pkt.len     = self->dnslen;
     self->have_dnslen = 0;
     return (core_object_t*)&self->pkt;
 }
 
+static const core_object_t* _produce_pool(output_tcpcli_t* self)
+{
+    size_t len;
+    mlassert_self();
+
+    switch (output_tcppool_recv(self->pool, self->recvbuf, sizeof(self->recvbuf), &len, self->blocking ? _timeout(self) : 0)) {
+    case 1:
+        self->pkts_recv++;
+        core_metrics_inc(_m_recv);
+        self->pkt.len = len;
+        break;
+    case 0:
+        self->pkt.len = 0;
+        break;
+    default:
+        self->errs++;
+        core_metrics_inc(_m_errs);
+        return 0;
+    }
+
+    return (core_object_t*)&self->pkt;
+}
+
 core_producer_t output_tcpcli_producer(output_tcpcli_t* self)
 {
     mlassert_self();
 
+    if (self->pool) {
+        return (core_producer_t)_produce_pool;
+    }
     if (self->fd < 0) {
         lfatal("not connected");
     }
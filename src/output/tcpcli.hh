@@ -37,12 +37,18 @@ typedef struct output_tcpcli {
 
     core_timespec_t timeout;
     int8_t          blocking;
+
+    /* Pool of connections with queries pipelined, see
+     * output_tcpcli_pool(). */
+    size_t conns, pipeline, reconnects;
+    void*  pool;
 } output_tcpcli_t;
 
 core_log_t* output_tcpcli_log();
 
 void output_tcpcli_init(output_tcpcli_t* self);
 void output_tcpcli_destroy(output_tcpcli_t* self);
+int output_tcpcli_pool(output_tcpcli_t* self, size_t conns, size_t pipeline);
 int output_tcpcli_connect(output_tcpcli_t* self, const char* host, const char* port);
 int output_tcpcli_nonblocking(output_tcpcli_t* self);
 int output_tcpcli_set_nonblocking(output_tcpcli_t* self, int nonblocking);
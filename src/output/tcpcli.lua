@@ -30,6 +30,21 @@
 -- there was nothing to receive or if the full payload have not been received
 -- yet.
 -- Additional calls will continue retrieving the payload.
+-- .P
+-- With
+-- .I pool()
+-- the client instead keeps a number of connections and pipelines queries
+-- over them, up to a number of queries in flight per connection.
+-- Responses are matched to the queries by message ID and may come back in
+-- any order (RFC 7766), a query is only put on a connection without a query
+-- in flight with the same ID.
+-- Sending waits, up to the timeout, while all connections are full and a
+-- connection that is closed or fails is reestablished and its queries in
+-- flight sent again.
+-- Queries not answered within the timeout are counted as errors and their
+-- place is given to new queries.
+-- Responses are kept until produced, in the order they were received, in
+-- nonblocking mode the producer does not wait for a response.
 -- .SS Attributes
 -- .TP
 -- timeout
@@ -62,6 +77,17 @@ function Tcpcli:timeout(seconds, nanoseconds)
     self.obj.timeout.nsec = nanoseconds
 end
 
+-- Use a pool of
+-- .I conns
+-- connections with up to
+-- .I pipeline
+-- queries in flight on each, must be set before
+-- .IR connect() .
+-- Returns 0 on success.
+function Tcpcli:pool(conns, pipeline)
+    return C.output_tcpcli_pool(self.obj, conns, pipeline)
+end
+
 -- Connect to the
 -- .I host
 -- and
@@ -128,4 +154,9 @@ function Tcpcli:errors()
     return tonumber(self.obj.errs)
 end
 
+-- Return the number of times a connection of the pool was reestablished.
+function Tcpcli:reconnects()
+    return tonumber(self.obj.reconnects)
+end
+
 return Tcpcli
@@ -0,0 +1,711 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "output/tcppool.h"
+#include "core/assert.h"
+#include "core/metrics.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+/* Times a query is sent, over reestablished connections, before it is
+ * given up. */
+#define _MAX_TRIES 3
+#define _IN_MIN 4096
+/* Responses kept for recv() before the oldest are dropped. */
+#define _MAX_RESPONSES 65536
+
+typedef struct _query {
+    uint8_t  used, tries;
+    uint16_t id;
+    /* When the query was last sent, in ms. */
+    uint64_t sent;
+
+    /* The query with its length prefix, kept to send it again. */
+    uint8_t* buf;
+    size_t   len, size;
+} _query_t;
+
+typedef struct _conn {
+    int              fd;
+    gnutls_session_t session;
+    int              blocked;
+
+    _query_t* query;
+    size_t    inflight;
+
+    uint8_t *out, *in;
+    size_t   out_len, out_sent, out_size;
+    size_t   in_len, in_size;
+} _conn_t;
+
+typedef struct _response {
+    uint8_t* buf;
+    size_t   len, size;
+} _response_t;
+
+typedef struct _output_tcppool {
+    output_tcppool_t pub;
+
+    gnutls_certificate_credentials_t cred;
+    struct sockaddr_storage          addr;
+    socklen_t                        addr_len;
+    int                              timeout;
+
+    _conn_t*       conn;
+    size_t         conns, pipeline, next;
+    struct pollfd* pfd;
+
+    /* Ring of responses not yet returned by recv(), it grows up to
+     * _MAX_RESPONSES and then the oldest response is dropped so sending
+     * without receiving does not stall. */
+    _response_t* resp;
+    size_t       resp_head, resp_len, resp_size;
+} _output_tcppool_t;
+
+#define _self ((_output_tcppool_t*)self)
+
+static core_log_t _log = LOG_T_INIT("output.tcppool");
+
+output_tcppool_t* output_tcppool_new(core_log_t* log, size_t conns, size_t pipeline, gnutls_certificate_credentials_t cred)
+{
+    output_tcppool_t* self;
+    size_t            n;
+
+    mlassert(log, "log is nil");
+    mlassert(conns, "conns is zero");
+    mlassert(pipeline, "pipeline is zero");
+
+    mlfatal_oom(self = calloc(1, sizeof(_output_tcppool_t)));
+    strncpy(self->_log.name, log->name, sizeof(self->_log.name) - 1);
+    self->_log.is_obj = 1;
+    self->_log.module = &log->settings;
+
+    _self->cred     = cred;
+    _self->conns    = conns;
+    _self->pipeline = pipeline;
+    lfatal_oom(_self->conn = calloc(conns, sizeof(_conn_t)));
+    lfatal_oom(_self->pfd = calloc(conns, sizeof(struct pollfd)));
+    for (n = 0; n < conns; n++) {
+        _self->conn[n].fd = -1;
+        lfatal_oom(_self->conn[n].query = calloc(pipeline, sizeof(_query_t)));
+    }
+    _self->resp_size = conns * pipeline < _MAX_RESPONSES ? conns * pipeline : _MAX_RESPONSES;
+    lfatal_oom(_self->resp = calloc(_self->resp_size, sizeof(_response_t)));
+
+    return self;
+}
+
+static void _conn_close(output_tcppool_t* self, _conn_t* c)
+{
+    if (c->session) {
+        gnutls_deinit(c->session);
+        c->session = 0;
+    }
+    if (c->fd > -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->in_len = c->out_len = c->out_sent = 0;
+    c->blocked                           = 0;
+}
+
+void output_tcppool_free(output_tcppool_t* self)
+{
+    size_t n, q;
+    mlassert_self();
+
+    for (n = 0; n < _self->conns; n++) {
+        _conn_t* c = &_self->conn[n];
+
+        if (c->session) {
+            gnutls_bye(c->session, GNUTLS_SHUT_WR);
+        }
+        _conn_close(self, c);
+        for (q = 0; q < _self->pipeline; q++) {
+            free(c->query[q].buf);
+        }
+        free(c->query);
+        free(c->out);
+        free(c->in);
+    }
+    for (n = 0; n < _self->resp_size; n++) {
+        free(_self->resp[n].buf);
+    }
+    free(_self->resp);
+    free(_self->pfd);
+    free(_self->conn);
+    free(self);
+}
+
+static uint64_t _now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int _wait_fd(int fd, short events, uint64_t deadline)
+{
+    struct pollfd p;
+    uint64_t      now;
+    int           n;
+
+    for (;;) {
+        now = _now_ms();
+        if (now >= deadline) {
+            return 0;
+        }
+        p.fd      = fd;
+        p.events  = events;
+        p.revents = 0;
+        n         = poll(&p, 1, deadline - now);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n;
+    }
+}
+
+/* Connect nonblocking and, for TLS, do the handshake within the timeout. */
+static int _conn_open(output_tcppool_t* self, _conn_t* c)
+{
+    uint64_t  deadline = _now_ms() + _self->timeout;
+    int       err, one = 1;
+    socklen_t len = sizeof(err);
+
+    if ((c->fd = socket(_self->addr.ss_family, SOCK_STREAM, 0)) < 0) {
+        lcritical("socket() error %s", core_log_errstr(errno));
+        return -1;
+    }
+    if (fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK)) {
+        lcritical("fcntl(FL_SETFL) error %s", core_log_errstr(errno));
+        _conn_close(self, c);
+        return -1;
+    }
+    /* queries are small and written one by one */
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(c->fd, (struct sockaddr*)&_self->addr, _self->addr_len)) {
+        if (errno != EINPROGRESS) {
+            lcritical("connect() error %s", core_log_errstr(errno));
+            _conn_close(self, c);
+            return -1;
+        }
+        if (_wait_fd(c->fd, POLLOUT, deadline) < 1) {
+            lcritical("connect() timed out");
+            _conn_close(self, c);
+            return -1;
+        }
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+            lcritical("connect() error %s", core_log_errstr(err));
+            _conn_close(self, c);
+            return -1;
+        }
+    }
+
+    if (!_self->cred) {
+        return 0;
+    }
+
+#ifdef GNUTLS_NO_SIGNAL
+    err = gnutls_init(&c->session, GNUTLS_CLIENT | GNUTLS_NONBLOCK | GNUTLS_NO_SIGNAL);
+#else
+    err = gnutls_init(&c->session, GNUTLS_CLIENT | GNUTLS_NONBLOCK);
+#endif
+    if (err != GNUTLS_E_SUCCESS) {
+        lcritical("gnutls_init() error: %s", gnutls_strerror(err));
+        _conn_close(self, c);
+        return -1;
+    }
+    if ((err = gnutls_set_default_priority(c->session)) != GNUTLS_E_SUCCESS
+        || (err = gnutls_credentials_set(c->session, GNUTLS_CRD_CERTIFICATE, _self->cred)) != GNUTLS_E_SUCCESS) {
+        lcritical("gnutls session setup error: %s", gnutls_strerror(err));
+        _conn_close(self, c);
+        return -1;
+    }
+    gnutls_transport_set_int(c->session, c->fd);
+
+    while ((err = gnutls_handshake(c->session)) != GNUTLS_E_SUCCESS) {
+        if (gnutls_error_is_fatal(err)) {
+            lcritical("gnutls_handshake() error: %s", gnutls_strerror(err));
+            _conn_close(self, c);
+            return -1;
+        }
+        if (_wait_fd(c->fd, gnutls_record_get_direction(c->session) ? POLLOUT : POLLIN, deadline) < 1) {
+            lcritical("gnutls_handshake() timed out");
+            _conn_close(self, c);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void _conn_queue(output_tcppool_t* self, _conn_t* c, const uint8_t* buf, size_t len)
+{
+    if (c->out_len + len > c->out_size) {
+        c->out_size = c->out_len + len;
+        lfatal_oom(c->out = realloc(c->out, c->out_size));
+    }
+    memcpy(c->out + c->out_len, buf, len);
+    c->out_len += len;
+}
+
+/* Write out as much of the output buffer as possible, returns -1 if the
+ * connection failed. */
+static int _conn_flush(output_tcppool_t* self, _conn_t* c)
+{
+    ssize_t n;
+
+    while (c->out_sent < c->out_len) {
+        if (c->session) {
+            /* after GNUTLS_E_AGAIN the send must be resumed without data,
+             * gnutls has a copy of the record */
+            if (c->blocked) {
+                n = gnutls_record_send(c->session, 0, 0);
+            } else {
+                n = gnutls_record_send(c->session, c->out + c->out_sent, c->out_len - c->out_sent);
+            }
+            if (n == GNUTLS_E_AGAIN || n == GNUTLS_E_INTERRUPTED) {
+                c->blocked = 1;
+                return 0;
+            }
+            c->blocked = 0;
+            if (n < 0) {
+                ldebug("gnutls_record_send() error: %s", gnutls_strerror(n));
+                return -1;
+            }
+        } else {
+#ifdef MSG_NOSIGNAL
+            n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+#else
+            n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, 0);
+#endif
+            if (n < 0) {
+                switch (errno) {
+                case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+                case EWOULDBLOCK:
+#endif
+                case EINTR:
+                    return 0;
+                default:
+                    ldebug("send() error %s", core_log_errstr(errno));
+                    return -1;
+                }
+            }
+        }
+        c->out_sent += n;
+    }
+    c->out_len = c->out_sent = 0;
+
+    return 0;
+}
+
+static void _lost(output_tcppool_t* self, _query_t* q)
+{
+    q->used = 0;
+    (*self->errs)++;
+    core_metrics_inc(self->m_errs);
+}
+
+/* Reestablish a failed or closed connection and send its queries in flight
+ * again, queries that have been tried too many times or can not be sent
+ * are lost. */
+static int _conn_reset(output_tcppool_t* self, _conn_t* c)
+{
+    size_t n;
+    int    ret;
+
+    _conn_close(self, c);
+    ret = _conn_open(self, c);
+    if (!ret) {
+        (*self->reconnects)++;
+    }
+
+    for (n = 0; n < _self->pipeline; n++) {
+        _query_t* q = &c->query[n];
+
+        if (!q->used) {
+            continue;
+        }
+        if (ret || q->tries >= _MAX_TRIES) {
+            _lost(self, q);
+            c->inflight--;
+            continue;
+        }
+        q->tries++;
+        q->sent = _now_ms();
+        _conn_queue(self, c, q->buf, q->len);
+    }
+
+    if (!ret && _conn_flush(self, c)) {
+        return _conn_reset(self, c);
+    }
+    return ret;
+}
+
+static void _response(output_tcppool_t* self, _conn_t* c, const uint8_t* buf, size_t len)
+{
+    _response_t* r;
+    uint16_t     id;
+    size_t       n;
+
+    if (len < 2) {
+        ldebug("response too short");
+        (*self->errs)++;
+        core_metrics_inc(self->m_errs);
+        return;
+    }
+    id = (buf[0] << 8) | buf[1];
+    for (n = 0; n < _self->pipeline; n++) {
+        if (c->query[n].used && c->query[n].id == id) {
+            break;
+        }
+    }
+    if (n == _self->pipeline) {
+        ldebug("response with id %u matches no query", id);
+        (*self->errs)++;
+        core_metrics_inc(self->m_errs);
+        return;
+    }
+    c->query[n].used = 0;
+    c->inflight--;
+
+    if (_self->resp_len == _self->resp_size) {
+        if (_self->resp_size < _MAX_RESPONSES) {
+            n = _self->resp_size * 2 < _MAX_RESPONSES ? _self->resp_size * 2 : _MAX_RESPONSES;
+            lfatal_oom(r = calloc(n, sizeof(_response_t)));
+            /* unwrap the ring, it is full */
+            memcpy(r, &_self->resp[_self->resp_head], (_self->resp_size - _self->resp_head) * sizeof(_response_t));
+            memcpy(&r[_self->resp_size - _self->resp_head], _self->resp, _self->resp_head * sizeof(_response_t));
+            free(_self->resp);
+            _self->resp      = r;
+            _self->resp_head = 0;
+            _self->resp_size = n;
+        } else {
+            ldebug("responses not received, dropping oldest");
+            _self->resp_head = (_self->resp_head + 1) % _self->resp_size;
+            _self->resp_len--;
+        }
+    }
+    r = &_self->resp[(_self->resp_head + _self->resp_len) % _self->resp_size];
+    if (len > r->size) {
+        r->size = len;
+        lfatal_oom(r->buf = realloc(r->buf, r->size));
+    }
+    memcpy(r->buf, buf, len);
+    r->len = len;
+    _self->resp_len++;
+}
+
+/* Read all available responses from the connection, returns -1 if the
+ * connection failed or was closed. */
+static int _conn_read(output_tcppool_t* self, _conn_t* c)
+{
+    ssize_t n;
+    size_t  at, len;
+
+    for (;;) {
+        if (c->in_len == c->in_size) {
+            c->in_size = c->in_size ? c->in_size * 2 : _IN_MIN;
+            lfatal_oom(c->in = realloc(c->in, c->in_size));
+        }
+        if (c->session) {
+            n = gnutls_record_recv(c->session, c->in + c->in_len, c->in_size - c->in_len);
+            if (n == GNUTLS_E_AGAIN || n == GNUTLS_E_INTERRUPTED) {
+                break;
+            }
+            if (n < 0) {
+                ldebug("gnutls_record_recv() error: %s", gnutls_strerror(n));
+                return -1;
+            }
+            if (!n) {
+                return -1;
+            }
+        } else {
+            n = recv(c->fd, c->in + c->in_len, c->in_size - c->in_len, 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                break;
+            }
+            if (n < 0) {
+                ldebug("recv() error %s", core_log_errstr(errno));
+                return -1;
+            }
+            if (!n) {
+                return -1;
+            }
+        }
+        c->in_len += n;
+
+        for (at = 0; at + 2 <= c->in_len; at += 2 + len) {
+            len = (c->in[at] << 8) | c->in[at + 1];
+            if (at + 2 + len > c->in_len) {
+                break;
+            }
+            _response(self, c, c->in + at + 2, len);
+        }
+        if (at) {
+            memmove(c->in, c->in + at, c->in_len - at);
+            c->in_len -= at;
+        }
+        /* make room for the whole message */
+        if (c->in_len >= 2) {
+            len = 2 + ((c->in[0] << 8) | c->in[1]);
+            if (len > c->in_size) {
+                c->in_size = len;
+                lfatal_oom(c->in = realloc(c->in, c->in_size));
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Queries not answered within the timeout are lost, the server may have
+ * dropped them and they would otherwise hold their place in the pipeline and
+ * their ID forever. */
+static void _expire(output_tcppool_t* self, uint64_t now)
+{
+    size_t n, q;
+
+    for (n = 0; n < _self->conns; n++) {
+        _conn_t* c = &_self->conn[n];
+
+        for (q = 0; c->inflight && q < _self->pipeline; q++) {
+            if (c->query[q].used && now - c->query[q].sent >= (uint64_t)_self->timeout) {
+                ldebug("query with id %u timed out", c->query[q].id);
+                _lost(self, &c->query[q]);
+                c->inflight--;
+            }
+        }
+    }
+}
+
+/* Wait for and process the connections until the deadline or something was
+ * read or written, returns -1 on error. */
+static int _poll(output_tcppool_t* self, uint64_t deadline)
+{
+    struct pollfd* p   = _self->pfd;
+    uint64_t       now = _now_ms();
+    size_t         n;
+    int            ret, to = deadline > now ? deadline - now : 0;
+
+    for (n = 0; n < _self->conns; n++) {
+        _conn_t* c = &_self->conn[n];
+
+        p[n].fd      = c->fd;
+        p[n].events  = POLLIN;
+        p[n].revents = 0;
+        if (c->out_len || (c->session && c->blocked && gnutls_record_get_direction(c->session))) {
+            p[n].events |= POLLOUT;
+        }
+        /* gnutls may have decrypted records buffered already */
+        if (c->session && gnutls_record_check_pending(c->session)) {
+            to = 0;
+        }
+    }
+
+    if ((ret = poll(p, _self->conns, to)) < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        lcritical("poll() error %s", core_log_errstr(errno));
+        return -1;
+    }
+
+    for (n = 0; n < _self->conns; n++) {
+        _conn_t* c = &_self->conn[n];
+
+        if (c->fd < 0) {
+            continue;
+        }
+        if (p[n].revents & (POLLIN | POLLERR | POLLHUP)
+            || (c->session && gnutls_record_check_pending(c->session))) {
+            if (_conn_read(self, c)) {
+                /* no need to keep a connection without queries in flight */
+                if (c->inflight) {
+                    _conn_reset(self, c);
+                } else {
+                    _conn_close(self, c);
+                }
+                continue;
+            }
+        }
+        if (p[n].revents & POLLOUT && _conn_flush(self, c)) {
+            _conn_reset(self, c);
+        }
+    }
+    _expire(self, _now_ms());
+
+    return 0;
+}
+
+int output_tcppool_connect(output_tcppool_t* self, const char* host, const char* port, int timeout)
+{
+    struct addrinfo* addr;
+    size_t           n;
+    int              err;
+    mlassert_self();
+    lassert(host, "host is nil");
+    lassert(port, "port is nil");
+
+    if ((err = getaddrinfo(host, port, 0, &addr))) {
+        lcritical("getaddrinfo(%s, %s) error %s", host, port, gai_strerror(err));
+        return -1;
+    }
+    if (!addr) {
+        lcritical("getaddrinfo failed, no address returned");
+        return -1;
+    }
+    memcpy(&_self->addr, addr->ai_addr, addr->ai_addrlen);
+    _self->addr_len = addr->ai_addrlen;
+    _self->timeout  = timeout;
+    freeaddrinfo(addr);
+
+    for (n = 0; n < _self->conns; n++) {
+        if (_conn_open(self, &_self->conn[n])) {
+            return -2;
+        }
+    }
+
+    return 0;
+}
+
+int output_tcppool_send(output_tcppool_t* self, const uint8_t* payload, size_t len, int timeout)
+{
+    uint64_t  deadline = _now_ms() + timeout;
+    _query_t* query;
+    uint16_t  id;
+    size_t    n, q;
+    mlassert_self();
+
+    if (len < 2 || len > 65535) {
+        lcritical("can not send message of length %zu", len);
+        return -1;
+    }
+    id = (payload[0] << 8) | payload[1];
+
+    for (;;) {
+        for (n = 0; n < _self->conns; n++) {
+            _conn_t* c = &_self->conn[(_self->next + n) % _self->conns];
+
+            if (c->inflight == _self->pipeline) {
+                continue;
+            }
+            for (q = 0; q < _self->pipeline; q++) {
+                if (c->query[q].used && c->query[q].id == id) {
+                    break;
+                }
+            }
+            if (q < _self->pipeline) {
+                continue;
+            }
+            if (c->fd < 0 && _conn_reset(self, c)) {
+                continue;
+            }
+
+            for (q = 0; c->query[q].used; q++)
+                ;
+            query = &c->query[q];
+            if (len + 2 > query->size) {
+                query->size = len + 2;
+                lfatal_oom(query->buf = realloc(query->buf, query->size));
+            }
+            query->buf[0] = len >> 8;
+            query->buf[1] = len;
+            memcpy(query->buf + 2, payload, len);
+            query->len   = len + 2;
+            query->id    = id;
+            query->tries = 1;
+            query->used  = 1;
+            query->sent  = _now_ms();
+            c->inflight++;
+            _self->next = (_self->next + n + 1) % _self->conns;
+
+            _conn_queue(self, c, query->buf, query->len);
+            if (_conn_flush(self, c)) {
+                _conn_reset(self, c);
+            }
+            return 0;
+        }
+
+        /* all connections are full or have a query with the same id */
+        if (_now_ms() >= deadline) {
+            return -1;
+        }
+        if (_poll(self, deadline)) {
+            return -1;
+        }
+    }
+}
+
+int output_tcppool_recv(output_tcppool_t* self, uint8_t* buf, size_t size, size_t* len, int timeout)
+{
+    uint64_t     deadline = _now_ms() + timeout;
+    _response_t* r;
+    size_t       n, inflight;
+    mlassert_self();
+    lassert(buf, "buf is nil");
+    lassert(len, "len is nil");
+
+    for (;;) {
+        if (_self->resp_len) {
+            r = &_self->resp[_self->resp_head];
+            if (r->len > size) {
+                lcritical("response of length %zu too large", r->len);
+                return -1;
+            }
+            memcpy(buf, r->buf, r->len);
+            *len             = r->len;
+            _self->resp_head = (_self->resp_head + 1) % _self->resp_size;
+            _self->resp_len--;
+            return 1;
+        }
+
+        for (inflight = 0, n = 0; n < _self->conns; n++) {
+            inflight += _self->conn[n].inflight;
+        }
+        if (!inflight) {
+            return 0;
+        }
+
+        if (_poll(self, deadline)) {
+            return -1;
+        }
+        if (!_self->resp_len && _now_ms() >= deadline) {
+            return 0;
+        }
+    }
+}
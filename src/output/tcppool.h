@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2018-2019, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of dnsjit.
+ *
+ * dnsjit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsjit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/log.h"
+
+#ifndef __dnsjit_output_tcppool_h
+#define __dnsjit_output_tcppool_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gnutls/gnutls.h>
+
+/*
+ * Pool of TCP, or TLS, connections to one server used by output.tcpcli and
+ * output.tlscli to pipeline queries over several connections.
+ *
+ * Each connection has up to pipeline queries in flight and responses are
+ * matched to them by message ID so they may come back in any order
+ * (RFC 7766 section 6.2.1.1), queries are only put on a connection that
+ * has no query in flight with the same ID.
+ * A connection that is closed or fails is reestablished and its queries
+ * in flight are sent again, queries not answered within the timeout given
+ * to connect are lost.
+ */
+
+typedef struct output_tcppool {
+    core_log_t _log;
+
+    /* Counters of the owner, errs is increased for queries that are lost
+     * and responses that match no query and m_errs is the metric of it. */
+    size_t* errs;
+    size_t  m_errs;
+    size_t* reconnects;
+} output_tcppool_t;
+
+output_tcppool_t* output_tcppool_new(core_log_t* log, size_t conns, size_t pipeline, gnutls_certificate_credentials_t cred);
+void output_tcppool_free(output_tcppool_t* self);
+int output_tcppool_connect(output_tcppool_t* self, const char* host, const char* port, int timeout);
+int output_tcppool_send(output_tcppool_t* self, const uint8_t* payload, size_t len, int timeout);
+int output_tcppool_recv(output_tcppool_t* self, uint8_t* buf, size_t size, size_t* len, int timeout);
+
+#endif
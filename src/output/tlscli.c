@@ -21,7 +21,9 @@
 #include "config.h"
 
 #include "output/tlscli.h"
+#include "output/tcppool.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 #include "core/object/dns.h"
 #include "core/object/payload.h"
 
@@ -41,9 +43,12 @@ static output_tlscli_t _defaults = {
     { 0 }, CORE_OBJECT_PAYLOAD_INIT(0),
     0, 0, 0, 0,
     { 5, 0 },
-    0, 0
+    0, 0,
+    1, 1, 0, 0
 };
 
+static size_t _m_pkts = 0, _m_recv = 0, _m_errs = 0;
+
 core_log_t* output_tlscli_log()
 {
     return &_log;
@@ -57,6 +62,10 @@ void output_tlscli_init(output_tlscli_t* self)
     *self             = _defaults;
     self->pkt.payload = self->recvbuf;
 
+    core_metrics_counter(&_m_pkts, "dnsjit_output_packets_total", "module=\"output.tlscli\"", "Packets sent by output modules");
+    core_metrics_counter(&_m_recv, "dnsjit_output_received_total", "module=\"output.tlscli\"", "Packets received by output modules");
+    core_metrics_counter(&_m_errs, "dnsjit_output_errors_total", "module=\"output.tlscli\"", "Errors of output modules");
+
     gnutls_global_init();
     if ((err = gnutls_certificate_allocate_credentials(&self->cred)) != GNUTLS_E_SUCCESS) {
         lfatal("gnutls_certificate_allocate_credentials() error: %s", gnutls_strerror(err));
@@ -86,6 +95,34 @@ void output_tlscli_destroy(output_tlscli_t* self)
             gnutls_certificate_free_credentials(self->cred);
         }
     }
+    if (self->pool) {
+        output_tcppool_free(self->pool);
+        gnutls_deinit(self->session);
+        gnutls_certificate_free_credentials(self->cred);
+    }
+}
+
+int output_tlscli_pool(output_tlscli_t* self, size_t conns, size_t pipeline)
+{
+    mlassert_self();
+
+    if (self->fd > -1 || self->pool) {
+        lfatal("already connected");
+    }
+    if (!conns || !pipeline) {
+        lcritical("connections and pipeline must be greater than 0");
+        return -1;
+    }
+
+    self->conns    = conns;
+    self->pipeline = pipeline;
+    return 0;
+}
+
+static int _timeout(output_tlscli_t* self)
+{
+    int to = (self->timeout.sec * 1e3) + (self->timeout.nsec / 1e6);
+    return to ? to : 1;
 }
 
 int output_tlscli_connect(output_tlscli_t* self, const char* host, const char* port)
@@ -97,13 +134,27 @@ int output_tlscli_connect(output_tlscli_t* self, const char* host, const char* p
     lassert(host, "host is nil");
     lassert(port, "port is nil");
 
-    if (self->fd > -1) {
+    if (self->fd > -1 || self->pool) {
         lfatal("already connected");
     }
     if (self->tls_ok) {
         lfatal("TLS already established");
     }
 
+    if (self->conns > 1 || self->pipeline > 1) {
+        output_tcppool_t* pool = output_tcppool_new(&self->_log, self->conns, self->pipeline, self->cred);
+
+        pool->errs       = &self->errs;
+        pool->m_errs     = _m_errs;
+        pool->reconnects = &self->reconnects;
+        if ((err = output_tcppool_connect(pool, host, port, _timeout(self)))) {
+            output_tcppool_free(pool);
+            return err;
+        }
+        self->pool = pool;
+        return 0;
+    }
+
     if ((err = getaddrinfo(host, port, 0, &addr))) {
         lcritical("getaddrinfo(%s, %s) error %s", host, port, gai_strerror(err));
         return -1;
@@ -189,6 +240,7 @@ static void _receive(output_tlscli_t* self, const core_object_t* obj)
                         if (sent < len)
                             continue;
                         self->pkts++;
+                        core_metrics_inc(_m_pkts);
                         return;
                     }
                     switch (ret) {
@@ -201,6 +253,7 @@ static void _receive(output_tlscli_t* self, const core_object_t* obj)
                     break;
                 }
                 self->errs++;
+                core_metrics_inc(_m_errs);
                 return;
             }
             switch (ret) {
@@ -213,14 +266,44 @@ static void _receive(output_tlscli_t* self, const core_object_t* obj)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 }
 
+static void _receive_pool(output_tlscli_t* self, const core_object_t* obj)
+{
+    mlassert_self();
+
+    for (; obj;) {
+        switch (obj->obj_type) {
+        case CORE_OBJECT_DNS:
+            obj = obj->obj_prev;
+            continue;
+        case CORE_OBJECT_PAYLOAD:
+            break;
+        default:
+            return;
+        }
+
+        if (output_tcppool_send(self->pool, ((core_object_payload_t*)obj)->payload, ((core_object_payload_t*)obj)->len, _timeout(self))) {
+            self->errs++;
+            core_metrics_inc(_m_errs);
+            return;
+        }
+        self->pkts++;
+        core_metrics_inc(_m_pkts);
+        return;
+    }
+}
+
 core_receiver_t output_tlscli_receiver(output_tlscli_t* self)
 {
     mlassert_self();
 
+    if (self->pool) {
+        return (core_receiver_t)_receive_pool;
+    }
     if (self->fd < 0) {
         lfatal("not connected");
     }
@@ -257,6 +340,7 @@ static const core_object_t* _produce(output_tlscli_t* self)
 
             if (self->recv > self->dnslen) {
                 self->pkts_recv++;
+                core_metrics_inc(_m_recv);
                 self->pkt.len     = self->dnslen;
                 self->have_dnslen = 0;
                 return (core_object_t*)&self->pkt;
@@ -285,6 +369,7 @@ static const core_object_t* _produce(output_tlscli_t* self)
                 break;
             }
             self->errs++;
+            core_metrics_inc(_m_errs);
             break;
         }
 
@@ -317,6 +402,7 @@ static const core_object_t* _produce(output_tlscli_t* self)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 
@@ -325,15 +411,42 @@ static const core_object_t* _produce(output_tlscli_t* self)
     }
 
     self->pkts_recv++;
+    core_metrics_inc(_m_recv);
     self->pkt.len     = self->dnslen;
     self->have_dnslen = 0;
     return (core_object_t*)&self->pkt;
 }
 
+static const core_object_t* _produce_pool(output_tlscli_t* self)
+{
+    size_t len;
+    mlassert_self();
+
+    switch (output_tcppool_recv(self->pool, self->recvbuf, sizeof(self->recvbuf), &len, _timeout(self))) {
+    case 1:
+        self->pkts_recv++;
+        core_metrics_inc(_m_recv);
+        self->pkt.len = len;
+        break;
+    case 0:
+        self->pkt.len = 0;
+        break;
+    default:
+        self->errs++;
+        core_metrics_inc(_m_errs);
+        return 0;
+    }
+
+    return (core_object_t*)&self->pkt;
+}
+
 core_producer_t output_tlscli_producer(output_tlscli_t* self)
 {
     mlassert_self();
 
+    if (self->pool) {
+        return (core_producer_t)_produce_pool;
+    }
     if (self->fd < 0) {
         lfatal("not connected");
     }
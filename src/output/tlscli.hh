@@ -40,12 +40,18 @@ typedef struct output_tlscli {
 
     gnutls_session_t                 session;
     gnutls_certificate_credentials_t cred;
+
+    /* Pool of connections with queries pipelined, see
+     * output_tlscli_pool(). */
+    size_t conns, pipeline, reconnects;
+    void*  pool;
 } output_tlscli_t;
 
 core_log_t* output_tlscli_log();
 
 void output_tlscli_init(output_tlscli_t* self);
 void output_tlscli_destroy(output_tlscli_t* self);
+int output_tlscli_pool(output_tlscli_t* self, size_t conns, size_t pipeline);
 int output_tlscli_connect(output_tlscli_t* self, const char* host, const char* port);
 
 core_receiver_t output_tlscli_receiver(output_tlscli_t* self);
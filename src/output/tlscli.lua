@@ -23,6 +23,20 @@
 -- Simple TLS client that attempts to do a TLS handshake (without
 -- certificate verification). It behaves the same way as tcpcli, except all
 -- the data is sent over the encrypted channel.
+-- .P
+-- With
+-- .I pool()
+-- the client instead keeps a number of connections and pipelines queries
+-- over them, up to a number of queries in flight per connection.
+-- Responses are matched to the queries by message ID and may come back in
+-- any order (RFC 7766), a query is only put on a connection without a query
+-- in flight with the same ID.
+-- Sending waits, up to the timeout, while all connections are full and a
+-- connection that is closed or fails is reestablished and its queries in
+-- flight sent again.
+-- Queries not answered within the timeout are counted as errors and their
+-- place is given to new queries.
+-- Responses are kept until produced, in the order they were received.
 -- .SS Attributes
 -- .TP
 -- timeout
@@ -55,6 +69,17 @@ function Tlscli:timeout(seconds, nanoseconds)
     self.obj.timeout.nsec = nanoseconds
 end
 
+-- Use a pool of
+-- .I conns
+-- connections with up to
+-- .I pipeline
+-- queries in flight on each, must be set before
+-- .IR connect() .
+-- Returns 0 on success.
+function Tlscli:pool(conns, pipeline)
+    return C.output_tlscli_pool(self.obj, conns, pipeline)
+end
+
 -- Connect to the
 -- .I host
 -- and
@@ -100,4 +125,9 @@ function Tlscli:errors()
     return tonumber(self.obj.errs)
 end
 
+-- Return the number of times a connection of the pool was reestablished.
+function Tlscli:reconnects()
+    return tonumber(self.obj.reconnects)
+end
+
 return Tlscli
@@ -22,6 +22,7 @@
 
 #include "output/udpcli.h"
 #include "core/assert.h"
+#include "core/metrics.h"
 #include "core/object/dns.h"
 #include "core/object/payload.h"
 
@@ -40,6 +41,8 @@ static output_udpcli_t _defaults = {
     { 5, 0 }, 1
 };
 
+static size_t _m_pkts = 0, _m_recv = 0, _m_errs = 0;
+
 core_log_t* output_udpcli_log()
 {
     return &_log;
@@ -51,6 +54,10 @@ void output_udpcli_init(output_udpcli_t* self)
 
     *self             = _defaults;
     self->pkt.payload = self->recvbuf;
+
+    core_metrics_counter(&_m_pkts, "dnsjit_output_packets_total", "module=\"output.udpcli\"", "Packets sent by output modules");
+    core_metrics_counter(&_m_recv, "dnsjit_output_received_total", "module=\"output.udpcli\"", "Packets received by output modules");
+    core_metrics_counter(&_m_errs, "dnsjit_output_errors_total", "module=\"output.udpcli\"", "Errors of output modules");
 }
 
 void output_udpcli_destroy(output_udpcli_t* self)
@@ -170,6 +177,7 @@ static void _receive(output_udpcli_t* self, const core_object_t* obj)
                 if (sent < len)
                     continue;
                 self->pkts++;
+                core_metrics_inc(_m_pkts);
                 return;
             }
             switch (errno) {
@@ -184,6 +192,7 @@ static void _receive(output_udpcli_t* self, const core_object_t* obj)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 }
@@ -220,6 +229,7 @@ static const core_object_t* _produce(output_udpcli_t* self)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 
@@ -228,6 +238,7 @@ static const core_object_t* _produce(output_udpcli_t* self)
     }
 
     self->pkts_recv++;
+    core_metrics_inc(_m_recv);
     self->pkt.len = n;
     return (core_object_t*)&self->pkt;
 }
@@ -250,6 +261,7 @@ static const core_object_t* _produce_block(output_udpcli_t* self)
     n = poll(&p, 1, to);
     if (n < 0 || (p.revents & (POLLERR | POLLHUP | POLLNVAL))) {
         self->errs++;
+        core_metrics_inc(_m_errs);
         return 0;
     }
     if (!n || !(p.revents & POLLIN)) {
@@ -273,6 +285,7 @@ static const core_object_t* _produce_block(output_udpcli_t* self)
             break;
         }
         self->errs++;
+        core_metrics_inc(_m_errs);
         break;
     }
 
@@ -281,6 +294,7 @@ static const core_object_t* _produce_block(output_udpcli_t* self)
     }
 
     self->pkts_recv++;
+    core_metrics_inc(_m_recv);
     self->pkt.len = n;
     return (core_object_t*)&self->pkt;
 }
@@ -0,0 +1,37 @@
+#!/bin/sh -e
+# Copyright (c) 2020, CZ.NIC, z.s.p.o.
+# All rights reserved.
+#
+# This file is part of dnsjit.
+#
+# dnsjit is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# dnsjit is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with dnsjit.  If not, see <http://www.gnu.org/licenses/>.
+
+../dnsjit "$srcdir/test_log.lua" >test-log.out
+
+# 3 limited messages, the number suppressed and the one after the interval
+test "`grep -c '^test info: limited' test-log.out`" = 4
+grep -q '^test info: 7 similar messages suppressed$' test-log.out
+grep -q '^test info: limited 11$' test-log.out
+test "`grep -c '^test critical: critical' test-log.out`" = 10
+test "`grep -c '^test info: unlimited' test-log.out`" = 10
+
+# asynchronous output in order
+awk '/^test info: async / { if ($4 != ++n) exit 1 } END { if (n != 100) exit 1 }' test-log.out
+
+# written and dropped messages add up, and match the warnings and dropped()
+written=`grep -c '^test info: bulk' test-log.out`
+warned=`awk '/^core warning: dropped [0-9]+ log messages/ { n += $4 } END { print n + 0 }' test-log.out`
+reported=`sed -n 's/^dropped() //p' test-log.out`
+test "$((written + warned))" = 200000
+test "$warned" = "$reported"
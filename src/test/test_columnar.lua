@@ -0,0 +1,173 @@
+-- Test cases for dnsjit.output.columnar
+local function run(output)
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+    local recv, rctx = output:receive()
+
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        recv(rctx, obj)
+    end
+end
+
+local file = "test-columnar.arrows.out"
+local output = require("dnsjit.output.columnar").new(16)
+output:qrmatch(require("dnsjit.filter.qrmatch").new())
+assert(output:open(file) == 0, "open failed")
+run(output)
+assert(output:close() == 0, "close failed")
+
+assert(output:rows() == 82, "not all DNS messages written")
+assert(output:batches() == 6, "wrong number of record batches")
+
+local f = io.open(file, "rb")
+local data = f:read("*a")
+f:close()
+assert(#data == output:bytes(), "bytes written does not match file size")
+assert(data:sub(1, 4) == "\255\255\255\255", "missing continuation marker")
+assert(data:sub(-8) == "\255\255\255\255\0\0\0\0", "missing end-of-stream marker")
+os.remove(file)
+
+-- read back the FlatBuffers encoded messages, positions are 0-based
+local function u8(p) return data:byte(p + 1) end
+local function u16(p) return u8(p) + u8(p + 1) * 256 end
+local function u32(p) return u16(p) + u16(p + 2) * 65536 end
+local function i32(p)
+    local v = u32(p)
+    return v >= 2147483648 and v - 4294967296 or v
+end
+local function i64(p) return u32(p) + u32(p + 4) * 4294967296 end
+
+-- position of field i of the table at t, nil if not present
+local function field(t, i)
+    local vt = t - i32(t)
+    if 4 + 2 * i >= u16(vt) or u16(vt + 4 + 2 * i) == 0 then return nil end
+    return t + u16(vt + 4 + 2 * i)
+end
+local function scalar(t, i, read)
+    local p = field(t, i)
+    return p and read(p) or 0
+end
+local function ref(t, i)
+    local p = field(t, i)
+    return p and p + u32(p)
+end
+local function vector(t, i)
+    local p = ref(t, i)
+    return u32(p), p + 4
+end
+local function str(t, i)
+    local p = ref(t, i)
+    return data:sub(p + 5, p + 4 + u32(p))
+end
+local function element(v, i)
+    local p = v + 4 * i
+    return p + u32(p)
+end
+
+-- Message: header_type, header and bodyLength
+local messages, pos = {}, 0
+while true do
+    assert(u32(pos) == 0xffffffff, "missing continuation marker")
+    local len = i32(pos + 4)
+    if len == 0 then break end
+    local msg = pos + 8 + u32(pos + 8)
+    table.insert(messages, { type = scalar(msg, 1, u8), header = ref(msg, 2) })
+    pos = pos + 8 + len + scalar(msg, 3, i64)
+end
+assert(pos + 8 == #data, "message lengths do not add up to the file size")
+
+local SCHEMA, DICTIONARY_BATCH, RECORD_BATCH = 1, 2, 3
+local INT, UTF8, TIMESTAMP, FIXED_SIZE_BINARY, DURATION = 2, 5, 10, 15, 18
+local NANOSECOND = 3
+local columns = {
+    { "ts", TIMESTAMP }, { "src", FIXED_SIZE_BINARY, 16 }, { "dst", FIXED_SIZE_BINARY, 16 },
+    { "sport", INT, 16 }, { "dport", INT, 16 }, { "transport", INT, 8 },
+    { "id", INT, 16 }, { "flags", INT, 16 }, { "qname", UTF8, nil, true },
+    { "qtype", INT, 16, true }, { "rcode", INT, 8 }, { "size", INT, 32 },
+    { "rtt", DURATION, nil, true },
+}
+local QNAME_DICTIONARY = 8
+
+-- Schema: fields of Field with name, nullable, type and dictionary
+assert(messages[1].type == SCHEMA, "first message is not the schema")
+local n, fields = vector(messages[1].header, 1)
+assert(n == #columns, "wrong number of fields")
+for i, c in ipairs(columns) do
+    local f = element(fields, i - 1)
+    local name, kind, width, nullable = unpack(c, 1, 4)
+    assert(str(f, 0) == name, "field " .. i .. " is not " .. name)
+    assert(scalar(f, 2, u8) == kind, name .. " has wrong type")
+    assert((scalar(f, 1, u8) == 1) == (nullable == true), name .. " has wrong nullability")
+    local t = ref(f, 3)
+    if kind == INT then
+        assert(scalar(t, 0, i32) == width and scalar(t, 1, u8) == 0, name .. " is not uint" .. width)
+    elseif kind == FIXED_SIZE_BINARY then
+        assert(scalar(t, 0, i32) == width)
+    elseif kind == TIMESTAMP then
+        assert(scalar(t, 0, u16) == NANOSECOND and str(t, 1) == "UTC")
+    elseif kind == DURATION then
+        assert(scalar(t, 0, u16) == NANOSECOND)
+    end
+    local dictionary = ref(f, 4)
+    if name == "qname" then
+        assert(dictionary and scalar(dictionary, 0, i64) == QNAME_DICTIONARY)
+        local index = ref(dictionary, 1)
+        assert(scalar(index, 0, i32) == 32 and scalar(index, 1, u8) == 1, "qname index is not int32")
+    else
+        assert(dictionary == nil, name .. " is dictionary encoded")
+    end
+end
+
+-- the qname dictionary replaced before each RecordBatch, every column of
+-- every batch has one FieldNode with the length of the batch
+local rows, batches, rtt_nulls, other_nulls = 0, 0, 0, 0
+assert(#messages == 1 + 2 * output:batches(), "wrong number of messages")
+for i = 2, #messages, 2 do
+    local dictionary, batch = messages[i], messages[i + 1]
+    assert(dictionary.type == DICTIONARY_BATCH and batch.type == RECORD_BATCH)
+    assert(scalar(dictionary.header, 0, i64) == QNAME_DICTIONARY and scalar(dictionary.header, 2, u8) == 0)
+    local length = scalar(batch.header, 0, i64)
+    assert(length > 0 and length <= 16, "wrong batch length")
+    local nodes
+    n, nodes = vector(batch.header, 1)
+    assert(n == #columns, "wrong number of field nodes")
+    for c = 0, n - 1 do
+        assert(i64(nodes + 16 * c) == length, columns[c + 1][1] .. " has wrong length")
+        if columns[c + 1][1] == "rtt" then
+            rtt_nulls = rtt_nulls + i64(nodes + 16 * c + 8)
+        else
+            other_nulls = other_nulls + i64(nodes + 16 * c + 8)
+        end
+    end
+    assert(vector(batch.header, 2) == 2 * #columns, "wrong number of buffers")
+    rows = rows + length
+    batches = batches + 1
+end
+assert(rows == 82 and batches == 6, "rows or batches read back differ")
+-- only the 41 responses are matched to a query
+assert(rtt_nulls == 41 and other_nulls == 0, "wrong null counts")
+
+-- all batches pending before the writer takes the first
+local queued = require("dnsjit.output.columnar").new(1)
+queued:queue(1)
+queued:qrmatch(require("dnsjit.filter.qrmatch").new())
+assert(queued:open(file) == 0, "open failed")
+run(queued)
+assert(queued:close() == 0, "close failed")
+assert(queued:rows() == 82 and queued:batches() == 82)
+os.remove(file)
+
+if require("dnsjit.output.columnar").have_zstd() then
+    local zstd = require("dnsjit.output.columnar").new()
+    zstd:compression("zstd")
+    assert(zstd:open(file) == 0, "open failed")
+    run(zstd)
+    assert(zstd:close() == 0, "close failed")
+    assert(zstd:rows() == 82 and zstd:batches() == 1)
+    os.remove(file)
+end
@@ -0,0 +1,151 @@
+-- Test cases for dnsjit.core.object.dns:decode()
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local Dns = require("dnsjit.core.object.dns")
+local Msg = require("dnsjit.core.object.dns.msg")
+local label = require("dnsjit.core.object.dns.label")
+
+local MALFORMED = -2
+local NEEDMORE = -3
+
+local pl = ffi.new("core_object_payload_t")
+pl.obj_type = object.PAYLOAD
+local dns = Dns.new(ffi.cast("core_object_t*", pl))
+local buf
+
+local function decode(wire, msg)
+    buf = ffi.new("uint8_t[?]", #wire)
+    ffi.copy(buf, wire, #wire)
+    pl.payload = buf
+    pl.len = #wire
+    return dns:decode(msg)
+end
+
+local function u16(v)
+    return string.char(math.floor(v / 256), v % 256)
+end
+
+local function header(qd, an)
+    return "\0\1\129\128" .. u16(qd) .. u16(an or 0) .. u16(0) .. u16(0)
+end
+
+local function rr(owner, type, rdata)
+    return owner .. u16(type) .. u16(1) .. "\0\0\14\16" .. u16(#rdata) .. rdata
+end
+
+local A, CNAME, PRIVATE = 1, 5, 65280
+
+-- example.com A, answered with a compressed CNAME to www.example.com
+local question = "\7example\3com\0" .. u16(A) .. u16(1)
+local valid = header(1, 1) .. question .. rr("\192\12", CNAME, "\3www\192\12")
+local msg = Msg.new()
+assert(decode(valid, msg) == 0, "valid message not decoded")
+assert(msg.rrs == 2 and msg.names == 3)
+assert(msg.rr[0].section == Msg.SECTION.QUESTION and msg.rr[0].type == A)
+assert(msg.rr[1].section == Msg.SECTION.ANSWER and msg.rr[1].type == CNAME)
+assert(msg.rr[1].ttl == 3600 and msg.rr[1].rdlength == 6 and msg.rr[1].rdata_offset == 41)
+assert(msg.rr[1].offset == 29 and msg.rr[1].length == #valid - 29)
+assert(msg.rr[1].rdata_names == 1 and msg.rr[1].rdata_name == 2)
+assert(msg:name(0) == "example.com." and msg:name(1) == "example.com.")
+assert(msg:name(2) == "www.example.com." and msg.name[2].labels == 3)
+assert(msg:wire_name(2) == "\3www\7example\3com\0", "pointer not resolved in the arena")
+
+-- every truncation of a valid message is malformed
+for len = 1, #valid - 1 do
+    assert(decode(valid:sub(1, len), msg) == MALFORMED, "truncated to " .. len .. " bytes not rejected")
+end
+-- as is rdata shorter than its names
+assert(decode(header(1, 1) .. question .. rr("\192\12", CNAME, "\3www"), msg) == MALFORMED)
+
+-- pointers to themselves and forward pointers
+assert(decode(header(1) .. "\192\12" .. u16(A) .. u16(1), msg) == MALFORMED, "pointer loop not rejected")
+assert(decode(header(1) .. "\192\18" .. u16(A) .. u16(1) .. "\0", msg) == MALFORMED, "forward pointer not rejected")
+-- a pointer back to the label before it loops until the name is too long
+assert(decode(header(1) .. "\1a\192\12" .. u16(A) .. u16(1), msg) == MALFORMED, "label loop not rejected")
+
+-- a chain of backward pointers, the owner of the second record follows
+-- chain + 1 pointers
+local function chain(pointers)
+    local rdata = { "\192\12" }
+    for i = 1, pointers - 2 do
+        table.insert(rdata, u16(0xc000 + 29 + 2 * (i - 1)))
+    end
+    local owner = u16(0xc000 + 29 + 2 * (pointers - 2))
+    return header(1, 2) .. "\0" .. u16(A) .. u16(1)
+        .. rr("\192\12", PRIVATE, table.concat(rdata))
+        .. rr(owner, PRIVATE, "")
+end
+assert(decode(chain(128), msg) == 0 and msg:name(2) == ".", "128 pointers not followed")
+assert(decode(chain(129), msg) == MALFORMED, "more than 128 pointers followed")
+
+-- names are at most 255 bytes, also when they are put together from pointers
+local l63 = "\63" .. string.rep("a", 63)
+local l61 = "\61" .. string.rep("b", 61)
+assert(decode(header(1) .. l63 .. l63 .. l63 .. l61 .. "\0" .. u16(A) .. u16(1), msg) == 0, "255 byte name not decoded")
+assert(msg.name[0].length == 255 and msg.name[0].labels == 4)
+assert(decode(header(1) .. l63 .. l63 .. l63 .. l63 .. "\0" .. u16(A) .. u16(1), msg) == MALFORMED, "256 byte name not rejected")
+assert(decode(header(1, 1) .. l63 .. l63 .. l63 .. "\0" .. u16(A) .. u16(1)
+    .. rr(l63 .. "\192\12", A, "\127\0\0\1"), msg) == MALFORMED, "256 byte name from pointer not rejected")
+
+-- running out of rrs, names or arena space is reported as such
+assert(decode(valid, Msg.new(1)) == NEEDMORE, "rrs exhaustion not reported")
+assert(decode(valid, Msg.new(2, 2)) == NEEDMORE, "names exhaustion not reported")
+assert(decode(valid, Msg.new(2, 3, 43)) == 0, "exact arena not enough")
+assert(decode(valid, Msg.new(2, 3, 42)) == NEEDMORE, "arena exhaustion not reported")
+assert(decode(valid, msg) == 0, "message not decoded again after an error")
+
+-- the label parser leaves compression pointers unresolved, follow them
+local function resolve(dns, labels, num_labels)
+    local dn, offset = label.tostring(dns, labels, num_labels)
+    dn = dn or ""
+    while offset ~= nil do
+        local length = dns.payload[offset]
+        if length >= 0xc0 then
+            offset = (length - 0xc0) * 256 + dns.payload[offset + 1]
+        elseif length == 0 then
+            offset = nil
+        else
+            dn = dn .. ffi.string(dns.payload + offset + 1, length) .. "."
+            offset = offset + 1 + length
+        end
+    end
+    return dn == "" and "." or dn
+end
+
+-- decoding the capture gives the same records as the parser
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+input:open_offline("dns.pcap-dist")
+layer:producer(input)
+local prod, pctx = layer:produce()
+local q = require("dnsjit.core.object.dns.q").new()
+local r = require("dnsjit.core.object.dns.rr").new()
+local labels = label.new(127)
+local messages, records = 0, 0
+
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    if obj:type() == "payload" and obj:prev():type() == "udp" and obj:cast().len > 0 then
+        local d = Dns.new(obj)
+        assert(d:decode(msg) == 0, "message of the capture not decoded")
+        assert(d:parse_header() == 0)
+        assert(msg.rrs == d.qdcount + d.ancount + d.nscount + d.arcount, "record count differs")
+        for n = 0, tonumber(msg.rrs) - 1 do
+            local m = msg.rr[n]
+            if n < d.qdcount then
+                assert(d:parse_q(q, labels, 127) == 0)
+                assert(m.type == q.type and m.class == q.class)
+                assert(msg:name(m.name) == resolve(d, labels, q.labels), "question name differs")
+            else
+                assert(d:parse_rr(r, labels, 127) == 0)
+                assert(m.type == r.type and m.class == r.class and m.ttl == r.ttl)
+                assert(m.rdlength == r.rdlength and m.rdata_offset == r.rdata_offset)
+                assert(msg:name(m.name) == resolve(d, labels, r.labels), "owner name differs")
+            end
+            records = records + 1
+        end
+        messages = messages + 1
+    end
+end
+assert(messages == 82 and records > messages, "not all messages decoded")
@@ -0,0 +1,57 @@
+-- Test cases for dnsjit.input.dnsgen
+local object = require("dnsjit.core.objects")
+
+local function generate(seed)
+    local input = require("dnsjit.input.dnsgen").new()
+    assert(input:client("10.1.2.0/24") == 0)
+    assert(input:client("fd00::/120") == 0)
+    assert(input:client("bogus") ~= 0, "invalid client range accepted")
+    assert(input:name("a.example.com", "b.example.com.") == 0)
+    assert(input:name({ "c.example.org" }) == 0)
+    input:qtype("A", 3)
+    input:qtype(28)
+    input:zipf(1.0)
+    input:subdomain(0.25)
+    input:edns(0.5, 4096, 0.5)
+    input:rate(1000)
+    input:start(1000)
+    input:pool(1000)
+    input:seed(seed)
+    input:limit(10000)
+
+    local layer = require("dnsjit.filter.layer").new()
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+    local dns = require("dnsjit.core.object.dns").new()
+    local stats = { v4 = 0, v6 = 0, aaaa = 0, edns = 0, sum = 0 }
+    local last
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local payload = obj:cast()
+        assert(obj:type() == "payload", "packet not parsed by layer")
+        local udp = obj:prev():cast()
+        assert(udp.dport == 53, "wrong destination port")
+        local ip = udp:prev()
+        if ip.obj_type == object.IP then
+            stats.v4 = stats.v4 + 1
+        else
+            stats.v6 = stats.v6 + 1
+        end
+        last = ip:prev():prev():cast().ts
+        dns.obj_prev = obj
+        assert(dns:parse_header() == 0, "query not parsed")
+        assert(dns.qr == 0 and dns.rd == 1 and dns.qdcount == 1, "not a query")
+        stats.edns = stats.edns + dns.arcount
+        stats.sum = stats.sum + dns.id + payload.len
+    end
+
+    assert(input:packets() == 10000, "limit not reached")
+    assert(stats.v4 > 4000 and stats.v6 > 4000, "clients not mixed")
+    assert(stats.edns > 4000 and stats.edns < 6000, "edns probability off")
+    assert(last.sec == 1009 and last.nsec == 999000000, "wrong timestamps")
+    return stats.sum
+end
+
+assert(generate(1) == generate(1), "same seed generated different packets")
+assert(generate(1) ~= generate(2), "different seeds generated the same packets")
@@ -0,0 +1,84 @@
+-- Test cases for dnsjit.core.object.dns.name
+local name = require("dnsjit.core.object.dns.name")
+print("kernels", name.impl())
+
+-- scalar reference, only ASCII A-Z are lowercased
+local function lower(s)
+    return (s:gsub("[A-Z]", function(c) return string.char(c:byte() + 32) end))
+end
+
+local function flipcase(s)
+    return (s:gsub("%a", function(c)
+        if math.random(2) == 1 then return c:upper() end
+        return c:lower()
+    end))
+end
+
+-- bytes around the letters and their non-ASCII counterparts (0xc1 and 0xe1
+-- also differ only by 0x20)
+local edge = { 0, 63, 64, 65, 90, 91, 96, 97, 122, 123, 127, 128, 191, 193, 218, 225, 250, 255 }
+
+local function random(len)
+    local b = {}
+    for i = 1, len do
+        if math.random(2) == 1 then
+            b[i] = edge[math.random(#edge)]
+        else
+            b[i] = math.random(0, 255)
+        end
+    end
+    return string.char(unpack(b))
+end
+
+math.randomseed(1)
+-- lengths around the 16 and 32 byte vectors and their tails
+for len = 1, 100 do
+    for _ = 1, 20 do
+        local a = random(len)
+        assert(name.lower(a) == lower(a), "lower differs from scalar at length " .. len)
+
+        local b = flipcase(a)
+        assert(name.cmp(a, nil, b, nil) == 0 and name.equal(a, nil, b, nil), "case variants differ at length " .. len)
+        assert(name.hash(a) == name.hash(b), "hash is not case-insensitive at length " .. len)
+        assert(name.hash(a) == name.hash(lower(a)))
+        assert(name.hash(a, nil, 1) ~= name.hash(a), "seed not used")
+
+        -- first difference at every position, the result is the difference
+        -- of the lowercased bytes
+        local i = math.random(len)
+        local c = a:byte(i)
+        for _, d in ipairs(edge) do
+            if lower(string.char(d)) ~= lower(string.char(c)) then
+                b = a:sub(1, i - 1) .. string.char(d) .. a:sub(i + 1)
+                local expect = lower(string.char(c)):byte() - lower(string.char(d)):byte()
+                assert(name.cmp(a, nil, b, nil) == expect, "cmp differs from scalar at length " .. len)
+                assert(name.cmp(b, nil, a, nil) == -expect)
+                assert(not name.equal(a, nil, b, nil))
+            end
+        end
+
+        -- a prefix orders first
+        assert(name.cmp(a, nil, a .. "x", nil) == -1 and name.cmp(a .. "x", nil, a, nil) == 1)
+    end
+end
+
+-- non-ASCII bytes are not case folded
+assert(name.cmp("\193", nil, "\225", nil) == 193 - 225)
+assert(name.hash(string.rep("\193", 33)) ~= name.hash(string.rep("\225", 33)))
+assert(name.hash("@[") ~= name.hash("`{"))
+
+-- pointer and length and Lua string arguments are in the same order
+local www = name.wire("WWW.Example.COM.")
+local zone = name.wire("example.com")
+assert(www == "\3WWW\7Example\3COM\0" and zone == "\7example\3com\0")
+assert(name.labels(www) == 3 and name.labels(name.wire(".")) == 0)
+assert(name.suffix(www, nil, 2) == 4 and name.suffix(www, nil, 0) == #www - 1)
+assert(name.suffix(www, nil, 4) == nil)
+assert(name.equal(www:sub(5), nil, zone, nil))
+assert(name.is_subdomain(www, nil, zone) and name.is_subdomain(zone, nil, zone))
+assert(not name.is_subdomain(name.wire("wwwexample.com"), nil, zone))
+assert(not name.is_subdomain(zone, nil, www))
+local buf = require("ffi").new("uint8_t[?]", #www + 1)
+require("ffi").copy(buf, www .. "x", #www + 1)
+assert(name.is_subdomain(buf, #www, zone) and name.hash(buf, #www) == name.hash(www))
+assert(name.cmp(buf, #www, www, nil) == 0 and name.cmp(buf, #www + 1, www, nil) == 1)
@@ -0,0 +1,218 @@
+-- Test cases for dnsjit.output.dnssim against dnsjit.lib.responder
+local object = require("dnsjit.core.objects")
+local clock = require("dnsjit.lib.clock")
+
+local resp = require("dnsjit.lib.responder").new()
+resp:threads(2)
+resp:rcode(3)
+assert(resp:udp("127.0.0.1", 0) == 0, "udp failed")
+assert(resp:tcp("127.0.0.1", 0) == 0, "tcp failed")
+assert(resp:tls("127.0.0.1", 0) == 0, "tls failed")
+assert(resp:https2("127.0.0.1", 0) == 0, "https2 failed")
+assert(resp:start() == 0, "start failed")
+local udp, tcp, tls, https2 = resp:ports()
+
+-- replay the queries of the capture, one client per source address
+local function simulate(setup, timeout)
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    local split = require("dnsjit.filter.ipsplit").new()
+    local copy = require("dnsjit.filter.copy").new()
+    local sim = require("dnsjit.output.dnssim").new(100)
+    setup(sim)
+    sim:timeout(timeout or 5)
+    sim:free_after_use(true)
+    copy:obj_type(object.IP)
+    copy:obj_type(object.IP6)
+    copy:obj_type(object.PAYLOAD)
+    copy:receiver(sim)
+    split:overwrite_dst()
+    split:receiver(copy)
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+    local recv, rctx = split:receive()
+
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local pl = obj:cast()
+        if obj:type() == "payload" and pl.len > 0 and obj:prev():cast().dport == 53 then
+            recv(rctx, obj)
+            sim:run_nowait()
+        end
+    end
+    local deadline = clock.monotonic() + 10
+    while tonumber(sim.obj.ongoing) > 0 and clock.monotonic() < deadline do
+        sim:run_nowait()
+    end
+    assert(tonumber(sim.obj.ongoing) == 0, "requests still ongoing")
+    assert(sim:discarded() == 0, "requests discarded")
+    return sim
+end
+
+local function check(sim, name)
+    local stats = sim.obj.stats_sum
+    assert(sim:requests() == 41, name .. ": not all queries sent")
+    assert(sim:answers() == 41, name .. ": not all queries answered")
+    assert(tonumber(stats.rcode_nxdomain) == 41, name .. ": answers without rcode NXDOMAIN")
+    assert(tonumber(stats.conn_handshakes_done) > 0, name .. ": no handshakes done")
+    assert(tonumber(stats.conn_handshakes_failed) == 0, name .. ": handshakes failed")
+    assert(sim:latency_percentile(100) > 0, name .. ": no latency recorded")
+end
+
+local sim = simulate(function(sim)
+    sim:tcp()
+    assert(sim:target("127.0.0.1", tcp) == 0, "tcp target failed")
+end)
+check(sim, "tcp")
+
+-- DNS-over-TLS
+sim = simulate(function(sim)
+    sim:tls()
+    assert(sim:target("127.0.0.1", tls) == 0, "tls target failed")
+end)
+check(sim, "tls")
+
+-- with a server name and verification the self-signed certificate of the
+-- responder is rejected
+sim = simulate(function(sim)
+    sim:tls()
+    sim:tls_server_name("dns.example")
+    sim:tls_verify()
+    assert(sim:target("127.0.0.1", tls) == 0, "tls target failed")
+end, 1)
+assert(sim:requests() == 41 and sim:answers() == 0, "tls verify: unverified server answered")
+assert(tonumber(sim.obj.stats_sum.conn_handshakes_done) == 0, "tls verify: handshakes done")
+assert(tonumber(sim.obj.stats_sum.conn_handshakes_failed) > 0, "tls verify: no handshakes failed")
+
+-- DNS-over-HTTPS
+sim = simulate(function(sim)
+    sim:https2({ method = "POST" })
+    assert(sim:target("127.0.0.1", https2) == 0, "https2 target failed")
+end)
+check(sim, "https2 post")
+assert(tonumber(sim.obj.stats_sum.http2_streams) == 41, "https2 post: not all streams closed")
+
+sim = simulate(function(sim)
+    sim:https2({ method = "GET", authority = "localhost" })
+    assert(sim:target("127.0.0.1", https2) == 0, "https2 target failed")
+end)
+check(sim, "https2 get")
+assert(tonumber(sim.obj.stats_sum.http2_status_other) == 0, "https2 get: responses without status 200")
+
+local stats = resp:stats()
+assert(stats.queries == 164 and stats.answers == 164, "responder statistics do not add up")
+assert(stats.errors == 0, "responder errors")
+
+-- DNS-over-QUIC, lib.responder does not answer QUIC so the queries sent to
+-- its plain UDP listener must time out without a handshake
+if sim.have_quic() then
+    sim = simulate(function(sim)
+        sim:quic()
+        assert(sim:target("127.0.0.1", udp) == 0, "quic target failed")
+    end, 1)
+    assert(sim:requests() == 41, "quic: not all queries sent")
+    assert(sim:answers() == 0, "quic: answers from a non-QUIC server")
+    assert(tonumber(sim.obj.stats_sum.conn_handshakes_done) == 0, "quic: handshake with a non-QUIC server")
+
+    -- the handshake, streams and answers need a real DoQ server, given as
+    -- "address port" in DNSJIT_TEST_DOQ_SERVER
+    local server = os.getenv("DNSJIT_TEST_DOQ_SERVER")
+    local addr, port
+    if server then
+        addr, port = server:match("^(%S+)%s+(%d+)$")
+        assert(addr, "DNSJIT_TEST_DOQ_SERVER must be \"address port\"")
+    end
+    if addr then
+        sim = simulate(function(sim)
+            sim:quic()
+            assert(sim:target(addr, tonumber(port)) == 0, "quic target failed")
+        end)
+        assert(sim:requests() == 41 and sim:answers() == 41, "quic: not all queries answered")
+        assert(tonumber(sim.obj.stats_sum.quic_streams) == 41, "quic: not all streams answered")
+        assert(tonumber(sim.obj.stats_sum.conn_handshakes_done) > 0, "quic: no handshakes done")
+        assert(tonumber(sim.obj.stats_sum.conn_handshakes_failed) == 0, "quic: handshakes failed")
+        assert(sim:latency_percentile(100) > 0, "quic: no latency recorded")
+    else
+        print("skipping DNS-over-QUIC answers, no QUIC server (set DNSJIT_TEST_DOQ_SERVER)")
+    end
+else
+    print("skipping DNS-over-QUIC, not built with ngtcp2")
+end
+resp:stop()
+
+-- GOAWAY after every 4 streams, refused queries go over new connections
+resp:goaway_after(4)
+assert(resp:start() == 0, "restart failed")
+_, _, _, https2 = resp:ports()
+sim = simulate(function(sim)
+    sim:https2()
+    assert(sim:target("127.0.0.1", https2) == 0, "https2 target failed")
+end)
+check(sim, "https2 goaway")
+assert(tonumber(sim.obj.stats_sum.conn_handshakes_done) > 3, "https2 goaway: connections not replaced")
+resp:stop()
+
+-- dual-stack, a responder for each address family
+local resp4 = require("dnsjit.lib.responder").new()
+local resp6 = require("dnsjit.lib.responder").new()
+resp4:rcode(3)
+resp6:rcode(3)
+assert(resp4:udp("127.0.0.1", 0) == 0 and resp4:tcp("127.0.0.1", 0) == 0, "ipv4 responder failed")
+assert(resp6:udp("::1", 0) == 0 and resp6:tcp("::1", 0) == 0, "ipv6 responder failed")
+assert(resp4:start() == 0 and resp6:start() == 0, "start failed")
+local udp4, tcp4 = resp4:ports()
+local udp6, tcp6 = resp6:ports()
+
+-- the queries sent over each family must be answered by the responder of
+-- that family and be accounted to it
+local sent4, sent6 = 0, 0
+local function families(sim, name)
+    local stats = sim.obj.stats_sum
+    local ip4, ip6 = tonumber(stats.requests_ip4), tonumber(stats.requests_ip6)
+    assert(sim:requests() == 41 and sim:answers() == 41, name .. ": not all queries answered")
+    assert(ip4 + ip6 == 41, name .. ": requests not accounted to a family")
+    assert(tonumber(stats.answers_ip4) == ip4 and tonumber(stats.answers_ip6) == ip6, name .. ": answers not accounted to their family")
+    assert(tonumber(stats.rcode_nxdomain) == 41, name .. ": answers without rcode NXDOMAIN")
+    sent4, sent6 = sent4 + ip4, sent6 + ip6
+    assert(resp4:stats().queries == sent4 and resp6:stats().queries == sent6, name .. ": queries sent over another family than accounted")
+    return ip4, ip6
+end
+
+-- without sources the targets of both families are used in turns
+sim = simulate(function(sim)
+    sim:udp_only()
+    assert(sim:target("127.0.0.1", udp4) == 0 and sim:target("::1", udp6) == 0, "udp targets failed")
+end)
+local ip4, ip6 = families(sim, "udp dual-stack")
+assert(math.abs(ip4 - ip6) <= 1, "udp dual-stack: targets not used in turns")
+
+-- with sources of both families each query goes to the target of the family
+-- of its source
+sim = simulate(function(sim)
+    sim:udp_only()
+    assert(sim:target("::1", udp6) == 0 and sim:target("127.0.0.1", udp4) == 0, "udp targets failed")
+    assert(sim:bind("127.0.0.1") == 0 and sim:bind("::1") == 0, "bind failed")
+end)
+ip4, ip6 = families(sim, "udp sources")
+assert(math.abs(ip4 - ip6) <= 1, "udp sources: sources not used in turns")
+
+-- sources without a target of their family are skipped
+sim = simulate(function(sim)
+    sim:udp_only()
+    assert(sim:target("::1", udp6) == 0, "udp target failed")
+    assert(sim:bind("127.0.0.1") == 0 and sim:bind("::1") == 0, "bind failed")
+end)
+ip4, ip6 = families(sim, "udp ipv6 only")
+assert(ip4 == 0 and ip6 == 41, "udp ipv6 only: ipv4 source used")
+
+sim = simulate(function(sim)
+    sim:tcp()
+    assert(sim:target("127.0.0.1", tcp4) == 0, "tcp target failed")
+    assert(sim:bind("::1") == 0 and sim:bind("127.0.0.1") == 0, "bind failed")
+end)
+ip4, ip6 = families(sim, "tcp ipv4 only")
+assert(ip4 == 41 and ip6 == 0, "tcp ipv4 only: ipv6 source used")
+resp4:stop()
+resp6:stop()
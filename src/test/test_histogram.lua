@@ -0,0 +1,70 @@
+-- Test cases for dnsjit.lib.histogram
+local Histogram = require("dnsjit.lib.histogram")
+
+-- percentiles of 1..n are reported as the highest value of their bucket,
+-- which is at most the relative error of the precision above the real one
+local n = 100000
+for digits, err in pairs({ 0.1, 0.01, 0.001 }) do
+    local hist = Histogram.new(1, n, digits)
+    for v = 1, n do
+        hist:record(v)
+    end
+    assert(hist:count() == n)
+    assert(hist:min() == 1 and hist:max() == n)
+    assert(hist:mean() == (n + 1) / 2, "mean is not exact")
+    for _, p in ipairs({ 1, 10, 25, 50, 75, 90, 99, 99.9, 99.99 }) do
+        local expected = math.floor(p / 100 * n + 0.5)
+        local v = hist:percentile(p)
+        assert(v >= expected and v - expected <= expected * err,
+            string.format("p%g with %d digits: %d, expected %d", p, digits, v, expected))
+    end
+    assert(hist:percentile(0) == 1 and hist:percentile(100) == n)
+
+    local count = 0
+    local last = -1
+    for lowest, highest, c in hist:buckets() do
+        assert(lowest > last and highest >= lowest, "buckets overlap")
+        count = count + c
+        last = highest
+    end
+    assert(count == n, "bucket counts do not add up")
+end
+
+-- values above highest are counted as highest, values below lowest keep
+-- their value for min
+local hist = Histogram.new(1000, 1000000, 2)
+hist:record(5000000)
+assert(hist:max() == 1000000 and hist:percentile(100) == 1000000)
+hist:record(10, 3)
+assert(hist:count() == 4)
+assert(hist:min() == 10 and hist:percentile(50) < 1000)
+hist:reset()
+assert(hist:count() == 0 and hist:min() == 0 and hist:max() == 0 and hist:percentile(50) == 0)
+
+-- merging equals recording all values in one histogram
+local a = Histogram.new(1000, 10000000000, 2)
+local b = Histogram.new(1000, 10000000000, 2)
+local all = Histogram.new(1000, 10000000000, 2)
+for i = 1, 1000 do
+    local v = i * i * 1000
+    if i % 3 == 0 then
+        a:record(v)
+    else
+        b:record(v)
+    end
+    all:record(v)
+end
+assert(a:merge(b), "merge failed")
+assert(a:count() == all:count() and a:min() == all:min() and a:max() == all:max())
+assert(a:mean() == all:mean())
+for _, p in ipairs({ 0, 10, 50, 90, 99, 100 }) do
+    assert(a:percentile(p) == all:percentile(p), "merged p" .. p .. " differs")
+end
+
+-- a smaller range is merged into the top bucket, another precision not at all
+local small = Histogram.new(1000, 1000000, 2)
+small:record(5000)
+assert(small:merge(all), "merge of smaller range failed")
+assert(small:count() == 1001 and small:max() == 1000000)
+assert(not small:merge(Histogram.new(1000, 1000000, 3)), "merge of different precision not rejected")
+assert(not small:merge(Histogram.new(1, 1000000, 2)), "merge of different lowest not rejected")
@@ -0,0 +1,50 @@
+-- Test cases for dnsjit.filter.hll
+local function run(hll)
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+
+    local rollovers = 0
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        if hll:process(obj) then
+            rollovers = rollovers + 1
+        end
+    end
+    return rollovers
+end
+
+local hll = require("dnsjit.filter.hll").new()
+hll:interval(60)
+assert(run(hll) == 1, "expected one rollover")
+assert(hll:intervals() == 1)
+assert(hll:last_start() == 1476976980, "interval not aligned to the epoch")
+assert(hll:queries() == 41, "not all queries counted")
+
+assert(hll:estimate("client") == 1)
+assert(hll:estimate("prefix") == 1)
+assert(hll:estimate("qname") == 2)
+assert(hll:estimate("qname_qtype") == 2)
+assert(hll:estimate("client", "last") == 1)
+assert(hll:estimate("client", "current") == 1)
+
+local state = "test-hll.state.out"
+assert(hll:save(state) == 0, "saving state failed")
+local loaded = require("dnsjit.filter.hll").new()
+assert(loaded:load(state) == 0, "loading state failed")
+assert(loaded:estimate("qname") == 2)
+assert(require("dnsjit.filter.hll").new(10):load(state) ~= 0, "load of different precision not rejected")
+os.remove(state)
+
+local names = require("dnsjit.filter.hll").new()
+names:fields("qname")
+run(names)
+assert(names:estimate("qname") == 2 and names:estimate("client") == 0)
+assert(loaded:merge(names) == 0, "merge failed")
+assert(loaded:estimate("qname") == 2)
+
+hll:reset()
+assert(hll:estimate("client") == 0 and hll:intervals() == 0)
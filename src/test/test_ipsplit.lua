@@ -293,3 +293,67 @@ while true do
         assert(ip_pkt(obj):destination() == "8.8.8.8")
     end
 end
+
+-----------------------------------------------------
+--   pellets.pcap: overlaid copies from input.merge
+--
+-- Packets tagged with a source index are different
+-- clients for each source, untagged packets are
+-- split by address only.
+-----------------------------------------------------
+local function clients(merge)
+    local layer = require("dnsjit.filter.layer").new()
+    local ipsplit = require("dnsjit.filter.ipsplit").new()
+    local copy = require("dnsjit.filter.copy").new()
+    local out = require("dnsjit.core.channel").new(512)
+
+    layer:producer(merge)
+    copy:obj_type(object.IP)
+    copy:obj_type(object.IP6)
+    copy:obj_type(object.PAYLOAD)
+    copy:receiver(out)
+    ipsplit:receiver(copy)
+    ipsplit:overwrite_src()
+
+    local prod, pctx = layer:produce()
+    local recv, rctx = ipsplit:receive()
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        recv(rctx, obj)
+    end
+    out:close()
+    assert(ipsplit:discarded() == 0, "some valid packets have been discarded")
+
+    local ids, n = {}, 0
+    while true do
+        local obj = out:get()
+        if obj == nil then break end
+        local id = ffi.cast("uint32_t*", ip_pkt(obj).src)[0]
+        if not ids[id] then
+            ids[id] = true
+            n = n + 1
+        end
+    end
+    return n
+end
+
+local function pellets()
+    local input = require("dnsjit.input.fpcap").new()
+    assert(input:open("pellets.pcap-dist") == 0, "fpcap open failed")
+    return input
+end
+
+local merge = require("dnsjit.input.merge").new()
+merge:add(pellets())
+local single = clients(merge)
+assert(single > 1, "no clients")
+
+merge = require("dnsjit.input.merge").new()
+merge:overlay(pellets, 3)
+assert(clients(merge) == 3 * single, "copies share clients")
+
+merge = require("dnsjit.input.merge").new()
+merge:add(pellets())
+merge:add(pellets(), 1.0)
+assert(clients(merge) == single, "untagged copies are not the same clients")
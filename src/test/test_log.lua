@@ -0,0 +1,48 @@
+-- Test cases for the rate limiting and asynchronous output of
+-- dnsjit.core.log, the output is checked by test-log.sh
+local log = require("dnsjit.core.log")
+local clock = require("dnsjit.lib.clock")
+local l = log.new("test")
+l:enable("info")
+
+local function now()
+    local sec, nsec = clock.monotonic()
+    return sec + nsec / 1e9
+end
+
+local function wait(s)
+    local stop = now() + s
+    while now() < stop do end
+end
+
+-- 3 messages per 50ms, the rest are counted and reported with the next
+-- message after the interval
+log.ratelimit(3, 0.05)
+for i = 1, 10 do
+    log.info(l, "limited %s", tostring(i))
+end
+wait(0.1)
+log.info(l, "limited %s", "11")
+-- critical messages are never limited
+for i = 1, 10 do
+    log.critical(l, "critical %s", tostring(i))
+end
+log.ratelimit(0)
+for i = 1, 10 do
+    log.info(l, "unlimited %s", tostring(i))
+end
+
+-- queued and written in order by the writer thread
+log.async(true)
+for i = 1, 100 do
+    log.info(l, "async %s", tostring(i))
+end
+log.flush()
+
+-- every message is either written or counted as dropped
+local dropped = log.dropped()
+for i = 1, 200000 do
+    log.info(l, "bulk %s", tostring(i))
+end
+log.async(false)
+print("dropped() " .. (log.dropped() - dropped))
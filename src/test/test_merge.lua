@@ -0,0 +1,84 @@
+-- Test cases for dnsjit.input.merge
+
+-- Return a function that asserts the packets are in timestamp order and
+-- that packets with equal timestamps come in the order of their sources.
+local function ordered()
+    local sec, nsec, source
+    return function(pcap)
+        local s, ns = tonumber(pcap.ts.sec), tonumber(pcap.ts.nsec)
+        if sec ~= nil then
+            assert(s > sec or (s == sec and ns >= nsec), "timestamp went backwards")
+            if s == sec and ns == nsec then
+                assert(pcap.source >= source, "equal timestamps not in source order")
+            end
+        end
+        sec, nsec, source = s, ns, pcap.source
+    end
+end
+
+local function run(readahead, offset)
+    local merge = require("dnsjit.input.merge").new()
+    local fpcap = require("dnsjit.input.fpcap").new()
+    local mmpcap = require("dnsjit.input.mmpcap").new()
+    assert(fpcap:open("dns.pcap-dist") == 0, "fpcap open failed")
+    assert(mmpcap:open("dns.pcap-dist") == 0, "mmpcap open failed")
+    assert(merge:add(fpcap) == 0)
+    assert(merge:add(mmpcap, offset) == 1)
+    merge:tag()
+    merge:readahead(readahead)
+
+    local prod, pctx = merge:produce()
+    local sources = { [0] = 0, [1] = 0 }
+    local check = ordered()
+    local ties, last, first = 0, nil, {}
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local pcap = obj:cast()
+        local ts = tonumber(pcap.ts.sec) .. "." .. tonumber(pcap.ts.nsec)
+        check(pcap)
+        sources[pcap.source] = sources[pcap.source] + 1
+        -- without an offset each copy of a packet meets its original
+        if pcap.source == 1 and last == "0 " .. ts then
+            ties = ties + 1
+        end
+        last = pcap.source .. " " .. ts
+        if first[pcap.source] == nil then
+            first[pcap.source] = tonumber(pcap.ts.sec) + tonumber(pcap.ts.nsec) / 1000000000
+        end
+    end
+    assert(offset or ties > 0, "no equal timestamps merged")
+    assert(math.abs(first[1] - first[0] - (offset or 0)) < 0.000001, "offset not applied")
+
+    assert(merge:packets() == 266, "not all packets merged")
+    assert(merge:packets(0) == 133 and merge:packets(1) == 133, "wrong packets per source")
+    assert(sources[0] == 133 and sources[1] == 133, "wrong source tags")
+end
+
+run(1)
+run(16)
+run(1, 0.25)
+run(16, 0.25)
+
+-- overlaid copies are shifted by the spacing and tagged
+local merge = require("dnsjit.input.merge").new()
+merge:overlay(function()
+    local input = require("dnsjit.input.fpcap").new()
+    assert(input:open("dns.pcap-dist") == 0, "fpcap open failed")
+    return input
+end, 3, 0.5)
+local prod, pctx = merge:produce()
+local first = {}
+local check = ordered()
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local pcap = obj:cast()
+    check(pcap)
+    if first[pcap.source] == nil then
+        first[pcap.source] = tonumber(pcap.ts.sec) + tonumber(pcap.ts.nsec) / 1000000000
+    end
+end
+assert(merge:packets() == 399, "not all packets merged")
+assert(math.abs(first[1] - first[0] - 0.5) < 0.000001, "copy 1 not shifted")
+assert(math.abs(first[2] - first[0] - 1.0) < 0.000001, "copy 2 not shifted")
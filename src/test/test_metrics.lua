@@ -0,0 +1,58 @@
+-- Test cases for dnsjit.core.metrics
+local metrics = require("dnsjit.core.metrics")
+
+-- read the capture through filter.layer and check that the module metrics
+-- add up
+local input = require("dnsjit.input.fpcap").new()
+local layer = require("dnsjit.filter.layer").new()
+assert(input:open("dns.pcap-dist") == 0, "fpcap open failed")
+layer:producer(input)
+local prod, pctx = layer:produce()
+local n = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    n = n + 1
+end
+
+assert(metrics.value("dnsjit_input_packets_total", "module=\"input.fpcap\"") == 133, "wrong input packets")
+assert(metrics.value("dnsjit_layer_packets_total") + metrics.value("dnsjit_layer_errors_total") == 133, "wrong layer packets")
+assert(metrics.value("dnsjit_layer_packets_total") == n, "layer packets differ from produced")
+
+-- custom metrics, snapshots and merging
+local c = metrics.counter("test_total", "kind=\"a\"", "Test counter")
+assert(metrics.counter("test_total", "kind=\"a\"") == c, "registering again gave another slot")
+metrics.inc(c)
+metrics.inc(c, 4)
+local g = metrics.gauge("test_gauge")
+metrics.inc(g)
+metrics.dec(g)
+metrics.dec(g)
+local h = metrics.histogram("test_seconds", nil, "Test histogram", { 10, 100 }, 0.001)
+metrics.observe(h, 5)
+metrics.observe(h, 50)
+metrics.observe(h, 500)
+
+local snap = metrics.snapshot()
+assert(snap:value("test_total", "kind=\"a\"") == 5, "wrong counter")
+assert(snap:value("test_gauge") == -1, "wrong gauge")
+assert(snap:value("test_seconds") == 3, "wrong histogram count")
+snap:merge(metrics.snapshot())
+assert(snap:value("test_total", "kind=\"a\"") == 10, "wrong merged counter")
+
+local text = metrics.text()
+assert(text:find("# TYPE test_total counter\n", 1, true), "missing TYPE")
+assert(text:find("test_total{kind=\"a\"} 5\n", 1, true), "missing counter")
+assert(text:find("test_gauge -1\n", 1, true), "missing gauge")
+assert(text:find("test_seconds_bucket{le=\"0.01\"} 1\n", 1, true), "missing bucket")
+assert(text:find("test_seconds_bucket{le=\"0.1\"} 2\n", 1, true), "missing bucket")
+assert(text:find("test_seconds_bucket{le=\"+Inf\"} 3\n", 1, true), "missing +Inf bucket")
+assert(text:find("test_seconds_sum 0.555\n", 1, true), "missing sum")
+
+-- file export
+assert(metrics.export_file("metrics.prom") == 0, "export failed")
+local f = assert(io.open("metrics.prom"))
+local content = f:read("*a")
+f:close()
+os.remove("metrics.prom")
+assert(content:find("dnsjit_input_packets_total{module=\"input.fpcap\"} 133\n", 1, true), "missing input packets in file")
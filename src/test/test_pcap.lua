@@ -0,0 +1,53 @@
+-- Test cases for dnsjit.output.pcap
+local function run(output, file)
+    local input = require("dnsjit.input.pcap").new()
+    input:open_offline("dns.pcap-dist")
+    assert(output:open(file, input:linktype(), input:snaplen()) == 0, "open failed")
+    local prod, pctx = input:produce()
+    local recv, rctx = output:receive()
+
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        recv(rctx, obj)
+    end
+    output:close()
+    assert(output:packets() == 133, "not all packets written")
+    assert(output:errors() == 0, "write errors")
+end
+
+local function read(file)
+    local f = io.open(file, "rb")
+    local data = f:read("*a")
+    f:close()
+    return data
+end
+
+local orig = read("dns.pcap-dist")
+local file = "test-pcap.pcap.out"
+
+-- a small buffer to exercise the flushing thread
+local output = require("dnsjit.output.pcap").new()
+output:buffer_size(4096)
+run(output, file)
+assert(read(file) == orig, "written PCAP differs from input")
+os.remove(file)
+
+output = require("dnsjit.output.pcap").new()
+output:format("pcapng")
+run(output, file)
+local data = read(file)
+assert(#data == output:bytes(), "bytes written does not match file size")
+assert(data:sub(1, 4) == "\10\13\13\10", "missing section header block")
+os.remove(file)
+
+output = require("dnsjit.output.pcap").new()
+output:rotate(5000)
+run(output, file)
+assert(output:files() == 5, "wrong number of files")
+local size = 0
+for n = 0, 4 do
+    size = size + #read(file .. "." .. n)
+    os.remove(file .. "." .. n)
+end
+assert(size == output:bytes(), "bytes written does not match file sizes")
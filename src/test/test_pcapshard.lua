@@ -0,0 +1,198 @@
+-- Test cases for dnsjit.output.pcapshard
+local ffi = require("ffi")
+local C = ffi.C
+local object = require("dnsjit.core.objects")
+local file = "test-pcapshard.out"
+
+-- Return the IP/IP6 and UDP/TCP objects of the chain.
+local function layers(obj)
+    local ip, l4
+    obj = ffi.cast("core_object_t*", obj)
+    while obj ~= nil do
+        if obj.obj_type == object.UDP or obj.obj_type == object.TCP then
+            l4 = obj:cast()
+        elseif obj.obj_type == object.IP or obj.obj_type == object.IP6 then
+            ip = obj:cast()
+        end
+        obj = obj.obj_prev
+    end
+    return ip, l4
+end
+
+local function run(output)
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+    assert(output:open(file, input:linktype(), input:snaplen()) == 0, "open failed")
+    local recv, rctx = output:receive()
+
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        recv(rctx, obj)
+    end
+    output:close()
+    assert(output:packets() + output:discarded() == 133, "not all packets written or discarded")
+
+    for n = 0, output:shards() - 1 do
+        assert(os.remove(file .. "." .. n), "shard file missing")
+    end
+end
+
+local output = require("dnsjit.output.pcapshard").new(4)
+run(output)
+assert(output:clients() > 0, "no clients")
+assert(output:packets(0) > 0, "first client not in first shard")
+
+-- both directions of a flow must end up in the same shard
+output = require("dnsjit.output.pcapshard").new(3)
+output:flow()
+run(output)
+local flow = {}
+for n = 0, 2 do
+    flow[n] = output:packets(n)
+end
+output = require("dnsjit.output.pcapshard").new(3)
+output:flow()
+run(output)
+for n = 0, 2 do
+    assert(output:packets(n) == flow[n], "flow assignment not stable")
+end
+
+-- a query and its response select the same shard
+output = require("dnsjit.output.pcapshard").new(3)
+output:flow()
+local input = require("dnsjit.input.pcap").new()
+local layer = require("dnsjit.filter.layer").new()
+input:open_offline("dns.pcap-dist")
+layer:producer(input)
+local prod, pctx = layer:produce()
+local shard, answered = {}, 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local ip, l4 = layers(obj)
+    if ip and l4 then
+        local s = C.output_pcapshard_select(output.obj, obj)
+        local src = ip:source() .. "#" .. l4.sport
+        local dst = ip:destination() .. "#" .. l4.dport
+        assert(s >= 0 and s < 3, "invalid shard")
+        if shard[dst .. " " .. src] ~= nil then
+            assert(shard[dst .. " " .. src] == s, "query and response in different shards")
+            answered = answered + 1
+        end
+        shard[src .. " " .. dst] = s
+    end
+end
+assert(answered > 0, "no responses seen")
+
+-- sequential mode assigns clients the same way as filter.ipsplit
+output = require("dnsjit.output.pcapshard").new(2)
+input = require("dnsjit.input.pcap").new()
+layer = require("dnsjit.filter.layer").new()
+local copy = require("dnsjit.filter.copy").new()
+local ipsplit = require("dnsjit.filter.ipsplit").new()
+local out = { require("dnsjit.core.channel").new(256), require("dnsjit.core.channel").new(256) }
+input:open_offline("pellets.pcap-dist")
+layer:producer(input)
+ipsplit:receiver(out[1])
+ipsplit:receiver(out[2])
+copy:obj_type(object.IP)
+copy:obj_type(object.IP6)
+copy:obj_type(object.PAYLOAD)
+copy:receiver(ipsplit)
+prod, pctx = layer:produce()
+local recv, rctx = copy:receive()
+local client, clients = {}, 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    local ip = layers(obj)
+    local s = C.output_pcapshard_select(output.obj, obj)
+    if client[ip:source()] == nil then
+        client[ip:source()] = s
+        clients = clients + 1
+    end
+    assert(client[ip:source()] == s, "client moved to another shard")
+    recv(rctx, obj)
+end
+out[1]:close()
+out[2]:close()
+assert(clients > 2 and output:clients() == clients, "not all clients seen")
+for n = 1, 2 do
+    local seen = 0
+    while true do
+        local obj = out[n]:get()
+        if obj == nil then break end
+        assert(client[layers(obj):source()] == n - 1, "client in a different shard than ipsplit receiver")
+        seen = seen + 1
+    end
+    assert(seen > 0, "no packets for receiver")
+end
+
+output = require("dnsjit.output.pcapshard").new(2)
+output:client()
+output:format("pcapng")
+run(output)
+
+-- overlaid copies from input.merge are different clients, untagged
+-- packets are assigned by address only
+local function pellets()
+    local input = require("dnsjit.input.fpcap").new()
+    assert(input:open("pellets.pcap-dist") == 0, "fpcap open failed")
+    return input
+end
+
+local function assign(merge, mode)
+    local shard = require("dnsjit.output.pcapshard").new(8)
+    local layer = require("dnsjit.filter.layer").new()
+    local result = {}
+    shard[mode](shard)
+    layer:producer(merge)
+    local prod, pctx = layer:produce()
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local pcap = ffi.cast("core_object_t*", obj)
+        while pcap.obj_type ~= object.PCAP do
+            pcap = pcap.obj_prev
+        end
+        local key = layers(obj):source() .. "/" .. pcap:cast().source
+        local s = C.output_pcapshard_select(shard.obj, obj)
+        assert(result[key] == nil or result[key] == s, "client moved to another shard")
+        result[key] = s
+    end
+    return shard, result
+end
+
+-- Merge copies of pellets.pcap, tagged as overlaid copies or untagged.
+local function merged(copies, tagged)
+    local merge = require("dnsjit.input.merge").new()
+    if tagged then
+        merge:overlay(pellets, copies)
+        return merge
+    end
+    for n = 0, copies - 1 do
+        merge:add(pellets(), n * 1.0)
+    end
+    return merge
+end
+
+local single = assign(merged(1), "sequential"):clients()
+assert(single > 1, "no clients")
+assert(assign(merged(3, true), "sequential"):clients() == 3 * single, "copies share clients")
+assert(assign(merged(3), "sequential"):clients() == single, "untagged copies are not the same clients")
+
+local _, plain = assign(merged(1), "client")
+local _, tagged = assign(merged(3, true), "client")
+local moved = 0
+for key, s in pairs(plain) do
+    local address = key:sub(1, -3)
+    assert(tagged[address .. "/0"] == s, "first copy not assigned as untagged")
+    if tagged[address .. "/1"] ~= s or tagged[address .. "/2"] ~= s then
+        moved = moved + 1
+    end
+end
+assert(moved > 0, "copies not assigned as different clients")
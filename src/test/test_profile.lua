@@ -0,0 +1,60 @@
+-- Test cases for dnsjit.core.profile
+local profile = require("dnsjit.core.profile")
+profile.enable(2)
+
+local input = require("dnsjit.input.fpcap").new()
+local layer = require("dnsjit.filter.layer").new()
+assert(input:open("dns.pcap-dist") == 0, "fpcap open failed")
+
+local s_input = profile.stage("fpcap")
+local s_layer = profile.stage("layer")
+s_input:producer(input)
+layer:producer(s_input)
+s_layer:producer(layer)
+
+local prod, pctx = s_layer:produce()
+local n = 0
+while true do
+    local obj = prod(pctx)
+    if obj == nil then break end
+    n = n + 1
+end
+
+assert(n == 133, "wrong number of packets")
+assert(s_input:packets() == 133 and s_layer:packets() == 133, "wrong stage packets")
+assert(s_layer:sampled() > 60 and s_layer:sampled() == s_input:sampled(), "wrong sampling")
+assert(s_layer:cycles() >= s_input:cycles(), "outer stage faster than nested")
+assert(s_layer:self_cycles() == s_layer:cycles() - s_input:cycles(), "wrong self cycles")
+assert(profile.report("profile.txt") == 0, "report failed")
+assert(profile.folded("profile.folded") == 0, "folded report failed")
+
+local f = assert(io.open("profile.folded"))
+local folded = f:read("*a")
+f:close()
+os.remove("profile.txt")
+os.remove("profile.folded")
+assert(folded:find("^layer;fpcap %d+\n"), "missing nested stage in folded report")
+
+-- polling an exhausted producer is neither a packet nor timed
+profile.enable(1)
+input = require("dnsjit.input.fpcap").new()
+layer = require("dnsjit.filter.layer").new()
+assert(input:open("dns.pcap-dist") == 0, "fpcap open failed")
+s_input = profile.stage("fpcap all")
+s_layer = profile.stage("layer all")
+s_input:producer(input)
+layer:producer(s_input)
+s_layer:producer(layer)
+
+prod, pctx = s_layer:produce()
+n = 0
+while prod(pctx) ~= nil do
+    n = n + 1
+end
+for _ = 1, 10 do
+    assert(prod(pctx) == nil)
+end
+
+assert(n == 133 and s_layer:packets() == 133 and s_input:packets() == 133, "wrong stage packets")
+assert(s_layer:sampled() == 133 and s_input:sampled() == 133, "end of input timed")
+assert(s_layer:self_cycles() == s_layer:cycles() - s_input:cycles(), "wrong self cycles")
@@ -0,0 +1,64 @@
+-- Test cases for dnsjit.filter.qrmatch
+local function run(qrmatch, first, last)
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+
+    local n = 0
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        n = n + 1
+        if n >= first and n <= last then
+            local match = qrmatch:process(obj)
+            if match ~= nil then
+                assert(match.rtt_ns > 0, "response before query")
+                assert(match.server_port == 53, "server port is not 53")
+            end
+        end
+    end
+end
+
+-----------------------------------------------------
+--   dns.pcap: 41 UDP queries, 41 responses and
+--   ICMP packets which are discarded
+-----------------------------------------------------
+local qrmatch = require("dnsjit.filter.qrmatch").new(1024)
+qrmatch:timeout(60)
+run(qrmatch, 1, math.huge)
+
+assert(qrmatch:queries() == 41, "not all queries processed")
+assert(qrmatch:responses() == 41, "not all responses processed")
+assert(qrmatch:matched() == 41, "not all responses matched")
+assert(qrmatch:unmatched() == 0)
+assert(qrmatch:inflight() == 0)
+assert(qrmatch:timeouts() == 0)
+
+-----------------------------------------------------
+--   Save and load state in the middle of the PCAP
+-----------------------------------------------------
+local state = "test-qrmatch.state.out"
+local first = require("dnsjit.filter.qrmatch").new(1024)
+first:timeout(60)
+run(first, 1, 66)
+assert(first:save(state) == 0, "saving state failed")
+
+local second = require("dnsjit.filter.qrmatch").new(1024)
+second:timeout(60)
+assert(second:load(state) == 0, "loading state failed")
+assert(second:inflight() == first:inflight(), "state not fully loaded")
+run(second, 67, math.huge)
+
+assert(first:matched() + second:matched() == 41, "responses lost across state save/load")
+assert(second:inflight() == 0)
+os.remove(state)
+
+-----------------------------------------------------
+--   Table full: oldest queries are evicted
+-----------------------------------------------------
+local small = require("dnsjit.filter.qrmatch").new(1)
+small:timeout(60)
+run(small, 1, math.huge)
+assert(small:matched() + small:evicted() == 41)
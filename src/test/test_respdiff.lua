@@ -0,0 +1,118 @@
+-- Test cases for dnsjit.output.respdiff
+local Respdiff = require("dnsjit.output.respdiff")
+if not Respdiff.have_lmdb() then
+    print("skipping, no LMDB support")
+    return
+end
+
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local C = ffi.C
+
+ffi.cdef [[
+typedef struct MDB_txn MDB_txn;
+typedef struct MDB_val {
+    size_t      mv_size;
+    const void* mv_data;
+} MDB_val;
+typedef struct MDB_stat {
+    unsigned int ms_psize, ms_depth;
+    size_t       ms_branch_pages, ms_leaf_pages, ms_overflow_pages, ms_entries;
+} MDB_stat;
+int  mdb_txn_begin(void* env, MDB_txn* parent, unsigned int flags, MDB_txn** txn);
+void mdb_txn_abort(MDB_txn* txn);
+int  mdb_get(MDB_txn* txn, unsigned int dbi, MDB_val* key, MDB_val* data);
+int  mdb_stat(MDB_txn* txn, unsigned int dbi, MDB_stat* stat);
+]]
+local MDB_RDONLY = 0x20000
+
+local path = "test-respdiff.lmdb.out"
+local function cleanup()
+    os.remove(path .. "/data.mdb")
+    os.remove(path .. "/lock.mdb")
+    os.remove(path)
+end
+cleanup()
+
+-- records of about 500 bytes in a 64 KB map, which is full after the
+-- first few commits
+local records, per_commit = 2000, 100
+local output = Respdiff.new(path, "orig", "recv", 65536)
+assert(output:commit_interval(per_commit, 3600000) == per_commit)
+local recv, rctx = output:receive()
+
+local function payload(data, prev)
+    local pl = ffi.new("core_object_payload_t")
+    pl.obj_type = object.PAYLOAD
+    pl.obj_prev = prev
+    pl.payload = data
+    pl.len = #data
+    return pl
+end
+
+local function record(i)
+    local query = string.format("query %d ", i) .. string.rep("q", 100 + i % 50)
+    local original = string.format("original %d ", i) .. string.rep("o", 200)
+    local response = i % 2 == 1 and string.format("response %d ", i) .. string.rep("r", 150) or nil
+    return query, original, response
+end
+
+for i = 0, records - 1 do
+    local query, original, response = record(i)
+    local r = response and payload(response) or nil
+    local o = payload(original, r and ffi.cast("core_object_t*", r) or nil)
+    local q = payload(query, ffi.cast("core_object_t*", o))
+    recv(rctx, ffi.cast("core_object_t*", q))
+end
+output:commit(1, 2)
+
+local commits, resizes = output:commits()
+assert(commits == records / per_commit, "not committed every " .. per_commit .. " records")
+assert(resizes > 0, "map size not increased")
+
+-- read back with the environment of the output
+local txn = ffi.new("MDB_txn*[1]")
+assert(C.mdb_txn_begin(output.obj.env, nil, MDB_RDONLY, txn) == 0)
+local qdb = ffi.cast("unsigned int*", output.obj.qdb)[0]
+local rdb = ffi.cast("unsigned int*", output.obj.rdb)[0]
+local meta = ffi.cast("unsigned int*", output.obj.meta)[0]
+local key, val = ffi.new("MDB_val"), ffi.new("MDB_val")
+local id = ffi.new("uint32_t[1]")
+
+local function get(dbi, k, len)
+    key.mv_data = k
+    key.mv_size = len or #k
+    if C.mdb_get(txn[0], dbi, key, val) ~= 0 then return nil end
+    return ffi.string(val.mv_data, val.mv_size)
+end
+
+local function u16(v) return ffi.string(ffi.new("uint16_t[1]", v), 2) end
+local function u32(v) return ffi.string(ffi.new("uint32_t[1]", v), 4) end
+
+local stat = ffi.new("MDB_stat")
+assert(C.mdb_stat(txn[0], qdb, stat) == 0 and stat.ms_entries == records, "queries missing")
+assert(C.mdb_stat(txn[0], rdb, stat) == 0 and stat.ms_entries == records, "answers missing")
+
+-- no records lost or written twice when replayed after growing the map
+for i = 0, records - 1 do
+    local query, original, response = record(i)
+    id[0] = i
+    assert(get(qdb, id, 4) == query, "query " .. i .. " differs")
+    local answer = u32(1) .. u16(#original) .. original
+    if response then
+        answer = answer .. u32(1) .. u16(#response) .. response
+    else
+        answer = answer .. u32(0xffffffff) .. u16(0)
+    end
+    assert(get(rdb, id, 4) == answer, "answer " .. i .. " differs")
+end
+
+assert(get(meta, "version") == "2018-05-21")
+assert(get(meta, "servers") == u32(2))
+assert(get(meta, "name0") == "orig" and get(meta, "name1") == "recv")
+assert(get(meta, "start_time") == u32(1) and get(meta, "end_time") == u32(2))
+C.mdb_txn_abort(txn[0])
+
+output = nil
+collectgarbage()
+cleanup()
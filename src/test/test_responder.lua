@@ -0,0 +1,101 @@
+-- Test cases for dnsjit.lib.responder
+local ffi = require("ffi")
+local bit = require("bit")
+
+local function id(obj)
+    local pl = obj:cast()
+    return pl.payload[0] * 256 + pl.payload[1]
+end
+
+-- the UDP queries of the capture, copied and numbered from 1 so answers can
+-- be matched to them
+local function queries()
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+
+    local list = {}
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local pl = obj:cast()
+        if obj:type() == "payload" and pl.len > 0 and obj:prev():cast().dport == 53 then
+            local copy = obj:copy()
+            local payload = ffi.cast("uint8_t*", copy:cast().payload)
+            payload[0] = bit.rshift(#list + 1, 8)
+            payload[1] = bit.band(#list + 1, 0xff)
+            table.insert(list, copy)
+        end
+    end
+    return list
+end
+
+local function query(client, list)
+    local recv, rctx = client:receive()
+    local prod, pctx = client:produce()
+    local answers = 0
+    for _, obj in ipairs(list) do
+        recv(rctx, obj)
+        local res = prod(pctx)
+        assert(res ~= nil, "receiving failed")
+        local pl = res:cast()
+        if pl.len > 0 then
+            assert(pl.len >= 12, "answer too short")
+            assert(bit.band(pl.payload[2], 0x80) == 0x80, "answer without QR bit")
+            assert(bit.band(pl.payload[3], 0x0f) == 3, "answer without rcode NXDOMAIN")
+            assert(id(res) == id(obj), "answer to another query")
+            answers = answers + 1
+        end
+    end
+    return answers
+end
+
+local list = queries()
+assert(#list == 41, "not all queries found")
+
+local resp = require("dnsjit.lib.responder").new()
+resp:threads(2)
+resp:rcode(3)
+assert(resp:udp("127.0.0.1", 0) == 0, "udp failed")
+assert(resp:tcp("127.0.0.1", 0) == 0, "tcp failed")
+assert(resp:tls("127.0.0.1", 0) == 0, "tls failed")
+assert(resp:start() == 0, "start failed")
+local udp, tcp, tls = resp:ports()
+assert(udp > 0 and tcp > 0 and tls > 0, "ports not bound")
+
+local client = require("dnsjit.output.udpcli").new()
+client:timeout(5, 0)
+assert(client:connect("127.0.0.1", tostring(udp)) == 0, "udp connect failed")
+assert(query(client, list) == 41, "not all udp queries answered")
+
+client = require("dnsjit.output.tcpcli").new()
+client:timeout(5, 0)
+assert(client:connect("127.0.0.1", tostring(tcp)) == 0, "tcp connect failed")
+assert(query(client, list) == 41, "not all tcp queries answered")
+
+client = require("dnsjit.output.tlscli").new()
+client:timeout(5, 0)
+assert(client:connect("127.0.0.1", tostring(tls)) == 0, "tls connect failed")
+assert(query(client, list) == 41, "not all tls queries answered")
+
+local stats = resp:stats()
+assert(stats.queries == 123 and stats.answers == 123, "statistics do not add up")
+assert(stats.connections == 2)
+resp:stop()
+
+-- every query dropped, answers time out
+resp:drop(1.0)
+assert(resp:start() == 0, "restart failed")
+udp = resp:ports()
+client = require("dnsjit.output.udpcli").new()
+client:timeout(0, 100000000)
+assert(client:connect("127.0.0.1", tostring(udp)) == 0, "udp connect failed")
+assert(query(client, { list[1], list[2] }) == 0, "dropped query answered")
+resp:stop()
+assert(resp:stats().dropped == 2, "drops not counted")
+
+for _, obj in ipairs(list) do
+    obj:free()
+end
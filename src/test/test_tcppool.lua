@@ -0,0 +1,152 @@
+-- Test cases for the connection pools of dnsjit.output.tcpcli and
+-- dnsjit.output.tlscli
+local ffi = require("ffi")
+local bit = require("bit")
+
+local function id(obj)
+    local pl = obj:cast()
+    return pl.payload[0] * 256 + pl.payload[1]
+end
+
+-- the UDP queries of the capture, copied and numbered from 1 so answers can
+-- be matched to them
+local function queries()
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+
+    local list = {}
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        local pl = obj:cast()
+        if obj:type() == "payload" and pl.len > 0 and obj:prev():cast().dport == 53 then
+            local copy = obj:copy()
+            local payload = ffi.cast("uint8_t*", copy:cast().payload)
+            payload[0] = bit.rshift(#list + 1, 8)
+            payload[1] = bit.band(#list + 1, 0xff)
+            table.insert(list, copy)
+        end
+    end
+    return list
+end
+
+-- all queries in flight before the answers are received, returns the number
+-- of answers and their IDs in the order received
+local function pipeline(client, list, received)
+    local recv, rctx = client:receive()
+    local prod, pctx = client:produce()
+    if not received then
+        for _, obj in ipairs(list) do
+            recv(rctx, obj)
+        end
+    end
+    local answers, ids, seen = 0, {}, {}
+    while answers < #list do
+        local res = prod(pctx)
+        assert(res ~= nil and res:cast().len > 0, "receiving failed")
+        local n = id(res)
+        assert(n >= 1 and n <= #list and not seen[n], "answer " .. n .. " to no query sent or answered twice")
+        seen[n] = true
+        table.insert(ids, n)
+        answers = answers + 1
+    end
+    return answers, ids
+end
+
+local list = queries()
+assert(#list == 41, "not all queries found")
+
+local resp = require("dnsjit.lib.responder").new()
+resp:threads(2)
+resp:rcode(3)
+assert(resp:tcp("127.0.0.1", 0) == 0, "tcp failed")
+assert(resp:tls("127.0.0.1", 0) == 0, "tls failed")
+assert(resp:start() == 0, "start failed")
+local _, tcp, tls = resp:ports()
+assert(tcp > 0 and tls > 0, "ports not bound")
+
+local client = require("dnsjit.output.tcpcli").new()
+client:timeout(5, 0)
+assert(client:pool(4, 8) == 0, "tcp pool failed")
+assert(client:connect("127.0.0.1", tostring(tcp)) == 0, "tcp pool connect failed")
+assert(pipeline(client, list) == 41, "not all pipelined tcp queries answered")
+assert(client:errors() == 0 and client:reconnects() == 0)
+
+client = require("dnsjit.output.tlscli").new()
+client:timeout(5, 0)
+assert(client:pool(2, 16) == 0, "tls pool failed")
+assert(client:connect("127.0.0.1", tostring(tls)) == 0, "tls pool connect failed")
+assert(pipeline(client, list) == 41, "not all pipelined tls queries answered")
+assert(client:errors() == 0 and client:reconnects() == 0)
+
+local stats = resp:stats()
+assert(stats.queries == 82 and stats.answers == 82, "statistics do not add up")
+assert(stats.connections == 6)
+resp:stop()
+
+-- answers delayed up to 50ms come back out of order on one connection
+resp:latency("uniform", 0, 0.05, 1)
+assert(resp:start() == 0, "restart failed")
+_, tcp = resp:ports()
+client = require("dnsjit.output.tcpcli").new()
+client:timeout(5, 0)
+assert(client:pool(1, #list) == 0, "tcp pool failed")
+assert(client:connect("127.0.0.1", tostring(tcp)) == 0, "tcp pool connect failed")
+local answers, ids = pipeline(client, list)
+assert(answers == 41, "not all reordered tcp queries answered")
+local ordered = true
+for i, n in ipairs(ids) do
+    if n ~= i then ordered = false end
+end
+assert(not ordered, "answers not reordered")
+assert(client:errors() == 0 and client:reconnects() == 0)
+resp:stop()
+
+-- the responder is restarted, on the same port, before answering and the
+-- queries are sent again over new connections
+resp:latency("fixed", 5)
+assert(resp:tcp("127.0.0.1", tostring(tcp)) == 0, "tcp failed")
+assert(resp:start() == 0, "restart failed")
+client = require("dnsjit.output.tcpcli").new()
+client:timeout(5, 0)
+assert(client:pool(2, 32) == 0, "tcp pool failed")
+assert(client:connect("127.0.0.1", tostring(tcp)) == 0, "tcp pool connect failed")
+local recv, rctx = client:receive()
+for _, obj in ipairs(list) do
+    recv(rctx, obj)
+end
+resp:stop()
+resp:latency("fixed", 0)
+assert(resp:start() == 0, "restart failed")
+assert(pipeline(client, list, true) == 41, "not all resent tcp queries answered")
+assert(client:errors() == 0 and client:reconnects() == 2, "queries not sent again")
+resp:stop()
+
+-- every query dropped, the queries of a pool expire and make room for new
+-- queries with the same IDs
+resp:drop(1.0)
+assert(resp:start() == 0, "restart failed")
+_, tcp = resp:ports()
+client = require("dnsjit.output.tcpcli").new()
+client:timeout(0, 100000000)
+assert(client:pool(1, 2) == 0, "tcp pool failed")
+assert(client:connect("127.0.0.1", tostring(tcp)) == 0, "tcp pool connect failed")
+recv, rctx = client:receive()
+local prod, pctx = client:produce()
+for round = 1, 2 do
+    recv(rctx, list[1])
+    recv(rctx, list[2])
+    local res = prod(pctx)
+    assert(res ~= nil and res:cast().len == 0, "dropped query answered")
+    assert(client:errors() == 2 * round, "queries not expired")
+end
+assert(prod(pctx):cast().len == 0 and client:errors() == 4)
+resp:stop()
+assert(resp:stats().dropped == 4, "drops not counted")
+
+for _, obj in ipairs(list) do
+    obj:free()
+end
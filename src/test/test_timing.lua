@@ -0,0 +1,141 @@
+-- Test cases for the schedule of dnsjit.filter.timing, checks when packets
+-- were due and not when they were released
+local ffi = require("ffi")
+local object = require("dnsjit.core.objects")
+local Timing = require("dnsjit.filter.timing")
+
+-- pass packets captured at the given ns, or n packets captured at once,
+-- and return when each was due
+local function run(setup, stamps)
+    if type(stamps) == "number" then
+        local n = stamps
+        stamps = {}
+        for i = 1, n do stamps[i] = 0 end
+    end
+
+    local timing = Timing.new()
+    setup(timing)
+    timing:receiver(require("dnsjit.output.null").new())
+    local recv, rctx = timing:receive()
+    local pkt = ffi.new("core_object_pcap_t")
+    pkt.obj_type = object.PCAP
+
+    local due = {}
+    for i, ns in ipairs(stamps) do
+        pkt.ts.sec = math.floor(ns / 1e9)
+        pkt.ts.nsec = ns % 1e9
+        recv(rctx, ffi.cast("core_object_t*", pkt))
+        due[i] = timing:scheduled()
+    end
+    assert(timing:released() == #stamps, "not all packets released")
+    return due
+end
+
+local function same(due, expect, what)
+    assert(#due == #expect)
+    for i = 1, #due do
+        assert(due[i] == expect[i], what .. ": packet " .. i .. " due at " .. due[i] .. " not " .. expect[i])
+    end
+end
+
+-- packets due in each ms
+local function per_ms(due)
+    local count = {}
+    for _, ns in ipairs(due) do
+        local ms = math.floor(ns / 1000000) + 1
+        count[ms] = (count[ms] or 0) + 1
+    end
+    return count
+end
+
+-- the modes following the capture, packets 10, 5, 0 and 85 us apart
+local capture = { 1e9, 1e9 + 10000, 1e9 + 15000, 1e9 + 15000, 1e9 + 100000 }
+same(run(function(t) t:keep() end, capture), { 0, 10000, 15000, 15000, 100000 }, "keep")
+same(run(function(t) t:increase(5000) end, capture), { 0, 15000, 25000, 30000, 120000 }, "increase")
+-- gaps reduced below 0 are not waited for
+same(run(function(t) t:reduce(2000) end, capture), { 0, 8000, 11000, 11000, 94000 }, "reduce")
+same(run(function(t) t:multiply(2.5) end, capture), { 0, 25000, 37500, 37500, 250000 }, "multiply")
+same(run(function(t) t:fixed(7000) end, capture), { 0, 7000, 14000, 21000, 28000 }, "fixed")
+-- and not on the timing of the previous release
+same(run(function(t) t:keep() end, { 5e9, 5e9 + 1, 5e9 + 1000001 }), { 0, 1, 1000001 }, "keep")
+
+-- the gaps of the rate modes as computed by the filter, fractions of a ns
+-- are carried to the next gap
+local function schedule(n, rate_at)
+    local due, target, carry = {}, 0, 0
+    for i = 1, n do
+        due[i] = target
+        carry = carry + 1e9 / rate_at(target)
+        local whole = math.floor(carry)
+        carry = carry - whole
+        target = target + whole
+    end
+    return due
+end
+
+-- 1M packets per second is exactly 1us apart
+local due = run(function(t) t:rate(1e6) end, 1000)
+same(due, schedule(1000, function() return 1e6 end), "rate")
+assert(due[1000] == 999000)
+-- 3M packets per second, every third gap is a ns longer
+due = run(function(t) t:rate(3e6) end, 3000)
+same(due, schedule(3000, function() return 3e6 end), "rate")
+for i = 1, 3000 do
+    assert(math.abs(due[i] - (i - 1) * 1e9 / 3e6) <= 1, "rate drifts")
+end
+
+-- ramp from 1M by 1M every ms up to 3M packets per second
+local function stepped(ns)
+    return math.min(1e6 + 1e6 * math.floor(ns / 1000000), 3e6)
+end
+due = run(function(t) t:ramp(1e6, 1e6, 0.001, 3e6) end, 9500)
+same(due, schedule(9500, stepped), "ramp")
+local count = per_ms(due)
+assert(count[1] == 1000 and count[2] == 2000, "ramp not stepped")
+assert(math.abs(count[3] - 3000) <= 1 and math.abs(count[4] - 3000) <= 1, "ramp not limited")
+
+-- or continuously, 1M at the start and 2M after 1ms
+local function linear(ns)
+    return 1e6 + 1e6 * (ns / 1000000)
+end
+due = run(function(t) t:ramp(1e6, 1e6, 0.001, nil, true) end, 4000)
+same(due, schedule(4000, linear), "linear ramp")
+count = per_ms(due)
+assert(count[1] > 1000 and count[1] < 2000 and count[2] > 2000 and count[2] < 3000, "ramp not linear")
+
+-- exponential gaps with a mean of 1us, the same for the same seed
+local function gaps(due)
+    local list, sum = {}, 0
+    for i = 2, #due do
+        list[i - 1] = due[i] - due[i - 1]
+        sum = sum + list[i - 1]
+    end
+    return list, sum / #list
+end
+due = run(function(t) t:poisson(1e6, 42) end, 20000)
+same(due, run(function(t) t:poisson(1e6, 42) end, 20000), "poisson seed")
+local other = run(function(t) t:poisson(1e6, 43) end, 20000)
+assert(other[20000] ~= due[20000], "seed not used")
+
+local list, mean = gaps(due)
+assert(math.abs(mean - 1000) < 20, "poisson mean gap " .. mean .. " not 1us")
+local var, longer = 0, 0
+for _, gap in ipairs(list) do
+    var = var + (gap - mean) ^ 2
+    if gap > mean then longer = longer + 1 end
+end
+-- the standard deviation of an exponential distribution is its mean and
+-- e^-1 of the gaps are longer than the mean
+assert(math.abs(math.sqrt(var / #list) / mean - 1) < 0.03, "poisson gaps not exponential")
+assert(math.abs(longer / #list - math.exp(-1)) < 0.01, "poisson gaps not exponential")
+
+-- the mean rate follows a ramp, 1M in the first 5ms and 2M in the next
+due = run(function(t)
+    t:ramp(1e6, 1e6, 0.005)
+    t:poisson(nil, 7)
+end, 16000)
+count = per_ms(due)
+local first, second = 0, 0
+for ms = 1, 5 do first = first + count[ms] end
+for ms = 6, 10 do second = second + count[ms] end
+assert(math.abs(first / 5000 - 1) < 0.03 and math.abs(second / 10000 - 1) < 0.03, "poisson rate does not follow the ramp")
@@ -0,0 +1,64 @@
+-- Test cases for dnsjit.filter.topk
+local function run(topk, first, last)
+    local input = require("dnsjit.input.pcap").new()
+    local layer = require("dnsjit.filter.layer").new()
+    input:open_offline("dns.pcap-dist")
+    layer:producer(input)
+    local prod, pctx = layer:produce()
+
+    local n = 0
+    while true do
+        local obj = prod(pctx)
+        if obj == nil then break end
+        n = n + 1
+        if n >= first and n <= last then
+            topk:process(obj)
+        end
+    end
+end
+
+local function check(topk)
+    assert(topk:queries() == 41, "not all queries counted")
+    assert(topk:responses() == 41, "not all responses counted")
+    assert(topk:total("qname") == 41)
+
+    local top = topk:top("qname", 10)
+    assert(#top == 2, "wrong number of qnames")
+    assert(top[1].key == "google.com." and top[1].count == 24 and top[1].error == 0)
+    assert(top[2].key == "206.218.58.216.in-addr.arpa." and top[2].count == 17)
+
+    top = topk:top("qtype")
+    assert(top[1].key == 1 and top[1].count == 24)
+    assert(top[2].key == 12 and top[2].count == 17)
+
+    top = topk:top("client")
+    assert(#top == 1 and top[1].key == "172.17.0.10" and top[1].count == 41)
+
+    top = topk:top("rcode")
+    assert(#top == 1 and top[1].key == 0 and top[1].count == 41)
+
+    assert(topk:estimate("qname", "Google.COM") == 24)
+end
+
+local topk = require("dnsjit.filter.topk").new(10)
+run(topk, 1, math.huge)
+check(topk)
+
+local first = require("dnsjit.filter.topk").new(10)
+local second = require("dnsjit.filter.topk").new(10)
+run(first, 1, 66)
+run(second, 67, math.huge)
+assert(first:merge(second) == 0, "merge failed")
+check(first)
+
+assert(first:merge(require("dnsjit.filter.topk").new(5)) ~= 0, "merge of different k not rejected")
+
+local small = require("dnsjit.filter.topk").new(1, 0)
+run(small, 1, math.huge)
+local top = small:top("qname")
+local exact = { ["google.com."] = 24, ["206.218.58.216.in-addr.arpa."] = 17 }
+assert(#top == 1 and top[1].count == 41)
+assert(top[1].count - top[1].error <= exact[top[1].key], "count outside of error bound")
+
+topk:reset()
+assert(topk:total("qname") == 0 and #topk:top("qname") == 0)